@@ -0,0 +1,115 @@
+#include "AudioStage.h"
+#include <algorithm>
+
+namespace emu
+{
+    AudioStage::AudioStage()
+        : mSourceCount(0)
+        , mSampleCount(0)
+        , mChannelCount(0)
+    {
+    }
+
+    AudioStage::~AudioStage()
+    {
+        destroy();
+    }
+
+    bool AudioStage::create(uint32_t ticksPerFrame, uint32_t sampleCount, uint32_t sourceCount, const Format& format)
+    {
+        destroy();
+        EMU_VERIFY(ticksPerFrame && sampleCount);
+        EMU_VERIFY(format.channelCount && (format.channelCount <= Resampler::MAX_CHANNEL_COUNT));
+        EMU_VERIFY((sourceCount == 1) || (sourceCount == format.channelCount));
+
+        // Resampling only helps when the internal rate is higher than the output rate
+        uint32_t synthesisCount = sampleCount;
+        if (format.resample && (sampleCount < INTERNAL_SAMPLE_COUNT))
+        {
+            synthesisCount = INTERNAL_SAMPLE_COUNT;
+            EMU_VERIFY(mResampler.create(synthesisCount, sampleCount, sourceCount, format.quality));
+        }
+
+        for (uint32_t index = 0; index < sourceCount; ++index)
+        {
+            EMU_VERIFY(mSources[index].create(synthesisCount));
+            mSources[index].setRate(ticksPerFrame, synthesisCount);
+        }
+
+        mSamples.resize(sampleCount * sourceCount + synthesisCount, 0);
+        mSourceCount = sourceCount;
+        mSampleCount = sampleCount;
+        mChannelCount = format.channelCount;
+        return true;
+    }
+
+    void AudioStage::destroy()
+    {
+        for (auto& source : mSources)
+            source.destroy();
+        mResampler.destroy();
+        mSamples.clear();
+        mSourceCount = 0;
+        mSampleCount = 0;
+        mChannelCount = 0;
+    }
+
+    void AudioStage::clear()
+    {
+        for (uint32_t index = 0; index < mSourceCount; ++index)
+            mSources[index].clear();
+        mResampler.clear();
+    }
+
+    void AudioStage::endFrame(int32_t ticks, int16_t* dest)
+    {
+        if (!mSampleCount)
+            return;
+
+        // Each source is read in the scratch area after the interleaved frame
+        int16_t* samples = mSamples.data();
+        int16_t* scratch = samples + mSampleCount * mSourceCount;
+        size_t count = mSampleCount;
+        for (uint32_t index = 0; index < mSourceCount; ++index)
+        {
+            auto& source = mSources[index];
+            source.endFrame(ticks);
+            if (mResampler.isEnabled())
+            {
+                size_t sourceCount = source.read(scratch, INTERNAL_SAMPLE_COUNT);
+                mResampler.write(index, scratch, sourceCount);
+            }
+            else
+            {
+                size_t sourceCount = source.read(scratch, mSampleCount);
+                for (size_t pos = 0; pos < sourceCount; ++pos)
+                    samples[pos * mSourceCount + index] = scratch[pos];
+                count = std::min(count, sourceCount);
+            }
+        }
+        if (mResampler.isEnabled())
+            count = mResampler.read(samples, mSampleCount);
+
+        // The rates are rounded up, drop the fraction of a sample accumulated over many frames
+        for (uint32_t index = 0; index < mSourceCount; ++index)
+            mSources[index].remove(mSources[index].getAvailable());
+
+        if (!dest)
+            return;
+
+        // Expand to the output layout, repeating the last frame if the synthesis came up short
+        for (uint32_t pos = 0; pos < mSampleCount; ++pos)
+        {
+            int16_t* frame = dest + pos * mChannelCount;
+            if (pos >= count)
+            {
+                const int16_t* previous = frame - mChannelCount;
+                for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+                    frame[channel] = pos ? previous[channel] : 0;
+                continue;
+            }
+            for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+                frame[channel] = samples[pos * mSourceCount + (mSourceCount == 1 ? 0 : channel)];
+        }
+    }
+}
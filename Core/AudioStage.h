@@ -0,0 +1,64 @@
+#ifndef __AUDIO_STAGE_H__
+#define __AUDIO_STAGE_H__
+
+#include "BlipBuffer.h"
+#include "Resampler.h"
+#include <vector>
+
+namespace emu
+{
+    // Turns the amplitude changes of a sound chip into a frame of interleaved samples.
+    // Sources are synthesized at the output rate, or at a fixed internal rate followed by a resampler.
+    class AudioStage
+    {
+    public:
+        struct Format
+        {
+            uint32_t            channelCount = 1;
+            bool                resample = false;
+            Resampler::Quality  quality = Resampler::Quality::Medium;
+
+            bool operator==(const Format& other) const
+            {
+                return (channelCount == other.channelCount) && (resample == other.resample) && (quality == other.quality);
+            }
+        };
+
+        // Synthesis rate used when resampling, about 96 kHz at 60 frames per second
+        static const uint32_t INTERNAL_SAMPLE_COUNT = 1600;
+
+        AudioStage();
+        ~AudioStage();
+        bool create(uint32_t ticksPerFrame, uint32_t sampleCount, uint32_t sourceCount, const Format& format);
+        void destroy();
+        void clear();
+        void endFrame(int32_t ticks, int16_t* dest);
+
+        bool isEnabled() const
+        {
+            return mSampleCount != 0;
+        }
+
+        uint32_t getSourceCount() const
+        {
+            return mSourceCount;
+        }
+
+        // Sources stay valid while the stage is disabled, they simply ignore the deltas.
+        BlipBuffer& getSource(uint32_t index)
+        {
+            EMU_ASSERT(index < Resampler::MAX_CHANNEL_COUNT);
+            return mSources[index];
+        }
+
+    private:
+        BlipBuffer                  mSources[Resampler::MAX_CHANNEL_COUNT];
+        Resampler                   mResampler;
+        std::vector<int16_t>        mSamples;
+        uint32_t                    mSourceCount;
+        uint32_t                    mSampleCount;
+        uint32_t                    mChannelCount;
+    };
+}
+
+#endif
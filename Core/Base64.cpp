@@ -1,43 +1,181 @@
-/*
-base64.cpp and base64.h
+#include "Base64.h"
+#include "Simd.h"
 
-Copyright (C) 2004-2017 Ren Nyffenegger
+#if EMU_SIMD_X86
+#include <immintrin.h>
+#endif
 
-This source code is provided 'as-is', without any express or implied
-warranty. In no event will the author be held liable for any damages
-arising from the use of this software.
+namespace
+{
+    static const char ENCODE_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const uint8_t INVALID = 0xff;
 
-Permission is granted to anyone to use this software for any purpose,
-including commercial applications, and to alter it and redistribute it
-freely, subject to the following restrictions:
+    typedef size_t (*BlockFunc)(uint8_t* dest, const uint8_t* src, size_t size);
 
-1. The origin of this source code must not be misrepresented; you must not
-claim that you wrote the original source code. If you use this source code
-in a product, an acknowledgment in the product documentation would be
-appreciated but is not required.
+    struct DecodeTable
+    {
+        DecodeTable()
+        {
+            for (auto& value : values)
+                value = INVALID;
+            for (uint8_t index = 0; index < 64; ++index)
+                values[static_cast<uint8_t>(ENCODE_TABLE[index])] = index;
+        }
 
-2. Altered source versions must be plainly marked as such, and must not be
-misrepresented as being the original source code.
+        uint8_t values[256];
+    };
 
-3. This notice may not be removed or altered from any source distribution.
+    const DecodeTable& getDecodeTable()
+    {
+        static const DecodeTable table;
+        return table;
+    }
 
-Ren Nyffenegger rene.nyffenegger@adp-gmbh.ch
+    void encodeTriplet(char* dest, uint32_t value)
+    {
+        dest[0] = ENCODE_TABLE[(value >> 18) & 0x3f];
+        dest[1] = ENCODE_TABLE[(value >> 12) & 0x3f];
+        dest[2] = ENCODE_TABLE[(value >> 6) & 0x3f];
+        dest[3] = ENCODE_TABLE[value & 0x3f];
+    }
 
-*/
+    // Block functions convert whole groups and return how many input bytes they consumed, the rest is left to the
+    // scalar tail. Decoding stops at the first character outside of the alphabet.
+    size_t encodeBlocksScalar(uint8_t* dest, const uint8_t* src, size_t size)
+    {
+        size_t pos = 0;
+        for (; pos + 3 <= size; pos += 3, dest += 4)
+            encodeTriplet(reinterpret_cast<char*>(dest), (src[pos] << 16) | (src[pos + 1] << 8) | src[pos + 2]);
+        return pos;
+    }
 
-#include "Base64.h"
-#include <cctype>
+    size_t decodeBlocksScalar(uint8_t* dest, const uint8_t* src, size_t size)
+    {
+        auto& table = getDecodeTable().values;
+        size_t pos = 0;
+        for (; pos + 4 <= size; pos += 4, dest += 3)
+        {
+            uint32_t a = table[src[pos]];
+            uint32_t b = table[src[pos + 1]];
+            uint32_t c = table[src[pos + 2]];
+            uint32_t d = table[src[pos + 3]];
+            if ((a | b | c | d) & 0xc0)
+                break;
+            uint32_t value = (a << 18) | (b << 12) | (c << 6) | d;
+            dest[0] = static_cast<uint8_t>(value >> 16);
+            dest[1] = static_cast<uint8_t>(value >> 8);
+            dest[2] = static_cast<uint8_t>(value);
+        }
+        return pos;
+    }
 
-namespace
-{
-    static const std::string base64_chars =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
+#if EMU_SIMD_X86
+    // Vector code from Wojciech Mula's algorithms: 24 bytes become 32 characters per iteration.
+    // The loads start 4 bytes before the data so both 128 bit lanes find their 12 bytes with an in lane shuffle.
+    EMU_TARGET_AVX2 __m256i encodeReshuffleAVX2(__m256i input)
+    {
+        __m256i in = _mm256_shuffle_epi8(input, _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5));
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        return _mm256_or_si256(t1, t3);
+    }
+
+    EMU_TARGET_AVX2 __m256i encodeTranslateAVX2(__m256i in)
+    {
+        // Offset from each 6 bit value to its character, looked up by range
+        __m256i lut = _mm256_setr_epi8(
+            65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+            65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+        __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+        __m256i mask = _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25));
+        indices = _mm256_sub_epi8(indices, mask);
+        return _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+    }
+
+    EMU_TARGET_AVX2 size_t encodeBlocksAVX2(uint8_t* dest, const uint8_t* src, size_t size)
+    {
+        if (size < 32)
+            return 0;
+
+        // The first load cannot start before the data, it is moved up by 4 bytes instead
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        in = _mm256_permutevar8x32_epi32(in, _mm256_set_epi32(6, 5, 4, 3, 2, 1, 0, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), encodeTranslateAVX2(encodeReshuffleAVX2(in)));
+        size_t pos = 24;
+        dest += 32;
+
+        for (; pos + 28 <= size; pos += 24, dest += 32)
+        {
+            in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos - 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), encodeTranslateAVX2(encodeReshuffleAVX2(in)));
+        }
+        return pos;
+    }
+
+    EMU_TARGET_AVX2 size_t decodeBlocksAVX2(uint8_t* dest, const uint8_t* src, size_t size)
+    {
+        __m256i lutLow = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+        __m256i lutHigh = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        __m256i lutRoll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        __m256i mask2F = _mm256_set1_epi8(0x2f);
+
+        // Each store writes 32 bytes for 24 decoded ones, the input left after the block guarantees the room
+        size_t pos = 0;
+        for (; pos + 45 <= size; pos += 32, dest += 24)
+        {
+            __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos));
+            __m256i highNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask2F);
+            __m256i lowNibbles = _mm256_and_si256(in, mask2F);
+            __m256i high = _mm256_shuffle_epi8(lutHigh, highNibbles);
+            __m256i low = _mm256_shuffle_epi8(lutLow, lowNibbles);
+            if (!_mm256_testz_si256(low, high))
+                break;
+
+            __m256i eq2F = _mm256_cmpeq_epi8(in, mask2F);
+            __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, highNibbles));
+            in = _mm256_add_epi8(in, roll);
+
+            __m256i merged = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+            __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), out);
+        }
+        return pos;
+    }
+#endif
 
+    struct Codec
+    {
+        BlockFunc   encodeBlocks;
+        BlockFunc   decodeBlocks;
+    };
 
-    static inline bool is_base64(unsigned char c) {
-        return (isalnum(c) || (c == '+') || (c == '/'));
+    Codec selectCodec()
+    {
+#if EMU_SIMD_X86
+        if (emu::Simd::getLevel() >= emu::Simd::Level::AVX2)
+            return { encodeBlocksAVX2, decodeBlocksAVX2 };
+#endif
+        return { encodeBlocksScalar, decodeBlocksScalar };
+    }
+
+    const Codec& getCodec()
+    {
+        static const Codec codec = selectCodec();
+        return codec;
     }
 }
 
@@ -47,98 +185,74 @@ namespace emu
     {
         bool encode(std::string& result, const void* data, size_t length)
         {
-            auto bytes_to_encode = static_cast<unsigned char const*>(data);
-            auto in_len = static_cast<unsigned int>(length);
-
-            result.reserve(static_cast<uint32_t>(length * 8 / 6 + 3));
-            auto& ret = result;
-            int i = 0;
-            int j = 0;
-            unsigned char char_array_3[3];
-            unsigned char char_array_4[4];
-
-            while (in_len--) {
-                char_array_3[i++] = *(bytes_to_encode++);
-                if (i == 3) {
-                    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-                    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-                    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-                    char_array_4[3] = char_array_3[2] & 0x3f;
-
-                    for (i = 0; (i < 4); i++)
-                        ret += base64_chars[char_array_4[i]];
-                    i = 0;
-                }
-            }
-
-            if (i)
+            auto src = static_cast<const uint8_t*>(data);
+            size_t start = result.size();
+            result.resize(start + (length + 2) / 3 * 4);
+            if (!length)
+                return true;
+
+            auto dest = reinterpret_cast<uint8_t*>(&result[start]);
+            size_t pos = getCodec().encodeBlocks(dest, src, length);
+            pos += encodeBlocksScalar(dest + pos / 3 * 4, src + pos, length - pos);
+            dest += pos / 3 * 4;
+
+            // The last group is padded
+            size_t remaining = length - pos;
+            if (remaining)
             {
-                for (j = i; j < 3; j++)
-                    char_array_3[j] = '\0';
-
-                char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-                char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-                char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-                char_array_4[3] = char_array_3[2] & 0x3f;
-
-                for (j = 0; (j < i + 1); j++)
-                    ret += base64_chars[char_array_4[j]];
-
-                while ((i++ < 3))
-                    ret += '=';
+                uint32_t value = src[pos] << 16;
+                if (remaining > 1)
+                    value |= src[pos + 1] << 8;
+                encodeTriplet(reinterpret_cast<char*>(dest), value);
+                dest[3] = '=';
+                if (remaining == 1)
+                    dest[2] = '=';
             }
-
             return true;
         }
 
-        bool decode(Buffer& result, const std::string& encoded_string)
+        bool decode(Buffer& result, const std::string& str)
         {
-            int in_len = static_cast<int>(encoded_string.size());
-            int i = 0;
-            int j = 0;
-            int in_ = 0;
-            unsigned char char_array_4[4], char_array_3[3];
-            bool success = true;
-
-            int out_len = (in_len * 6 + 7) >> 3;
-            result.resize(out_len);
-            auto base = static_cast<unsigned char*>(result.data());
-            auto data = base;
-
-            while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-                char_array_4[i++] = encoded_string[in_]; in_++;
-                if (i == 4) {
-                    for (i = 0; i < 4; i++)
-                        char_array_4[i] = static_cast<unsigned char>(base64_chars.find(char_array_4[i]));
-
-                    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-                    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-                    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-                    for (i = 0; (i < 3); i++)
-                        *data++ = char_array_3[i];
-                    i = 0;
+            auto src = reinterpret_cast<const uint8_t*>(str.data());
+            size_t length = str.size();
+            result.resize((length * 6 + 7) >> 3);
+            auto base = static_cast<uint8_t*>(result.data());
+
+            size_t pos = getCodec().decodeBlocks(base, src, length);
+            pos += decodeBlocksScalar(base + pos / 4 * 3, src + pos, length - pos);
+            auto dest = base + pos / 4 * 3;
+
+            // Up to three characters are left before the padding or the first invalid character
+            auto& table = getDecodeTable().values;
+            uint32_t value = 0;
+            uint32_t count = 0;
+            for (; pos < length; ++pos)
+            {
+                uint8_t digit = table[src[pos]];
+                if (digit == INVALID)
+                    break;
+                value = (value << 6) | digit;
+                if (++count == 4)
+                {
+                    *dest++ = static_cast<uint8_t>(value >> 16);
+                    *dest++ = static_cast<uint8_t>(value >> 8);
+                    *dest++ = static_cast<uint8_t>(value);
+                    value = 0;
+                    count = 0;
                 }
             }
-            success = in_len == 0;
-
-            if (i) {
-                for (j = i; j < 4; j++)
-                    char_array_4[j] = 0;
-
-                for (j = 0; j < 4; j++)
-                    char_array_4[j] = static_cast<unsigned char>(base64_chars.find(char_array_4[j]));
-
-                char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-                char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-                char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-                for (j = 0; (j < i - 1); j++) *data++ = char_array_3[j];
+            if (count > 1)
+            {
+                value <<= 6 * (4 - count);
+                *dest++ = static_cast<uint8_t>(value >> 16);
+                if (count > 2)
+                    *dest++ = static_cast<uint8_t>(value >> 8);
             }
+            result.resize(dest - base);
 
-            result.resize(data - base);
-
-            return success;
+            while ((pos < length) && (src[pos] == '='))
+                ++pos;
+            return pos == length;
         }
     }
-}
\ No newline at end of file
+}
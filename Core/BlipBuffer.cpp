@@ -0,0 +1,164 @@
+#include "BlipBuffer.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+namespace
+{
+    static const uint32_t FRAC_BITS = 32;
+    static const uint32_t DELTA_BITS = 15;
+    static const uint32_t BASS_SHIFT = 9;
+    static const double PI = 3.14159265358979323846;
+    static const double CUTOFF = 0.9;
+}
+
+namespace emu
+{
+    BlipBuffer::BlipBuffer()
+        : mFactor(0)
+        , mOffset(0)
+        , mIntegrator(0)
+    {
+        initializeKernel();
+    }
+
+    BlipBuffer::~BlipBuffer()
+    {
+        destroy();
+    }
+
+    bool BlipBuffer::create(size_t sampleCount)
+    {
+        destroy();
+        EMU_VERIFY(sampleCount > 0);
+
+        // Leave room for a late frame end and for the kernel tail of the last deltas
+        mBuffer.resize((sampleCount + KERNEL_SIZE) * 2, 0);
+        return true;
+    }
+
+    void BlipBuffer::destroy()
+    {
+        mBuffer.clear();
+        mFactor = 0;
+        mOffset = 0;
+        mIntegrator = 0;
+    }
+
+    void BlipBuffer::clear()
+    {
+        std::fill(mBuffer.begin(), mBuffer.end(), 0);
+        mOffset = 0;
+        mIntegrator = 0;
+    }
+
+    void BlipBuffer::setRate(uint32_t ticks, uint32_t sampleCount)
+    {
+        // Round up so a full period of ticks always produces at least sampleCount samples
+        EMU_ASSERT(ticks > 0);
+        mFactor = ((static_cast<uint64_t>(sampleCount) << FRAC_BITS) + ticks - 1) / ticks;
+    }
+
+    void BlipBuffer::initializeKernel()
+    {
+        // Windowed sinc impulse for each sub-sample phase, normalized so the integrated step is exact
+        double center = KERNEL_SIZE / 2 - 1;
+        double halfWidth = KERNEL_SIZE / 2;
+        for (uint32_t phase = 0; phase < PHASE_COUNT; ++phase)
+        {
+            double coefficients[KERNEL_SIZE];
+            double sum = 0.0;
+            for (uint32_t index = 0; index < KERNEL_SIZE; ++index)
+            {
+                double x = index - center - static_cast<double>(phase) / PHASE_COUNT;
+                double sinc = x == 0.0 ? 1.0 : sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+                double window = 0.0;
+                if (fabs(x) < halfWidth)
+                    window = 0.42 + 0.5 * cos(PI * x / halfWidth) + 0.08 * cos(2.0 * PI * x / halfWidth);
+                coefficients[index] = sinc * window;
+                sum += coefficients[index];
+            }
+
+            int32_t total = 0;
+            uint32_t largest = 0;
+            for (uint32_t index = 0; index < KERNEL_SIZE; ++index)
+            {
+                auto value = static_cast<int16_t>(floor(coefficients[index] * (1 << DELTA_BITS) / sum + 0.5));
+                mKernel[phase][index] = value;
+                total += value;
+                if (value > mKernel[phase][largest])
+                    largest = index;
+            }
+            mKernel[phase][largest] += static_cast<int16_t>((1 << DELTA_BITS) - total);
+        }
+    }
+
+    void BlipBuffer::addDelta(int32_t tick, int32_t delta)
+    {
+        if (!delta || mBuffer.empty())
+            return;
+
+        EMU_ASSERT(tick >= 0);
+        uint64_t fixed = static_cast<uint64_t>(std::max(tick, 0)) * mFactor + mOffset;
+        size_t pos = static_cast<size_t>(fixed >> FRAC_BITS);
+        if (pos + KERNEL_SIZE > mBuffer.size())
+            return;
+
+        uint32_t phase = static_cast<uint32_t>(fixed >> (FRAC_BITS - PHASE_BITS)) & (PHASE_COUNT - 1);
+        const int16_t* kernel = mKernel[phase];
+        int32_t* dest = mBuffer.data() + pos;
+        for (uint32_t index = 0; index < KERNEL_SIZE; ++index)
+            dest[index] += kernel[index] * delta;
+    }
+
+    void BlipBuffer::endFrame(int32_t ticks)
+    {
+        if (mBuffer.empty())
+            return;
+
+        mOffset += static_cast<uint64_t>(ticks) * mFactor;
+        size_t limit = mBuffer.size() - KERNEL_SIZE;
+        if (getAvailable() > limit)
+            mOffset = (mOffset & ((1ull << FRAC_BITS) - 1)) | (static_cast<uint64_t>(limit) << FRAC_BITS);
+    }
+
+    size_t BlipBuffer::getAvailable() const
+    {
+        return static_cast<size_t>(mOffset >> FRAC_BITS);
+    }
+
+    size_t BlipBuffer::read(int16_t* dest, size_t count)
+    {
+        count = std::min(count, getAvailable());
+        int32_t integrator = mIntegrator;
+        for (size_t pos = 0; pos < count; ++pos)
+        {
+            // Integrate the deltas, then slowly pull the integrator back to zero to remove any DC offset
+            integrator += mBuffer[pos];
+            int32_t sample = integrator >> DELTA_BITS;
+            if (sample != static_cast<int16_t>(sample))
+                sample = (sample >> 31) ^ 0x7fff;
+            if (dest)
+                dest[pos] = static_cast<int16_t>(sample);
+            integrator -= sample << (DELTA_BITS - BASS_SHIFT);
+        }
+        mIntegrator = integrator;
+        if (count)
+            shift(count);
+        return count;
+    }
+
+    void BlipBuffer::remove(size_t count)
+    {
+        // Skipped samples are still integrated so the following ones keep the right level
+        read(nullptr, count);
+    }
+
+    void BlipBuffer::shift(size_t count)
+    {
+        size_t remaining = mBuffer.size() - count;
+        memmove(mBuffer.data(), mBuffer.data() + count, remaining * sizeof(mBuffer[0]));
+        std::fill(mBuffer.begin() + remaining, mBuffer.end(), 0);
+        mOffset -= static_cast<uint64_t>(count) << FRAC_BITS;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef __BLIP_BUFFER_H__
+#define __BLIP_BUFFER_H__
+
+#include "Core.h"
+#include <vector>
+
+namespace emu
+{
+    // Band-limited step synthesis: amplitude changes are added at the clock tick where they happen
+    // and integrated into output samples at the configured rate.
+    class BlipBuffer
+    {
+    public:
+        BlipBuffer();
+        ~BlipBuffer();
+        bool create(size_t sampleCount);
+        void destroy();
+        void clear();
+        void setRate(uint32_t ticks, uint32_t sampleCount);
+        void addDelta(int32_t tick, int32_t delta);
+        void endFrame(int32_t ticks);
+        size_t getAvailable() const;
+        size_t read(int16_t* dest, size_t count);
+        void remove(size_t count);
+
+        bool isEnabled() const
+        {
+            return !mBuffer.empty();
+        }
+
+    private:
+        static const uint32_t PHASE_BITS = 5;
+        static const uint32_t PHASE_COUNT = 1 << PHASE_BITS;
+        static const uint32_t KERNEL_SIZE = 16;
+
+        void initializeKernel();
+        void shift(size_t count);
+
+        std::vector<int32_t>    mBuffer;
+        uint64_t                mFactor;
+        uint64_t                mOffset;
+        int32_t                 mIntegrator;
+        int16_t                 mKernel[PHASE_COUNT][KERNEL_SIZE];
+    };
+}
+
+#endif
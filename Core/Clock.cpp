@@ -152,15 +152,19 @@ namespace emu
         mListeners.erase(item);
     }
 
-    void Clock::serialize(ISerializer& serializer)
+    void Clock::serialize(ISerializer& serializer, bool target)
     {
         // TODO: Can't serialize properly if we have timers queued
         //EMU_ASSERT(mTimers.empty());
 
         uint32_t version = 1;
         EMU_UNUSED(version);
-        serializer
-            .value("TargetTicks", mTargetTicks)
-            .value("DesiredTicks", mDesiredTicks);
+
+        // States are taken between frames, where the target is always back to 0
+        if (target)
+            serializer.value("TargetTicks", mTargetTicks);
+        else
+            mTargetTicks = 0;
+        serializer.value("DesiredTicks", mDesiredTicks);
     }
 }
@@ -36,7 +36,7 @@ namespace emu
         void clearEvents();
         void addListener(IListener& listener);
         void removeListener(IListener& listener);
-        void serialize(ISerializer& serializer);
+        void serialize(ISerializer& serializer, bool target = true);
 
         int32_t getDesiredTicks() const
         {
@@ -29,6 +29,17 @@ namespace emu
             instance.reserve(size);
         }
 
+        static bool resize(CollectionType& instance, size_t size)
+        {
+            instance.resize(size);
+            return true;
+        }
+
+        static ElementType* data(CollectionType& instance)
+        {
+            return instance.data();
+        }
+
         static size_t size(const CollectionType& instance)
         {
             return instance.size();
@@ -70,6 +81,17 @@ namespace emu
             EMU_ASSERT(size == N);
         }
 
+        static bool resize(CollectionType& instance, size_t size)
+        {
+            EMU_UNUSED(instance);
+            return size == N;
+        }
+
+        static ElementType* data(CollectionType& instance)
+        {
+            return &instance[0];
+        }
+
         static size_t size(const CollectionType& instance)
         {
             EMU_UNUSED(instance);
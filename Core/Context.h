@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Core.h"
+#include "AudioStage.h"
+#include "Observation.h"
+#include "PixelFormat.h"
 
 namespace emu
 {
@@ -25,7 +28,8 @@ namespace emu
         virtual bool getDisplayInfo(DisplayInfo& info) = 0;
         virtual bool serializeGameData(ISerializer& serializer) = 0;
         virtual bool serializeGameState(ISerializer& serializer) = 0;
-        virtual bool setRenderBuffer(void* buffer, size_t pitch) = 0;
+        virtual bool setRenderBuffer(void* buffer, size_t pitch, PixelFormat format = PixelFormat::RGBA8888) = 0;
+        // Size is in frames, each frame holds one sample per channel of the sound format.
         virtual bool setSoundBuffer(void* buffer, size_t size) = 0;
         virtual bool setController(uint32_t index, uint32_t value) = 0;
         virtual bool reset() = 0;
@@ -36,5 +40,63 @@ namespace emu
             EMU_UNUSED(index);
             return nullptr;
         }
+
+        // Creates a context for the same game in the same state, sharing the ROM. It is destroyed like any other context.
+        // This is a full create() followed by cloneInto, about as slow as creating a context and loading a saved state in it.
+        // Code forking repeatedly should keep a pool of contexts and only call cloneInto, which skips create() and its memory maps.
+        virtual IContext* clone()
+        {
+            return nullptr;
+        }
+
+        // Copies the state to a context created by the same emulator for the same ROM, its memory maps are kept as they are.
+        virtual bool cloneInto(IContext& context)
+        {
+            EMU_UNUSED(context);
+            return false;
+        }
+
+        // Hash of the game state, kept up to date incrementally so it can be compared every frame to detect desyncs.
+        virtual bool getStateHash(uint64_t& hash)
+        {
+            EMU_UNUSED(hash);
+            return false;
+        }
+
+        virtual bool setSoundFormat(const AudioStage::Format& format)
+        {
+            EMU_UNUSED(format);
+            return false;
+        }
+
+        virtual bool setObservation(const Observation::Config& config)
+        {
+            EMU_UNUSED(config);
+            return false;
+        }
+
+        virtual bool getObservation(void* buffer, size_t size)
+        {
+            EMU_UNUSED(buffer);
+            EMU_UNUSED(size);
+            return false;
+        }
+
+        // Reports which lines of the render buffer changed during the last frame, flags may be null.
+        // Returns false when that is unknown, every line is then to be considered changed.
+        virtual bool getDirtyLines(uint32_t& dirtyCount, uint8_t* flags = nullptr, size_t count = 0)
+        {
+            EMU_UNUSED(dirtyCount);
+            EMU_UNUSED(flags);
+            EMU_UNUSED(count);
+            return false;
+        }
+
+        // Keeps composing and hashing lines without a render buffer, so getDirtyLines() also works headless.
+        virtual bool enableDirtyLines(bool enable)
+        {
+            EMU_UNUSED(enable);
+            return false;
+        }
     };
 }
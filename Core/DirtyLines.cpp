@@ -0,0 +1,143 @@
+#include "DirtyLines.h"
+#include <algorithm>
+
+namespace
+{
+    static const uint32_t FNV_OFFSET_BASIS = 0x811c9dc5;
+    static const uint32_t FNV_PRIME = 0x01000193;
+}
+
+namespace emu
+{
+    DirtyLines::DirtyLines()
+        : mDirtyCount(0)
+        , mInvalid(true)
+        , mRendered(false)
+        , mTracked(false)
+        , mEnabled(false)
+        , mAttached(false)
+        , mStale(false)
+        , mSurface(nullptr)
+        , mPitch(0)
+        , mFormat(PixelFormat::RGBA8888)
+    {
+    }
+
+    DirtyLines::~DirtyLines()
+    {
+        destroy();
+    }
+
+    bool DirtyLines::create(uint32_t lineCount)
+    {
+        mHashes.resize(lineCount, 0);
+        mPreviousHashes.resize(lineCount, 0);
+        mFlags.resize(lineCount, 1);
+        mDirtyCount = lineCount;
+        invalidate();
+        return true;
+    }
+
+    void DirtyLines::destroy()
+    {
+        mHashes.clear();
+        mPreviousHashes.clear();
+        mFlags.clear();
+        mDirtyCount = 0;
+        mTracked = false;
+        mEnabled = false;
+        mAttached = false;
+        mStale = false;
+        mSurface = nullptr;
+        mPitch = 0;
+        mFormat = PixelFormat::RGBA8888;
+    }
+
+    void DirtyLines::setSurface(const void* surface, size_t pitch, PixelFormat format)
+    {
+        // The last surface is assumed to be reused, unless frames were hashed while it was detached since it missed them
+        mAttached = surface != nullptr;
+        if (!surface)
+            return;
+
+        if ((surface != mSurface) || (pitch != mPitch) || (format != mFormat) || mStale)
+        {
+            mSurface = surface;
+            mPitch = pitch;
+            mFormat = format;
+            mStale = false;
+            invalidate();
+        }
+    }
+
+    void DirtyLines::setEnabled(bool enabled)
+    {
+        if (enabled && !mEnabled)
+            invalidate();
+        mEnabled = enabled;
+    }
+
+    void DirtyLines::invalidate()
+    {
+        mInvalid = true;
+    }
+
+    uint32_t DirtyLines::hash(const void* data, size_t size, uint32_t seed)
+    {
+        auto data8 = static_cast<const uint8_t*>(data);
+        uint32_t value = seed;
+        for (size_t pos = 0; pos < size; ++pos)
+            value = (value ^ data8[pos]) * FNV_PRIME;
+        return value;
+    }
+
+    void DirtyLines::addLine(uint32_t line, uint32_t x, const uint8_t* src, uint32_t count, uint32_t seed)
+    {
+        if (line >= mHashes.size())
+            return;
+
+        // Lines may be rendered in several pieces, always from left to right
+        mRendered = true;
+        mStale |= !mAttached;
+        auto& value = mHashes[line];
+        if (x == 0)
+            value = FNV_OFFSET_BASIS ^ seed;
+        value = hash(src, count, value);
+    }
+
+    void DirtyLines::endFrame()
+    {
+        // Nothing was hashed, without a surface nor tracking enabled, the lines of that frame are unknown
+        mTracked = mRendered;
+        if (!mRendered)
+        {
+            std::fill(mFlags.begin(), mFlags.end(), 1);
+            mDirtyCount = static_cast<uint32_t>(mFlags.size());
+            return;
+        }
+
+        mDirtyCount = 0;
+        for (size_t line = 0; line < mHashes.size(); ++line)
+        {
+            bool dirty = mInvalid || (mHashes[line] != mPreviousHashes[line]);
+            mFlags[line] = dirty ? 1 : 0;
+            mDirtyCount += dirty ? 1 : 0;
+        }
+        mPreviousHashes = mHashes;
+        mInvalid = false;
+        mRendered = false;
+    }
+
+    bool DirtyLines::read(uint32_t& dirtyCount, uint8_t* flags, size_t count) const
+    {
+        EMU_VERIFY(mTracked && !mFlags.empty());
+        dirtyCount = mDirtyCount;
+        if (flags)
+        {
+            size_t size = std::min(count, mFlags.size());
+            std::copy(mFlags.begin(), mFlags.begin() + size, flags);
+            std::fill(flags + size, flags + count, 1);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __DIRTY_LINES_H__
+#define __DIRTY_LINES_H__
+
+#include "Core.h"
+#include "PixelFormat.h"
+#include <vector>
+
+namespace emu
+{
+    // Tracks which lines of a render surface changed since the previous frame, using a hash per line.
+    // Lines are hashed whenever they are composed, once enabled this works without a surface as a "frame changed" signal.
+    class DirtyLines
+    {
+    public:
+        DirtyLines();
+        ~DirtyLines();
+        bool create(uint32_t lineCount);
+        void destroy();
+        void setSurface(const void* surface, size_t pitch, PixelFormat format);
+        void setEnabled(bool enabled);
+        void invalidate();
+        void addLine(uint32_t line, uint32_t x, const uint8_t* src, uint32_t count, uint32_t seed);
+        void endFrame();
+
+        // Returns false when no line of the last frame was hashed.
+        bool read(uint32_t& dirtyCount, uint8_t* flags, size_t count) const;
+
+        static uint32_t hash(const void* data, size_t size, uint32_t seed);
+
+        bool isEnabled() const
+        {
+            return mEnabled;
+        }
+
+    private:
+        std::vector<uint32_t>   mHashes;
+        std::vector<uint32_t>   mPreviousHashes;
+        std::vector<uint8_t>    mFlags;
+        uint32_t                mDirtyCount;
+        bool                    mInvalid;
+        bool                    mRendered;
+        bool                    mTracked;
+        bool                    mEnabled;
+        bool                    mAttached;
+        bool                    mStale;
+        const void*             mSurface;
+        size_t                  mPitch;
+        PixelFormat             mFormat;
+    };
+}
+
+#endif
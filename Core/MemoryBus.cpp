@@ -1,6 +1,7 @@
 #include "Core.h"
 #include "Log.h"
 #include "MemoryBus.h"
+#include "TrackedBuffer.h"
 #include <memory.h>
 #include <stdio.h>
 #include <algorithm>
@@ -64,6 +65,8 @@ void memory_write8(const MEM_PAGE& page, int32_t ticks, uint16_t addr, uint8_t v
     if (buffer)
     {
         buffer[addrFixed] = value;
+        if (access->tracker)
+            access->tracker->markDirty(buffer + addrFixed);
         return;
     }
     else
@@ -92,6 +95,7 @@ void memory_bus_write8(const MEMORY_BUS& bus, int32_t ticks, uint16_t addr, uint
 MEM_ACCESS& MEM_ACCESS::setReadMemory(const uint8_t* _mem, uint32_t _base)
 {
     base = _base;
+    tracker = nullptr;
     context = 0;
     io.read.mem = _mem;
     io.read.func = nullptr;
@@ -101,6 +105,7 @@ MEM_ACCESS& MEM_ACCESS::setReadMemory(const uint8_t* _mem, uint32_t _base)
 MEM_ACCESS& MEM_ACCESS::setReadMethod(Read8Func _func, void* _context, uint32_t _base)
 {
     base = _base;
+    tracker = nullptr;
     context = _context;
     io.read.mem = nullptr;
     io.read.func = _func;
@@ -110,15 +115,24 @@ MEM_ACCESS& MEM_ACCESS::setReadMethod(Read8Func _func, void* _context, uint32_t
 MEM_ACCESS& MEM_ACCESS::setWriteMemory(uint8_t* _mem, uint32_t _base)
 {
     base = _base;
+    tracker = nullptr;
     context = 0;
     io.write.mem = _mem;
     io.write.func = nullptr;
     return *this;
 }
 
+MEM_ACCESS& MEM_ACCESS::setWriteMemory(uint8_t* _mem, emu::TrackedBuffer& _tracker, uint32_t _base)
+{
+    setWriteMemory(_mem, _base);
+    tracker = &_tracker;
+    return *this;
+}
+
 MEM_ACCESS& MEM_ACCESS::setWriteMethod(Write8Func _func, void* _context, uint32_t _base)
 {
     base = _base;
+    tracker = nullptr;
     context = _context;
     io.write.mem = nullptr;
     io.write.func = _func;
@@ -134,6 +148,13 @@ MEM_ACCESS_READ_WRITE& MEM_ACCESS_READ_WRITE::setReadWriteMemory(uint8_t* _mem,
     return *this;
 }
 
+MEM_ACCESS_READ_WRITE& MEM_ACCESS_READ_WRITE::setReadWriteMemory(uint8_t* _mem, emu::TrackedBuffer& _tracker, uint32_t _base)
+{
+    read.setReadMemory(_mem, _base);
+    write.setWriteMemory(_mem, _tracker, _base);
+    return *this;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace emu
@@ -296,4 +317,16 @@ namespace emu
             accessor.page = find_page(mState, addr, MEMORY_BUS::PAGE_TABLE_WRITE);
         memory_write8(*accessor.page, ticks, addr, value);
     }
+
+    const uint8_t* MemoryBus::getReadMemory(Accessor& accessor, uint16_t addr, uint32_t size)
+    {
+        EMU_ASSERT(size > 0);
+        if (!is_valid_page(*accessor.page, addr))
+            accessor.page = find_page(mState, addr, MEMORY_BUS::PAGE_TABLE_READ);
+        const MEM_PAGE& page = *accessor.page;
+        const uint8_t* buffer = page.access->io.read.mem;
+        if (!buffer || (addr + size - 1 > page.end))
+            return nullptr;
+        return buffer + static_cast<uint16_t>(addr - page.offset);
+    }
 }
\ No newline at end of file
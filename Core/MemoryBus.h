@@ -7,6 +7,11 @@
 struct MEM_PAGE_READ;
 struct MEM_PAGE_WRITE;
 
+namespace emu
+{
+    class TrackedBuffer;
+}
+
 typedef uint8_t (*Read8Func)(void* context, int32_t ticks, uint32_t addr);
 typedef void (*Write8Func)(void* context, int32_t ticks, uint32_t addr, uint8_t value);
 
@@ -27,10 +32,12 @@ struct MEM_ACCESS
             Write8Func      func;
         }                   write;
     }                       io;
+    emu::TrackedBuffer*     tracker;
 
     MEM_ACCESS& setReadMemory(const uint8_t* _mem, uint32_t _base = 0);
     MEM_ACCESS& setReadMethod(Read8Func _func, void* _context, uint32_t _base = 0);
     MEM_ACCESS& setWriteMemory(uint8_t* _mem, uint32_t _base = 0);
+    MEM_ACCESS& setWriteMemory(uint8_t* _mem, emu::TrackedBuffer& _tracker, uint32_t _base = 0);
     MEM_ACCESS& setWriteMethod(Write8Func _func, void* _context, uint32_t _base = 0);
 };
 
@@ -40,6 +47,7 @@ struct MEM_ACCESS_READ_WRITE
     MEM_ACCESS      write;
 
     MEM_ACCESS_READ_WRITE& setReadWriteMemory(uint8_t* _mem, uint32_t _base = 0);
+    MEM_ACCESS_READ_WRITE& setReadWriteMemory(uint8_t* _mem, emu::TrackedBuffer& _tracker, uint32_t _base = 0);
 };
 
 struct MEM_PAGE
@@ -97,6 +105,9 @@ namespace emu
         uint8_t read8(Accessor& accessor, int32_t ticks, uint16_t addr);
         void write8(Accessor& accessor, int32_t ticks, uint16_t addr, uint8_t value);
 
+        // Host memory backing [addr, addr + size), or nullptr when the range is handled by a callback or spans several pages
+        const uint8_t* getReadMemory(Accessor& accessor, uint16_t addr, uint32_t size);
+
     private:
         MEMORY_BUS                  mState;
         std::vector<MEM_PAGE*>      mPageReadRef;
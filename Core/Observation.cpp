@@ -0,0 +1,180 @@
+#include "Observation.h"
+#include "PixelFormat.h"
+#include <algorithm>
+#include <string.h>
+
+namespace emu
+{
+    Observation::Observation()
+        : mSourceSizeX(0)
+        , mSourceSizeY(0)
+        , mFrameSize(0)
+        , mFrameIndex(0)
+    {
+        memset(mGray, 0, sizeof(mGray));
+    }
+
+    Observation::~Observation()
+    {
+        destroy();
+    }
+
+    bool Observation::create(const Config& config, uint32_t sourceSizeX, uint32_t sourceSizeY)
+    {
+        destroy();
+        if (!config.sizeX || !config.sizeY)
+            return true;
+
+        EMU_VERIFY(config.sizeX <= sourceSizeX);
+        EMU_VERIFY(config.sizeY <= sourceSizeY);
+        EMU_VERIFY(config.frameCount > 0);
+        EMU_VERIFY(config.filter < Filter::COUNT);
+
+        mConfig = config;
+        mSourceSizeX = sourceSizeX;
+        mSourceSizeY = sourceSizeY;
+        mFrameSize = config.sizeX * config.sizeY;
+        initializeTaps(mTapsX, sourceSizeX, config.sizeX, config.filter);
+        initializeTaps(mTapsY, sourceSizeY, config.sizeY, config.filter);
+        mRowSum.resize(config.sizeX);
+        mRowWeight.resize(config.sizeX);
+        mSum.resize(mFrameSize);
+        mWeight.resize(mFrameSize);
+        mFrames.resize(mFrameSize * config.frameCount);
+        reset();
+        return true;
+    }
+
+    void Observation::destroy()
+    {
+        mConfig = Config();
+        mSourceSizeX = 0;
+        mSourceSizeY = 0;
+        mFrameSize = 0;
+        mFrameIndex = 0;
+        mTapsX.clear();
+        mTapsY.clear();
+        mRowSum.clear();
+        mRowWeight.clear();
+        mSum.clear();
+        mWeight.clear();
+        mFrames.clear();
+    }
+
+    void Observation::reset()
+    {
+        mFrameIndex = 0;
+        std::fill(mSum.begin(), mSum.end(), 0.0f);
+        std::fill(mWeight.begin(), mWeight.end(), 0.0f);
+        std::fill(mFrames.begin(), mFrames.end(), 0);
+    }
+
+    void Observation::setPalette(const uint32_t* rgba, size_t count)
+    {
+        EMU_ASSERT(count <= EMU_ARRAY_SIZE(mGray));
+        for (size_t index = 0; index < count; ++index)
+            mGray[index] = static_cast<float>(Pixel::convert(PixelFormat::Gray8, rgba[index], static_cast<uint8_t>(index)));
+    }
+
+    void Observation::initializeTaps(std::vector<Tap>& taps, uint32_t sourceSize, uint32_t targetSize, Filter filter)
+    {
+        taps.resize(sourceSize);
+        for (uint32_t pos = 0; pos < sourceSize; ++pos)
+        {
+            auto& tap = taps[pos];
+
+            // Source pixel covers [start, end) in target pixels scaled by sourceSize
+            uint32_t start = pos * targetSize;
+            uint32_t end = start + targetSize;
+            uint32_t index = start / sourceSize;
+            uint32_t boundary = (index + 1) * sourceSize;
+            tap.index[0] = index;
+            tap.index[1] = index;
+            tap.weight[0] = 1.0f;
+            tap.weight[1] = 0.0f;
+            if ((filter == Filter::Area) && (end > boundary) && (index + 1 < targetSize))
+            {
+                tap.index[1] = index + 1;
+                tap.weight[0] = static_cast<float>(boundary - start) / targetSize;
+                tap.weight[1] = static_cast<float>(end - boundary) / targetSize;
+            }
+        }
+    }
+
+    void Observation::addLine(uint32_t line, uint32_t x, const uint8_t* src, uint32_t count)
+    {
+        if (!mFrameSize || !count || (line >= mSourceSizeY) || (x >= mSourceSizeX))
+            return;
+        if (count > mSourceSizeX - x)
+            count = mSourceSizeX - x;
+
+        // Reduce horizontally first, then spread the row over the target lines it touches
+        std::fill(mRowSum.begin(), mRowSum.end(), 0.0f);
+        std::fill(mRowWeight.begin(), mRowWeight.end(), 0.0f);
+        auto taps = mTapsX.data() + x;
+        for (uint32_t pos = 0; pos < count; ++pos)
+        {
+            const auto& tap = taps[pos];
+            float value = mGray[src[pos]];
+            mRowSum[tap.index[0]] += value * tap.weight[0];
+            mRowWeight[tap.index[0]] += tap.weight[0];
+            mRowSum[tap.index[1]] += value * tap.weight[1];
+            mRowWeight[tap.index[1]] += tap.weight[1];
+        }
+
+        uint32_t first = mTapsX[x].index[0];
+        uint32_t last = mTapsX[x + count - 1].index[1];
+        const auto& tapY = mTapsY[line];
+        for (uint32_t tap = 0; tap < 2; ++tap)
+        {
+            float weight = tapY.weight[tap];
+            if (weight <= 0.0f)
+                continue;
+
+            auto sum = mSum.data() + tapY.index[tap] * mConfig.sizeX;
+            auto total = mWeight.data() + tapY.index[tap] * mConfig.sizeX;
+            for (uint32_t pos = first; pos <= last; ++pos)
+            {
+                sum[pos] += mRowSum[pos] * weight;
+                total[pos] += mRowWeight[pos] * weight;
+            }
+        }
+    }
+
+    void Observation::endFrame()
+    {
+        if (!mFrameSize)
+            return;
+
+        auto dest = mFrames.data() + mFrameIndex * mFrameSize;
+        for (size_t pos = 0; pos < mFrameSize; ++pos)
+        {
+            float weight = mWeight[pos];
+            float value = weight > 0.0f ? mSum[pos] / weight + 0.5f : 0.0f;
+            dest[pos] = static_cast<uint8_t>(std::min(value, 255.0f));
+        }
+        std::fill(mSum.begin(), mSum.end(), 0.0f);
+        std::fill(mWeight.begin(), mWeight.end(), 0.0f);
+
+        if (++mFrameIndex >= mConfig.frameCount)
+            mFrameIndex = 0;
+    }
+
+    size_t Observation::getSize() const
+    {
+        return mFrames.size();
+    }
+
+    bool Observation::read(void* dest, size_t size) const
+    {
+        EMU_VERIFY(mFrameSize);
+        EMU_VERIFY(size == mFrames.size());
+
+        // Frames are returned from oldest to most recent
+        size_t split = mFrameIndex * mFrameSize;
+        auto dest8 = static_cast<uint8_t*>(dest);
+        memcpy(dest8, mFrames.data() + split, mFrames.size() - split);
+        memcpy(dest8 + mFrames.size() - split, mFrames.data(), split);
+        return true;
+    }
+}
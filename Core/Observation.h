@@ -0,0 +1,74 @@
+#ifndef __OBSERVATION_H__
+#define __OBSERVATION_H__
+
+#include "Core.h"
+#include <vector>
+
+namespace emu
+{
+    // Downscaled grayscale copy of the rendered image, accumulated one scanline at a time.
+    class Observation
+    {
+    public:
+        enum class Filter
+        {
+            Box,        // Every source pixel contributes to the single target pixel containing it
+            Area,       // Source pixels are weighted by their coverage of each target pixel
+            COUNT
+        };
+
+        struct Config
+        {
+            uint32_t    sizeX = 0;          // Target width, 0 disables the observation stage
+            uint32_t    sizeY = 0;          // Target height
+            uint32_t    frameCount = 1;     // Number of frames kept in the observation stack
+            Filter      filter = Filter::Area;
+        };
+
+        Observation();
+        ~Observation();
+        bool create(const Config& config, uint32_t sourceSizeX, uint32_t sourceSizeY);
+        void destroy();
+        void reset();
+        void setPalette(const uint32_t* rgba, size_t count);
+        void addLine(uint32_t line, uint32_t x, const uint8_t* src, uint32_t count);
+        void endFrame();
+        size_t getSize() const;
+        bool read(void* dest, size_t size) const;
+
+        bool isEnabled() const
+        {
+            return mFrameSize != 0;
+        }
+
+        const Config& getConfig() const
+        {
+            return mConfig;
+        }
+
+    private:
+        struct Tap
+        {
+            uint32_t    index[2];
+            float       weight[2];
+        };
+
+        static void initializeTaps(std::vector<Tap>& taps, uint32_t sourceSize, uint32_t targetSize, Filter filter);
+
+        Config                  mConfig;
+        uint32_t                mSourceSizeX;
+        uint32_t                mSourceSizeY;
+        size_t                  mFrameSize;
+        uint32_t                mFrameIndex;
+        float                   mGray[256];
+        std::vector<Tap>        mTapsX;
+        std::vector<Tap>        mTapsY;
+        std::vector<float>      mRowSum;
+        std::vector<float>      mRowWeight;
+        std::vector<float>      mSum;
+        std::vector<float>      mWeight;
+        std::vector<uint8_t>    mFrames;
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "PixelFormat.h"
+
+namespace emu
+{
+    namespace Pixel
+    {
+        size_t getSize(PixelFormat format)
+        {
+            switch (format)
+            {
+            case PixelFormat::RGBA8888:
+            case PixelFormat::BGRA8888:
+                return 4;
+
+            case PixelFormat::RGB565:
+                return 2;
+
+            case PixelFormat::Indexed8:
+            case PixelFormat::Gray8:
+                return 1;
+
+            default:
+                EMU_ASSERT(false);
+                return 4;
+            }
+        }
+
+        uint32_t convert(PixelFormat format, uint32_t rgba, uint8_t index)
+        {
+            emu::word32_t color;
+            color.u = rgba;
+            uint32_t r = color.w8[0].u;
+            uint32_t g = color.w8[1].u;
+            uint32_t b = color.w8[2].u;
+
+            switch (format)
+            {
+            case PixelFormat::RGBA8888:
+                return rgba;
+
+            case PixelFormat::BGRA8888:
+                color.w8[0].u = static_cast<uint8_t>(b);
+                color.w8[2].u = static_cast<uint8_t>(r);
+                return color.u;
+
+            case PixelFormat::RGB565:
+                return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+
+            case PixelFormat::Indexed8:
+                return index;
+
+            case PixelFormat::Gray8:
+                return (r * 77 + g * 150 + b * 29) >> 8;
+
+            default:
+                EMU_ASSERT(false);
+                return rgba;
+            }
+        }
+
+        void convertPalette(PixelFormat format, uint32_t* dest, const uint32_t* rgba, size_t count)
+        {
+            for (size_t index = 0; index < count; ++index)
+                dest[index] = convert(format, rgba[index], static_cast<uint8_t>(index));
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Core.h"
+
+namespace emu
+{
+    enum class PixelFormat
+    {
+        RGBA8888,       // 32 bits, bytes stored as R, G, B, A
+        BGRA8888,       // 32 bits, bytes stored as B, G, R, A
+        RGB565,         // 16 bits, native endianness
+        Indexed8,       // 8 bits, system specific palette index
+        Gray8,          // 8 bits, luminance
+        COUNT
+    };
+
+    namespace Pixel
+    {
+        // Returns the number of bytes written per pixel in the given format.
+        size_t getSize(PixelFormat format);
+
+        // Converts a color stored as RGBA bytes to the given format. For indexed formats, the palette index is returned.
+        uint32_t convert(PixelFormat format, uint32_t rgba, uint8_t index);
+
+        // Converts a whole palette of RGBA colors to the given format.
+        void convertPalette(PixelFormat format, uint32_t* dest, const uint32_t* rgba, size_t count);
+
+        // Writes count pixels to dest, mapping each source index through a palette already converted to the given format.
+        inline void blit(PixelFormat format, void* dest, const uint32_t* palette, const uint8_t* src, uint32_t count)
+        {
+            switch (getSize(format))
+            {
+            case 4:
+            {
+                auto dest32 = static_cast<uint32_t*>(dest);
+                for (uint32_t pos = 0; pos < count; ++pos)
+                    dest32[pos] = palette[src[pos]];
+                break;
+            }
+
+            case 2:
+            {
+                auto dest16 = static_cast<uint16_t*>(dest);
+                for (uint32_t pos = 0; pos < count; ++pos)
+                    dest16[pos] = static_cast<uint16_t>(palette[src[pos]]);
+                break;
+            }
+
+            default:
+            {
+                auto dest8 = static_cast<uint8_t*>(dest);
+                for (uint32_t pos = 0; pos < count; ++pos)
+                    dest8[pos] = static_cast<uint8_t>(palette[src[pos]]);
+                break;
+            }
+            }
+        }
+    }
+}
@@ -0,0 +1,291 @@
+#include "Log.h"
+#include "Resampler.h"
+#include "Simd.h"
+#include <algorithm>
+#include <math.h>
+
+#if EMU_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    static const uint32_t FRAC_BITS = 32;
+    static const uint32_t COEFFICIENT_BITS = 14;
+    static const double PI = 3.14159265358979323846;
+    static const uint32_t TAP_COUNT[] = { 16, 32, 64 };
+    static const uint32_t VERIFY_ITERATIONS = 1024;
+    static const uint32_t VERIFY_SIZE = 64;
+
+    // Sums count products of 16 bit values, count is a multiple of 16.
+    typedef int32_t (*DotProduct)(const int16_t* samples, const int16_t* coefficients, uint32_t count);
+
+    struct Kernels
+    {
+        const char*     name;
+        DotProduct      dotProduct;
+    };
+
+    int32_t dotProductScalar(const int16_t* samples, const int16_t* coefficients, uint32_t count)
+    {
+        int32_t sum = 0;
+        for (uint32_t index = 0; index < count; ++index)
+            sum += samples[index] * coefficients[index];
+        return sum;
+    }
+
+#if EMU_SIMD_X86
+    int32_t dotProductSSE2(const int16_t* samples, const int16_t* coefficients, uint32_t count)
+    {
+        __m128i sum0 = _mm_setzero_si128();
+        __m128i sum1 = _mm_setzero_si128();
+        for (uint32_t index = 0; index < count; index += 16)
+        {
+            __m128i samples0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + index));
+            __m128i samples1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + index + 8));
+            __m128i coefficients0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients + index));
+            __m128i coefficients1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients + index + 8));
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(samples0, coefficients0));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(samples1, coefficients1));
+        }
+        __m128i sum = _mm_add_epi32(sum0, sum1);
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+
+    EMU_TARGET_AVX2 int32_t dotProductAVX2(const int16_t* samples, const int16_t* coefficients, uint32_t count)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        for (uint32_t index = 0; index < count; index += 16)
+        {
+            __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + index));
+            __m256i weights = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefficients + index));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(values, weights));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(half);
+    }
+#endif
+
+    const Kernels kernelsScalar = { "Scalar", dotProductScalar };
+#if EMU_SIMD_X86
+    const Kernels kernelsSSE2 = { "SSE2", dotProductSSE2 };
+    const Kernels kernelsAVX2 = { "AVX2", dotProductAVX2 };
+#endif
+
+    uint32_t nextRandom(uint32_t& seed)
+    {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    }
+
+    bool verifyKernels(const Kernels& kernels)
+    {
+        // Full scale samples, coefficients are kept small enough for the sums to fit in 32 bits
+        uint32_t seed = 1;
+        for (uint32_t iteration = 0; iteration < VERIFY_ITERATIONS; ++iteration)
+        {
+            int16_t samples[VERIFY_SIZE + 1];
+            int16_t coefficients[VERIFY_SIZE];
+            for (auto& value : samples)
+                value = static_cast<int16_t>(nextRandom(seed));
+            for (auto& value : coefficients)
+                value = static_cast<int16_t>(nextRandom(seed)) >> 6;
+            if (iteration == 0)
+            {
+                std::fill(samples, samples + VERIFY_SIZE + 1, INT16_MIN);
+                std::fill(coefficients, coefficients + VERIFY_SIZE, INT16_MIN >> 6);
+            }
+
+            // Odd offset for unaligned loads
+            for (uint32_t count = 16; count <= VERIFY_SIZE; count += 16)
+            {
+                if (kernelsScalar.dotProduct(samples + 1, coefficients, count) != kernels.dotProduct(samples + 1, coefficients, count))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    const Kernels& selectKernels()
+    {
+        const Kernels* candidates[3];
+        uint32_t count = 0;
+#if EMU_SIMD_X86
+        auto level = emu::Simd::getLevel();
+        if (level >= emu::Simd::Level::AVX2)
+            candidates[count++] = &kernelsAVX2;
+        if (level >= emu::Simd::Level::SSE2)
+            candidates[count++] = &kernelsSSE2;
+#endif
+        candidates[count++] = &kernelsScalar;
+
+        for (uint32_t index = 0; index < count; ++index)
+        {
+            auto& kernels = *candidates[index];
+            if (verifyKernels(kernels))
+                return kernels;
+            emu::Log::printf(emu::Log::Type::Error, "Resampler kernels %s do not match the reference implementation\n", kernels.name);
+        }
+        return kernelsScalar;
+    }
+
+    const Kernels& getKernels()
+    {
+        static const Kernels& kernels = selectKernels();
+        return kernels;
+    }
+}
+
+namespace emu
+{
+    Resampler::Resampler()
+        : mDotProduct(getKernels().dotProduct)
+        , mChannelCount(0)
+        , mTapCount(0)
+        , mStep(0)
+        , mPosition(0)
+    {
+    }
+
+    Resampler::~Resampler()
+    {
+        destroy();
+    }
+
+    bool Resampler::create(uint32_t inputRate, uint32_t outputRate, uint32_t channelCount, Quality quality)
+    {
+        destroy();
+        EMU_VERIFY(inputRate && outputRate);
+        EMU_VERIFY(channelCount && (channelCount <= MAX_CHANNEL_COUNT));
+        EMU_VERIFY(quality < Quality::COUNT);
+
+        mChannelCount = channelCount;
+        mTapCount = TAP_COUNT[static_cast<uint32_t>(quality)];
+        mStep = (static_cast<uint64_t>(inputRate) << FRAC_BITS) / outputRate;
+
+        // The cutoff follows the output Nyquist frequency when decimating
+        initializeKernel(std::min(1.0, static_cast<double>(outputRate) / inputRate));
+        clear();
+        return true;
+    }
+
+    void Resampler::destroy()
+    {
+        mKernel.clear();
+        for (auto& input : mInput)
+            input.clear();
+        mChannelCount = 0;
+        mTapCount = 0;
+        mStep = 0;
+        mPosition = 0;
+    }
+
+    void Resampler::clear()
+    {
+        // A filter length of silence lets the first frame produce all its samples
+        for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+            mInput[channel].assign(mTapCount, 0);
+        mPosition = 0;
+    }
+
+    void Resampler::initializeKernel(double cutoff)
+    {
+        // Windowed sinc for each sub-sample phase, plus one more phase so positions can be rounded up
+        mKernel.resize((PHASE_COUNT + 1) * mTapCount);
+        double center = mTapCount / 2 - 1;
+        double halfWidth = mTapCount / 2;
+        std::vector<double> coefficients(mTapCount);
+        for (uint32_t phase = 0; phase <= PHASE_COUNT; ++phase)
+        {
+            double sum = 0.0;
+            for (uint32_t index = 0; index < mTapCount; ++index)
+            {
+                double x = index - center - static_cast<double>(phase) / PHASE_COUNT;
+                double sinc = x == 0.0 ? 1.0 : sin(PI * cutoff * x) / (PI * cutoff * x);
+                double window = 0.0;
+                if (fabs(x) < halfWidth)
+                    window = 0.42 + 0.5 * cos(PI * x / halfWidth) + 0.08 * cos(2.0 * PI * x / halfWidth);
+                coefficients[index] = sinc * window;
+                sum += coefficients[index];
+            }
+
+            int16_t* kernel = &mKernel[phase * mTapCount];
+            for (uint32_t index = 0; index < mTapCount; ++index)
+                kernel[index] = static_cast<int16_t>(floor(coefficients[index] * (1 << COEFFICIENT_BITS) / sum + 0.5));
+        }
+    }
+
+    void Resampler::write(uint32_t channel, const int16_t* data, size_t count)
+    {
+        EMU_ASSERT(channel < mChannelCount);
+        auto& input = mInput[channel];
+        input.insert(input.end(), data, data + count);
+    }
+
+    size_t Resampler::read(int16_t* dest, size_t count)
+    {
+        if (!mTapCount)
+            return 0;
+
+        auto dotProduct = mDotProduct;
+        size_t available = mInput[0].size();
+        for (uint32_t channel = 1; channel < mChannelCount; ++channel)
+            available = std::min(available, mInput[channel].size());
+
+        size_t produced = 0;
+        for (; produced < count; ++produced)
+        {
+            // Round to the nearest phase, the extra phase covers the rounding up to the next sample
+            uint64_t position = mPosition + (1ull << (FRAC_BITS - PHASE_BITS - 1));
+            size_t index = static_cast<size_t>(mPosition >> FRAC_BITS);
+            if (index + mTapCount > available)
+                break;
+
+            uint32_t phase = static_cast<uint32_t>((position >> (FRAC_BITS - PHASE_BITS)) - (static_cast<uint64_t>(index) << PHASE_BITS));
+            const int16_t* kernel = &mKernel[phase * mTapCount];
+            for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+            {
+                int32_t sum = dotProduct(&mInput[channel][index], kernel, mTapCount);
+                int32_t sample = (sum + (1 << (COEFFICIENT_BITS - 1))) >> COEFFICIENT_BITS;
+                if (sample != static_cast<int16_t>(sample))
+                    sample = (sample >> 31) ^ 0x7fff;
+                dest[produced * mChannelCount + channel] = static_cast<int16_t>(sample);
+            }
+            mPosition += mStep;
+        }
+
+        // Drop the samples that no longer contribute to the next output
+        size_t consumed = std::min(static_cast<size_t>(mPosition >> FRAC_BITS), available);
+        for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+            mInput[channel].erase(mInput[channel].begin(), mInput[channel].begin() + consumed);
+        mPosition -= static_cast<uint64_t>(consumed) << FRAC_BITS;
+        return produced;
+    }
+
+    const char* Resampler::getKernelName()
+    {
+        return getKernels().name;
+    }
+
+    bool Resampler::setKernelLevel(Simd::Level level)
+    {
+        const Kernels* kernels = nullptr;
+        if (level == Simd::Level::Scalar)
+            kernels = &kernelsScalar;
+#if EMU_SIMD_X86
+        else if (level > Simd::getLevel())
+            return false;
+        else if (level == Simd::Level::SSE2)
+            kernels = &kernelsSSE2;
+        else if (level == Simd::Level::AVX2)
+            kernels = &kernelsAVX2;
+#endif
+        EMU_VERIFY(kernels && verifyKernels(*kernels));
+        mDotProduct = kernels->dotProduct;
+        return true;
+    }
+}
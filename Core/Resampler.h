@@ -0,0 +1,67 @@
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#include "Core.h"
+#include "Simd.h"
+#include <vector>
+
+namespace emu
+{
+    // Polyphase FIR converting planar samples from one rate to interleaved samples at another rate.
+    // Rates only matter through their ratio, so they can also be given as sample counts per frame.
+    class Resampler
+    {
+    public:
+        enum class Quality
+        {
+            Low,        // 16 taps
+            Medium,     // 32 taps
+            High,       // 64 taps
+            COUNT
+        };
+
+        static const uint32_t MAX_CHANNEL_COUNT = 2;
+
+        Resampler();
+        ~Resampler();
+        bool create(uint32_t inputRate, uint32_t outputRate, uint32_t channelCount, Quality quality);
+        void destroy();
+        void clear();
+        void write(uint32_t channel, const int16_t* data, size_t count);
+        size_t read(int16_t* dest, size_t count);
+
+        bool isEnabled() const
+        {
+            return mTapCount != 0;
+        }
+
+        uint32_t getChannelCount() const
+        {
+            return mChannelCount;
+        }
+
+        // Name of the instruction set used by the filter.
+        static const char* getKernelName();
+
+        // Runs this filter with the kernels of an instruction set, returns false when the processor doesn't support it.
+        bool setKernelLevel(Simd::Level level);
+
+    private:
+        static const uint32_t PHASE_BITS = 8;
+        static const uint32_t PHASE_COUNT = 1 << PHASE_BITS;
+
+        typedef int32_t (*DotProduct)(const int16_t* samples, const int16_t* coefficients, uint32_t count);
+
+        void initializeKernel(double cutoff);
+
+        std::vector<int16_t>    mKernel;
+        std::vector<int16_t>    mInput[MAX_CHANNEL_COUNT];
+        DotProduct              mDotProduct;
+        uint32_t                mChannelCount;
+        uint32_t                mTapCount;
+        uint64_t                mStep;
+        uint64_t                mPosition;
+    };
+}
+
+#endif
@@ -127,6 +127,13 @@ namespace emu
     {
     }
 
+    bool BinaryReader::rawValues(void* data, size_t size)
+    {
+        // Values are stored in native little endian order, the layout matches one value at a time
+        mSuccess |= mStream->read(data, size);
+        return true;
+    }
+
     ////////////////////////////////////////////////////////////////////////////////
 
     BinaryWriter::BinaryWriter(IStream& stream)
@@ -251,4 +258,10 @@ namespace emu
     void BinaryWriter::sequenceItem()
     {
     }
+
+    bool BinaryWriter::rawValues(void* data, size_t size)
+    {
+        mSuccess |= mStream->write(data, size);
+        return true;
+    }
 }
\ No newline at end of file
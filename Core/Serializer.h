@@ -3,6 +3,7 @@
 
 #include "CollectionTraits.h"
 #include "Core.h"
+#include "TrackedBuffer.h"
 #include <cstdint>
 #include <string>
 #include <type_traits>
@@ -38,6 +39,22 @@ namespace emu
         virtual void sequenceEnd() = 0;
         virtual void sequenceItem() = 0;
 
+        // Copies contiguous values as they are in memory, returns false when they must be serialized one at a time.
+        virtual bool rawValues(void* data, size_t size)
+        {
+            EMU_UNUSED(data);
+            EMU_UNUSED(size);
+            return false;
+        }
+
+        // Tracked buffers are serialized like any buffer unless the serializer can store their pages.
+        virtual void value(TrackedBuffer& item)
+        {
+            value(static_cast<Buffer&>(item));
+            if (isReading())
+                item.markAllDirty();
+        }
+
         bool isReading() const
         {
             return !isWriting();
@@ -63,13 +80,20 @@ namespace emu
                 size_t count = 0;
                 if (sequenceBegin(count))
                 {
+                    if (rawSequence(item, count, RawElements<T>()))
+                    {
+                        sequenceEnd();
+                        return *this;
+                    }
+
+                    CollectionTraits<T>::clear(item);
                     CollectionTraits<T>::reserve(item, count);
                     for (size_t n = 0; n < count; ++n)
                     {
                         sequenceItem();
                         CollectionTraits<T>::ElementType element;
                         serialize(*this, element);
-                        CollectionTraits<T>::push_back(item, element, count);
+                        CollectionTraits<T>::push_back(item, element, n);
                     }
                     sequenceEnd();
                 }
@@ -79,6 +103,12 @@ namespace emu
                 auto count = CollectionTraits<T>::size(item);
                 if (sequenceBegin(count))
                 {
+                    if (rawSequence(item, count, RawElements<T>()))
+                    {
+                        sequenceEnd();
+                        return *this;
+                    }
+
                     for (auto element = CollectionTraits<T>::begin(item); element != CollectionTraits<T>::end(item); ++element)
                     {
                         sequenceItem();
@@ -89,6 +119,29 @@ namespace emu
             }
             return *this;
         }
+
+    private:
+        // Sequences of numbers have the same layout in memory and in a stream, bool is left out because of std::vector<bool>
+        template <typename T>
+        using RawElements = std::integral_constant<bool,
+            std::is_arithmetic<typename CollectionTraits<T>::ElementType>::value &&
+            !std::is_same<typename CollectionTraits<T>::ElementType, bool>::value>;
+
+        template <typename T>
+        bool rawSequence(T& item, size_t count, std::true_type)
+        {
+            if (!CollectionTraits<T>::resize(item, count))
+                return false;
+            return rawValues(CollectionTraits<T>::data(item), count * sizeof(typename CollectionTraits<T>::ElementType));
+        }
+
+        template <typename T>
+        bool rawSequence(T& item, size_t count, std::false_type)
+        {
+            EMU_UNUSED(item);
+            EMU_UNUSED(count);
+            return false;
+        }
     };
 
     class IStreamSerializer : public ISerializer
@@ -123,6 +176,7 @@ namespace emu
         virtual bool sequenceBegin(size_t& size) override;
         virtual void sequenceEnd() override;
         virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
 
     private:
         IStream*     mStream;
@@ -155,6 +209,7 @@ namespace emu
         virtual bool sequenceBegin(size_t& size) override;
         virtual void sequenceEnd() override;
         virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
 
     private:
         IStream*    mStream;
@@ -253,6 +308,11 @@ namespace emu
         serializer.value(item);
     }
 
+    inline void serialize(ISerializer& serializer, TrackedBuffer& item)
+    {
+        serializer.value(item);
+    }
+
     template <typename T>
     std::enable_if_t<std::is_enum<T>::value>
         serialize(ISerializer& serializer, T& item)
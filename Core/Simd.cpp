@@ -0,0 +1,89 @@
+#include "Simd.h"
+
+#if EMU_SIMD_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+#if EMU_SIMD_X86
+    void cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t regs[4])
+    {
+#if defined(_MSC_VER)
+        int values[4];
+        __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subLeaf));
+        for (uint32_t index = 0; index < 4; ++index)
+            regs[index] = static_cast<uint32_t>(values[index]);
+#else
+        __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    uint64_t xgetbv()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+    }
+#endif
+
+    emu::Simd::Level detectLevel()
+    {
+#if EMU_SIMD_X86
+        uint32_t regs[4];
+        cpuid(0, 0, regs);
+        uint32_t maxLeaf = regs[0];
+        if (maxLeaf < 1)
+            return emu::Simd::Level::Scalar;
+
+        cpuid(1, 0, regs);
+        bool sse2 = (regs[3] & (1u << 26)) != 0;
+        bool osxsave = (regs[2] & (1u << 27)) != 0;
+        bool avx = (regs[2] & (1u << 28)) != 0;
+        if (!sse2)
+            return emu::Simd::Level::Scalar;
+
+        // AVX2 also requires the operating system to save the YMM registers
+        if ((maxLeaf >= 7) && osxsave && avx && ((xgetbv() & 0x6) == 0x6))
+        {
+            cpuid(7, 0, regs);
+            if (regs[1] & (1u << 5))
+                return emu::Simd::Level::AVX2;
+        }
+        return emu::Simd::Level::SSE2;
+#else
+        return emu::Simd::Level::Scalar;
+#endif
+    }
+}
+
+namespace emu
+{
+    namespace Simd
+    {
+        Level getLevel()
+        {
+            static const Level level = detectLevel();
+            return level;
+        }
+
+        const char* getLevelName(Level level)
+        {
+            switch (level)
+            {
+            case Level::Scalar: return "Scalar";
+            case Level::SSE2: return "SSE2";
+            case Level::AVX2: return "AVX2";
+            default: return "Unknown";
+            }
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include "Core.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define EMU_SIMD_X86    1
+#else
+#define EMU_SIMD_X86    0
+#endif
+
+// Functions using AVX2 intrinsics must be tagged so they can live in a translation unit compiled for SSE2
+#if defined(_MSC_VER) || !EMU_SIMD_X86
+#define EMU_TARGET_AVX2
+#else
+#define EMU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace emu
+{
+    namespace Simd
+    {
+        enum class Level
+        {
+            Scalar,
+            SSE2,
+            AVX2,
+            COUNT
+        };
+
+        // Highest instruction set supported by both the processor and the operating system.
+        Level getLevel();
+        const char* getLevelName(Level level);
+    }
+}
+
+#endif
@@ -0,0 +1,665 @@
+#include "Context.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    static const uint32_t DEFAULT_KEY_INTERVAL = 32;
+    static const size_t MAX_FREE_ENTRIES = 64;
+    static const uint8_t PAGE_UNCHANGED = 0;
+    static const uint8_t PAGE_CHANGED = 1;
+    static const uint8_t PAGE_RESTORED = 2;
+}
+
+namespace emu
+{
+    SnapshotWriter::SnapshotWriter(std::vector<uint8_t>& buffer)
+        : mBuffer(&buffer)
+        , mSize(0)
+    {
+    }
+
+    size_t SnapshotWriter::getSize() const
+    {
+        return mSize;
+    }
+
+    bool SnapshotWriter::success() const
+    {
+        return true;
+    }
+
+    bool SnapshotWriter::isWriting() const
+    {
+        return true;
+    }
+
+    void SnapshotWriter::write(const void* data, size_t size)
+    {
+        // The buffer is only grown, a reused writer settles on the size of the state
+        if (mSize + size > mBuffer->size())
+            mBuffer->resize(std::max(mSize + size, mBuffer->size() * 2));
+        memcpy(mBuffer->data() + mSize, data, size);
+        mSize += size;
+    }
+
+    void SnapshotWriter::value(bool& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(char& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(int8_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(uint8_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(int16_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(uint16_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(int32_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(uint32_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(int64_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(uint64_t& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(float& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(double& item)
+    {
+        write(&item, sizeof(item));
+    }
+
+    void SnapshotWriter::value(std::string& item)
+    {
+        size_t size = item.size();
+        write(&size, sizeof(size));
+        write(item.data(), size);
+    }
+
+    void SnapshotWriter::value(Buffer& item)
+    {
+        size_t size = item.size();
+        write(&size, sizeof(size));
+        write(item.data(), size);
+    }
+
+    bool SnapshotWriter::nodeBegin(const char* name)
+    {
+        EMU_UNUSED(name);
+        return true;
+    }
+
+    void SnapshotWriter::nodeEnd()
+    {
+    }
+
+    bool SnapshotWriter::sequenceBegin(size_t& size)
+    {
+        write(&size, sizeof(size));
+        return true;
+    }
+
+    void SnapshotWriter::sequenceEnd()
+    {
+    }
+
+    void SnapshotWriter::sequenceItem()
+    {
+    }
+
+    bool SnapshotWriter::rawValues(void* data, size_t size)
+    {
+        write(data, size);
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+
+    SnapshotReader::SnapshotReader(const void* data, size_t size)
+        : mData(static_cast<const uint8_t*>(data))
+        , mSize(size)
+        , mPos(0)
+        , mSuccess(true)
+    {
+    }
+
+    bool SnapshotReader::success() const
+    {
+        return mSuccess;
+    }
+
+    bool SnapshotReader::isWriting() const
+    {
+        return false;
+    }
+
+    void SnapshotReader::read(void* data, size_t size)
+    {
+        if (mPos + size > mSize)
+        {
+            mSuccess = false;
+            memset(data, 0, size);
+            return;
+        }
+        memcpy(data, mData + mPos, size);
+        mPos += size;
+    }
+
+    void SnapshotReader::value(bool& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(char& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(int8_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(uint8_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(int16_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(uint16_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(int32_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(uint32_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(int64_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(uint64_t& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(float& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(double& item)
+    {
+        read(&item, sizeof(item));
+    }
+
+    void SnapshotReader::value(std::string& item)
+    {
+        size_t size = 0;
+        read(&size, sizeof(size));
+        item.resize(mSuccess ? size : 0);
+        if (!item.empty())
+            read(&item[0], item.size());
+    }
+
+    void SnapshotReader::value(Buffer& item)
+    {
+        size_t size = 0;
+        read(&size, sizeof(size));
+        item.resize(mSuccess ? size : 0);
+        read(item.data(), item.size());
+    }
+
+    bool SnapshotReader::nodeBegin(const char* name)
+    {
+        EMU_UNUSED(name);
+        return true;
+    }
+
+    void SnapshotReader::nodeEnd()
+    {
+    }
+
+    bool SnapshotReader::sequenceBegin(size_t& size)
+    {
+        read(&size, sizeof(size));
+        return mSuccess;
+    }
+
+    void SnapshotReader::sequenceEnd()
+    {
+    }
+
+    void SnapshotReader::sequenceItem()
+    {
+    }
+
+    bool SnapshotReader::rawValues(void* data, size_t size)
+    {
+        read(data, size);
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+
+    Snapshot::Snapshot()
+        : mSize(0)
+    {
+    }
+
+    void Snapshot::clear()
+    {
+        mSize = 0;
+    }
+
+    bool Snapshot::save(IContext& context)
+    {
+        SnapshotWriter writer(mBuffer);
+        bool result = context.serializeGameState(writer);
+        mSize = result ? writer.getSize() : 0;
+        return result;
+    }
+
+    bool Snapshot::load(IContext& context) const
+    {
+        EMU_VERIFY(mSize);
+        SnapshotReader reader(mBuffer.data(), mSize);
+        EMU_VERIFY(context.serializeGameState(reader));
+        return reader.success();
+    }
+
+    void* Snapshot::allocate(size_t size)
+    {
+        if (size > mBuffer.size())
+            mBuffer.resize(size);
+        mSize = size;
+        return mBuffer.data();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+
+    // Stores each tracked buffer as its size followed by the pages to copy over the ones of the parent snapshot.
+    class SnapshotChain::Writer : public SnapshotWriter
+    {
+    public:
+        using SnapshotWriter::value;
+
+        Writer(Entry& entry, bool full)
+            : SnapshotWriter(entry.data)
+            , mEntry(&entry)
+            , mFull(full)
+        {
+        }
+
+        virtual void value(TrackedBuffer& item) override
+        {
+            mEntry->records.push_back(getSize());
+            size_t size = item.size();
+            uint32_t pageCount = static_cast<uint32_t>(item.getPageCount());
+            uint32_t count = 0;
+            for (uint32_t page = 0; page < pageCount; ++page)
+            {
+                if (mFull || item.isDirty(page))
+                    ++count;
+            }
+
+            write(&size, sizeof(size));
+            write(&count, sizeof(count));
+            for (uint32_t page = 0; page < pageCount; ++page)
+            {
+                if (mFull || item.isDirty(page))
+                {
+                    size_t offset = static_cast<size_t>(page) << TrackedBuffer::PAGE_SIZE_LOG2;
+                    write(&page, sizeof(page));
+                    write(item.data() + offset, std::min<size_t>(TrackedBuffer::PAGE_SIZE, size - offset));
+                }
+            }
+            item.clearDirty();
+        }
+
+    private:
+        Entry*      mEntry;
+        bool        mFull;
+    };
+
+    // Reads the state of the first snapshot of the path, the pages of tracked buffers are only copied when they changed
+    // since the common ancestor of that snapshot and the current state, each one from the nearest snapshot storing it.
+    class SnapshotChain::Reader : public SnapshotReader
+    {
+    public:
+        using SnapshotReader::value;
+
+        Reader(const std::vector<const Entry*>& path, size_t common, const std::vector<const Entry*>& changes, std::vector<uint8_t>& pages)
+            : SnapshotReader(path.front()->data.data(), path.front()->size)
+            , mPath(&path)
+            , mChanges(&changes)
+            , mPages(&pages)
+            , mCommon(common)
+            , mRecord(0)
+        {
+        }
+
+        virtual void value(TrackedBuffer& item) override
+        {
+            size_t size = 0;
+            read(&size, sizeof(size));
+            if (!mSuccess)
+                return;
+
+            bool all = mCommon >= mPath->size();
+            if (item.size() != size)
+            {
+                item.resize(size);
+                all = true;
+            }
+
+            // Pages written since the common ancestor, by the emulation or by the snapshots leading to the current state
+            size_t pageCount = item.getPageCount();
+            size_t remaining = 0;
+            auto& pages = *mPages;
+            pages.assign(pageCount, PAGE_UNCHANGED);
+            for (size_t page = 0; page < pageCount; ++page)
+            {
+                if (all || item.isDirty(page))
+                {
+                    pages[page] = PAGE_CHANGED;
+                    ++remaining;
+                }
+            }
+            for (size_t index = 0; (index < mChanges->size()) && !all; ++index)
+            {
+                size_t pos = 0;
+                const Entry& entry = *(*mChanges)[index];
+                if (!findRecord(entry, size, pos) || !parsePages(entry.data.data(), entry.size, pos, size, [&](uint32_t page, const uint8_t*, size_t)
+                {
+                    if (pages[page] == PAGE_UNCHANGED)
+                    {
+                        pages[page] = PAGE_CHANGED;
+                        ++remaining;
+                    }
+                }))
+                {
+                    return;
+                }
+            }
+
+            // Snapshots newer than the common ancestor hold pages that changed, the older ones only fill the gaps
+            for (size_t index = 0; index < mPath->size(); ++index)
+            {
+                // The pages of the first snapshot are always read to move on to the next value
+                bool newer = index < mCommon;
+                if (index && !newer && !remaining)
+                    break;
+
+                size_t pos = mPos;
+                const Entry& entry = *(*mPath)[index];
+                if (index && !findRecord(entry, size, pos))
+                    return;
+                if (!parsePages(entry.data.data(), entry.size, pos, size, [&](uint32_t page, const uint8_t* data, size_t pageSize)
+                {
+                    auto& state = pages[page];
+                    if ((state == PAGE_CHANGED) || (newer && (state == PAGE_UNCHANGED)))
+                    {
+                        size_t offset = static_cast<size_t>(page) << TrackedBuffer::PAGE_SIZE_LOG2;
+                        memcpy(item.data() + offset, data, pageSize);
+                        item.markDirty(offset, pageSize);
+                        remaining -= state == PAGE_CHANGED;
+                        state = PAGE_RESTORED;
+                    }
+                }))
+                {
+                    return;
+                }
+                if (!index)
+                    mPos = pos;
+            }
+
+            if (remaining)
+                mSuccess = false;
+
+            // The restored pages stay dirty for the other clients of the flags
+            item.clearDirty();
+            ++mRecord;
+        }
+
+    private:
+        // Position of the pages of the current tracked buffer in an older snapshot.
+        bool findRecord(const Entry& entry, size_t size, size_t& pos)
+        {
+            size_t entrySize = 0;
+            pos = mRecord < entry.records.size() ? entry.records[mRecord] : entry.size;
+            if (pos + sizeof(entrySize) <= entry.size)
+                memcpy(&entrySize, entry.data.data() + pos, sizeof(entrySize));
+            pos += sizeof(entrySize);
+            if (entrySize != size)
+                mSuccess = false;
+            return mSuccess;
+        }
+
+        template <typename Func>
+        bool parsePages(const uint8_t* data, size_t dataSize, size_t& pos, size_t size, Func func)
+        {
+            uint32_t count = 0;
+            if (pos + sizeof(count) > dataSize)
+            {
+                mSuccess = false;
+                return false;
+            }
+            memcpy(&count, data + pos, sizeof(count));
+            pos += sizeof(count);
+
+            for (uint32_t index = 0; index < count; ++index)
+            {
+                uint32_t page = 0;
+                size_t offset = size;
+                if (pos + sizeof(page) <= dataSize)
+                {
+                    memcpy(&page, data + pos, sizeof(page));
+                    pos += sizeof(page);
+                    offset = static_cast<size_t>(page) << TrackedBuffer::PAGE_SIZE_LOG2;
+                }
+                size_t pageSize = offset < size ? std::min<size_t>(TrackedBuffer::PAGE_SIZE, size - offset) : 0;
+                if (!pageSize || (pos + pageSize > dataSize))
+                {
+                    mSuccess = false;
+                    return false;
+                }
+                func(page, data + pos, pageSize);
+                pos += pageSize;
+            }
+            return true;
+        }
+
+        const std::vector<const Entry*>*    mPath;
+        const std::vector<const Entry*>*    mChanges;
+        std::vector<uint8_t>*               mPages;
+        size_t                              mCommon;
+        size_t                              mRecord;
+    };
+
+    SnapshotChain::SnapshotChain()
+        : mNextId(INVALID_ID + 1)
+        , mCurrent(INVALID_ID)
+        , mKeyInterval(DEFAULT_KEY_INTERVAL)
+        , mMemorySize(0)
+    {
+    }
+
+    void SnapshotChain::clear()
+    {
+        mEntries.clear();
+        mFreeEntries.clear();
+        mCurrent = INVALID_ID;
+        mMemorySize = 0;
+    }
+
+    void SnapshotChain::setKeyInterval(uint32_t interval)
+    {
+        mKeyInterval = std::max(interval, 1u);
+    }
+
+    SnapshotChain::Id SnapshotChain::capture(IContext& context)
+    {
+        Entry entry;
+        if (!mFreeEntries.empty())
+        {
+            entry = std::move(mFreeEntries.back());
+            mFreeEntries.pop_back();
+        }
+
+        const Entry* parent = find(mCurrent);
+        bool full = !parent || (parent->depth + 1 >= mKeyInterval);
+        entry.id = mNextId++;
+        entry.parent = full ? INVALID_ID : parent->id;
+        entry.key = full ? entry.id : parent->key;
+        entry.depth = full ? 0 : parent->depth + 1;
+        entry.size = 0;
+        entry.records.clear();
+
+        Writer writer(entry, full);
+        if (!context.serializeGameState(writer))
+        {
+            // Some pages may no longer be flagged, the next snapshot must store all of them
+            mCurrent = INVALID_ID;
+            release(entry);
+            return INVALID_ID;
+        }
+
+        entry.size = writer.getSize();
+        mMemorySize += entry.size;
+        mCurrent = entry.id;
+        mEntries.push_back(std::move(entry));
+        return mCurrent;
+    }
+
+    bool SnapshotChain::restore(IContext& context, Id id)
+    {
+        mPath.clear();
+        for (const Entry* entry = find(id); entry; entry = find(entry->parent))
+            mPath.push_back(entry);
+        EMU_VERIFY(!mPath.empty());
+
+        // The current state only differs from its snapshot by the flagged pages, look for the snapshot both derive from
+        mChanges.clear();
+        size_t common = mPath.size();
+        const Entry* current = find(mCurrent);
+        if (current && (current->key == mPath.back()->key))
+        {
+            for (size_t index = 0; current && (index < mPath.size());)
+            {
+                if (current->id == mPath[index]->id)
+                {
+                    common = index;
+                    break;
+                }
+                if (current->id > mPath[index]->id)
+                {
+                    mChanges.push_back(current);
+                    current = find(current->parent);
+                }
+                else
+                {
+                    ++index;
+                }
+            }
+        }
+
+        mCurrent = INVALID_ID;
+        Reader reader(mPath, common, mChanges, mPages);
+        EMU_VERIFY(context.serializeGameState(reader) && reader.success());
+        mCurrent = id;
+        return true;
+    }
+
+    void SnapshotChain::removeLast()
+    {
+        if (mEntries.empty())
+            return;
+
+        // Pages written since the removed snapshot can no longer be told apart
+        if (mEntries.back().id == mCurrent)
+            mCurrent = INVALID_ID;
+        release(mEntries.back());
+        mEntries.pop_back();
+    }
+
+    void SnapshotChain::removeOldest()
+    {
+        if (mEntries.empty())
+            return;
+
+        Id key = mEntries.front().key;
+        for (auto& entry : mEntries)
+        {
+            if (entry.key == key)
+            {
+                if (entry.id == mCurrent)
+                    mCurrent = INVALID_ID;
+                release(entry);
+            }
+        }
+        mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(), [key](const Entry& entry) { return entry.key == key; }), mEntries.end());
+    }
+
+    const SnapshotChain::Entry* SnapshotChain::find(Id id) const
+    {
+        auto entry = std::lower_bound(mEntries.begin(), mEntries.end(), id, [](const Entry& item, Id value) { return item.id < value; });
+        return (entry != mEntries.end()) && (entry->id == id) ? &*entry : nullptr;
+    }
+
+    void SnapshotChain::release(Entry& entry)
+    {
+        // The buffers are kept for the next captures
+        mMemorySize -= entry.size;
+        entry.size = 0;
+        if (mFreeEntries.size() < MAX_FREE_ENTRIES)
+            mFreeEntries.push_back(std::move(entry));
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "Core.h"
+#include "Serializer.h"
+#include <deque>
+#include <vector>
+
+namespace emu
+{
+    class IContext;
+
+    // Copies values to a memory block without names or size checks, sequences of numbers are copied at once.
+    // The layout only matches the build that wrote it, so this is meant for rewind and run ahead, not save files.
+    class SnapshotWriter : public ISerializer
+    {
+    public:
+        SnapshotWriter(std::vector<uint8_t>& buffer);
+        size_t getSize() const;
+        virtual bool success() const override;
+        virtual bool isWriting() const override;
+        virtual void value(bool& item) override;
+        virtual void value(char& item) override;
+        virtual void value(int8_t& item) override;
+        virtual void value(uint8_t& item) override;
+        virtual void value(int16_t& item) override;
+        virtual void value(uint16_t& item) override;
+        virtual void value(int32_t& item) override;
+        virtual void value(uint32_t& item) override;
+        virtual void value(int64_t& item) override;
+        virtual void value(uint64_t& item) override;
+        virtual void value(float& item) override;
+        virtual void value(double& item) override;
+        virtual void value(std::string& item) override;
+        virtual void value(Buffer& item) override;
+        virtual bool nodeBegin(const char* name) override;
+        virtual void nodeEnd() override;
+        virtual bool sequenceBegin(size_t& size) override;
+        virtual void sequenceEnd() override;
+        virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
+
+    protected:
+        void write(const void* data, size_t size);
+
+    private:
+        std::vector<uint8_t>*   mBuffer;
+        size_t                  mSize;
+    };
+
+    class SnapshotReader : public ISerializer
+    {
+    public:
+        SnapshotReader(const void* data, size_t size);
+        virtual bool success() const override;
+        virtual bool isWriting() const override;
+        virtual void value(bool& item) override;
+        virtual void value(char& item) override;
+        virtual void value(int8_t& item) override;
+        virtual void value(uint8_t& item) override;
+        virtual void value(int16_t& item) override;
+        virtual void value(uint16_t& item) override;
+        virtual void value(int32_t& item) override;
+        virtual void value(uint32_t& item) override;
+        virtual void value(int64_t& item) override;
+        virtual void value(uint64_t& item) override;
+        virtual void value(float& item) override;
+        virtual void value(double& item) override;
+        virtual void value(std::string& item) override;
+        virtual void value(Buffer& item) override;
+        virtual bool nodeBegin(const char* name) override;
+        virtual void nodeEnd() override;
+        virtual bool sequenceBegin(size_t& size) override;
+        virtual void sequenceEnd() override;
+        virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
+
+    protected:
+        void read(void* data, size_t size);
+
+        const uint8_t*          mData;
+        size_t                  mSize;
+        size_t                  mPos;
+        bool                    mSuccess;
+    };
+
+    // Game state of a context kept in a buffer that is reused from one capture to the next.
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        void clear();
+        bool save(IContext& context);
+        bool load(IContext& context) const;
+
+        // Makes room for a snapshot of the given size to be copied from elsewhere.
+        void* allocate(size_t size);
+
+        const void* getData() const
+        {
+            return mBuffer.data();
+        }
+
+        size_t getSize() const
+        {
+            return mSize;
+        }
+
+    private:
+        std::vector<uint8_t>    mBuffer;
+        size_t                  mSize;
+    };
+
+    // Snapshots storing only the pages of tracked buffers written since their parent, the snapshot captured or restored last.
+    // Every few generations a snapshot stores all the pages, which bounds the restore time and lets old snapshots be dropped.
+    class SnapshotChain
+    {
+    public:
+        typedef uint64_t Id;
+
+        static const Id INVALID_ID = 0;
+
+        SnapshotChain();
+        void clear();
+        void setKeyInterval(uint32_t interval);
+        Id capture(IContext& context);
+        bool restore(IContext& context, Id id);
+
+        // Drops the newest snapshot. When the state derives from it, the next snapshot or restore handles all the pages.
+        void removeLast();
+
+        // Drops the oldest snapshot storing all the pages along with the snapshots built on top of it.
+        void removeOldest();
+
+        Id getLast() const
+        {
+            return mEntries.empty() ? INVALID_ID : mEntries.back().id;
+        }
+
+        size_t getCount() const
+        {
+            return mEntries.size();
+        }
+
+        size_t getMemorySize() const
+        {
+            return mMemorySize;
+        }
+
+    private:
+        class Writer;
+        class Reader;
+
+        struct Entry
+        {
+            Id                      id;
+            Id                      parent;
+            Id                      key;
+            uint32_t                depth;
+            size_t                  size;
+            std::vector<uint8_t>    data;
+            std::vector<size_t>     records;
+        };
+
+        const Entry* find(Id id) const;
+        void release(Entry& entry);
+
+        std::deque<Entry>           mEntries;
+        std::vector<Entry>          mFreeEntries;
+        std::vector<const Entry*>   mPath;
+        std::vector<const Entry*>   mChanges;
+        std::vector<uint8_t>        mPages;
+        Id                          mNextId;
+        Id                          mCurrent;
+        uint32_t                    mKeyInterval;
+        size_t                      mMemorySize;
+    };
+}
+
+#endif
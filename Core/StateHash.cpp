@@ -0,0 +1,348 @@
+#include "StateHash.h"
+#include "Context.h"
+#include "Serializer.h"
+#include "Stream.h"
+#include "TrackedBuffer.h"
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    static const uint64_t PRIME_1 = 0x9e3779b185ebca87ull;
+    static const uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+    static const uint64_t PRIME_3 = 0x165667b19e3779f9ull;
+    static const uint64_t PRIME_4 = 0x85ebca77c2b2ae63ull;
+    static const uint64_t PRIME_5 = 0x27d4eb2f165667c5ull;
+    static const uint64_t SEED = 0x5ca1ab1e0ddba11ull;
+
+    uint64_t rotateLeft(uint64_t value, uint32_t count)
+    {
+        return (value << count) | (value >> (64 - count));
+    }
+
+    uint64_t read64(const uint8_t* data)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint64_t hashRound(uint64_t lane, uint64_t value)
+    {
+        return rotateLeft(lane + value * PRIME_2, 31) * PRIME_1;
+    }
+
+    uint64_t mergeRound(uint64_t hash, uint64_t lane)
+    {
+        return (hash ^ hashRound(0, lane)) * PRIME_1 + PRIME_4;
+    }
+
+    uint64_t mix(uint64_t hash, uint64_t value)
+    {
+        return rotateLeft(hash ^ hashRound(0, value), 27) * PRIME_1 + PRIME_4;
+    }
+
+    uint64_t avalanche(uint64_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= PRIME_2;
+        hash ^= hash >> 29;
+        hash *= PRIME_3;
+        return hash ^ (hash >> 32);
+    }
+
+    // Same construction as XXH64: four independent lanes over 32 byte stripes, then the tail one word at a time
+    uint64_t hashBytes(const void* data, size_t size)
+    {
+        auto pos = static_cast<const uint8_t*>(data);
+        auto end = pos + size;
+        uint64_t hash;
+        if (size >= 32)
+        {
+            uint64_t lane0 = SEED + PRIME_1 + PRIME_2;
+            uint64_t lane1 = SEED + PRIME_2;
+            uint64_t lane2 = SEED;
+            uint64_t lane3 = SEED - PRIME_1;
+            for (; pos + 32 <= end; pos += 32)
+            {
+                lane0 = hashRound(lane0, read64(pos));
+                lane1 = hashRound(lane1, read64(pos + 8));
+                lane2 = hashRound(lane2, read64(pos + 16));
+                lane3 = hashRound(lane3, read64(pos + 24));
+            }
+            hash = rotateLeft(lane0, 1) + rotateLeft(lane1, 7) + rotateLeft(lane2, 12) + rotateLeft(lane3, 18);
+            hash = mergeRound(hash, lane0);
+            hash = mergeRound(hash, lane1);
+            hash = mergeRound(hash, lane2);
+            hash = mergeRound(hash, lane3);
+        }
+        else
+            hash = SEED + PRIME_5;
+
+        hash += size;
+        for (; pos + 8 <= end; pos += 8)
+            hash = mix(hash, read64(pos));
+        if (pos < end)
+        {
+            uint64_t value = 0;
+            memcpy(&value, pos, end - pos);
+            hash = mix(hash, value);
+        }
+        return avalanche(hash);
+    }
+
+    struct StateHashData
+    {
+        std::vector<uint64_t>   hashes;
+
+        void serialize(emu::ISerializer& serializer)
+        {
+            uint32_t version = 1;
+            serializer
+                .value("Version", version)
+                .value("Hashes", hashes);
+        }
+    };
+}
+
+namespace emu
+{
+    // Folds every value in the hash in the order the state is serialized, names are left out since the order fixes them.
+    class StateHasher::Writer : public ISerializer
+    {
+    public:
+        Writer(std::vector<PageHashes>& buffers)
+            : mBuffers(&buffers)
+            , mBufferIndex(0)
+            , mHash(SEED)
+        {
+        }
+
+        uint64_t getHash() const
+        {
+            return avalanche(mHash);
+        }
+
+        virtual bool success() const override
+        {
+            return true;
+        }
+
+        virtual bool isWriting() const override
+        {
+            return true;
+        }
+
+        virtual void value(bool& item) override
+        {
+            mHash = mix(mHash, item ? 1 : 0);
+        }
+
+        virtual void value(char& item) override
+        {
+            mHash = mix(mHash, static_cast<uint8_t>(item));
+        }
+
+        virtual void value(int8_t& item) override
+        {
+            mHash = mix(mHash, static_cast<uint8_t>(item));
+        }
+
+        virtual void value(uint8_t& item) override
+        {
+            mHash = mix(mHash, item);
+        }
+
+        virtual void value(int16_t& item) override
+        {
+            mHash = mix(mHash, static_cast<uint16_t>(item));
+        }
+
+        virtual void value(uint16_t& item) override
+        {
+            mHash = mix(mHash, item);
+        }
+
+        virtual void value(int32_t& item) override
+        {
+            mHash = mix(mHash, static_cast<uint32_t>(item));
+        }
+
+        virtual void value(uint32_t& item) override
+        {
+            mHash = mix(mHash, item);
+        }
+
+        virtual void value(int64_t& item) override
+        {
+            mHash = mix(mHash, static_cast<uint64_t>(item));
+        }
+
+        virtual void value(uint64_t& item) override
+        {
+            mHash = mix(mHash, item);
+        }
+
+        virtual void value(float& item) override
+        {
+            uint32_t bits;
+            memcpy(&bits, &item, sizeof(bits));
+            mHash = mix(mHash, bits);
+        }
+
+        virtual void value(double& item) override
+        {
+            uint64_t bits;
+            memcpy(&bits, &item, sizeof(bits));
+            mHash = mix(mHash, bits);
+        }
+
+        virtual void value(std::string& item) override
+        {
+            mHash = mix(mHash, hashBytes(item.data(), item.size()));
+        }
+
+        virtual void value(Buffer& item) override
+        {
+            mHash = mix(mHash, hashBytes(item.data(), item.size()));
+        }
+
+        virtual void value(TrackedBuffer& item) override
+        {
+            // Buffers are matched to their cached page hashes by the order they come in
+            if (mBufferIndex >= mBuffers->size())
+                mBuffers->resize(mBufferIndex + 1);
+            auto& cache = (*mBuffers)[mBufferIndex++];
+            size_t size = item.size();
+            size_t pageCount = item.getPageCount();
+            bool all = (cache.buffer != &item) || (cache.size != size);
+            cache.buffer = &item;
+            cache.size = size;
+            cache.hashes.resize(pageCount);
+
+            for (size_t page = 0; page < pageCount; ++page)
+            {
+                if (all || item.isDirty(page, TrackedBuffer::TRACK_HASH))
+                {
+                    size_t offset = page << TrackedBuffer::PAGE_SIZE_LOG2;
+                    cache.hashes[page] = hashBytes(item.data() + offset, std::min<size_t>(TrackedBuffer::PAGE_SIZE, size - offset));
+                }
+            }
+            item.clearDirty(TrackedBuffer::TRACK_HASH);
+
+            mHash = mix(mHash, size);
+            mHash = mix(mHash, hashBytes(cache.hashes.data(), pageCount * sizeof(uint64_t)));
+        }
+
+        virtual bool nodeBegin(const char* name) override
+        {
+            EMU_UNUSED(name);
+            return true;
+        }
+
+        virtual void nodeEnd() override
+        {
+        }
+
+        virtual bool sequenceBegin(size_t& size) override
+        {
+            mHash = mix(mHash, size);
+            return true;
+        }
+
+        virtual void sequenceEnd() override
+        {
+        }
+
+        virtual void sequenceItem() override
+        {
+        }
+
+        virtual bool rawValues(void* data, size_t size) override
+        {
+            mHash = mix(mHash, hashBytes(data, size));
+            return true;
+        }
+
+    private:
+        std::vector<PageHashes>*    mBuffers;
+        size_t                      mBufferIndex;
+        uint64_t                    mHash;
+    };
+
+    StateHasher::StateHasher()
+    {
+    }
+
+    void StateHasher::clear()
+    {
+        mBuffers.clear();
+    }
+
+    bool StateHasher::compute(IContext& context, uint64_t& hash)
+    {
+        Writer writer(mBuffers);
+        EMU_VERIFY(context.serializeGameState(writer));
+        hash = writer.getHash();
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+
+    StateHashLog::StateHashLog()
+        : mFrame(0)
+        , mFirstMismatch(INVALID_FRAME)
+    {
+    }
+
+    void StateHashLog::clear()
+    {
+        mHashes.clear();
+        mFrame = 0;
+        mFirstMismatch = INVALID_FRAME;
+    }
+
+    bool StateHashLog::load(const char* path)
+    {
+        clear();
+        FileStream stream(path, "rb");
+        if (!stream.valid())
+            return false;
+
+        StateHashData data;
+        BinaryReader reader(stream);
+        data.serialize(reader);
+        EMU_VERIFY(reader.success());
+        mHashes.swap(data.hashes);
+        return true;
+    }
+
+    bool StateHashLog::save(const char* path)
+    {
+        FileStream stream(path, "wb");
+        if (!stream.valid())
+            return false;
+
+        StateHashData data;
+        data.hashes = mHashes;
+        BinaryWriter writer(stream);
+        data.serialize(writer);
+        return writer.success();
+    }
+
+    void StateHashLog::record(uint64_t hash)
+    {
+        mHashes.push_back(hash);
+        ++mFrame;
+    }
+
+    bool StateHashLog::verify(uint64_t hash)
+    {
+        uint32_t frame = mFrame++;
+        if ((frame >= mHashes.size()) || (mHashes[frame] == hash))
+            return true;
+        if (mFirstMismatch == INVALID_FRAME)
+            mFirstMismatch = frame;
+        return false;
+    }
+}
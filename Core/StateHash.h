@@ -0,0 +1,73 @@
+#ifndef __STATE_HASH_H__
+#define __STATE_HASH_H__
+
+#include "Core.h"
+#include <vector>
+
+namespace emu
+{
+    class IContext;
+    class TrackedBuffer;
+
+    // 64 bit hash of a game state kept up to date from one call to the next. The pages of tracked buffers are only hashed
+    // again when they were written since the previous call, the registers and other values are hashed every time.
+    // Contexts in the same state give the same hash on the same build, which is cheap enough to compare every frame.
+    class StateHasher
+    {
+    public:
+        StateHasher();
+        void clear();
+        bool compute(IContext& context, uint64_t& hash);
+
+    private:
+        class Writer;
+
+        struct PageHashes
+        {
+            const TrackedBuffer*    buffer;
+            size_t                  size;
+            std::vector<uint64_t>   hashes;
+        };
+
+        std::vector<PageHashes>     mBuffers;
+    };
+
+    // State hash of each frame of an input recording, saved next to it. A replay of the recording checks its own hashes
+    // against these ones to find the first frame where it diverges.
+    class StateHashLog
+    {
+    public:
+        static const uint32_t INVALID_FRAME = UINT32_MAX;
+
+        StateHashLog();
+        void clear();
+        bool load(const char* path);
+        bool save(const char* path);
+        void record(uint64_t hash);
+
+        // Compares the hash of the next frame to the recorded one, frames past the end of the recording always match.
+        bool verify(uint64_t hash);
+
+        uint32_t getFrame() const
+        {
+            return mFrame;
+        }
+
+        uint32_t getFirstMismatch() const
+        {
+            return mFirstMismatch;
+        }
+
+        uint64_t getRecordedHash(uint32_t frame) const
+        {
+            return frame < mHashes.size() ? mHashes[frame] : 0;
+        }
+
+    private:
+        std::vector<uint64_t>   mHashes;
+        uint32_t                mFrame;
+        uint32_t                mFirstMismatch;
+    };
+}
+
+#endif
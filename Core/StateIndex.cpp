@@ -0,0 +1,590 @@
+#include "StateIndex.h"
+#include "Stream.h"
+#include <algorithm>
+
+namespace
+{
+    static const uint32_t STATE_INDEX_TAG = 0x49534d45; // "EMSI"
+    static const uint32_t STATE_INDEX_VERSION = 1;
+    static const size_t PAYLOAD_ALIGNMENT = 8;
+    static const uint32_t FNV_OFFSET_BASIS = 0x811c9dc5;
+    static const uint32_t FNV_PRIME = 0x01000193;
+
+    struct Header
+    {
+        uint32_t    tag;
+        uint32_t    version;
+        uint32_t    fieldCount;
+        uint32_t    slotCount;
+        uint32_t    pathSize;
+        uint32_t    payloadSize;
+    };
+
+    uint32_t hashPath(const char* path)
+    {
+        uint32_t value = FNV_OFFSET_BASIS;
+        while (*path)
+            value = (value ^ static_cast<uint8_t>(*path++)) * FNV_PRIME;
+        return value;
+    }
+
+    // Repeated paths, values written without a node of their own, get a suffix counting them
+    std::string getUniquePath(const std::string& path, uint32_t index)
+    {
+        return index ? path + "#" + std::to_string(index) : path;
+    }
+
+    void appendIndex(std::string& path, uint32_t index)
+    {
+        if (!path.empty())
+            path += '/';
+        path += std::to_string(index);
+    }
+}
+
+namespace emu
+{
+    StateIndex::StateIndex()
+    {
+        close();
+    }
+
+    bool StateIndex::open(const void* data, size_t size)
+    {
+        close();
+        EMU_VERIFY(data && (size >= sizeof(Header)));
+
+        Header header;
+        memcpy(&header, data, sizeof(header));
+        EMU_VERIFY(header.tag == STATE_INDEX_TAG);
+        EMU_VERIFY(header.version == STATE_INDEX_VERSION);
+        EMU_VERIFY(header.slotCount && !(header.slotCount & (header.slotCount - 1)));
+
+        auto bytes = static_cast<const uint8_t*>(data);
+        size_t fieldsPos = sizeof(Header);
+        size_t slotsPos = fieldsPos + size_t(header.fieldCount) * sizeof(Field);
+        size_t pathsPos = slotsPos + size_t(header.slotCount) * sizeof(uint32_t);
+        size_t payloadPos = pathsPos + header.pathSize;
+        EMU_VERIFY(payloadPos + header.payloadSize <= size);
+        EMU_VERIFY(!header.pathSize || !bytes[payloadPos - 1]);
+
+        auto fields = reinterpret_cast<const Field*>(bytes + fieldsPos);
+        for (uint32_t index = 0; index < header.fieldCount; ++index)
+        {
+            const auto& field = fields[index];
+            EMU_VERIFY(field.path < header.pathSize);
+            EMU_VERIFY((field.offset <= header.payloadSize) && (field.size <= header.payloadSize - field.offset));
+        }
+
+        mFields = fields;
+        mSlots = reinterpret_cast<const uint32_t*>(bytes + slotsPos);
+        mPaths = reinterpret_cast<const char*>(bytes + pathsPos);
+        mPayload = bytes + payloadPos;
+        mFieldCount = header.fieldCount;
+        mSlotCount = header.slotCount;
+        mPathSize = header.pathSize;
+        mPayloadSize = header.payloadSize;
+        return true;
+    }
+
+    void StateIndex::close()
+    {
+        mFields = nullptr;
+        mSlots = nullptr;
+        mPaths = nullptr;
+        mPayload = nullptr;
+        mFieldCount = 0;
+        mSlotCount = 0;
+        mPathSize = 0;
+        mPayloadSize = 0;
+    }
+
+    const StateIndex::Field* StateIndex::find(const char* path) const
+    {
+        if (!mSlotCount)
+            return nullptr;
+
+        size_t mask = mSlotCount - 1;
+        size_t slot = hashPath(path) & mask;
+        for (size_t probe = 0; probe < mSlotCount; ++probe)
+        {
+            uint32_t entry = mSlots[slot];
+            if (!entry)
+                break;
+            if ((entry <= mFieldCount) && !strcmp(getPath(mFields[entry - 1]), path))
+                return &mFields[entry - 1];
+            slot = (slot + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    const char* StateIndex::getPath(const Field& field) const
+    {
+        return mPaths + field.path;
+    }
+
+    const void* StateIndex::getData(const Field& field) const
+    {
+        return mPayload + field.offset;
+    }
+
+    void StateIndex::diff(const StateIndex& first, const StateIndex& second, std::vector<Difference>& differences)
+    {
+        differences.clear();
+        for (size_t index = 0; index < first.mFieldCount; ++index)
+        {
+            const auto& field = first.mFields[index];
+            auto path = first.getPath(field);
+            auto other = second.find(path);
+            if (!other)
+            {
+                differences.push_back({ path, 0 });
+                continue;
+            }
+
+            auto data = static_cast<const uint8_t*>(first.getData(field));
+            auto otherData = static_cast<const uint8_t*>(second.getData(*other));
+            size_t size = std::min(field.size, other->size);
+            size_t offset = std::mismatch(data, data + size, otherData).first - data;
+            if ((offset < size) || (field.size != other->size) || (field.count != other->count) || (field.type != other->type))
+                differences.push_back({ path, offset });
+        }
+
+        for (size_t index = 0; index < second.mFieldCount; ++index)
+        {
+            auto path = second.getPath(second.mFields[index]);
+            if (!first.find(path))
+                differences.push_back({ path, 0 });
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    IndexedWriter::IndexedWriter()
+    {
+    }
+
+    void IndexedWriter::clear()
+    {
+        mPath.clear();
+        mNodes.clear();
+        mSequences.clear();
+        mFields.clear();
+        mFieldIndices.clear();
+        mPaths.clear();
+        mPayload.clear();
+    }
+
+    bool IndexedWriter::write(IStream& stream) const
+    {
+        EMU_VERIFY(mNodes.empty() && mSequences.empty());
+
+        // Half full table, a missing path is found after a few probes at most
+        uint32_t slotCount = 1;
+        while (slotCount < mFields.size() * 2)
+            slotCount <<= 1;
+        std::vector<uint32_t> slots(slotCount, 0);
+        for (size_t index = 0; index < mFields.size(); ++index)
+        {
+            uint32_t slot = hashPath(&mPaths[mFields[index].path]) & (slotCount - 1);
+            while (slots[slot])
+                slot = (slot + 1) & (slotCount - 1);
+            slots[slot] = static_cast<uint32_t>(index + 1);
+        }
+
+        // The payload starts aligned so a mapped file can be read in place
+        size_t headerSize = sizeof(Header) + mFields.size() * sizeof(StateIndex::Field) + slots.size() * sizeof(uint32_t);
+        size_t pathSize = mPaths.size();
+        while ((headerSize + pathSize) % PAYLOAD_ALIGNMENT)
+            ++pathSize;
+        std::string paths(mPaths);
+        paths.resize(pathSize, '\0');
+
+        Header header;
+        header.tag = STATE_INDEX_TAG;
+        header.version = STATE_INDEX_VERSION;
+        header.fieldCount = static_cast<uint32_t>(mFields.size());
+        header.slotCount = slotCount;
+        header.pathSize = static_cast<uint32_t>(pathSize);
+        header.payloadSize = static_cast<uint32_t>(mPayload.size());
+
+        EMU_VERIFY(stream.write(&header, sizeof(header)));
+        if (!mFields.empty())
+            EMU_VERIFY(stream.write(mFields.data(), mFields.size() * sizeof(StateIndex::Field)));
+        EMU_VERIFY(stream.write(slots.data(), slots.size() * sizeof(uint32_t)));
+        if (!paths.empty())
+            EMU_VERIFY(stream.write(paths.data(), paths.size()));
+        if (!mPayload.empty())
+            EMU_VERIFY(stream.write(mPayload.data(), mPayload.size()));
+        return true;
+    }
+
+    bool IndexedWriter::success() const
+    {
+        return true;
+    }
+
+    bool IndexedWriter::isWriting() const
+    {
+        return true;
+    }
+
+    void IndexedWriter::value(bool& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(char& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(int8_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(uint8_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(int16_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(uint16_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(int32_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(uint32_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(int64_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(uint64_t& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(float& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(double& item)
+    {
+        addField(StateIndex::FieldType::Value, &item, sizeof(item), 1);
+    }
+
+    void IndexedWriter::value(std::string& item)
+    {
+        addField(StateIndex::FieldType::String, item.data(), item.size(), 1);
+    }
+
+    void IndexedWriter::value(Buffer& item)
+    {
+        addField(StateIndex::FieldType::Buffer, item.data(), item.size(), 1);
+    }
+
+    bool IndexedWriter::nodeBegin(const char* name)
+    {
+        mNodes.push_back(mPath.size());
+        if (!mPath.empty())
+            mPath += '/';
+        mPath += name;
+        return true;
+    }
+
+    void IndexedWriter::nodeEnd()
+    {
+        EMU_ASSERT(!mNodes.empty());
+        mPath.resize(mNodes.back());
+        mNodes.pop_back();
+    }
+
+    bool IndexedWriter::sequenceBegin(size_t& size)
+    {
+        // The field is added once it is known whether the values come at once or one item at a time
+        Sequence sequence;
+        sequence.pathLength = mPath.size();
+        sequence.count = static_cast<uint32_t>(size);
+        sequence.item = 0;
+        sequence.pending = true;
+        mSequences.push_back(sequence);
+        return true;
+    }
+
+    void IndexedWriter::sequenceEnd()
+    {
+        EMU_ASSERT(!mSequences.empty());
+        addPendingSequence();
+        mPath.resize(mSequences.back().pathLength);
+        mSequences.pop_back();
+    }
+
+    void IndexedWriter::sequenceItem()
+    {
+        EMU_ASSERT(!mSequences.empty());
+        addPendingSequence();
+        auto& sequence = mSequences.back();
+        mPath.resize(sequence.pathLength);
+        appendIndex(mPath, sequence.item++);
+    }
+
+    bool IndexedWriter::rawValues(void* data, size_t size)
+    {
+        EMU_ASSERT(!mSequences.empty() && mSequences.back().pending);
+        auto& sequence = mSequences.back();
+        sequence.pending = false;
+        addField(StateIndex::FieldType::Raw, data, size, sequence.count);
+        return true;
+    }
+
+    void IndexedWriter::addField(StateIndex::FieldType type, const void* data, size_t size, uint32_t count)
+    {
+        std::string path;
+        for (uint32_t index = 0; ; ++index)
+        {
+            path = getUniquePath(mPath, index);
+            if (mFieldIndices.find(path) == mFieldIndices.end())
+                break;
+        }
+        mFieldIndices[path] = static_cast<uint32_t>(mFields.size());
+
+        StateIndex::Field field;
+        field.path = static_cast<uint32_t>(mPaths.size());
+        field.offset = static_cast<uint32_t>(mPayload.size());
+        field.size = static_cast<uint32_t>(size);
+        field.count = count;
+        field.type = type;
+        mFields.push_back(field);
+
+        mPaths.append(path.c_str(), path.size() + 1);
+        if (size)
+        {
+            auto bytes = static_cast<const uint8_t*>(data);
+            mPayload.insert(mPayload.end(), bytes, bytes + size);
+        }
+    }
+
+    void IndexedWriter::addPendingSequence()
+    {
+        auto& sequence = mSequences.back();
+        if (!sequence.pending)
+            return;
+
+        sequence.pending = false;
+        addField(StateIndex::FieldType::Sequence, nullptr, 0, sequence.count);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    IndexedReader::IndexedReader(const StateIndex& index)
+        : mIndex(&index)
+        , mMissingCount(0)
+        , mSuccess(false)
+    {
+    }
+
+    size_t IndexedReader::getMissingCount() const
+    {
+        return mMissingCount;
+    }
+
+    bool IndexedReader::success() const
+    {
+        return mSuccess;
+    }
+
+    bool IndexedReader::isWriting() const
+    {
+        return false;
+    }
+
+    void IndexedReader::value(bool& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(char& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(int8_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(uint8_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(int16_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(uint16_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(int32_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(uint32_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(int64_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(uint64_t& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(float& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(double& item)
+    {
+        readValue(&item, sizeof(item));
+    }
+
+    void IndexedReader::value(std::string& item)
+    {
+        auto field = findField();
+        if (!field || (field->type != StateIndex::FieldType::String))
+        {
+            ++mMissingCount;
+            return;
+        }
+        item.assign(static_cast<const char*>(mIndex->getData(*field)), field->size);
+        mSuccess = true;
+    }
+
+    void IndexedReader::value(Buffer& item)
+    {
+        auto field = findField();
+        if (!field || (field->type != StateIndex::FieldType::Buffer))
+        {
+            ++mMissingCount;
+            return;
+        }
+        item.resize(field->size);
+        if (field->size)
+            memcpy(item.data(), mIndex->getData(*field), field->size);
+        mSuccess = true;
+    }
+
+    bool IndexedReader::nodeBegin(const char* name)
+    {
+        mNodes.push_back(mPath.size());
+        if (!mPath.empty())
+            mPath += '/';
+        mPath += name;
+        return true;
+    }
+
+    void IndexedReader::nodeEnd()
+    {
+        EMU_ASSERT(!mNodes.empty());
+        mPath.resize(mNodes.back());
+        mNodes.pop_back();
+    }
+
+    bool IndexedReader::sequenceBegin(size_t& size)
+    {
+        auto field = findField();
+        if (!field || ((field->type != StateIndex::FieldType::Raw) && (field->type != StateIndex::FieldType::Sequence)))
+        {
+            ++mMissingCount;
+            size = 0;
+            return false;
+        }
+
+        Sequence sequence;
+        sequence.pathLength = mPath.size();
+        sequence.item = 0;
+        sequence.field = field;
+        mSequences.push_back(sequence);
+        size = field->count;
+        return true;
+    }
+
+    void IndexedReader::sequenceEnd()
+    {
+        EMU_ASSERT(!mSequences.empty());
+        mPath.resize(mSequences.back().pathLength);
+        mSequences.pop_back();
+    }
+
+    void IndexedReader::sequenceItem()
+    {
+        EMU_ASSERT(!mSequences.empty());
+        auto& sequence = mSequences.back();
+        mPath.resize(sequence.pathLength);
+        appendIndex(mPath, sequence.item++);
+    }
+
+    bool IndexedReader::rawValues(void* data, size_t size)
+    {
+        // Sequences written one item at a time are read the same way
+        EMU_ASSERT(!mSequences.empty());
+        auto field = mSequences.back().field;
+        if (field->type != StateIndex::FieldType::Raw)
+            return false;
+
+        if (field->size != size)
+            ++mMissingCount;
+        else if (size)
+        {
+            memcpy(data, mIndex->getData(*field), size);
+            mSuccess = true;
+        }
+        return true;
+    }
+
+    const StateIndex::Field* IndexedReader::findField()
+    {
+        uint32_t index = mVisits[mPath]++;
+        if (!index)
+            return mIndex->find(mPath.c_str());
+        return mIndex->find(getUniquePath(mPath, index).c_str());
+    }
+
+    void IndexedReader::readValue(void* data, size_t size)
+    {
+        auto field = findField();
+        if (!field || (field->type != StateIndex::FieldType::Value) || (field->size != size))
+        {
+            ++mMissingCount;
+            return;
+        }
+        memcpy(data, mIndex->getData(*field), size);
+        mSuccess = true;
+    }
+}
@@ -0,0 +1,189 @@
+#ifndef __STATE_INDEX_H__
+#define __STATE_INDEX_H__
+
+#include "Core.h"
+#include "Serializer.h"
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace emu
+{
+    class IStream;
+
+    // Read only view of an indexed state: a table of fields named by their node path ("Cpu/Registers/A", "Sprites/3/X")
+    // followed by the payload. Fields are found through a hash table stored with them, so a mapped file can be queried
+    // without parsing it. The memory is not copied and must outlive the index.
+    class StateIndex
+    {
+    public:
+        enum class FieldType : uint32_t
+        {
+            Value,
+            String,
+            Buffer,
+            Raw,
+            Sequence,
+        };
+
+        struct Field
+        {
+            uint32_t    path;
+            uint32_t    offset;
+            uint32_t    size;
+            uint32_t    count;
+            FieldType   type;
+        };
+
+        struct Difference
+        {
+            std::string path;
+            size_t      offset;
+        };
+
+        StateIndex();
+        bool open(const void* data, size_t size);
+        void close();
+        const Field* find(const char* path) const;
+        const char* getPath(const Field& field) const;
+        const void* getData(const Field& field) const;
+
+        // Lists the fields that differ, with the first byte that does, or that only one of the states has.
+        static void diff(const StateIndex& first, const StateIndex& second, std::vector<Difference>& differences);
+
+        template <typename T>
+        bool get(const char* path, T& value) const
+        {
+            static_assert(std::is_arithmetic<T>::value, "Only single values can be read");
+            auto field = find(path);
+            if (!field || (field->type != FieldType::Value) || (field->size != sizeof(T)))
+                return false;
+            memcpy(&value, getData(*field), sizeof(T));
+            return true;
+        }
+
+        size_t getFieldCount() const
+        {
+            return mFieldCount;
+        }
+
+        const Field& getField(size_t index) const
+        {
+            EMU_ASSERT(index < mFieldCount);
+            return mFields[index];
+        }
+
+    private:
+        const Field*            mFields;
+        const uint32_t*         mSlots;
+        const char*             mPaths;
+        const uint8_t*          mPayload;
+        size_t                  mFieldCount;
+        size_t                  mSlotCount;
+        size_t                  mPathSize;
+        size_t                  mPayloadSize;
+    };
+
+    // Builds an indexed state from the node names given by the serialized objects.
+    class IndexedWriter : public ISerializer
+    {
+    public:
+        IndexedWriter();
+        void clear();
+        bool write(IStream& stream) const;
+        virtual bool success() const override;
+        virtual bool isWriting() const override;
+        virtual void value(bool& item) override;
+        virtual void value(char& item) override;
+        virtual void value(int8_t& item) override;
+        virtual void value(uint8_t& item) override;
+        virtual void value(int16_t& item) override;
+        virtual void value(uint16_t& item) override;
+        virtual void value(int32_t& item) override;
+        virtual void value(uint32_t& item) override;
+        virtual void value(int64_t& item) override;
+        virtual void value(uint64_t& item) override;
+        virtual void value(float& item) override;
+        virtual void value(double& item) override;
+        virtual void value(std::string& item) override;
+        virtual void value(Buffer& item) override;
+        virtual bool nodeBegin(const char* name) override;
+        virtual void nodeEnd() override;
+        virtual bool sequenceBegin(size_t& size) override;
+        virtual void sequenceEnd() override;
+        virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
+
+    private:
+        struct Sequence
+        {
+            size_t      pathLength;
+            uint32_t    count;
+            uint32_t    item;
+            bool        pending;
+        };
+
+        void addField(StateIndex::FieldType type, const void* data, size_t size, uint32_t count);
+        void addPendingSequence();
+
+        std::string                                 mPath;
+        std::vector<size_t>                         mNodes;
+        std::vector<Sequence>                       mSequences;
+        std::vector<StateIndex::Field>              mFields;
+        std::unordered_map<std::string, uint32_t>   mFieldIndices;
+        std::string                                 mPaths;
+        std::vector<uint8_t>                        mPayload;
+    };
+
+    // Loads an indexed state by path, values missing from it are left unchanged and counted.
+    class IndexedReader : public ISerializer
+    {
+    public:
+        IndexedReader(const StateIndex& index);
+        size_t getMissingCount() const;
+        virtual bool success() const override;
+        virtual bool isWriting() const override;
+        virtual void value(bool& item) override;
+        virtual void value(char& item) override;
+        virtual void value(int8_t& item) override;
+        virtual void value(uint8_t& item) override;
+        virtual void value(int16_t& item) override;
+        virtual void value(uint16_t& item) override;
+        virtual void value(int32_t& item) override;
+        virtual void value(uint32_t& item) override;
+        virtual void value(int64_t& item) override;
+        virtual void value(uint64_t& item) override;
+        virtual void value(float& item) override;
+        virtual void value(double& item) override;
+        virtual void value(std::string& item) override;
+        virtual void value(Buffer& item) override;
+        virtual bool nodeBegin(const char* name) override;
+        virtual void nodeEnd() override;
+        virtual bool sequenceBegin(size_t& size) override;
+        virtual void sequenceEnd() override;
+        virtual void sequenceItem() override;
+        virtual bool rawValues(void* data, size_t size) override;
+
+    private:
+        struct Sequence
+        {
+            size_t                      pathLength;
+            uint32_t                    item;
+            const StateIndex::Field*    field;
+        };
+
+        const StateIndex::Field* findField();
+        void readValue(void* data, size_t size);
+
+        const StateIndex*                           mIndex;
+        std::string                                 mPath;
+        std::vector<size_t>                         mNodes;
+        std::vector<Sequence>                       mSequences;
+        std::unordered_map<std::string, uint32_t>   mVisits;
+        size_t                                      mMissingCount;
+        bool                                        mSuccess;
+    };
+}
+
+#endif
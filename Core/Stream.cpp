@@ -1,6 +1,206 @@
 #include "Stream.h"
+#include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    static const uint32_t COMPRESSED_STREAM_TAG = 0x315a4d45; // "EMZ1"
+    static const size_t BLOCK_SIZE = 64 * 1024;
+    static const size_t HISTORY_SIZE = 64 * 1024;
+    static const size_t MAX_OFFSET = 65535;
+    static const uint32_t HASH_LOG2 = 14;
+    static const size_t MIN_MATCH = 4;
+    static const size_t MATCH_FIND_LIMIT = 12;
+    static const size_t LAST_LITERALS = 5;
+    static const uint32_t SKIP_TRIGGER = 6;
+    static const size_t WILD_COPY_SIZE = 8;
+
+    uint32_t read32(const uint8_t* src)
+    {
+        uint32_t value;
+        memcpy(&value, src, sizeof(value));
+        return value;
+    }
+
+    uint32_t hash(uint32_t value)
+    {
+        return (value * 2654435761u) >> (32 - HASH_LOG2);
+    }
+
+    uint32_t countTrailingZeros(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+
+    size_t countMatch(const uint8_t* src, const uint8_t* ref, const uint8_t* limit)
+    {
+        const uint8_t* start = src;
+        while (src + 4 <= limit)
+        {
+            uint32_t diff = read32(src) ^ read32(ref);
+            if (diff)
+                return (src - start) + (countTrailingZeros(diff) >> 3);
+            src += 4;
+            ref += 4;
+        }
+        while ((src < limit) && (*src == *ref))
+        {
+            ++src;
+            ++ref;
+        }
+        return src - start;
+    }
+
+    size_t getCompressBound(size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    uint8_t* writeLength(uint8_t* dest, size_t length)
+    {
+        while (length >= 255)
+        {
+            *dest++ = 255;
+            length -= 255;
+        }
+        *dest++ = static_cast<uint8_t>(length);
+        return dest;
+    }
+
+    uint8_t* writeSequence(uint8_t* dest, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength)
+    {
+        uint8_t* token = dest++;
+        *token = static_cast<uint8_t>(std::min<size_t>(literalCount, 15) << 4);
+        if (literalCount >= 15)
+            dest = writeLength(dest, literalCount - 15);
+        memcpy(dest, literals, literalCount);
+        dest += literalCount;
+        if (!matchLength)
+            return dest;
+
+        *dest++ = static_cast<uint8_t>(offset);
+        *dest++ = static_cast<uint8_t>(offset >> 8);
+        matchLength -= MIN_MATCH;
+        *token |= static_cast<uint8_t>(std::min<size_t>(matchLength, 15));
+        if (matchLength >= 15)
+            dest = writeLength(dest, matchLength - 15);
+        return dest;
+    }
+
+    // Compresses base[start, end), matches may start anywhere in the window before it.
+    size_t compressBlock(const uint8_t* base, size_t start, size_t end, uint32_t* hashTable, uint8_t* dest)
+    {
+        uint8_t* output = dest;
+        size_t pos = start;
+        size_t anchor = start;
+        if (end - start > MATCH_FIND_LIMIT)
+        {
+            size_t limit = end - MATCH_FIND_LIMIT;
+            const uint8_t* matchLimit = base + end - LAST_LITERALS;
+            uint32_t searchCount = 1 << SKIP_TRIGGER;
+            while (pos < limit)
+            {
+                // Incompressible data is skipped at an increasing pace
+                uint32_t value = read32(base + pos);
+                uint32_t& entry = hashTable[hash(value)];
+                size_t ref = entry;
+                entry = static_cast<uint32_t>(pos);
+                if ((ref >= pos) || (pos - ref > MAX_OFFSET) || (read32(base + ref) != value))
+                {
+                    pos += searchCount++ >> SKIP_TRIGGER;
+                    continue;
+                }
+                searchCount = 1 << SKIP_TRIGGER;
+
+                while ((pos > anchor) && (ref > 0) && (base[pos - 1] == base[ref - 1]))
+                {
+                    --pos;
+                    --ref;
+                }
+
+                size_t length = MIN_MATCH + countMatch(base + pos + MIN_MATCH, base + ref + MIN_MATCH, matchLimit);
+                output = writeSequence(output, base + anchor, pos - anchor, pos - ref, length);
+                pos += length;
+                anchor = pos;
+                if (pos < limit)
+                    hashTable[hash(read32(base + pos - 2))] = static_cast<uint32_t>(pos - 2);
+            }
+        }
+        output = writeSequence(output, base + anchor, end - anchor, 0, 0);
+        return output - dest;
+    }
+
+    size_t readLength(const uint8_t*& src, const uint8_t* srcEnd, size_t length)
+    {
+        if (length != 15)
+            return length;
+        while (src < srcEnd)
+        {
+            uint8_t value = *src++;
+            length += value;
+            if (value != 255)
+                return length;
+        }
+        return SIZE_MAX;
+    }
+
+    // Expands into base[start, end), the window before start must hold the history used by the compressor.
+    bool decompressBlock(const uint8_t* src, size_t size, uint8_t* base, size_t start, size_t end)
+    {
+        const uint8_t* srcEnd = src + size;
+        uint8_t* dest = base + start;
+        uint8_t* destEnd = base + end;
+        while (src < srcEnd)
+        {
+            uint8_t token = *src++;
+            size_t literalCount = readLength(src, srcEnd, token >> 4);
+            if ((literalCount > static_cast<size_t>(srcEnd - src)) || (literalCount > static_cast<size_t>(destEnd - dest)))
+                return false;
+            memcpy(dest, src, literalCount);
+            src += literalCount;
+            dest += literalCount;
+            if (src == srcEnd)
+                break;
+
+            if (srcEnd - src < 2)
+                return false;
+            size_t offset = src[0] | (src[1] << 8);
+            src += 2;
+            size_t length = readLength(src, srcEnd, token & 15);
+            if (length == SIZE_MAX)
+                return false;
+            length += MIN_MATCH;
+            if (!offset || (offset > static_cast<size_t>(dest - base)) || (length > static_cast<size_t>(destEnd - dest)))
+                return false;
+
+            // Short offsets repeat a pattern and must be copied one byte at a time
+            const uint8_t* ref = dest - offset;
+            if (offset >= WILD_COPY_SIZE)
+            {
+                for (size_t pos = 0; pos < length; pos += WILD_COPY_SIZE)
+                    memcpy(dest + pos, ref + pos, WILD_COPY_SIZE);
+            }
+            else
+            {
+                for (size_t pos = 0; pos < length; ++pos)
+                    dest[pos] = ref[pos];
+            }
+            dest += length;
+        }
+        return dest == destEnd;
+    }
+}
 
 namespace emu
 {
@@ -213,4 +413,171 @@ namespace emu
             mFile = nullptr;
         }
     }
-}
\ No newline at end of file
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    CompressedStream::CompressedStream(IStream& stream)
+        : mStream(&stream)
+        , mMode(Mode::None)
+        , mHistorySize(0)
+        , mBlockSize(0)
+        , mBlockPos(0)
+        , mSuccess(true)
+    {
+        mWindow.resize(HISTORY_SIZE + BLOCK_SIZE + WILD_COPY_SIZE, 0);
+    }
+
+    CompressedStream::~CompressedStream()
+    {
+        flush();
+    }
+
+    void CompressedStream::setDictionary(const void* data, size_t size)
+    {
+        EMU_ASSERT(mMode == Mode::None);
+        size_t count = std::min(size, HISTORY_SIZE);
+        memcpy(&mWindow[0], static_cast<const uint8_t*>(data) + size - count, count);
+        mHistorySize = count;
+
+        mHashTable.assign(size_t(1) << HASH_LOG2, 0);
+        for (size_t pos = 0; pos + sizeof(uint32_t) <= count; ++pos)
+            mHashTable[hash(read32(&mWindow[pos]))] = static_cast<uint32_t>(pos);
+    }
+
+    bool CompressedStream::flush()
+    {
+        if (mMode == Mode::Write)
+            writeBlock();
+        return mSuccess;
+    }
+
+    bool CompressedStream::read(void* data, size_t size)
+    {
+        if (mMode == Mode::None)
+        {
+            uint32_t tag = 0;
+            if (!mStream->read(&tag, sizeof(tag)))
+                mSuccess = false;
+            else if (tag == COMPRESSED_STREAM_TAG)
+                mMode = Mode::Read;
+            else
+            {
+                memcpy(&mWindow[mHistorySize], &tag, sizeof(tag));
+                mBlockSize = sizeof(tag);
+                mMode = Mode::Raw;
+            }
+        }
+        EMU_ASSERT(mMode != Mode::Write);
+
+        uint8_t* dest = static_cast<uint8_t*>(data);
+        while (size && mSuccess)
+        {
+            if (mBlockPos == mBlockSize)
+            {
+                if (mMode == Mode::Raw)
+                    return mStream->read(dest, size);
+                if (!readBlock())
+                    break;
+            }
+            size_t count = std::min(size, mBlockSize - mBlockPos);
+            memcpy(dest, &mWindow[mHistorySize + mBlockPos], count);
+            mBlockPos += count;
+            dest += count;
+            size -= count;
+        }
+        if (size)
+            memset(dest, 0, size);
+        return mSuccess;
+    }
+
+    bool CompressedStream::write(const void* data, size_t size)
+    {
+        if (mMode == Mode::None)
+        {
+            if (mHashTable.empty())
+                mHashTable.assign(size_t(1) << HASH_LOG2, 0);
+            if (!mStream->write(&COMPRESSED_STREAM_TAG, sizeof(COMPRESSED_STREAM_TAG)))
+                mSuccess = false;
+            mMode = Mode::Write;
+        }
+        EMU_ASSERT(mMode == Mode::Write);
+
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        while (size)
+        {
+            size_t count = std::min(size, BLOCK_SIZE - mBlockSize);
+            memcpy(&mWindow[mHistorySize + mBlockSize], src, count);
+            mBlockSize += count;
+            src += count;
+            size -= count;
+            if (mBlockSize == BLOCK_SIZE)
+                writeBlock();
+        }
+        return mSuccess;
+    }
+
+    bool CompressedStream::writeBlock()
+    {
+        if (!mBlockSize)
+            return mSuccess;
+
+        // Blocks that do not shrink are stored as is, the sizes are then equal
+        mPacked.resize(getCompressBound(BLOCK_SIZE));
+        uint32_t rawSize = static_cast<uint32_t>(mBlockSize);
+        uint32_t packedSize = static_cast<uint32_t>(compressBlock(mWindow.data(), mHistorySize, mHistorySize + mBlockSize, mHashTable.data(), mPacked.data()));
+        const uint8_t* packed = mPacked.data();
+        if (packedSize >= rawSize)
+        {
+            packedSize = rawSize;
+            packed = &mWindow[mHistorySize];
+        }
+
+        if (!mStream->write(&rawSize, sizeof(rawSize)) ||
+            !mStream->write(&packedSize, sizeof(packedSize)) ||
+            !mStream->write(packed, packedSize))
+            mSuccess = false;
+        slide();
+        return mSuccess;
+    }
+
+    bool CompressedStream::readBlock()
+    {
+        slide();
+
+        uint32_t rawSize = 0;
+        uint32_t packedSize = 0;
+        if (!mStream->read(&rawSize, sizeof(rawSize)) || !mStream->read(&packedSize, sizeof(packedSize)))
+            mSuccess = false;
+        else if (!rawSize || (rawSize > BLOCK_SIZE) || (packedSize > rawSize))
+            mSuccess = false;
+        else if (packedSize == rawSize)
+            mSuccess = mStream->read(&mWindow[mHistorySize], rawSize);
+        else
+        {
+            mPacked.resize(packedSize);
+            mSuccess = mStream->read(mPacked.data(), packedSize) &&
+                decompressBlock(mPacked.data(), packedSize, mWindow.data(), mHistorySize, mHistorySize + rawSize);
+        }
+
+        mBlockSize = mSuccess ? rawSize : 0;
+        mBlockPos = 0;
+        return mSuccess;
+    }
+
+    void CompressedStream::slide()
+    {
+        // Keep the last 64 KB as history for the next block, the hash table follows the data
+        size_t total = mHistorySize + mBlockSize;
+        size_t count = std::min(total, HISTORY_SIZE);
+        size_t shift = total - count;
+        if (shift)
+        {
+            memmove(&mWindow[0], &mWindow[shift], count);
+            for (auto& entry : mHashTable)
+                entry = (entry > shift) ? static_cast<uint32_t>(entry - shift) : 0;
+        }
+        mHistorySize = count;
+        mBlockSize = 0;
+        mBlockPos = 0;
+    }
+}
@@ -68,6 +68,43 @@ namespace emu
 
         FILE*   mFile;
     };
+    // Compresses the data written through it into another stream, or expands it back when reading.
+    // Blocks use an LZ4 style byte format and may refer to the previous 64 KB of data, which both sides can prime with
+    // the same dictionary. Data read without the compression header is passed through unchanged.
+    class CompressedStream : public IStream
+    {
+    public:
+        CompressedStream(IStream& stream);
+        virtual ~CompressedStream();
+        void setDictionary(const void* data, size_t size);
+        bool flush();
+        virtual bool read(void* data, size_t size);
+        virtual bool write(const void* data, size_t size);
+
+    private:
+        enum class Mode
+        {
+            None,
+            Write,
+            Read,
+            Raw,
+        };
+
+        CompressedStream();
+        bool writeBlock();
+        bool readBlock();
+        void slide();
+
+        IStream*                mStream;
+        Mode                    mMode;
+        std::vector<uint8_t>    mWindow;
+        std::vector<uint8_t>    mPacked;
+        std::vector<uint32_t>   mHashTable;
+        size_t                  mHistorySize;
+        size_t                  mBlockSize;
+        size_t                  mBlockPos;
+        bool                    mSuccess;
+    };
 }
 
 #endif
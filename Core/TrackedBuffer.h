@@ -0,0 +1,80 @@
+#ifndef __TRACKED_BUFFER_H__
+#define __TRACKED_BUFFER_H__
+
+#include "Core.h"
+#include <vector>
+
+namespace emu
+{
+    // Buffer split in pages with a flag telling which ones were written since the flags were last cleared.
+    // Writes going through a memory bus access set the flags, code writing to the buffer directly calls markDirty().
+    // Each client of the flags owns a bit, so snapshots and state hashes clear theirs without hiding writes from the other.
+    class TrackedBuffer : public Buffer
+    {
+    public:
+        static const uint32_t PAGE_SIZE_LOG2 = 8;
+        static const uint32_t PAGE_SIZE = 1 << PAGE_SIZE_LOG2;
+
+        static const uint8_t TRACK_SNAPSHOT = 0x01;
+        static const uint8_t TRACK_HASH = 0x02;
+        static const uint8_t TRACK_ALL = 0xff;
+
+        void resize(size_t size, uint8_t value = 0)
+        {
+            Buffer::resize(size, value);
+            markAllDirty();
+        }
+
+        void clear()
+        {
+            Buffer::clear();
+            mDirty.clear();
+        }
+
+        size_t getPageCount() const
+        {
+            return (size() + PAGE_SIZE - 1) >> PAGE_SIZE_LOG2;
+        }
+
+        bool isDirty(size_t page, uint8_t tracks = TRACK_SNAPSHOT) const
+        {
+            return (mDirty[page] & tracks) != 0;
+        }
+
+        void markDirty(const uint8_t* address)
+        {
+            EMU_ASSERT((address >= data()) && (address < data() + size()));
+            mDirty[(address - data()) >> PAGE_SIZE_LOG2] = TRACK_ALL;
+        }
+
+        void markDirty(size_t offset, size_t count)
+        {
+            if (!count)
+                return;
+            EMU_ASSERT(offset + count <= size());
+            for (size_t page = offset >> PAGE_SIZE_LOG2; page <= ((offset + count - 1) >> PAGE_SIZE_LOG2); ++page)
+                mDirty[page] = TRACK_ALL;
+        }
+
+        // The size may have been changed through the base class, the flags follow it.
+        void markAllDirty()
+        {
+            mDirty.resize(getPageCount());
+            for (auto& flags : mDirty)
+                flags = TRACK_ALL;
+        }
+
+        void clearDirty(uint8_t tracks = TRACK_SNAPSHOT)
+        {
+            uint8_t mask = static_cast<uint8_t>(~tracks);
+            mDirty.resize(getPageCount());
+            for (auto& flags : mDirty)
+                flags &= mask;
+        }
+
+    private:
+        std::vector<uint8_t>    mDirty;
+    };
+}
+
+#endif
@@ -2,39 +2,222 @@
 #include "Base64.h"
 #include "Log.h"
 
-#pragma warning(push, 3)
-#include <yaml-cpp/yaml.h>
-#pragma warning(pop)
-
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
-#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
-#include <strstream>
+#include <type_traits>
 #include <vector>
 
+// Block style YAML as written by yaml-cpp: nested maps, sequences and scalars, one value per line.
+// The writer appends to the output as the values come, the reader indexes the lines once and walks that index.
 namespace
 {
-    class YamlReaderImpl : public emu::YamlReader
+    static const uint32_t INVALID_ENTRY = UINT32_MAX;
+    static const uint32_t REPLACEMENT_CHARACTER = 0xfffd;
+    static const char* PLAIN_START_INDICATORS = ",[]{}#&*!|>'\"%@`";
+
+    bool isBlankOrBreak(char value)
     {
-    public:
-        YamlReaderImpl()
-            : mSuccess(true)
+        return (value == ' ') || (value == '\t') || (value == '\n') || (value == '\r');
+    }
+
+    bool isNullScalar(const char* text, size_t size)
+    {
+        return ((size == 1) && (text[0] == '~')) ||
+            ((size == 4) && (!strncmp(text, "null", 4) || !strncmp(text, "Null", 4) || !strncmp(text, "NULL", 4)));
+    }
+
+    bool isNotPrintable(const uint8_t* text, size_t pos, size_t size)
+    {
+        uint8_t value = text[pos];
+        if ((value <= 0x08) || (value == 0x0b) || (value == 0x0c) || (value == 0x7f) || ((value >= 0x0e) && (value <= 0x1f)))
+            return true;
+        if ((value == 0xc2) && (pos + 1 < size))
         {
-            mContext.push_back(YAML::Node());
+            uint8_t next = text[pos + 1];
+            return ((next >= 0x80) && (next <= 0x84)) || ((next >= 0x86) && (next <= 0x9f));
         }
+        if ((value == 0xef) && (pos + 2 < size))
+            return (text[pos + 1] == 0xbb) && (text[pos + 2] == 0xbf);
+        return false;
+    }
 
-        void safeExecute(std::function<void()> func)
+    // Same rules as yaml-cpp so the files do not change when written again
+    bool isPlainScalar(const char* text, size_t size)
+    {
+        if (!size || isNullScalar(text, size))
+            return false;
+        if (isBlankOrBreak(text[0]) || strchr(PLAIN_START_INDICATORS, text[0]))
+            return false;
+        if (((text[0] == '-') || (text[0] == '?') || (text[0] == ':')) && ((size == 1) || isBlankOrBreak(text[1])))
+            return false;
+        if (text[size - 1] == ' ')
+            return false;
+
+        auto bytes = reinterpret_cast<const uint8_t*>(text);
+        for (size_t pos = 0; pos < size; ++pos)
         {
-            try
-            {
-                func();
-            }
-            catch (YAML::Exception except)
+            char value = text[pos];
+            if ((value == ':') && ((pos + 1 == size) || isBlankOrBreak(text[pos + 1])))
+                return false;
+            if (isBlankOrBreak(value) && (pos + 1 < size) && (text[pos + 1] == '#'))
+                return false;
+            if ((value == '\n') || (value == '\r') || (value == '\t') || isNotPrintable(bytes, pos, size))
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t readCodePoint(const uint8_t*& text, const uint8_t* end)
+    {
+        static const int8_t LENGTHS[16] = { 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, 2, 2, 3, 4 };
+        int32_t count = LENGTHS[*text >> 4];
+        if (count < 1)
+        {
+            ++text;
+            return REPLACEMENT_CHARACTER;
+        }
+        if (count == 1)
+            return *text++;
+
+        uint32_t value = *text++ & ~(0xff << (7 - count));
+        for (--count; count > 0; --count, ++text)
+        {
+            if ((text == end) || ((*text & 0xc0) != 0x80))
+                return REPLACEMENT_CHARACTER;
+            value = (value << 6) | (*text & 0x3f);
+        }
+        if ((value > 0x10ffff) || ((value >= 0xd800) && (value <= 0xdfff)) || ((value & 0xfffe) == 0xfffe) || ((value >= 0xfdd0) && (value <= 0xfdef)))
+            return REPLACEMENT_CHARACTER;
+        return value;
+    }
+
+    void appendCodePoint(std::string& output, uint32_t value)
+    {
+        if (value < 0x80)
+            output += static_cast<char>(value);
+        else if (value < 0x800)
+        {
+            output += static_cast<char>(0xc0 | (value >> 6));
+            output += static_cast<char>(0x80 | (value & 0x3f));
+        }
+        else if (value < 0x10000)
+        {
+            output += static_cast<char>(0xe0 | (value >> 12));
+            output += static_cast<char>(0x80 | ((value >> 6) & 0x3f));
+            output += static_cast<char>(0x80 | (value & 0x3f));
+        }
+        else
+        {
+            output += static_cast<char>(0xf0 | (value >> 18));
+            output += static_cast<char>(0x80 | ((value >> 12) & 0x3f));
+            output += static_cast<char>(0x80 | ((value >> 6) & 0x3f));
+            output += static_cast<char>(0x80 | (value & 0x3f));
+        }
+    }
+
+    void appendEscape(std::string& output, uint32_t value)
+    {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+        uint32_t digits = 8;
+        output += '\\';
+        if (value < 0xff)
+        {
+            output += 'x';
+            digits = 2;
+        }
+        else if (value < 0xffff)
+        {
+            output += 'u';
+            digits = 4;
+        }
+        else
+            output += 'U';
+        for (; digits > 0; --digits)
+            output += HEX_DIGITS[(value >> (4 * (digits - 1))) & 0xf];
+    }
+
+    void appendString(std::string& output, const char* text, size_t size)
+    {
+        if (isPlainScalar(text, size))
+        {
+            output.append(text, size);
+            return;
+        }
+
+        output += '"';
+        auto pos = reinterpret_cast<const uint8_t*>(text);
+        auto end = pos + size;
+        while (pos < end)
+        {
+            uint32_t value = readCodePoint(pos, end);
+            switch (value)
             {
-                mSuccess = false;
-                emu::Log::printf(emu::Log::Type::Error, "YamlReaderImpl: %s\n", except.what());
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\n': output += "\\n"; break;
+            case '\t': output += "\\t"; break;
+            case '\r': output += "\\r"; break;
+            case '\b': output += "\\b"; break;
+            default:
+                if ((value < 0x20) || ((value >= 0x7f) && (value <= 0xa0)) || (value == 0xfeff))
+                    appendEscape(output, value);
+                else
+                    appendCodePoint(output, value);
+                break;
             }
         }
+        output += '"';
+    }
+
+    template <typename T>
+    void appendInteger(std::string& output, T value)
+    {
+        char buffer[24];
+        char* end = buffer + sizeof(buffer);
+        char* pos = end;
+        typedef typename std::make_unsigned<T>::type UnsignedType;
+        UnsignedType magnitude = static_cast<UnsignedType>(value);
+        bool negative = value < 0;
+        if (negative)
+            magnitude = static_cast<UnsignedType>(0) - magnitude;
+        do
+        {
+            *--pos = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (negative)
+            *--pos = '-';
+        output.append(pos, end - pos);
+    }
+
+    void appendFloat(std::string& output, double value, int precision)
+    {
+        if (std::isnan(value))
+            output += ".nan";
+        else if (std::isinf(value))
+            output += (value > 0) ? ".inf" : "-.inf";
+        else
+        {
+            char buffer[32];
+            int size = snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            output.append(buffer, size);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+
+    class YamlReaderImpl : public emu::YamlReader
+    {
+    public:
+        YamlReaderImpl()
+            : mSuccess(true)
+        {
+        }
 
         virtual bool success() const
         {
@@ -46,96 +229,127 @@ namespace
             return false;
         }
 
-        template <typename T>
-        void valueRead(T& item)
-        {
-            safeExecute([&]()
-            {
-                item = mContext.back().as<std::remove_reference<decltype(item)>::type>();
-            });
-        }
-
         virtual void value(bool& item) override
         {
-            valueRead(item);
+            static const char* TRUE_VALUES[] = { "y", "Y", "yes", "Yes", "YES", "true", "True", "TRUE", "on", "On", "ON" };
+            static const char* FALSE_VALUES[] = { "n", "N", "no", "No", "NO", "false", "False", "FALSE", "off", "Off", "OFF" };
+            auto text = getScalar();
+            if (!text)
+                return;
+            for (auto name : TRUE_VALUES)
+            {
+                if (*text == name)
+                {
+                    item = true;
+                    return;
+                }
+            }
+            for (auto name : FALSE_VALUES)
+            {
+                if (*text == name)
+                {
+                    item = false;
+                    return;
+                }
+            }
+            conversionError();
         }
 
         virtual void value(char& item) override
         {
-            valueRead(item);
+            auto text = getScalar();
+            if (!text)
+                return;
+            if (text->size() == 1)
+                item = (*text)[0];
+            else
+                conversionError();
         }
 
         virtual void value(int8_t& item) override
         {
-            valueRead(item);
+            readSmallInteger(item);
         }
 
         virtual void value(uint8_t& item) override
         {
-            valueRead(item);
+            readSmallInteger(item);
         }
 
         virtual void value(int16_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(uint16_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(int32_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(uint32_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(int64_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(uint64_t& item) override
         {
-            valueRead(item);
+            readInteger(item);
         }
 
         virtual void value(float& item) override
         {
-            valueRead(item);
+            double value = 0;
+            if (readFloat(value))
+                item = static_cast<float>(value);
         }
 
         virtual void value(double& item) override
         {
-            valueRead(item);
+            readFloat(item);
         }
 
         virtual void value(std::string& item) override
         {
-            valueRead(item);
+            auto text = getScalar();
+            if (text)
+                item = *text;
         }
 
         virtual void value(emu::Buffer& item) override
         {
-            std::string value;
-            valueRead(value);
-            emu::Base64::decode(item, value);
+            auto text = getScalar();
+            if (text)
+                emu::Base64::decode(item, *text);
         }
 
         virtual bool nodeBegin(const char* name) override
         {
-            auto node = mContext.back()[name];
-            bool success = !!node;
-            if (node)
-            {
-                mContext.push_back(node);
-            }
-            return success;
+            // Keys are searched from the one following the last match, reading them in order finds each one at once
+            uint32_t parent = mContext.back();
+            if ((parent == INVALID_ENTRY) || (mEntries[parent].kind != Kind::Map))
+                return false;
+
+            uint32_t end = mEntries[parent].next;
+            uint32_t start = mCursors[parent];
+            uint32_t child = findKey(name, start, end);
+            if (child == INVALID_ENTRY)
+                child = findKey(name, parent + 1, start);
+            if (child == INVALID_ENTRY)
+                return false;
+
+            mCursors[parent] = (mEntries[child].next < end) ? mEntries[child].next : parent + 1;
+            mContext.push_back(child);
+            return true;
         }
 
         virtual void nodeEnd() override
@@ -145,202 +359,822 @@ namespace
 
         virtual bool sequenceBegin(size_t& size) override
         {
-            size = mContext.back().size();
-            auto iterator = mContext.back().begin();
-            mIterator.push_back(iterator);
-            mContext.push_back(YAML::Node());
+            uint32_t parent = mContext.back();
+            Items items = { INVALID_ENTRY, INVALID_ENTRY };
+            size = 0;
+            if ((parent != INVALID_ENTRY) && (mEntries[parent].kind == Kind::Sequence))
+            {
+                size = mEntries[parent].count;
+                items.next = parent + 1;
+                items.end = mEntries[parent].next;
+            }
+            mItems.push_back(items);
+            mContext.push_back(INVALID_ENTRY);
             return true;
         }
 
         virtual void sequenceEnd() override
         {
             mContext.pop_back();
-            mIterator.pop_back();
+            mItems.pop_back();
         }
 
         virtual void sequenceItem() override
         {
-            auto& iterator = mIterator.back();
-            mContext.pop_back();
-            mContext.push_back(*iterator);
-            ++iterator;
+            auto& items = mItems.back();
+            if (items.next < items.end)
+            {
+                mContext.back() = items.next;
+                items.next = mEntries[items.next].next;
+            }
+            else
+                mContext.back() = INVALID_ENTRY;
         }
 
         virtual bool read(const std::string& data) override
         {
-            safeExecute([&]()
-            {
-                mContext.back() = YAML::Load(data.c_str());
-            });
+            mSuccess = true;
+            mEntries.clear();
+            mContext.clear();
+            mItems.clear();
+            splitLines(data);
+
+            mLine = 0;
+            addEntry(0);
+            if (!mLines.empty())
+                parseBlock(0);
+            if (mSuccess && (mLine < mLines.size()))
+                parseError(mLines[mLine].number, "unexpected indentation");
+
+            mCursors.resize(mEntries.size());
+            for (uint32_t index = 0; index < mEntries.size(); ++index)
+                mCursors[index] = index + 1;
+            mContext.push_back(0);
             return mSuccess;
         }
 
     private:
-        bool                            mSuccess;
-        std::vector<YAML::Node>         mContext;
-        std::vector<YAML::iterator>     mIterator;
-    };
+        enum class Kind : uint8_t
+        {
+            Null,
+            Scalar,
+            Map,
+            Sequence,
+        };
 
-    ////////////////////////////////////////////////////////////////////////////
+        // Entries are stored depth first, the children of an entry come right after it and end at its next sibling
+        struct Entry
+        {
+            std::string key;
+            std::string value;
+            uint32_t    next;
+            uint32_t    count;
+            uint32_t    line;
+            Kind        kind;
+        };
 
-    class YamlWriterImpl : public emu::YamlWriter
-    {
-    public:
-        YamlWriterImpl()
-            : mSuccess(true)
+        struct Line
         {
-            mContext.push_back(YAML::Node());
+            const char* begin;
+            const char* end;
+            uint32_t    indent;
+            uint32_t    number;
+        };
+
+        struct Items
+        {
+            uint32_t    next;
+            uint32_t    end;
+        };
+
+        void parseError(uint32_t line, const char* message)
+        {
+            emu::Log::printf(emu::Log::Type::Error, "YamlReader: line %u: %s\n", line, message);
+            mSuccess = false;
         }
 
-        void safeExecute(std::function<void()> func)
+        void conversionError()
         {
-            try
+            uint32_t entry = mContext.back();
+            parseError((entry != INVALID_ENTRY) ? mEntries[entry].line : 0, "bad conversion");
+        }
+
+        uint32_t addEntry(uint32_t line)
+        {
+            Entry entry;
+            entry.next = INVALID_ENTRY;
+            entry.count = 0;
+            entry.line = line;
+            entry.kind = Kind::Null;
+            mEntries.push_back(entry);
+            return static_cast<uint32_t>(mEntries.size() - 1);
+        }
+
+        uint32_t findKey(const char* name, uint32_t begin, uint32_t end) const
+        {
+            for (uint32_t child = begin; child < end; child = mEntries[child].next)
             {
-                func();
+                if (mEntries[child].key == name)
+                    return child;
             }
-            catch (YAML::Exception except)
+            return INVALID_ENTRY;
+        }
+
+        void splitLines(const std::string& data)
+        {
+            mLines.clear();
+            const char* pos = data.c_str();
+            const char* end = pos + data.size();
+            for (uint32_t number = 1; pos < end; ++number)
             {
-                mSuccess = false;
-                emu::Log::printf(emu::Log::Type::Warning, "YamlWriterImpl: %s\n", except.what());
+                const char* lineEnd = static_cast<const char*>(memchr(pos, '\n', end - pos));
+                if (!lineEnd)
+                    lineEnd = end;
+                const char* next = lineEnd + (lineEnd < end ? 1 : 0);
+                if ((lineEnd > pos) && (lineEnd[-1] == '\r'))
+                    --lineEnd;
+
+                Line line;
+                line.begin = pos;
+                while ((line.begin < lineEnd) && (*line.begin == ' '))
+                    ++line.begin;
+                line.end = lineEnd;
+                while ((line.end > line.begin) && isBlankOrBreak(line.end[-1]))
+                    --line.end;
+                line.indent = static_cast<uint32_t>(line.begin - pos);
+                line.number = number;
+                pos = next;
+
+                // Comments, document markers and directives carry no value
+                size_t size = line.end - line.begin;
+                if (!size || (*line.begin == '#') || (*line.begin == '%'))
+                    continue;
+                if ((size == 3) && (!strncmp(line.begin, "---", 3) || !strncmp(line.begin, "...", 3)))
+                    continue;
+                mLines.push_back(line);
             }
         }
 
-        virtual bool success() const
+        static bool isDash(const Line& line)
         {
-            return mSuccess;
+            return (*line.begin == '-') && ((line.begin + 1 == line.end) || (line.begin[1] == ' '));
         }
 
-        virtual bool isWriting() const override
+        static const char* skipQuoted(const char* pos, const char* end)
         {
+            char quote = *pos++;
+            while (pos < end)
+            {
+                if ((quote == '"') && (*pos == '\\'))
+                    pos += 2;
+                else if (*pos == quote)
+                {
+                    if ((quote == '\'') && (pos + 1 < end) && (pos[1] == '\''))
+                        pos += 2;
+                    else
+                        return pos + 1;
+                }
+                else
+                    ++pos;
+            }
+            return nullptr;
+        }
+
+        static const char* findKeySeparator(const char* begin, const char* end)
+        {
+            const char* pos = begin;
+            if ((*pos == '"') || (*pos == '\''))
+            {
+                pos = skipQuoted(pos, end);
+                if (!pos)
+                    return nullptr;
+                while ((pos < end) && (*pos == ' '))
+                    ++pos;
+                return ((pos < end) && (*pos == ':') && ((pos + 1 == end) || isBlankOrBreak(pos[1]))) ? pos : nullptr;
+            }
+            if ((*pos == '[') || (*pos == '{'))
+                return nullptr;
+            for (; pos < end; ++pos)
+            {
+                if ((*pos == ':') && ((pos + 1 == end) || isBlankOrBreak(pos[1])))
+                    return pos;
+                if ((*pos == '#') && (pos > begin) && isBlankOrBreak(pos[-1]))
+                    return nullptr;
+            }
+            return nullptr;
+        }
+
+        bool decodeQuoted(const char* begin, const char* end, std::string& result, uint32_t line)
+        {
+            char quote = *begin++;
+            result.clear();
+            for (const char* pos = begin; pos < end; ++pos)
+            {
+                if (*pos == quote)
+                {
+                    if ((quote == '\'') && (pos + 1 < end) && (pos[1] == '\''))
+                    {
+                        result += '\'';
+                        ++pos;
+                        continue;
+                    }
+                    return true;
+                }
+                if ((quote == '\'') || (*pos != '\\'))
+                {
+                    result += *pos;
+                    continue;
+                }
+
+                if (++pos == end)
+                    break;
+                uint32_t digits = 0;
+                switch (*pos)
+                {
+                case '0': result += '\0'; break;
+                case 'a': result += '\a'; break;
+                case 'b': result += '\b'; break;
+                case 't': case '\t': result += '\t'; break;
+                case 'n': result += '\n'; break;
+                case 'v': result += '\v'; break;
+                case 'f': result += '\f'; break;
+                case 'r': result += '\r'; break;
+                case 'e': result += '\x1b'; break;
+                case ' ': result += ' '; break;
+                case '"': result += '"'; break;
+                case '\'': result += '\''; break;
+                case '/': result += '/'; break;
+                case '\\': result += '\\'; break;
+                case 'N': appendCodePoint(result, 0x85); break;
+                case '_': appendCodePoint(result, 0xa0); break;
+                case 'L': appendCodePoint(result, 0x2028); break;
+                case 'P': appendCodePoint(result, 0x2029); break;
+                case 'x': digits = 2; break;
+                case 'u': digits = 4; break;
+                case 'U': digits = 8; break;
+                default:
+                    parseError(line, "unknown escape sequence");
+                    return false;
+                }
+
+                if (digits)
+                {
+                    if (static_cast<uint32_t>(end - pos - 1) < digits)
+                        break;
+                    char hex[9] = {};
+                    memcpy(hex, pos + 1, digits);
+                    char* hexEnd = nullptr;
+                    uint32_t value = static_cast<uint32_t>(strtoul(hex, &hexEnd, 16));
+                    if (hexEnd != hex + digits)
+                    {
+                        parseError(line, "bad escape sequence");
+                        return false;
+                    }
+                    appendCodePoint(result, value);
+                    pos += digits;
+                }
+            }
+            parseError(line, "unterminated string");
+            return false;
+        }
+
+        // Scalars, quoted strings and flow collections that fit on the line
+        void parseInline(uint32_t entry, const char* begin, const char* end, uint32_t line)
+        {
+            while ((begin < end) && (*begin == ' '))
+                ++begin;
+            if (begin == end)
+                return;
+
+            if ((*begin == '"') || (*begin == '\''))
+            {
+                if (decodeQuoted(begin, end, mEntries[entry].value, line))
+                    mEntries[entry].kind = Kind::Scalar;
+                return;
+            }
+
+            if ((*begin == '[') || (*begin == '{'))
+            {
+                parseFlow(entry, begin, end, line);
+                return;
+            }
+
+            const char* valueEnd = begin;
+            for (const char* pos = begin; pos < end; ++pos)
+            {
+                if ((*pos == '#') && isBlankOrBreak(pos[-1]))
+                    break;
+                if (!isBlankOrBreak(*pos))
+                    valueEnd = pos + 1;
+            }
+            if (isNullScalar(begin, valueEnd - begin))
+                return;
+            mEntries[entry].value.assign(begin, valueEnd);
+            mEntries[entry].kind = Kind::Scalar;
+        }
+
+        // Only flat collections such as [1, 2] or {A: 1}, which is what gets written by hand
+        void parseFlow(uint32_t entry, const char* begin, const char* end, uint32_t line)
+        {
+            bool isMap = *begin == '{';
+            const char* close = static_cast<const char*>(memchr(begin, isMap ? '}' : ']', end - begin));
+            if (!close)
+            {
+                parseError(line, "unterminated flow collection");
+                return;
+            }
+
+            mEntries[entry].kind = isMap ? Kind::Map : Kind::Sequence;
+            const char* pos = begin + 1;
+            while (pos < close)
+            {
+                while ((pos < close) && (*pos == ' '))
+                    ++pos;
+                if (pos == close)
+                    break;
+
+                const char* itemEnd = pos;
+                if ((*pos == '"') || (*pos == '\''))
+                    itemEnd = skipQuoted(pos, close);
+                if (!itemEnd)
+                {
+                    parseError(line, "unterminated string");
+                    return;
+                }
+                const char* separator = static_cast<const char*>(memchr(itemEnd, ',', close - itemEnd));
+                if (!separator)
+                    separator = close;
+
+                uint32_t child = addEntry(line);
+                if (isMap)
+                {
+                    const char* colon = findKeySeparator(pos, separator);
+                    if (!colon)
+                    {
+                        parseError(line, "missing key in flow map");
+                        return;
+                    }
+                    parseKey(child, pos, colon, line);
+                    parseInline(child, colon + 1, separator, line);
+                }
+                else
+                    parseInline(child, pos, separator, line);
+                mEntries[child].next = static_cast<uint32_t>(mEntries.size());
+                ++mEntries[entry].count;
+                pos = separator + 1;
+            }
+        }
+
+        void parseKey(uint32_t entry, const char* begin, const char* end, uint32_t line)
+        {
+            if ((*begin == '"') || (*begin == '\''))
+            {
+                decodeQuoted(begin, end, mEntries[entry].key, line);
+                return;
+            }
+            while ((end > begin) && isBlankOrBreak(end[-1]))
+                --end;
+            mEntries[entry].key.assign(begin, end);
+        }
+
+        // The value of an entry starting on the current line, a map, a sequence or a scalar
+        void parseBlock(uint32_t entry)
+        {
+            auto& line = mLines[mLine];
+            if (isDash(line))
+                parseSequence(entry, line.indent);
+            else if (findKeySeparator(line.begin, line.end))
+                parseMap(entry, line.indent);
+            else
+            {
+                parseInline(entry, line.begin, line.end, line.number);
+                ++mLine;
+            }
+            mEntries[entry].next = static_cast<uint32_t>(mEntries.size());
+        }
+
+        // A value on the lines after its key or its dash, when they are indented further
+        void parseNested(uint32_t entry, uint32_t indent, bool allowSequence)
+        {
+            if (mLine < mLines.size())
+            {
+                auto& line = mLines[mLine];
+                if ((line.indent > indent) || (allowSequence && (line.indent == indent) && isDash(line)))
+                {
+                    parseBlock(entry);
+                    return;
+                }
+            }
+            mEntries[entry].next = static_cast<uint32_t>(mEntries.size());
+        }
+
+        void parseMap(uint32_t entry, uint32_t indent)
+        {
+            mEntries[entry].kind = Kind::Map;
+            while (mSuccess && (mLine < mLines.size()))
+            {
+                auto& line = mLines[mLine];
+                if ((line.indent < indent) || isDash(line))
+                    break;
+                const char* separator = findKeySeparator(line.begin, line.end);
+                if ((line.indent > indent) || !separator)
+                {
+                    parseError(line.number, "expected a key");
+                    break;
+                }
+
+                uint32_t child = addEntry(line.number);
+                ++mEntries[entry].count;
+                parseKey(child, line.begin, separator, line.number);
+                const char* value = separator + 1;
+                while ((value < line.end) && (*value == ' '))
+                    ++value;
+                if ((value < line.end) && (*value != '#'))
+                {
+                    parseInline(child, value, line.end, line.number);
+                    mEntries[child].next = static_cast<uint32_t>(mEntries.size());
+                    ++mLine;
+                }
+                else
+                {
+                    ++mLine;
+                    parseNested(child, indent, true);
+                }
+            }
+        }
+
+        void parseSequence(uint32_t entry, uint32_t indent)
+        {
+            mEntries[entry].kind = Kind::Sequence;
+            while (mSuccess && (mLine < mLines.size()))
+            {
+                auto& line = mLines[mLine];
+                if ((line.indent != indent) || !isDash(line))
+                {
+                    if (line.indent > indent)
+                        parseError(line.number, "expected an item");
+                    break;
+                }
+
+                uint32_t child = addEntry(line.number);
+                ++mEntries[entry].count;
+                const char* value = line.begin + 1;
+                while ((value < line.end) && (*value == ' '))
+                    ++value;
+                if ((value < line.end) && (*value != '#'))
+                {
+                    // The rest of the line reads as if it started a line of its own at its column
+                    line.indent += static_cast<uint32_t>(value - line.begin);
+                    line.begin = value;
+                    parseBlock(child);
+                }
+                else
+                {
+                    ++mLine;
+                    parseNested(child, indent, false);
+                }
+            }
+        }
+
+        const std::string* getScalar()
+        {
+            uint32_t entry = mContext.back();
+            if ((entry == INVALID_ENTRY) || (mEntries[entry].kind == Kind::Map) || (mEntries[entry].kind == Kind::Sequence))
+            {
+                conversionError();
+                return nullptr;
+            }
+            return &mEntries[entry].value;
+        }
+
+        template <typename T>
+        bool parseInteger(const std::string& text, T& item)
+        {
+            if (text.empty())
+                return false;
+
+            char* end = nullptr;
+            errno = 0;
+            if (std::is_signed<T>::value)
+            {
+                long long value = strtoll(text.c_str(), &end, 0);
+                if (errno || *end || (value < std::numeric_limits<T>::min()) || (value > std::numeric_limits<T>::max()))
+                    return false;
+                item = static_cast<T>(value);
+            }
+            else
+            {
+                if (text[0] == '-')
+                    return false;
+                unsigned long long value = strtoull(text.c_str(), &end, 0);
+                if (errno || *end || (value > std::numeric_limits<T>::max()))
+                    return false;
+                item = static_cast<T>(value);
+            }
             return true;
         }
 
         template <typename T>
-        void valueWrite(T& item)
+        void readInteger(T& item)
         {
-            safeExecute([&]()
+            auto text = getScalar();
+            if (text && !parseInteger(*text, item))
+                conversionError();
+        }
+
+        // Older files hold 8 bit values as a single character
+        template <typename T>
+        void readSmallInteger(T& item)
+        {
+            auto text = getScalar();
+            if (!text || parseInteger(*text, item))
+                return;
+            if (text->size() == 1)
+                item = static_cast<T>((*text)[0]);
+            else
+                conversionError();
+        }
+
+        bool readFloat(double& item)
+        {
+            auto text = getScalar();
+            if (!text)
+                return false;
+
+            const char* value = text->c_str();
+            if (!strcmp(value, ".inf") || !strcmp(value, ".Inf") || !strcmp(value, ".INF") || !strcmp(value, "+.inf") || !strcmp(value, "+.Inf") || !strcmp(value, "+.INF"))
+                item = std::numeric_limits<double>::infinity();
+            else if (!strcmp(value, "-.inf") || !strcmp(value, "-.Inf") || !strcmp(value, "-.INF"))
+                item = -std::numeric_limits<double>::infinity();
+            else if (!strcmp(value, ".nan") || !strcmp(value, ".NaN") || !strcmp(value, ".NAN"))
+                item = std::numeric_limits<double>::quiet_NaN();
+            else
             {
-                mContext.back() = item;
-            });
+                char* end = nullptr;
+                double result = strtod(value, &end);
+                if (!*value || *end)
+                {
+                    conversionError();
+                    return false;
+                }
+                item = result;
+            }
+            return true;
+        }
+
+        bool                    mSuccess;
+        std::vector<Line>       mLines;
+        size_t                  mLine;
+        std::vector<Entry>      mEntries;
+        std::vector<uint32_t>   mCursors;
+        std::vector<uint32_t>   mContext;
+        std::vector<Items>      mItems;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+
+    class YamlWriterImpl : public emu::YamlWriter
+    {
+    public:
+        YamlWriterImpl()
+            : mSuccess(true)
+        {
+            Frame root;
+            root.kind = Kind::Pending;
+            root.item = false;
+            root.root = true;
+            root.column = 0;
+            mFrames.push_back(root);
+        }
+
+        virtual bool success() const
+        {
+            return mSuccess;
+        }
+
+        virtual bool isWriting() const override
+        {
+            return true;
         }
 
         virtual void value(bool& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                mOutput += item ? "true" : "false";
         }
 
         virtual void value(char& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendString(mOutput, &item, 1);
         }
 
         virtual void value(int8_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(uint8_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(int16_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(uint16_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(int32_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(uint32_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(int64_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(uint64_t& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendInteger(mOutput, item);
         }
 
         virtual void value(float& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendFloat(mOutput, item, std::numeric_limits<float>::max_digits10);
         }
 
         virtual void value(double& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendFloat(mOutput, item, std::numeric_limits<double>::max_digits10);
         }
 
         virtual void value(std::string& item) override
         {
-            valueWrite(item);
+            if (beginScalar())
+                appendString(mOutput, item.data(), item.size());
         }
 
         virtual void value(emu::Buffer& item) override
         {
-            std::string value;
-            emu::Base64::encode(value, item.data(), item.size());
-            valueWrite(value);
+            if (!beginScalar())
+                return;
+            if (item.size())
+                emu::Base64::encode(mOutput, item.data(), item.size());
+            else
+                mOutput += "\"\"";
         }
 
         virtual bool nodeBegin(const char* name) override
         {
-            auto node = mContext.back()[name] = YAML::Node();
-            mContext.push_back(node);
+            auto kind = mFrames.back().kind;
+            if ((kind != Kind::Pending) && (kind != Kind::Map))
+            {
+                mSuccess = false;
+                return false;
+            }
+
+            uint32_t column = beginEntry(true);
+            appendString(mOutput, name, strlen(name));
+            mOutput += ':';
+            pushFrame(false, column);
             return true;
         }
 
         virtual void nodeEnd() override
         {
-            mContext.pop_back();
+            popFrame();
         }
 
         virtual bool sequenceBegin(size_t& size) override
         {
-            (void)size;
-            mContext.push_back(YAML::Node());
+            EMU_UNUSED(size);
+            mSequences.push_back(false);
             return true;
         }
 
         virtual void sequenceEnd() override
         {
-            mContext.pop_back();
+            if (mSequences.back())
+                popFrame();
+            mSequences.pop_back();
         }
 
         virtual void sequenceItem() override
         {
-            mContext.pop_back();
-            auto node = YAML::Node();
-            mContext.back().push_back(node);
-            mContext.push_back(node);
+            if (mSequences.back())
+                popFrame();
+            mSequences.back() = true;
+
+            uint32_t column = beginEntry(false);
+            mOutput += '-';
+            pushFrame(true, column);
         }
 
         virtual bool write(std::string& data) override
         {
-            safeExecute([&]()
-            {
-                std::string result = YAML::Dump(mContext.back());
-                data = result.c_str();
-            });
+            data = mOutput.empty() ? "~" : mOutput;
             return mSuccess;
         }
 
     private:
-        bool                        mSuccess;
-        std::vector<YAML::Node>     mContext;
+        enum class Kind : uint8_t
+        {
+            Pending,
+            Scalar,
+            Map,
+            Sequence,
+        };
+
+        // A key or a sequence item, its value is only known once something is written to it
+        struct Frame
+        {
+            Kind        kind;
+            bool        item;
+            bool        root;
+            uint32_t    column;
+        };
+
+        void pushFrame(bool item, uint32_t column)
+        {
+            Frame frame;
+            frame.kind = Kind::Pending;
+            frame.item = item;
+            frame.root = false;
+            frame.column = column;
+            mFrames.push_back(frame);
+        }
+
+        void popFrame()
+        {
+            if (mFrames.back().kind == Kind::Pending)
+                mOutput += " ~";
+            mFrames.pop_back();
+        }
+
+        void newLine(uint32_t column)
+        {
+            if (!mOutput.empty())
+                mOutput += '\n';
+            mOutput.append(column, ' ');
+        }
+
+        // The first key of a map in a sequence item goes on the line of the dash, anything else on a line of its own
+        uint32_t beginEntry(bool key)
+        {
+            auto& parent = mFrames.back();
+            uint32_t column = parent.root ? 0 : parent.column + 2;
+            if (parent.kind == Kind::Pending)
+            {
+                parent.kind = key ? Kind::Map : Kind::Sequence;
+                if (parent.item && key)
+                {
+                    mOutput += ' ';
+                    return column;
+                }
+            }
+            newLine(column);
+            return column;
+        }
+
+        bool beginScalar()
+        {
+            auto& frame = mFrames.back();
+            if (frame.kind != Kind::Pending)
+            {
+                mSuccess = false;
+                return false;
+            }
+            frame.kind = Kind::Scalar;
+            if (!mOutput.empty())
+                mOutput += ' ';
+            return true;
+        }
+
+        bool                    mSuccess;
+        std::string             mOutput;
+        std::vector<Frame>      mFrames;
+        std::vector<bool>       mSequences;
     };
 }
 
@@ -365,4 +1199,4 @@ namespace emu
     {
         delete &static_cast<YamlWriterImpl&>(instance);
     }
-}
\ No newline at end of file
+}
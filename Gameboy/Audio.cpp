@@ -2,6 +2,7 @@
 #include <Core/Serializer.h>
 #include "Audio.h"
 #include "Interrupts.h"
+#include <algorithm>
 
 namespace
 {
@@ -67,9 +68,17 @@ namespace
     static const uint8_t NR51_SO1_OUTPUT_SHIFT = 0;
 
     static const uint8_t NR52_ALL_ON = 0x80;
+    static const uint8_t NR52_UNUSED_MASK = 0x70;
     static const uint8_t NR52_SOUND_MASK = 0x0f;
     static const uint8_t NR52_SOUND_SHIFT = 0;
 
+    uint32_t countSteps(uint32_t first, uint32_t count, uint32_t period, uint32_t phase)
+    {
+        // Number of steps in [first, first + count) falling on the given phase of a power of two period
+        auto countBefore = [period, phase](uint32_t step) { return step > phase ? (step - phase - 1) / period + 1 : 0; };
+        return countBefore(first + count) - countBefore(first);
+    }
+
     static const int32_t kVolumeDAC[VOLUME_MAX + 1] =
     {
         -15, -13, -11, -9, -7, -5, -3, -1,
@@ -149,6 +158,60 @@ namespace gb
 
     ////////////////////////////////////////////////////////////////////////////
 
+    Audio::Output::Output()
+        : mSourceCount(0)
+        , mLevel(0)
+    {
+        mBlip[0] = nullptr;
+        mBlip[1] = nullptr;
+        mGain[0] = 0;
+        mGain[1] = 0;
+        mAmplitude[0] = 0;
+        mAmplitude[1] = 0;
+    }
+
+    void Audio::Output::reset(emu::AudioStage& audio)
+    {
+        mBlip[0] = &audio.getSource(0);
+        mBlip[1] = &audio.getSource(1);
+        mSourceCount = audio.getSourceCount();
+        mLevel = 0;
+        mGain[0] = 0;
+        mGain[1] = 0;
+        mAmplitude[0] = 0;
+        mAmplitude[1] = 0;
+    }
+
+    void Audio::Output::setLevel(int32_t tick, int32_t level)
+    {
+        if (mLevel != level)
+        {
+            mLevel = level;
+            update(tick);
+        }
+    }
+
+    void Audio::Output::setGain(int32_t tick, uint32_t source, int32_t gain)
+    {
+        if (mGain[source] != gain)
+        {
+            mGain[source] = gain;
+            update(tick);
+        }
+    }
+
+    void Audio::Output::update(int32_t tick)
+    {
+        for (uint32_t source = 0; source < mSourceCount; ++source)
+        {
+            int32_t amplitude = mLevel * mGain[source];
+            mBlip[source]->addDelta(tick, amplitude - mAmplitude[source]);
+            mAmplitude[source] = amplitude;
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+
     Audio::Sweep::Sweep(const uint8_t& NRx0, const uint8_t& NRx4, Frequency& frequency)
         : mNRx0(NRx0)
         , mNRx4(NRx4)
@@ -200,9 +263,15 @@ namespace gb
                     deltaPeriod = -deltaPeriod;
                 auto nextPeriod = mPeriod + deltaPeriod;
                 if (nextPeriod >= FREQUENCY_PERIOD_LIMIT)
+                {
+                    // Overflow stops the sweep, the period can't be represented by the channel timer
                     mEnabled = false;
-                mPeriod = nextPeriod;
-                mFrequency.setPeriod(nextPeriod);
+                }
+                else
+                {
+                    mPeriod = nextPeriod;
+                    mFrequency.setPeriod(nextPeriod);
+                }
             }
         }
     }
@@ -258,6 +327,22 @@ namespace gb
         }
     }
 
+    void Audio::Length::skip(uint32_t steps)
+    {
+        if ((mNRx4 & NRx4_DECREMENT) && mCounter)
+        {
+            if (steps >= mCounter)
+            {
+                mCounter = 0;
+                mOutputMask = OUTPUT_MASK_DISABLED;
+            }
+            else
+            {
+                mCounter -= steps;
+            }
+        }
+    }
+
     void Audio::Length::serialize(emu::ISerializer& serializer)
     {
         serializer
@@ -314,6 +399,38 @@ namespace gb
         }
     }
 
+    void Audio::Volume::skip(uint32_t steps)
+    {
+        // Same as calling step() repeatedly: the volume moves once every counterStart steps until it saturates
+        auto counterStart = (mNRx2 & NRx2_COUNTER_MASK) >> NRx2_COUNTER_SHIFT;
+        if (!mVolume || !counterStart || !steps)
+            return;
+
+        if (!mCounter || (steps < mCounter))
+        {
+            mCounter -= steps;
+            return;
+        }
+
+        uint32_t remaining = steps - mCounter;
+        uint32_t changes = 1 + remaining / counterStart;
+        mCounter = counterStart - remaining % counterStart;
+        if (mNRx2 & NRx2_INCREASE)
+        {
+            mVolume = std::min(mVolume + changes, VOLUME_MAX);
+        }
+        else if (changes >= mVolume - VOLUME_MIN)
+        {
+            // The envelope stops once silent, the counter keeps its reload value
+            mVolume = VOLUME_MIN;
+            mCounter = counterStart;
+        }
+        else
+        {
+            mVolume -= changes;
+        }
+    }
+
     void Audio::Volume::serialize(emu::ISerializer& serializer)
     {
         serializer
@@ -397,6 +514,14 @@ namespace gb
         }
     }
 
+    int32_t Audio::BaseFrequency::getCycleTick(uint32_t cycles) const
+    {
+        // First tick at which update() moves the cycle forward by the requested count
+        int32_t clockStart = mClockLastTick >> mClockShift;
+        int32_t clock = clockStart + (mClockPeriod - mClockStep) + (static_cast<int32_t>(cycles) - 1) * mClockPeriod;
+        return clock << mClockShift;
+    }
+
     void Audio::BaseFrequency::serialize(emu::ISerializer& serializer)
     {
         serializer
@@ -523,6 +648,20 @@ namespace gb
         return result;
     }
 
+    uint32_t Audio::SquarePattern::getRun(uint32_t cycle) const
+    {
+        // Number of cycles until the duty output changes
+        static const uint8_t kRun[4][SQUARE_CYCLE_SIZE] =
+        {
+            { 7, 6, 5, 4, 3, 2, 1, 1 },
+            { 1, 6, 5, 4, 3, 2, 1, 2 },
+            { 1, 4, 3, 2, 1, 4, 3, 2 },
+            { 1, 6, 5, 4, 3, 2, 1, 2 },
+        };
+        auto duty = (mNRx1 & NRx1_DUTY_MASK) >> NRx1_DUTY_SHIFT;
+        return kRun[duty][cycle];
+    }
+
     ////////////////////////////////////////////////////////////////////////////
 
     Audio::WavePattern::WavePattern(const uint8_t& NRx0, const uint8_t& NRx2, const uint8_t* wave)
@@ -547,6 +686,11 @@ namespace gb
         return result;
     }
 
+    bool Audio::WavePattern::isMuted() const
+    {
+        return (mNRx2 & NR32_OUTPUT_LEVEL_MASK) == 0;
+    }
+
     ////////////////////////////////////////////////////////////////////////////
 
     Audio::NoisePattern::NoisePattern(const uint8_t& NRx3, const uint8_t& NRx4)
@@ -603,11 +747,14 @@ namespace gb
         mClock = nullptr;
         mSoundBuffer = nullptr;
         mSoundBufferSize = 0;
-        mSoundBufferOffset = 0;
+        mSoundFormat = emu::AudioStage::Format();
+        mAudio.destroy();
+        mTicksPerFrame = 0;
+        resetOutputs();
         resetClock();
     }
 
-    bool Audio::create(emu::Clock& clock, uint32_t masterClockFrequency, uint32_t masterClockDivider, emu::RegisterBank& registers)
+    bool Audio::create(emu::Clock& clock, uint32_t masterClockFrequency, uint32_t masterClockDivider, uint32_t masterClockPerFrame, emu::RegisterBank& registers)
     {
         EMU_UNUSED(masterClockFrequency);
 
@@ -615,9 +762,8 @@ namespace gb
         EMU_VERIFY(mClockListener.create(clock, *this));
 
         // The following timings are not exactly true. They are used to match correctly with a frame rate of 60 Hz and to allow SGB to run a bit faster
-        mMasterClockFrequency = MASTER_CLOCK_FREQUENCY_GB * masterClockDivider;
         mTicksPerSequencerStep = TICKS_PER_SEQUENCER_STEP * masterClockDivider;
-        mTicksPerSample = 0;
+        mTicksPerFrame = masterClockPerFrame;
 
         EMU_VERIFY(mChannel1Frequency.initClock(masterClockDivider));
         EMU_VERIFY(mChannel2Frequency.initClock(masterClockDivider));
@@ -686,33 +832,25 @@ namespace gb
 
     void Audio::execute()
     {
-        update(mDesiredTick);
+        // Without an output nothing needs to run in the background, registers catch up when accessed
+        if (mAudio.isEnabled())
+            update(mDesiredTick);
     }
 
     void Audio::resetClock()
     {
         mDesiredTick = 0;
         mUpdateTick = 0;
-        mSampleTick = 0;
         mSequencerTick = 0;
     }
 
     void Audio::advanceClock(int32_t tick)
     {
-        if (mSoundBuffer)
-        {
-            EMU_ASSERT(mSoundBufferOffset <= mSoundBufferSize);
-            while (mSoundBufferOffset < mSoundBufferSize)
-            {
-                mSoundBuffer[mSoundBufferOffset] = mSoundBuffer[mSoundBufferOffset - 1];
-                ++mSoundBufferOffset;
-            }
-            mSoundBufferOffset -= mSoundBufferSize;
-        }
+        update(tick);
+        mAudio.endFrame(tick, mSoundBuffer);
 
         mDesiredTick -= tick;
         mUpdateTick -= tick;
-        mSampleTick = 0;    // TODO: Do a -= tick once we stop producing a fixed number of samples per frame
         mSequencerTick -= tick;
 
         mChannel1Frequency.advanceClock(tick);
@@ -726,69 +864,6 @@ namespace gb
         mDesiredTick = tick;
     }
 
-    void Audio::sampleStep(int32_t tick)
-    {
-        if (mRegNR52 & NR52_ALL_ON)
-        {
-            int16_t sample[2] = { 0, 0 };
-            if (mSoundBufferOffset < mSoundBufferSize)
-            {
-                uint8_t output[2];
-                output[0] = (mRegNR51 & NR51_SO1_OUTPUT_MASK) >> NR51_SO1_OUTPUT_SHIFT;
-                output[1] = (mRegNR51 & NR51_SO2_OUTPUT_MASK) >> NR51_SO2_OUTPUT_SHIFT;
-
-                int8_t volume[2];
-                volume[0] = ((mRegNR50 & NR50_SO1_VOLUME_MASK) >> NR50_SO1_VOLUME_SHIFT) + 1;
-                volume[1] = ((mRegNR50 & NR50_SO2_VOLUME_MASK) >> NR50_SO2_VOLUME_SHIFT) + 1;
-
-                int8_t level[4] = { 0, 0, 0, 0 };
-                if (mChannel1Length.getOutputMask())
-                {
-                    mChannel1Frequency.update(tick);
-                    level[0] = static_cast<uint8_t>(mChannel1Length.getOutputMask() & mChannel1Pattern.getSample(mChannel1Frequency.getCycle(), mChannel1Volume.getVolume()));
-                }
-                if (mChannel2Length.getOutputMask())
-                {
-                    mChannel2Frequency.update(tick);
-                    level[1] = static_cast<uint8_t>(mChannel2Length.getOutputMask() & mChannel2Pattern.getSample(mChannel2Frequency.getCycle(), mChannel2Volume.getVolume()));
-                }
-                if (mChannel3Length.getOutputMask())
-                {
-                    mChannel3Frequency.update(tick);
-                    level[2] = static_cast<uint8_t>(mChannel3Length.getOutputMask() & mChannel3Pattern.getSample(mChannel3Frequency.getCycle()));
-                }
-                if (mChannel4Length.getOutputMask())
-                {
-                    mChannel4Frequency.update(tick);
-                    level[3] = static_cast<uint8_t>(mChannel4Length.getOutputMask() & mChannel4Pattern.getSample(mChannel4Frequency.getCycle(), mChannel4Volume.getVolume()));
-                }
-
-                for (uint32_t track = 0; track < 2; ++track)
-                {
-                    for (uint32_t channel = 0; channel < 4; ++channel)
-                    {
-                        if (output[track] & (1 << channel))
-                            sample[track] += level[channel];
-                    }
-                    sample[track] *= volume[track] << 5;
-                }
-            }
-
-            // TODO: Support for stereo tracks
-            // Note: with Audacity, tracks are in growing order starting at the bottom
-            // Note: with Audacity, tracks are listed in the same order than BGB if SO2 comes first
-            emu::word16_t final;
-#if 0
-            final.w8[0].i = sample[1] >> 8;
-            final.w8[1].i = sample[0] >> 8;
-#else
-            final.i = sample[0];
-#endif
-            mSoundBuffer[mSoundBufferOffset] = final.i;
-        }
-        ++mSoundBufferOffset;
-    }
-
     void Audio::sequencerStep()
     {
         mSequencerStep = (mSequencerStep + 1) & 7;
@@ -811,27 +886,152 @@ namespace gb
         }
     }
 
-    void Audio::updateSample(int32_t tick)
+    void Audio::skipSequencerSteps(uint32_t steps)
     {
-        if (mSoundBuffer)
+        // Only the counters visible through the registers move, apply all the steps at once
+        uint32_t first = mSequencerStep + 1;
+        uint32_t lengthSteps = countSteps(first, steps, 2, 0);
+        mChannel1Length.skip(lengthSteps);
+        mChannel2Length.skip(lengthSteps);
+        mChannel3Length.skip(lengthSteps);
+        mChannel4Length.skip(lengthSteps);
+
+        uint32_t volumeSteps = countSteps(first, steps, 8, 7);
+        mChannel1Volume.skip(volumeSteps);
+        mChannel2Volume.skip(volumeSteps);
+        mChannel4Volume.skip(volumeSteps);
+
+        // Sweep steps change the period, the channel must reach them before they apply
+        for (uint32_t step = (2 - first) & 3; (step < steps) && mChannel1Sweep.isEnabled(); step += 4)
         {
-            while (tick - mSampleTick >= static_cast<int32_t>(mTicksPerSample))
+            mChannel1Frequency.update(mSequencerTick + (step + 1) * mTicksPerSequencerStep);
+            mChannel1Sweep.step();
+        }
+
+        mSequencerStep = (mSequencerStep + steps) & 7;
+        mSequencerTick += steps * mTicksPerSequencerStep;
+    }
+
+    void Audio::resetOutputs()
+    {
+        mChannel1Output.reset(mAudio);
+        mChannel2Output.reset(mAudio);
+        mChannel3Output.reset(mAudio);
+        mChannel4Output.reset(mAudio);
+    }
+
+    void Audio::updateOutputs(int32_t tick)
+    {
+        // In stereo the left source is SO2 and the right one SO1, a mono output only mixes SO1
+        uint32_t sourceCount = mAudio.getSourceCount();
+        for (uint32_t source = 0; source < sourceCount; ++source)
+        {
+            bool left = (sourceCount == 2) && (source == 0);
+            int32_t gain = 0;
+            if (mRegNR52 & NR52_ALL_ON)
             {
-                mSampleTick += mTicksPerSample;
-                sampleStep(mSampleTick);
+                if (left)
+                    gain = (((mRegNR50 & NR50_SO2_VOLUME_MASK) >> NR50_SO2_VOLUME_SHIFT) + 1) << 5;
+                else
+                    gain = (((mRegNR50 & NR50_SO1_VOLUME_MASK) >> NR50_SO1_VOLUME_SHIFT) + 1) << 5;
             }
+            uint8_t output = left ? (mRegNR51 & NR51_SO2_OUTPUT_MASK) >> NR51_SO2_OUTPUT_SHIFT : (mRegNR51 & NR51_SO1_OUTPUT_MASK) >> NR51_SO1_OUTPUT_SHIFT;
+            mChannel1Output.setGain(tick, source, (output & 0x01) ? gain : 0);
+            mChannel2Output.setGain(tick, source, (output & 0x02) ? gain : 0);
+            mChannel3Output.setGain(tick, source, (output & 0x04) ? gain : 0);
+            mChannel4Output.setGain(tick, source, (output & 0x08) ? gain : 0);
         }
+
+        int32_t level[4] = { 0, 0, 0, 0 };
+        if (mChannel1Length.getOutputMask())
+            level[0] = mChannel1Pattern.getSample(mChannel1Frequency.getCycle(), mChannel1Volume.getVolume());
+        if (mChannel2Length.getOutputMask())
+            level[1] = mChannel2Pattern.getSample(mChannel2Frequency.getCycle(), mChannel2Volume.getVolume());
+        if (mChannel3Length.getOutputMask())
+            level[2] = mChannel3Pattern.getSample(mChannel3Frequency.getCycle());
+        if (mChannel4Length.getOutputMask())
+            level[3] = mChannel4Pattern.getSample(mChannel4Frequency.getCycle(), mChannel4Volume.getVolume());
+        mChannel1Output.setLevel(tick, level[0]);
+        mChannel2Output.setLevel(tick, level[1]);
+        mChannel3Output.setLevel(tick, level[2]);
+        mChannel4Output.setLevel(tick, level[3]);
+    }
+
+    void Audio::synthesizeSquare(Output& output, const Length& length, const Volume& volume, Frequency& frequency, const SquarePattern& pattern, int32_t tick)
+    {
+        // Only the cycles flipping the duty bit change the output, jump from one to the next
+        if (output.isActive() && length.getOutputMask() && volume.getVolume())
+        {
+            while (true)
+            {
+                int32_t cycleTick = frequency.getCycleTick(pattern.getRun(frequency.getCycle()));
+                if (cycleTick > tick)
+                    break;
+                frequency.update(cycleTick);
+                output.setLevel(cycleTick, pattern.getSample(frequency.getCycle(), volume.getVolume()));
+            }
+        }
+        frequency.update(tick);
+    }
+
+    void Audio::synthesizeWave(int32_t tick)
+    {
+        if (mChannel3Output.isActive() && mChannel3Length.getOutputMask() && !mChannel3Pattern.isMuted())
+        {
+            while (true)
+            {
+                int32_t cycleTick = mChannel3Frequency.getCycleTick(1);
+                if (cycleTick > tick)
+                    break;
+                mChannel3Frequency.update(cycleTick);
+                mChannel3Output.setLevel(cycleTick, mChannel3Pattern.getSample(mChannel3Frequency.getCycle()));
+            }
+        }
+        mChannel3Frequency.update(tick);
+    }
+
+    void Audio::synthesizeNoise(int32_t tick)
+    {
+        if (mChannel4Output.isActive() && mChannel4Length.getOutputMask() && mChannel4Volume.getVolume())
+        {
+            while (true)
+            {
+                int32_t cycleTick = mChannel4Frequency.getCycleTick(1);
+                if (cycleTick > tick)
+                    break;
+                mChannel4Frequency.update(cycleTick);
+                mChannel4Output.setLevel(cycleTick, mChannel4Pattern.getSample(mChannel4Frequency.getCycle(), mChannel4Volume.getVolume()));
+            }
+        }
+        mChannel4Frequency.update(tick);
+    }
+
+    void Audio::synthesize(int32_t tick)
+    {
+        // Silent, muted or disabled channels only advance their frequency counters
+        synthesizeSquare(mChannel1Output, mChannel1Length, mChannel1Volume, mChannel1Frequency, mChannel1Pattern, tick);
+        synthesizeSquare(mChannel2Output, mChannel2Length, mChannel2Volume, mChannel2Frequency, mChannel2Pattern, tick);
+        synthesizeWave(tick);
+        synthesizeNoise(tick);
     }
 
     void Audio::updateSequencer(int32_t tick)
     {
+        if (!mAudio.isEnabled())
+        {
+            skipSequencerSteps((tick - mSequencerTick) / mTicksPerSequencerStep);
+            synthesize(tick);
+            return;
+        }
+
         while (tick - mSequencerTick >= static_cast<int32_t>(mTicksPerSequencerStep))
         {
             mSequencerTick += mTicksPerSequencerStep;
-            updateSample(mSequencerTick);
+            synthesize(mSequencerTick);
             sequencerStep();
+            updateOutputs(mSequencerTick);
         }
-        updateSample(tick);
+        synthesize(tick);
     }
 
     void Audio::update(int32_t tick)
@@ -856,6 +1056,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR10 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR11(int32_t tick, uint16_t addr)
@@ -872,6 +1073,7 @@ namespace gb
         update(tick);
         mRegNR11 = value;
         mChannel1Length.onWriteNRx1();
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR12(int32_t tick, uint16_t addr)
@@ -887,6 +1089,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR12 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR13(int32_t tick, uint16_t addr)
@@ -902,6 +1105,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR13 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR14(int32_t tick, uint16_t addr)
@@ -921,6 +1125,7 @@ namespace gb
         mChannel1Volume.onWriteNRx4();
         mChannel1Frequency.onWriteNRx4(tick);
         mChannel1Sweep.onWriteNRx4();
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR21(int32_t tick, uint16_t addr)
@@ -937,6 +1142,7 @@ namespace gb
         update(tick);
         mRegNR21 = value;
         mChannel2Length.onWriteNRx1();
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR22(int32_t tick, uint16_t addr)
@@ -952,6 +1158,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR22 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR23(int32_t tick, uint16_t addr)
@@ -967,6 +1174,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR23 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR24(int32_t tick, uint16_t addr)
@@ -985,6 +1193,7 @@ namespace gb
         mChannel2Length.onWriteNRx4();
         mChannel2Volume.onWriteNRx4();
         mChannel2Frequency.onWriteNRx4(tick);
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR30(int32_t tick, uint16_t addr)
@@ -1000,6 +1209,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR30 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR31(int32_t tick, uint16_t addr)
@@ -1016,6 +1226,7 @@ namespace gb
         update(tick);
         mRegNR31 = value;
         mChannel3Length.onWriteNRx1();
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR32(int32_t tick, uint16_t addr)
@@ -1031,6 +1242,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR32 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR33(int32_t tick, uint16_t addr)
@@ -1046,6 +1258,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR33 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR34(int32_t tick, uint16_t addr)
@@ -1063,6 +1276,7 @@ namespace gb
         mRegNR34 = value;
         mChannel3Length.onWriteNRx4();
         mChannel3Frequency.onWriteNRx4(tick);
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR41(int32_t tick, uint16_t addr)
@@ -1079,6 +1293,7 @@ namespace gb
         update(tick);
         mRegNR41 = value;
         mChannel4Length.onWriteNRx1();
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR42(int32_t tick, uint16_t addr)
@@ -1094,6 +1309,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR42 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR43(int32_t tick, uint16_t addr)
@@ -1109,6 +1325,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR43 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR44(int32_t tick, uint16_t addr)
@@ -1127,6 +1344,7 @@ namespace gb
         mChannel4Length.onWriteNRx4();
         mChannel4Volume.onWriteNRx4();
         mChannel4Frequency.onWriteNRx4(tick);
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR50(int32_t tick, uint16_t addr)
@@ -1142,6 +1360,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR50 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR51(int32_t tick, uint16_t addr)
@@ -1157,14 +1376,23 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR51 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readNR52(int32_t tick, uint16_t addr)
     {
-        EMU_UNUSED(tick);
         EMU_UNUSED(addr);
-        EMU_NOT_IMPLEMENTED();
-        return mRegNR52;
+        update(tick);
+        uint8_t value = (mRegNR52 & NR52_ALL_ON) | NR52_UNUSED_MASK;
+        if (mChannel1Length.getOutputMask())
+            value |= 0x01 << NR52_SOUND_SHIFT;
+        if (mChannel2Length.getOutputMask())
+            value |= 0x02 << NR52_SOUND_SHIFT;
+        if (mChannel3Length.getOutputMask())
+            value |= 0x04 << NR52_SOUND_SHIFT;
+        if (mChannel4Length.getOutputMask())
+            value |= 0x08 << NR52_SOUND_SHIFT;
+        return value;
     }
 
     void Audio::writeNR52(int32_t tick, uint16_t addr, uint8_t value)
@@ -1172,6 +1400,7 @@ namespace gb
         EMU_UNUSED(addr);
         update(tick);
         mRegNR52 = value;
+        updateOutputs(tick);
     }
 
     uint8_t Audio::readWAVE(int32_t tick, uint16_t addr)
@@ -1185,11 +1414,13 @@ namespace gb
     {
         update(tick);
         mRegWAVE[addr - 0x30] = value;
+        updateOutputs(tick);
     }
 
     void Audio::reset()
     {
-        mSoundBufferOffset = 0;
+        mAudio.clear();
+        resetOutputs();
         mRegNR10 = 0x80;
         mRegNR11 = 0xBF;
         mRegNR12 = 0xF3;
@@ -1224,17 +1455,42 @@ namespace gb
         mChannel4Length.reset();
         mChannel4Volume.reset();
         mChannel4Frequency.reset();
+        updateOutputs(mUpdateTick);
     }
 
     void Audio::setSoundBuffer(int16_t* buffer, size_t size)
     {
-        mSoundBuffer = buffer;
-        mSoundBufferSize = static_cast<uint32_t>(size);
-        mSoundBufferOffset = 0;
-        if (buffer && size)
-            mTicksPerSample = mMasterClockFrequency / (60 * mSoundBufferSize) + 1;
-        else
-            mTicksPerSample = 1000000;
+        uint32_t sampleCount = buffer ? static_cast<uint32_t>(size) : 0;
+        mSoundBuffer = sampleCount ? buffer : nullptr;
+        if (sampleCount == mSoundBufferSize)
+            return;
+
+        // The buffer receives a whole frame of samples, so its size defines the sampling rate
+        mSoundBufferSize = sampleCount;
+        createAudio();
+    }
+
+    bool Audio::setSoundFormat(const emu::AudioStage::Format& format)
+    {
+        if (format == mSoundFormat)
+            return true;
+
+        mSoundFormat = format;
+        return createAudio();
+    }
+
+    bool Audio::createAudio()
+    {
+        // Stereo output gets one source per terminal
+        mAudio.destroy();
+        resetOutputs();
+        if (mSoundBufferSize)
+        {
+            EMU_VERIFY(mAudio.create(mTicksPerFrame, mSoundBufferSize, mSoundFormat.channelCount, mSoundFormat));
+            resetOutputs();
+            updateOutputs(mUpdateTick);
+        }
+        return true;
     }
 
     void Audio::serialize(emu::ISerializer& serializer)
@@ -1278,5 +1534,7 @@ namespace gb
             .value("Channel4Length", mChannel4Length)
             .value("Channel4Volume", mChannel4Volume)
             .value("Channel4Frequency", mChannel4Frequency);
+        if (serializer.isReading())
+            updateOutputs(mUpdateTick);
     }
 }
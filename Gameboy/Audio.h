@@ -1,5 +1,6 @@
 #pragma once
 
+#include <Core/AudioStage.h>
 #include <Core/Clock.h>
 #include <Core/Core.h>
 #include <Core/RegisterBank.h>
@@ -12,10 +13,11 @@ namespace gb
     public:
         Audio();
         ~Audio();
-        bool create(emu::Clock& clock, uint32_t masterClockFrequency, uint32_t masterClockDivider, emu::RegisterBank& registers);
+        bool create(emu::Clock& clock, uint32_t masterClockFrequency, uint32_t masterClockDivider, uint32_t masterClockPerFrame, emu::RegisterBank& registers);
         void destroy();
         void reset();
         void setSoundBuffer(int16_t* buffer, size_t size);
+        bool setSoundFormat(const emu::AudioStage::Format& format);
         void serialize(emu::ISerializer& serializer);
 
     private:
@@ -97,9 +99,12 @@ namespace gb
         void resetClock();
         void advanceClock(int32_t tick);
         void setDesiredTicks(int32_t tick);
-        void sampleStep(int32_t tick);
         void sequencerStep();
-        void updateSample(int32_t tick);
+        void skipSequencerSteps(uint32_t steps);
+        void resetOutputs();
+        bool createAudio();
+        void updateOutputs(int32_t tick);
+        void synthesize(int32_t tick);
         void updateSequencer(int32_t tick);
         void update(int32_t tick);
 
@@ -150,6 +155,29 @@ namespace gb
 
         class Frequency;
 
+        class Output
+        {
+        public:
+            Output();
+            void reset(emu::AudioStage& audio);
+            void setLevel(int32_t tick, int32_t level);
+            void setGain(int32_t tick, uint32_t source, int32_t gain);
+
+            bool isActive() const
+            {
+                return (mGain[0] || mGain[1]) && mBlip[0]->isEnabled();
+            }
+
+        private:
+            void update(int32_t tick);
+
+            emu::BlipBuffer*    mBlip[2];
+            uint32_t            mSourceCount;
+            int32_t             mLevel;
+            int32_t             mGain[2];
+            int32_t             mAmplitude[2];
+        };
+
         class Sweep
         {
         public:
@@ -159,6 +187,11 @@ namespace gb
             void step();
             void serialize(emu::ISerializer& serializer);
 
+            bool isEnabled() const
+            {
+                return mEnabled;
+            }
+
         private:
             void reload();
             void reloadSweep();
@@ -179,6 +212,7 @@ namespace gb
             void onWriteNRx1();
             void onWriteNRx4();
             void step();
+            void skip(uint32_t steps);
             void serialize(emu::ISerializer& serializer);
 
             uint32_t getOutputMask() const
@@ -203,6 +237,7 @@ namespace gb
             void reset();
             void onWriteNRx4();
             void step();
+            void skip(uint32_t steps);
             void serialize(emu::ISerializer& serializer);
 
             uint32_t getVolume() const
@@ -226,6 +261,7 @@ namespace gb
             bool initClock(int32_t clockDivider);
             void advanceClock(int32_t tick);
             void update(int32_t tick);
+            int32_t getCycleTick(uint32_t cycles) const;
             void serialize(emu::ISerializer& serializer);
 
             uint32_t getCycle() const
@@ -286,6 +322,7 @@ namespace gb
         public:
             SquarePattern(const uint8_t& NRx1);
             int32_t getSample(uint32_t cycle, uint32_t volume) const;
+            uint32_t getRun(uint32_t cycle) const;
 
         private:
             const uint8_t&  mNRx1;
@@ -296,6 +333,7 @@ namespace gb
         public:
             WavePattern(const uint8_t& NRx0, const uint8_t& NRx2, const uint8_t* wave);
             int32_t getSample(uint32_t cycle) const;
+            bool isMuted() const;
 
         private:
             const uint8_t&  mNRx0;
@@ -314,18 +352,21 @@ namespace gb
             const uint8_t&  mNRx4;
         };
 
+        void synthesizeSquare(Output& output, const Length& length, const Volume& volume, Frequency& frequency, const SquarePattern& pattern, int32_t tick);
+        void synthesizeWave(int32_t tick);
+        void synthesizeNoise(int32_t tick);
+
         emu::Clock*             mClock;
         ClockListener           mClockListener;
         RegisterAccessors       mRegisterAccessors;
         int16_t*                mSoundBuffer;
         uint32_t                mSoundBufferSize;
-        uint32_t                mSoundBufferOffset;
-        uint32_t                mMasterClockFrequency;
-        uint32_t                mTicksPerSample;
+        emu::AudioStage::Format mSoundFormat;
+        emu::AudioStage         mAudio;
+        uint32_t                mTicksPerFrame;
         uint32_t                mTicksPerSequencerStep;
         int32_t                 mDesiredTick;
         int32_t                 mUpdateTick;
-        int32_t                 mSampleTick;
         int32_t                 mSequencerTick;
         uint8_t                 mSequencerStep;
         uint8_t                 mRegNR10;
@@ -350,6 +391,10 @@ namespace gb
         uint8_t                 mRegNR51;
         uint8_t                 mRegNR52;
         uint8_t                 mRegWAVE[16];
+        Output                  mChannel1Output;
+        Output                  mChannel2Output;
+        Output                  mChannel3Output;
+        Output                  mChannel4Output;
         Length                  mChannel1Length;
         Volume                  mChannel1Volume;
         Frequency               mChannel1Frequency;
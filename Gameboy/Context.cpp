@@ -1,7 +1,11 @@
 #include <Core/Clock.h>
+#include <Core/Log.h>
 #include <Core/MemoryBus.h>
 #include <Core/RegisterBank.h>
 #include <Core/Serializer.h>
+#include <Core/Snapshot.h>
+#include <Core/StateHash.h>
+#include <Core/TrackedBuffer.h>
 #include "Audio.h"
 #include "CpuZ80.h"
 #include "Display.h"
@@ -16,6 +20,10 @@
 
 namespace
 {
+    // States before version 2 had neither, their first value is the clock target tick
+    static const uint32_t STATE_TAG = 0x54534247; // 'GBST'
+    static const uint32_t STATE_VERSION = 2;
+
     static const uint32_t MEM_SIZE_LOG2 = 16;
     static const uint32_t MEM_SIZE = 1 << MEM_SIZE_LOG2;
     static const uint32_t MEM_PAGE_SIZE_LOG2 = 10;
@@ -46,6 +54,17 @@ namespace
     static const uint8_t KEY1_CURRENT_SPEED = 0x80;
 
     static const uint8_t SVBK_BANK_MASK = 0x07;
+
+    // The display and the timer were rewritten in version 2, they convert the older layout themselves
+    template <typename T>
+    void serializeVersioned(emu::ISerializer& serializer, const char* name, T& item, uint32_t version)
+    {
+        if (serializer.nodeBegin(name))
+        {
+            item.serialize(serializer, version);
+            serializer.nodeEnd();
+        }
+    }
 }
 
 namespace gb_context
@@ -65,6 +84,7 @@ namespace gb_context
 
         void initialize()
         {
+            mRom = nullptr;
             mMapper = nullptr;
         }
 
@@ -82,6 +102,7 @@ namespace gb_context
 
         bool create(const gb::Rom& rom, gb::Model model)
         {
+            mRom = &rom;
             mModel = model;
 
             bool isGBC = mModel >= gb::Model::GBC;
@@ -135,7 +156,7 @@ namespace gb_context
             EMU_VERIFY(mDisplay.create(displayConfig, mClock, fixedClockDivider, mMemory, mInterrupts, mRegistersIO));
             EMU_VERIFY(mJoypad.create(mClock, mInterrupts, mRegistersIO));
             EMU_VERIFY(mTimer.create(mClock, masterClockFrequency, fixedClockDivider, mVariableClockDivider, mInterrupts, mRegistersIO));
-            EMU_VERIFY(mAudio.create(mClock, masterClockFrequency, fixedClockDivider, mRegistersIO));
+            EMU_VERIFY(mAudio.create(mClock, masterClockFrequency, fixedClockDivider, mTicksPerFrame, mRegistersIO));
 
             if (mModel >= gb::Model::GBC)
             {
@@ -178,6 +199,34 @@ namespace gb_context
             delete this;
         }
 
+        virtual emu::IContext* clone() override
+        {
+            auto context = gb::Context::create(*mRom, mModel);
+            if (context && !cloneInto(*context))
+            {
+                context->dispose();
+                context = nullptr;
+            }
+            return context;
+        }
+
+        virtual bool cloneInto(emu::IContext& context) override
+        {
+            // Each context points its memory maps at its own buffers, only the state needs to be copied
+            auto& target = static_cast<ContextImpl&>(context);
+            if (&target == this)
+                return true;
+            EMU_VERIFY((target.mRom == mRom) && (target.mModel == mModel));
+            EMU_VERIFY(mCloneSnapshot.save(*this));
+            EMU_VERIFY(target.reset());
+            return mCloneSnapshot.load(target);
+        }
+
+        virtual bool getStateHash(uint64_t& hash) override
+        {
+            return mStateHasher.compute(*this, hash);
+        }
+
         virtual bool getDisplayInfo(DisplayInfo& info) override
         {
             info = DisplayInfo();
@@ -196,7 +245,7 @@ namespace gb_context
             mVariableClockDivider = 1;
             if (mModel >= gb::Model::GBC)
                 mVariableClockDivider = 2;
-            setVariableClockDivider(mVariableClockDivider);
+            setVariableClockDivider(0, mVariableClockDivider);
 
             mMemoryReadAccessor.reset();
             mMemoryWriteAccessor.reset();
@@ -213,11 +262,11 @@ namespace gb_context
             return true;
         }
 
-        void setVariableClockDivider(uint32_t variableClockDivider)
+        void setVariableClockDivider(int32_t tick, uint32_t variableClockDivider)
         {
             mVariableClockDivider = variableClockDivider;
             mCpu.setClockDivider(variableClockDivider);
-            mTimer.setVariableClockDivider(variableClockDivider);
+            mTimer.setVariableClockDivider(tick, variableClockDivider);
         }
 
         virtual bool setController(uint32_t index, uint32_t buttons) override
@@ -232,9 +281,35 @@ namespace gb_context
             return true;
         }
 
-        virtual bool setRenderBuffer(void* surface, size_t pitch) override
+        virtual bool setSoundFormat(const emu::AudioStage::Format& format) override
+        {
+            return mAudio.setSoundFormat(format);
+        }
+
+        virtual bool setRenderBuffer(void* surface, size_t pitch, emu::PixelFormat format = emu::PixelFormat::RGBA8888) override
         {
-            mDisplay.setRenderSurface(surface, pitch);
+            mDisplay.setRenderSurface(surface, pitch, format);
+            return true;
+        }
+
+        virtual bool setObservation(const emu::Observation::Config& config) override
+        {
+            return mDisplay.setObservation(config);
+        }
+
+        virtual bool getObservation(void* buffer, size_t size) override
+        {
+            return mDisplay.getObservation().read(buffer, size);
+        }
+
+        virtual bool getDirtyLines(uint32_t& dirtyCount, uint8_t* flags, size_t count) override
+        {
+            return mDisplay.getDirtyLines().read(dirtyCount, flags, count);
+        }
+
+        virtual bool enableDirtyLines(bool enable) override
+        {
+            mDisplay.enableDirtyLines(enable);
             return true;
         }
 
@@ -260,6 +335,11 @@ namespace gb_context
             mMemory.write8(mMemoryWriteAccessor, mClock.getDesiredTicks(), addr, value);
         }
 
+        virtual void setDisplayKernels(const gb::DisplayKernels& kernels)
+        {
+            mDisplay.setKernels(kernels);
+        }
+
         virtual bool serializeGameData(emu::ISerializer& serializer) override
         {
             if (mMapper)
@@ -269,9 +349,21 @@ namespace gb_context
 
         virtual bool serializeGameState(emu::ISerializer& serializer) override
         {
-            uint32_t version = 1;
-            EMU_UNUSED(version);
-            mClock.serialize(serializer);
+            // Version 1 had no header, a binary reader gets its clock target in place of the tag
+            uint32_t tag = serializer.isReading() ? 0 : STATE_TAG;
+            uint32_t version = STATE_VERSION;
+            serializer.value("Tag", tag);
+            if (tag == STATE_TAG)
+                serializer.value("Version", version);
+            else
+                version = 1;
+            if (version > STATE_VERSION)
+            {
+                emu::Log::printf(emu::Log::Type::Error, "Game state version %u is not supported\n", version);
+                return false;
+            }
+
+            mClock.serialize(serializer, version >= 2);
             mCpu.serialize(serializer);
             if (mMapper)
                 mMapper->serializeGameState(serializer);
@@ -283,15 +375,15 @@ namespace gb_context
                 .value("RegKEY1", mRegKEY1)
                 .value("RegSVBK", mRegSVBK)
                 .value("Interrupts", mInterrupts)
-                .value("GameLink", mGameLink)
-                .value("Display", mDisplay)
-                .value("Joypad", mJoypad)
-                .value("Timer", mTimer)
-                .value("Audio", mAudio);
+                .value("GameLink", mGameLink);
+            serializeVersioned(serializer, "Display", mDisplay, version);
+            serializer.value("Joypad", mJoypad);
+            serializeVersioned(serializer, "Timer", mTimer, version);
+            serializer.value("Audio", mAudio);
             if (serializer.isReading())
             {
                 updateMemoryMap();
-                setVariableClockDivider(mVariableClockDivider);
+                setVariableClockDivider(mClock.getDesiredTicks(), mVariableClockDivider);
             }
             return true;
         }
@@ -367,10 +459,10 @@ namespace gb_context
 
         bool updateMemoryMap()
         {
-            mMemoryWRAM[0].setReadWriteMemory(mWRAM.data());
-            mMemoryWRAM[1].setReadWriteMemory(mBankMapWRAM[mBankWRAM]);
-            mMemoryWRAM[2].setReadWriteMemory(mWRAM.data());
-            mMemoryWRAM[3].setReadWriteMemory(mBankMapWRAM[mBankWRAM]);
+            mMemoryWRAM[0].setReadWriteMemory(mWRAM.data(), mWRAM);
+            mMemoryWRAM[1].setReadWriteMemory(mBankMapWRAM[mBankWRAM], mWRAM);
+            mMemoryWRAM[2].setReadWriteMemory(mWRAM.data(), mWRAM);
+            mMemoryWRAM[3].setReadWriteMemory(mBankMapWRAM[mBankWRAM], mWRAM);
             mMemoryHRAM.setReadWriteMemory(mHRAM.data());
             return true;
         }
@@ -413,7 +505,7 @@ namespace gb_context
                 {
                     mRegKEY1 &= ~KEY1_SPEED_SWITCH;
                     mRegKEY1 ^= KEY1_CURRENT_SPEED;
-                    setVariableClockDivider((mVariableClockDivider == 1) ? 2 : 1);
+                    setVariableClockDivider(tick, (mVariableClockDivider == 1) ? 2 : 1);
                     mCpu.resume(tick);
                 }
                 else
@@ -428,6 +520,7 @@ namespace gb_context
             mCpu.resume(tick);
         }
 
+        const gb::Rom*              mRom;
         gb::Model                   mModel;
         emu::Clock                  mClock;
         emu::MemoryBus              mMemory;
@@ -439,7 +532,7 @@ namespace gb_context
         StopListener                mStopListener;
         MEM_ACCESS_READ_WRITE       mMemoryWRAM[4];
         MEM_ACCESS_READ_WRITE       mMemoryHRAM;
-        emu::Buffer                 mWRAM;
+        emu::TrackedBuffer          mWRAM;
         emu::Buffer                 mHRAM;
         uint32_t                    mVariableClockDivider;
         uint32_t                    mTicksPerFrame;
@@ -455,6 +548,8 @@ namespace gb_context
         gb::Joypad                  mJoypad;
         gb::Timer                   mTimer;
         gb::Audio                   mAudio;
+        emu::Snapshot               mCloneSnapshot;
+        emu::StateHasher            mStateHasher;
     };
 }
 
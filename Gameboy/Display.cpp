@@ -1,6 +1,7 @@
 #include <Core/RegisterBank.h>
 #include <Core/Serializer.h>
 #include "Display.h"
+#include "DisplayKernels.h"
 #include "Interrupts.h"
 #include <algorithm>
 
@@ -12,6 +13,13 @@ namespace
     static const uint32_t VRAM_SIZE_GB = 0x2000;
     static const uint32_t VRAM_SIZE_GBC = 0x4000;
 
+    static const uint32_t TILE_SIZE = 16;
+    static const uint32_t TILE_DATA_SIZE = 0x1800;
+    static const uint32_t TILE_COUNT = TILE_DATA_SIZE / TILE_SIZE;
+    static const uint32_t TILE_CACHE_ROW_SIZE = 16; // Decoded row followed by the same row flipped horizontally
+    static const uint32_t TILE_CACHE_FLIP_X = 8;
+    static const uint32_t TILE_CACHE_TILE_SIZE = TILE_CACHE_ROW_SIZE * 8;
+
     static const uint32_t OAM_SIZE = 0xa0;
 
     static const uint8_t LCDC_LCD_ENABLE = 0x80;
@@ -50,10 +58,12 @@ namespace
     static const uint32_t RENDER_ROW_STORAGE = DISPLAY_SIZE_X + 16;
     static const uint32_t RENDER_TILE_COUNT = DISPLAY_SIZE_X / 8;
     static const uint32_t RENDER_TILE_STORAGE = RENDER_TILE_COUNT + 1;
+    static const uint32_t REGISTER_LOG_CAPACITY = DISPLAY_SIZE_Y * 8;
 
     static const uint32_t PALETTE_BASE_BGP = 0;
     static const uint32_t PALETTE_BASE_OBP = 0x20;
     static const uint32_t PALETTE_SIZE = 64;
+    static const uint32_t PALETTE_STORAGE_SIZE = PALETTE_SIZE * 2; // Upper half mirrors the palette for pixels flagged with background priority
 
     static const uint32_t PALETTE_MONO_BASE_BGP = PALETTE_BASE_BGP;
     static const uint32_t PALETTE_MONO_BASE_OBP0 = PALETTE_BASE_OBP;
@@ -89,14 +99,9 @@ namespace
     static const uint16_t HDMA_DST_BASE = 0x8000;
     static const uint16_t HDMA_DST_MASK = 0x1ff0;
     static const uint16_t HDMA_DST_FINAL_MASK = 0x1fff;
+    static const uint16_t HDMA_SRC_MASK = 0xfff0;
+    static const uint16_t HDMA_BLOCK_SIZE = 0x10;
 
-    static const uint8_t INT_MODE_0 = 0x01;
-    static const uint8_t INT_MODE_1 = 0x02;
-    static const uint8_t INT_MODE_2 = 0x04;
-    static const uint8_t INT_LINE = 0x08;
-    static const uint8_t INT_VBLANK = 0x10;
-    static const uint8_t INT_ALL = INT_MODE_0 | INT_MODE_1 | INT_MODE_2 | INT_LINE | INT_VBLANK;
-    static const uint8_t INT_NONE = 0x00;
 
     static const uint8_t kMonoPalette[4][4] =
     {
@@ -106,24 +111,6 @@ namespace
         { 0x00, 0x00, 0x00, 0x00 },
     };
 
-    static uint8_t patternMask[256][16];
-
-    bool initializePatternTable()
-    {
-        for (uint32_t pattern = 0; pattern < 256; ++pattern)
-        {
-            for (uint32_t bit = 0; bit < 8; ++bit)
-            {
-                uint8_t mask = ((pattern << bit) & 0x80) ? 0xff : 0x00;
-                patternMask[pattern][bit] = mask;
-                patternMask[pattern][15 - bit] = mask;
-            }
-        }
-        return true;
-    }
-
-    bool patternTableInitialized = initializePatternTable();
-
     float saturate(float value)
     {
         if (value < 0.0f)
@@ -281,6 +268,12 @@ namespace gb
         mInterrupts             = nullptr;
         mSurface                = nullptr;
         mPitch                  = 0;
+        mPixelFormat            = emu::PixelFormat::RGBA8888;
+        mPixelSize              = 4;
+        mPaletteHash            = 0;
+        mPaletteMono            = 0;
+        mRegisterLogPos         = 0;
+        mKernels                = &DisplayKernels::getDefault();
         mRenderedLine           = 0;
         mRenderedLineFirstTick  = 0;
         mRenderedTick           = 0;
@@ -313,19 +306,11 @@ namespace gb
         mRegHDMA[2]             = 0x00;
         mRegHDMA[3]             = 0x00;
         mRegHDMA[4]             = 0x00;
-        mActiveSprites          = 0;
         mSortedSprites = false;
         mCachedPalette = false;
         resetClock();
-        mLineIntTick = 0;
-        mLineIntLastLY = 0;
-        mLineIntLastLYC = 0;
-        mLineIntLastEnabled = false;
-
-        mIntUpdate = INT_NONE;
-        mIntEnabled = INT_NONE;
-        mIntSync = INT_NONE;
-        mIntPredictionMode0 = 0;
+        mStatIntTick = INT32_MAX;
+        mHDMATick = INT32_MAX;
     }
 
     bool Display::create(Config& config, emu::Clock& clock, uint32_t master_clock_divider, emu::MemoryBus& memory, Interrupts& interrupts, emu::RegisterBank& registers)
@@ -345,11 +330,19 @@ namespace gb
 
         bool isGBC = mConfig.model >= gb::Model::GBC;
         mVRAM.resize(isGBC ? VRAM_SIZE_GBC : VRAM_SIZE_GB, 0);
+        uint32_t tileCount = static_cast<uint32_t>(mVRAM.size() / VRAM_BANK_SIZE) * TILE_COUNT;
+        mTileCache.resize(tileCount * TILE_CACHE_TILE_SIZE, 0);
+        mTileDirty.resize(tileCount, 0);
+        mTileDirtyList.reserve(tileCount);
+        mRegisterLog.reserve(REGISTER_LOG_CAPACITY);
+        invalidateTiles();
         EMU_VERIFY(updateMemoryMap());
         EMU_VERIFY(memory.addMemoryRange(VRAM_BANK_START, VRAM_BANK_END, mMemoryVRAM));
 
         mOAM.resize(OAM_SIZE, 0);
-        mOAMOrder.resize(SPRITE_CAPACITY);
+        mLineSprites.resize(DISPLAY_SIZE_Y * SPRITE_LINE_LIMIT, 0);
+        mLineSpriteCount.resize(DISPLAY_SIZE_Y, 0);
+        mLineSpriteTotal.resize(DISPLAY_SIZE_Y, 0);
         mMemoryOAM.read.setReadMemory(mOAM.data());
         mMemoryOAM.write.setWriteMethod(&onWriteOAM, this);
         EMU_VERIFY(memory.addMemoryRange(0xfe00, 0xfe9f, mMemoryOAM));
@@ -357,7 +350,8 @@ namespace gb
         mMemoryNotUsable.write.setWriteMethod(&onWriteNotUsable, this, 0);
         EMU_VERIFY(memory.addMemoryRange(MEMORY_BUS::PAGE_TABLE_WRITE, 0xfea0, 0xfeff, mMemoryNotUsable.write));
 
-        mPalette.resize(PALETTE_SIZE, *reinterpret_cast<const uint32_t*>(&kMonoPalette[0]));
+        mPalette.resize(PALETTE_STORAGE_SIZE, *reinterpret_cast<const uint32_t*>(&kMonoPalette[0]));
+        EMU_VERIFY(mDirtyLines.create(DISPLAY_SIZE_Y));
 
         EMU_VERIFY(mRegisterAccessors.read.LCDC.create(registers, 0x40, *this, &Display::readLCDC));
         EMU_VERIFY(mRegisterAccessors.read.STAT.create(registers, 0x41, *this, &Display::readSTAT));
@@ -410,10 +404,17 @@ namespace gb
 
     void Display::destroy()
     {
-        mOAMOrder.clear();
+        mLineSprites.clear();
+        mLineSpriteCount.clear();
+        mLineSpriteTotal.clear();
+        mRegisterLog.clear();
         mOAM.clear();
         mVRAM.clear();
+        mTileCache.clear();
+        mTileDirty.clear();
+        mTileDirtyList.clear();
         mClockListener.destroy();
+        mDirtyLines.destroy();
         mRegisterAccessors = RegisterAccessors();
         initialize();
     }
@@ -446,7 +447,10 @@ namespace gb
         mLineFirstTick -= tick;
         mLineTick -= tick;
         mRasterTick -= tick;
-        mIntPredictionMode0 -= tick;
+        if (mStatIntTick != INT32_MAX)
+            mStatIntTick -= tick;
+        if (mHDMATick != INT32_MAX)
+            mHDMATick -= tick;
     }
 
     void Display::setDesiredTicks(int32_t tick)
@@ -456,7 +460,8 @@ namespace gb
 
     bool Display::updateMemoryMap()
     {
-        mMemoryVRAM.setReadWriteMemory(mVRAM.data() + mBankVRAM * VRAM_BANK_SIZE);
+        mMemoryVRAM.read.setReadMemory(mVRAM.data() + mBankVRAM * VRAM_BANK_SIZE);
+        mMemoryVRAM.write.setWriteMethod(&onWriteVRAM, this);
         return true;
     }
 
@@ -464,15 +469,15 @@ namespace gb
     {
         updateMemoryMap();
         mClock->addEvent(onVBlankStart, this, mVBlankStartTick);
+        if (mStatIntTick != INT32_MAX)
+            mClock->addEvent(onStatInterrupt, this, mStatIntTick);
+        if (mHDMATick != INT32_MAX)
+            mClock->addEvent(onHDMA, this, mHDMATick);
         mRasterLine -= DISPLAY_LINE_COUNT;
         mRenderedLine = 0;
         mRenderedLineFirstTick = 0;
         mRenderedTick = 0;
-        mLineIntLastEnabled = false;
-        updateLineInterrupt(mSimulatedTick);
-
-        mIntSync = INT_ALL;
-        updateRasterPos(mSimulatedTick);
+        resetRegisterLog();
     }
 
     uint8_t Display::readLCDC(int32_t tick, uint16_t addr)
@@ -488,7 +493,10 @@ namespace gb
         uint8_t modified = mRegLCDC ^ value;
         if (modified)
         {
-            render(tick);
+            // Sprite buckets and raster timing are not logged, draw the lines preceding the change
+            if (modified & (LCDC_LCD_ENABLE | LCDC_SPRITES_SIZE))
+                render(tick);
+            logRegister(tick, &RenderRegisters::LCDC, value);
             bool spriteSizeChanged = ((mRegLCDC ^ value) & LCDC_SPRITES_SIZE) != 0;
             if (spriteSizeChanged)
                 mSortedSprites = false;
@@ -502,9 +510,8 @@ namespace gb
                         mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::VBlank);
                 }
 
-                updateLineInterrupt(tick);
-                mIntUpdate = INT_ALL;
-                updateRasterPos(tick);
+                scheduleStatInterrupt(tick);
+                scheduleHDMA(tick);
             }
         }
     }
@@ -525,21 +532,8 @@ namespace gb
         uint8_t modified = mRegSTAT ^ value;
         if (modified)
         {
-            updateRasterPos(tick);
             mRegSTAT = value;
-            if (modified & STAT_OAM_INT)
-            {
-                EMU_NOT_IMPLEMENTED();
-            }
-            if (modified & STAT_VBLANK_INT)
-            {
-                EMU_NOT_IMPLEMENTED();
-            }
-            if (modified & STAT_HBLANK_INT)
-                mIntUpdate |= INT_MODE_0;
-            if (modified & STAT_LYC_LY_INT)
-                updateLineInterrupt(tick);
-            updateRasterPos(tick);
+            scheduleStatInterrupt(tick);
         }
     }
 
@@ -555,7 +549,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegSCY != value)
         {
-            render(tick);
+            logRegister(tick, &RenderRegisters::SCY, value);
             mRegSCY = value;
         }
     }
@@ -572,7 +566,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegSCX != value)
         {
-            render(tick);
+            logRegister(tick, &RenderRegisters::SCX, value);
             mRegSCX = value;
         }
     }
@@ -608,7 +602,7 @@ namespace gb
         if (mRegLYC != value)
         {
             mRegLYC = value;
-            updateLineInterrupt(tick);
+            scheduleStatInterrupt(tick);
         }
     }
 
@@ -624,10 +618,18 @@ namespace gb
         render(tick);
         uint16_t read_addr = value << 8;
 
-        for (uint8_t index = 0; index < DMA_SIZE; ++index)
+        const uint8_t* src = mMemory->getReadMemory(mMemoryDMAReadAccessor, read_addr, DMA_SIZE);
+        if (src)
+        {
+            memcpy(mOAM.data(), src, DMA_SIZE);
+        }
+        else
         {
-            uint8_t dma_value = mMemory->read8(mMemoryDMAReadAccessor, tick, read_addr + index);
-            mOAM[index] = dma_value;
+            for (uint8_t index = 0; index < DMA_SIZE; ++index)
+            {
+                uint8_t dma_value = mMemory->read8(mMemoryDMAReadAccessor, tick, read_addr + index);
+                mOAM[index] = dma_value;
+            }
         }
         mSortedSprites = false;
         mRegDMA = value;
@@ -645,8 +647,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegBGP != value)
         {
-            mCachedPalette = false;
-            render(tick);
+            logRegister(tick, &RenderRegisters::BGP, value);
             mRegBGP = value;
         }
     }
@@ -663,8 +664,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegOBP0 != value)
         {
-            mCachedPalette = false;
-            render(tick);
+            logRegister(tick, &RenderRegisters::OBP0, value);
             mRegOBP0 = value;
         }
     }
@@ -681,8 +681,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegOBP1 != value)
         {
-            mCachedPalette = false;
-            render(tick);
+            logRegister(tick, &RenderRegisters::OBP1, value);
             mRegOBP1 = value;
         }
     }
@@ -699,7 +698,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegWY != value)
         {
-            render(tick);
+            logRegister(tick, &RenderRegisters::WY, value);
             mRegWY = value;
         }
     }
@@ -716,7 +715,7 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegWX != value)
         {
-            render(tick);
+            logRegister(tick, &RenderRegisters::WX, value);
             mRegWX = value;
         }
     }
@@ -818,32 +817,120 @@ namespace gb
     void Display::writeHDMA(int32_t tick, uint16_t addr, uint8_t value)
     {
         uint32_t index = addr - 0x51;
-        mRegHDMA[index] = value;
-        if (index == 4)
+        if (index < 4)
         {
-            if (!mConfig.fastHDMA)
-            {
-                EMU_NOT_IMPLEMENTED();
-            }
+            mRegHDMA[index] = value;
+            return;
+        }
+
+        if (!mConfig.fastHDMA)
+        {
+            EMU_NOT_IMPLEMENTED();
+        }
 
-            if (value & HDMA5_HBLANK)
+        if (isHDMAActive())
+        {
+            // Writing with bit 7 cleared stops the HBlank transfer, the remaining length stays readable
+            if ((value & HDMA5_HBLANK) == 0)
             {
-                EMU_NOT_IMPLEMENTED();
+                mRegHDMA[4] |= HDMA5_HBLANK;
+                mHDMATick = INT32_MAX;
+                return;
             }
+        }
 
-            render(tick);
+        if (value & HDMA5_HBLANK)
+        {
+            // One block is transferred at the start of each HBlank
+            mRegHDMA[4] = value & HDMA5_SIZE_MASK;
+            scheduleHDMA(tick);
+            return;
+        }
 
-            uint32_t size = ((value & HDMA5_SIZE_MASK) + 1) << 4;
-            uint16_t src = (mRegHDMA[0] << 8) | mRegHDMA[1];
-            uint16_t dst = (mRegHDMA[2] << 8) | mRegHDMA[3];
-            dst = (dst & HDMA_DST_MASK) + HDMA_DST_BASE;
-            for (uint32_t pos = 0; pos < size; ++pos)
-            {
-                uint8_t localValue = mMemory->read8(mMemoryHDMAReadAccessor, tick, static_cast<uint16_t>(src + pos));
-                auto dstFinal = ((dst + pos) & HDMA_DST_FINAL_MASK) + HDMA_DST_BASE;
-                mMemory->write8(mMemoryHDMAWriteAccessor, tick, static_cast<uint16_t>(dstFinal), localValue);
-            }
+        // General purpose DMA: transfer everything in the same tick
+        render(tick);
+        uint32_t blockCount = (value & HDMA5_SIZE_MASK) + 1;
+        for (uint32_t block = 0; block < blockCount; ++block)
+            transferHDMABlock(tick);
+        mRegHDMA[4] = HDMA5_DONE;
+        mHDMATick = INT32_MAX;
+    }
+
+    bool Display::isHDMAActive() const
+    {
+        return (mRegHDMA[4] & HDMA5_HBLANK) == 0;
+    }
+
+    void Display::scheduleHDMA(int32_t tick)
+    {
+        mHDMATick = INT32_MAX;
+        if (!isHDMAActive() || !(mRegLCDC & LCDC_LCD_ENABLE))
+            return;
+
+        mHDMATick = getNextMode0Tick(tick);
+        mClock->addEvent(onHDMA, this, mHDMATick);
+    }
+
+    void Display::onHDMA(int32_t tick)
+    {
+        // Events are never removed from the clock, ignore the ones from a cancelled or rescheduled transfer
+        if ((tick != mHDMATick) || !isHDMAActive())
+            return;
+
+        render(tick);
+        transferHDMABlock(tick);
+        if (mRegHDMA[4]-- == 0)
+        {
             mRegHDMA[4] = HDMA5_DONE;
+            mHDMATick = INT32_MAX;
+            return;
+        }
+        scheduleHDMA(tick);
+    }
+
+    void Display::transferHDMABlock(int32_t tick)
+    {
+        uint16_t src = ((mRegHDMA[0] << 8) | mRegHDMA[1]) & HDMA_SRC_MASK;
+        uint16_t dst = ((mRegHDMA[2] << 8) | mRegHDMA[3]) & HDMA_DST_MASK;
+
+        // Blocks are aligned on 16 bytes so they never straddle a bus page nor a tile
+        uint8_t block[HDMA_BLOCK_SIZE];
+        const uint8_t* data = mMemory->getReadMemory(mMemoryHDMAReadAccessor, src, HDMA_BLOCK_SIZE);
+        if (!data)
+        {
+            for (uint32_t pos = 0; pos < HDMA_BLOCK_SIZE; ++pos)
+                block[pos] = mMemory->read8(mMemoryHDMAReadAccessor, tick, static_cast<uint16_t>(src + pos));
+            data = block;
+        }
+
+        uint8_t* vram = mVRAM.data() + mBankVRAM * VRAM_BANK_SIZE + dst;
+        if (memcmp(vram, data, HDMA_BLOCK_SIZE) != 0)
+        {
+            memcpy(vram, data, HDMA_BLOCK_SIZE);
+            mVRAM.markDirty(vram);
+            if (dst < TILE_DATA_SIZE)
+                invalidateTile(mBankVRAM * TILE_COUNT + (dst / TILE_SIZE));
+        }
+
+        src += HDMA_BLOCK_SIZE;
+        dst = (dst + HDMA_BLOCK_SIZE) & HDMA_DST_FINAL_MASK;
+        mRegHDMA[0] = static_cast<uint8_t>(src >> 8);
+        mRegHDMA[1] = static_cast<uint8_t>(src);
+        mRegHDMA[2] = static_cast<uint8_t>((dst + HDMA_DST_BASE) >> 8);
+        mRegHDMA[3] = static_cast<uint8_t>(dst);
+    }
+
+    void Display::writeVRAM(int32_t tick, uint16_t addr, uint8_t value)
+    {
+        uint32_t offset = mBankVRAM * VRAM_BANK_SIZE + addr;
+        if (mVRAM[offset] != value)
+        {
+            // The lines before the write are drawn with the old tiles and maps, the tile cache included
+            render(tick);
+            mVRAM[offset] = value;
+            mVRAM.markDirty(&mVRAM[offset]);
+            if (addr < TILE_DATA_SIZE)
+                invalidateTile(mBankVRAM * TILE_COUNT + (addr / TILE_SIZE));
         }
     }
 
@@ -852,8 +939,10 @@ namespace gb
         if (mOAM[addr] != value)
         {
             render(tick);
+            uint8_t oldValue = mOAM[addr];
             mOAM[addr] = value;
-            mSortedSprites = false;
+            if (mSortedSprites)
+                updateSprite(static_cast<uint8_t>(addr >> 2), addr & 3, oldValue);
         }
     }
 
@@ -861,7 +950,6 @@ namespace gb
     {
         mMemoryDMAReadAccessor.reset();
         mMemoryHDMAReadAccessor.reset();
-        mMemoryHDMAWriteAccessor.reset();
         mRegLCDC = 0x91;
         mRegSTAT = 0x00;
         mRegSCY  = 0x00;
@@ -881,19 +969,15 @@ namespace gb
         mRegHDMA[4] = 0xff;
         mSortedSprites = false;
         mCachedPalette = false;
-        mLineIntTick = 0;
-        mLineIntLastLY = 0;
-        mLineIntLastLYC = 0;
-        mLineIntLastEnabled = false;
-
-        mIntUpdate = INT_NONE;
-        mIntEnabled = INT_NONE;
-        mIntSync = INT_NONE;
-        mIntPredictionMode0 = 0;
+        mStatIntTick = INT32_MAX;
+        mHDMATick = INT32_MAX;
+        resetRegisterLog();
     }
 
-    void Display::serialize(emu::ISerializer& serializer)
+    void Display::serialize(emu::ISerializer& serializer, uint32_t version)
     {
+        // Version 1 tracked the STAT interrupt line by line, that state is dropped and the interrupt predicted again
+        int32_t lineIntTick = 0;
         serializer
             .value("VRAM", mVRAM)
             .value("OAM", mOAM)
@@ -902,8 +986,10 @@ namespace gb
             .value("RenderedTick", mRenderedTick)
             .value("DesiredTick", mDesiredTick)
             .value("LineFirstTick", mLineFirstTick)
-            .value("LineTick", mLineTick)
-            .value("LineIntTick", mLineIntTick)
+            .value("LineTick", mLineTick);
+        if (version < 2)
+            serializer.value("LineIntTick", lineIntTick);
+        serializer
             .value("RasterTick", mRasterTick)
             .value("RasterLine", mRasterLine)
             .value("BankVRAM", mBankVRAM)
@@ -923,31 +1009,94 @@ namespace gb
             .value("RegBGPD", mRegBGPD)
             .value("RegOBPI", mRegOBPI)
             .value("RegOBPD", mRegOBPD)
-            .value("RegHDMA", mRegHDMA)
-            .value("LineIntLastLY", mLineIntLastLY)
-            .value("LineIntLastLYC", mLineIntLastLYC)
-            .value("LineIntLastEnabled", mLineIntLastEnabled)
-            .value("IntUpdate", mIntUpdate)
-            .value("IntEnabled", mIntEnabled)
-            .value("IntSync", mIntSync)
-            .value("IntPredictionMode0", mIntPredictionMode0);
+            .value("RegHDMA", mRegHDMA);
+        if (version >= 2)
+        {
+            serializer
+                .value("StatIntTick", mStatIntTick)
+                .value("HDMATick", mHDMATick);
+        }
+        else
+        {
+            uint8_t lineIntLastLY = 0;
+            uint8_t lineIntLastLYC = 0;
+            bool lineIntLastEnabled = false;
+            uint8_t intUpdate = 0;
+            uint8_t intEnabled = 0;
+            uint8_t intSync = 0;
+            int32_t intPredictionMode0 = 0;
+            serializer
+                .value("LineIntLastLY", lineIntLastLY)
+                .value("LineIntLastLYC", lineIntLastLYC)
+                .value("LineIntLastEnabled", lineIntLastEnabled)
+                .value("IntUpdate", intUpdate)
+                .value("IntEnabled", intEnabled)
+                .value("IntSync", intSync)
+                .value("IntPredictionMode0", intPredictionMode0);
+        }
         if (serializer.isReading())
         {
+            if (version < 2)
+            {
+                // HBlank transfers were not emulated, none can be in progress
+                mRegHDMA[4] = HDMA5_DONE;
+                mHDMATick = INT32_MAX;
+                mStatIntTick = getNextStatTick(mDesiredTick);
+            }
+            invalidateTiles();
+            resetRegisterLog();
             mSortedSprites = false;
             mCachedPalette = false;
-            mIntSync = INT_ALL;
         }
     }
 
-    void Display::setRenderSurface(void* surface, size_t pitch)
+    void Display::setRenderSurface(void* surface, size_t pitch, emu::PixelFormat format)
     {
         mSurface = static_cast<uint8_t*>(surface);
         mPitch = pitch;
+        mDirtyLines.setSurface(surface, pitch, format);
+        if (mPixelFormat != format)
+        {
+            mPixelFormat = format;
+            mPixelSize = emu::Pixel::getSize(format);
+            mCachedPalette = false;
+        }
+    }
+
+    bool Display::setObservation(const emu::Observation::Config& config)
+    {
+        EMU_VERIFY(mObservation.create(config, DISPLAY_SIZE_X, DISPLAY_SIZE_Y));
+        mCachedPalette = false;
+        return true;
+    }
+
+    const emu::Observation& Display::getObservation() const
+    {
+        return mObservation;
+    }
+
+    const emu::DirtyLines& Display::getDirtyLines() const
+    {
+        return mDirtyLines;
+    }
+
+    void Display::enableDirtyLines(bool enable)
+    {
+        mDirtyLines.setEnabled(enable);
+    }
+
+    void Display::setKernels(const DisplayKernels& kernels)
+    {
+        // Tiles already decoded came from the previous kernels
+        mKernels = &kernels;
+        invalidateTiles();
     }
 
     void Display::onVBlankStart(int32_t tick)
     {
         render(tick);
+        mObservation.endFrame();
+        mDirtyLines.endFrame();
         if ((mRegLCDC & LCDC_LCD_ENABLE) != 0)
             mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::VBlank);
     }
@@ -980,8 +1129,6 @@ namespace gb
             if (mRegLY >= DISPLAY_LINE_COUNT)
                 mRegLY -= DISPLAY_LINE_COUNT;
         }
-        updateLineInterrupt(mRasterTick);
-        updateInterrupts(mRasterTick);
     }
 
     uint8_t Display::getMode(int32_t tick)
@@ -996,92 +1143,68 @@ namespace gb
         return 0;
     }
 
-    void Display::updateInterrupts(int32_t tick)
+    int32_t Display::getNextLineTick(int32_t tick, int32_t lineTick, uint32_t firstLine, uint32_t lineCount) const
     {
-        // Process any signaled interrupt
-        if (mIntEnabled && !mIntUpdate)
-        {
-            if ((mIntEnabled & INT_MODE_0) && (mIntPredictionMode0 <= tick))
-            {
-                mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::LcdStat);
-                mIntUpdate |= INT_MODE_0;
-            }
-        }
-
-        // Update dirty predictions
-        if (mIntUpdate)
-        {
-            if (mIntUpdate & INT_MODE_0)
-            {
-                bool enabled = (mRegLCDC & LCDC_LCD_ENABLE) && (mRegSTAT & STAT_HBLANK_INT);
-                if (enabled)
-                    mIntEnabled |= INT_MODE_0;
-                else
-                    mIntEnabled &= ~INT_MODE_0;
-                if (enabled)
-                {
-                    mIntPredictionMode0 = mLineFirstTick + mMode0StartTick;
-                    uint8_t line = mRasterLine;
-                    while (true)
-                    {
-                        if (line >= DISPLAY_LINE_COUNT)
-                            line -= DISPLAY_LINE_COUNT;
-                        if ((line < DISPLAY_SIZE_Y) && (tick < mIntPredictionMode0))
-                            break;
-                        mIntPredictionMode0 += mTicksPerLine;
-                        ++line;
-                    }
-                    mIntSync |= INT_MODE_0;
-                }
-            }
-            mIntUpdate = 0;
-        }
-
-        if (mIntSync)
+        // Lines restart every frame, find the first matching line after the tick in this frame or the next
+        int32_t frameTicks = static_cast<int32_t>(DISPLAY_LINE_COUNT) * mTicksPerLine;
+        int32_t frameStart = tick - ((tick % frameTicks) + frameTicks) % frameTicks;
+        for (uint32_t frame = 0; frame < 2; ++frame, frameStart += frameTicks)
         {
-            // Find next prediction to be true
-            mIntSync &= mIntEnabled;
-            int32_t prediction = INT32_MAX;
-            if (mIntSync & INT_MODE_0)
-                prediction = std::min(prediction, mIntPredictionMode0);
-            mIntSync = 0;
-
-            // Synchronize
-            if (prediction < INT32_MAX)
-                mClock->addSync(prediction);
+            int32_t offset = tick - frameStart - lineTick;
+            uint32_t line = offset < 0 ? 0 : static_cast<uint32_t>(offset / mTicksPerLine) + 1;
+            line = std::max(line, firstLine);
+            if (line < firstLine + lineCount)
+                return frameStart + static_cast<int32_t>(line) * mTicksPerLine + lineTick;
         }
+        return INT32_MAX;
     }
 
-    void Display::updateLineInterrupt(int32_t tick)
+    int32_t Display::getNextMode0Tick(int32_t tick) const
     {
-        bool enabled = (mRegLCDC & LCDC_LCD_ENABLE) && (mRegSTAT & STAT_LYC_LY_INT) && (mRegLYC < DISPLAY_LINE_COUNT);
-        bool modifiedEnabled = enabled && !mLineIntLastEnabled;
+        return getNextLineTick(tick, mMode0StartTick, 0, DISPLAY_SIZE_Y);
+    }
 
-        bool modifiedLYC = mLineIntLastLYC != mRegLYC;
-        if (modifiedLYC)
-            mLineIntTick = mRegLYC * mTicksPerLine;
+    int32_t Display::getNextStatTick(int32_t tick) const
+    {
+        if (!(mRegLCDC & LCDC_LCD_ENABLE))
+            return INT32_MAX;
 
-        bool lineIntTriggered = (mLineIntLastLY < mRegLYC) && (mRegLY >= mRegLYC);
+        // Sources starting on the same tick raise a single interrupt
+        int32_t statTick = INT32_MAX;
+        if (mRegSTAT & STAT_HBLANK_INT)
+            statTick = std::min(statTick, getNextMode0Tick(tick));
+        if (mRegSTAT & STAT_OAM_INT)
+            statTick = std::min(statTick, getNextLineTick(tick, 0, 0, DISPLAY_SIZE_Y));
+        if (mRegSTAT & STAT_VBLANK_INT)
+            statTick = std::min(statTick, getNextLineTick(tick, 0, DISPLAY_SIZE_Y, 1));
+        if ((mRegSTAT & STAT_LYC_LY_INT) && (mRegLYC < DISPLAY_LINE_COUNT))
+            statTick = std::min(statTick, getNextLineTick(tick, 0, mRegLYC, 1));
+        return statTick;
+    }
 
-        mLineIntLastLY = mRegLY;
-        mLineIntLastLYC = mRegLYC;
-        mLineIntLastEnabled = enabled;
+    void Display::scheduleStatInterrupt(int32_t tick)
+    {
+        mStatIntTick = getNextStatTick(tick);
+        if (mStatIntTick != INT32_MAX)
+            mClock->addEvent(onStatInterrupt, this, mStatIntTick);
+    }
 
-        if (enabled)
-        {
-            if (modifiedEnabled | modifiedLYC)
-            {
-                if (mRegLY < mRegLYC)
-                    mClock->addSync(mLineIntTick);
-            }
+    void Display::onStatInterrupt(int32_t tick)
+    {
+        // Events are never removed from the clock, ignore the ones predicted before the last STAT, LYC or LCDC write
+        if (tick != mStatIntTick)
+            return;
 
-            if (lineIntTriggered)
-                mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::LcdStat);
-        }
+        mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::LcdStat);
+        scheduleStatInterrupt(tick);
     }
 
-    void Display::updatePalette()
+    void Display::updatePalette(const RenderRegisters& registers)
     {
+        uint32_t colors[PALETTE_STORAGE_SIZE];
+        for (auto& color : colors)
+            color = *reinterpret_cast<const uint32_t*>(kMonoPalette[0]);
+
         if (mConfig.model >= gb::Model::GBC)
         {
             for (uint32_t index = 0; index < PALETTE_SIZE; ++index)
@@ -1099,7 +1222,7 @@ namespace gb
                     color.w.l.u = mRegOBPD[base + 0];
                     color.w.h.u = mRegOBPD[base + 1];
                 }
-                mPalette[index] = colorTable[color.u & 0x7fff];
+                colors[index] = colorTable[color.u & 0x7fff];
             }
         }
         else
@@ -1112,9 +1235,9 @@ namespace gb
             };
             uint8_t values[] =
             {
-                mRegBGP,
-                mRegOBP0,
-                mRegOBP1,
+                registers.BGP,
+                registers.OBP0,
+                registers.OBP1,
             };
             for (uint32_t index = 0; index < EMU_ARRAY_SIZE(values); ++index)
             {
@@ -1124,53 +1247,234 @@ namespace gb
                 {
                     auto shade = value & 0x3;
                     value >>= 2;
-                    mPalette[base + subIndex] = *reinterpret_cast<const uint32_t*>(kMonoPalette[shade]);
+                    colors[base + subIndex] = *reinterpret_cast<const uint32_t*>(kMonoPalette[shade]);
                 }
             }
         }
+        // The mirrored half is copied after conversion, indexed formats must give the same slot for both
+        emu::Pixel::convertPalette(mPixelFormat, mPalette.data(), colors, PALETTE_SIZE);
+        for (uint32_t index = 0; index < PALETTE_SIZE; ++index)
+        {
+            colors[index + PALETTE_SIZE] = colors[index];
+            mPalette[index + PALETTE_SIZE] = mPalette[index];
+        }
+        mPaletteHash = emu::DirtyLines::hash(mPalette.data(), PALETTE_STORAGE_SIZE * sizeof(uint32_t), 0);
+        mObservation.setPalette(colors, PALETTE_STORAGE_SIZE);
+        mPaletteMono = getMonoPalette(registers);
         mCachedPalette = true;
     }
 
+    uint16_t Display::getSpriteKey(uint8_t index) const
+    {
+        // DMG draws sprites by increasing X then OAM index, GBC by OAM index only
+        if (mConfig.model >= gb::Model::GBC)
+            return index;
+        return static_cast<uint16_t>((mOAM[index * 4 + 1] << 8) | index);
+    }
+
+    bool Display::getSpriteLines(uint8_t spriteY, uint32_t& firstLine, uint32_t& lastLine) const
+    {
+        uint32_t spriteSizeY = (mRegLCDC & LCDC_SPRITES_SIZE) ? 16 : 8;
+        if ((spriteY >= SPRITE_VISIBLE_Y_END) || (spriteY + spriteSizeY <= SPRITE_VISIBLE_Y_BEGIN))
+            return false;
+        firstLine = spriteY > SPRITE_VISIBLE_Y_BEGIN ? spriteY - SPRITE_VISIBLE_Y_BEGIN : 0;
+        lastLine = std::min(spriteY + spriteSizeY - SPRITE_VISIBLE_Y_BEGIN - 1, DISPLAY_SIZE_Y - 1);
+        return true;
+    }
+
     void Display::sortSprites()
     {
-        mActiveSprites = 0;
-        uint8_t spriteSizeY = (mRegLCDC & LCDC_SPRITES_SIZE) ? 16 : 8;
+        // Drawing priority order, using a counting sort on X for DMG
+        uint8_t order[SPRITE_CAPACITY];
         if (mConfig.model >= gb::Model::GBC)
         {
             for (uint32_t index = 0; index < SPRITE_CAPACITY; ++index)
-            {
-                // Check if sprite is active
-                uint8_t spriteY = mOAM[index * 4 + 0];
-                if ((spriteY >= SPRITE_VISIBLE_Y_END) || (spriteY + spriteSizeY <= SPRITE_VISIBLE_Y_BEGIN))
-                    continue;
-
-                mOAMOrder[mActiveSprites++] = static_cast<uint8_t>(index);
-            }
+                order[index] = static_cast<uint8_t>(index);
         }
         else
         {
-            uint16_t keys[SPRITE_CAPACITY];
+            uint8_t start[256];
+            memset(start, 0, sizeof(start));
+            for (uint32_t index = 0; index < SPRITE_CAPACITY; ++index)
+                ++start[mOAM[index * 4 + 1]];
+            uint8_t offset = 0;
+            for (uint32_t spriteX = 0; spriteX < 256; ++spriteX)
+            {
+                uint8_t count = start[spriteX];
+                start[spriteX] = offset;
+                offset += count;
+            }
             for (uint32_t index = 0; index < SPRITE_CAPACITY; ++index)
+                order[start[mOAM[index * 4 + 1]]++] = static_cast<uint8_t>(index);
+        }
+
+        // The hardware keeps the first sprites in OAM order on each line, whatever their priority
+        uint64_t selected[DISPLAY_SIZE_Y];
+        memset(selected, 0, sizeof(selected));
+        std::fill(mLineSpriteCount.begin(), mLineSpriteCount.end(), 0);
+        std::fill(mLineSpriteTotal.begin(), mLineSpriteTotal.end(), 0);
+        for (uint32_t index = 0; index < SPRITE_CAPACITY; ++index)
+        {
+            uint32_t firstLine, lastLine;
+            if (!getSpriteLines(mOAM[index * 4 + 0], firstLine, lastLine))
+                continue;
+            for (uint32_t line = firstLine; line <= lastLine; ++line)
             {
-                // Check if sprite is active
-                uint8_t spriteY = mOAM[index * 4 + 0];
-                if ((spriteY >= SPRITE_VISIBLE_Y_END) || (spriteY + spriteSizeY <= SPRITE_VISIBLE_Y_BEGIN))
-                    continue;
-                uint8_t spriteX = mOAM[index * 4 + 1];
-                keys[mActiveSprites++] = (spriteX << 8) | (index & 0xff);
+                if (mLineSpriteTotal[line]++ < SPRITE_LINE_LIMIT)
+                    selected[line] |= 1ull << index;
             }
+        }
 
-            if (mActiveSprites)
+        // Distribute selected sprites in each line bucket by priority
+        for (uint32_t key = 0; key < SPRITE_CAPACITY; ++key)
+        {
+            uint8_t index = order[key];
+            uint32_t firstLine, lastLine;
+            if (!getSpriteLines(mOAM[index * 4 + 0], firstLine, lastLine))
+                continue;
+            for (uint32_t line = firstLine; line <= lastLine; ++line)
             {
-                // Sort sprites
-                std::sort(keys, keys + mActiveSprites, [](int a, int b){ return a < b; });
-                for (uint32_t index = 0; index < mActiveSprites; ++index)
-                    mOAMOrder[index] = keys[index] & 0xff;
+                if (selected[line] & (1ull << index))
+                    mLineSprites[line * SPRITE_LINE_LIMIT + mLineSpriteCount[line]++] = index;
             }
         }
         mSortedSprites = true;
     }
 
+    void Display::insertLineSprite(uint32_t line, uint8_t index)
+    {
+        auto sprites = mLineSprites.data() + line * SPRITE_LINE_LIMIT;
+        uint8_t count = mLineSpriteCount[line];
+        uint16_t key = getSpriteKey(index);
+        uint32_t pos = count;
+        while ((pos > 0) && (getSpriteKey(sprites[pos - 1]) > key))
+        {
+            sprites[pos] = sprites[pos - 1];
+            --pos;
+        }
+        sprites[pos] = index;
+        mLineSpriteCount[line] = count + 1;
+    }
+
+    bool Display::eraseLineSprite(uint32_t line, uint8_t index)
+    {
+        auto sprites = mLineSprites.data() + line * SPRITE_LINE_LIMIT;
+        uint8_t count = mLineSpriteCount[line];
+        for (uint32_t pos = 0; pos < count; ++pos)
+        {
+            if (sprites[pos] == index)
+            {
+                memmove(sprites + pos, sprites + pos + 1, count - pos - 1);
+                mLineSpriteCount[line] = count - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Display::addLineSprite(uint32_t line, uint8_t index)
+    {
+        ++mLineSpriteTotal[line];
+        if (mLineSpriteCount[line] >= SPRITE_LINE_LIMIT)
+        {
+            // Line is full, the sprite only gets in by evicting the one with the highest OAM index
+            auto sprites = mLineSprites.data() + line * SPRITE_LINE_LIMIT;
+            uint8_t last = sprites[0];
+            for (uint32_t pos = 1; pos < SPRITE_LINE_LIMIT; ++pos)
+                last = std::max(last, sprites[pos]);
+            if (last < index)
+                return;
+            eraseLineSprite(line, last);
+        }
+        insertLineSprite(line, index);
+    }
+
+    void Display::removeLineSprite(uint32_t line, uint8_t index)
+    {
+        --mLineSpriteTotal[line];
+        if (!eraseLineSprite(line, index))
+            return;
+
+        // A sprite that was dropped by the line limit may now be visible
+        if (mLineSpriteTotal[line] > mLineSpriteCount[line])
+        {
+            mLineSpriteCount[line] = 0;
+            mLineSpriteTotal[line] = 0;
+            for (uint32_t other = 0; other < SPRITE_CAPACITY; ++other)
+            {
+                uint32_t firstLine, lastLine;
+                if (getSpriteLines(mOAM[other * 4 + 0], firstLine, lastLine) && (firstLine <= line) && (line <= lastLine))
+                    addLineSprite(line, static_cast<uint8_t>(other));
+            }
+        }
+    }
+
+    void Display::updateSprite(uint8_t index, uint32_t field, uint8_t oldValue)
+    {
+        if (field == 0)
+        {
+            // Vertical position: move the sprite between the buckets it leaves and enters
+            uint32_t oldFirst = 1, oldLast = 0;
+            uint32_t newFirst = 1, newLast = 0;
+            getSpriteLines(oldValue, oldFirst, oldLast);
+            getSpriteLines(mOAM[index * 4 + 0], newFirst, newLast);
+            for (uint32_t line = oldFirst; line <= oldLast; ++line)
+            {
+                if ((line < newFirst) || (line > newLast))
+                    removeLineSprite(line, index);
+            }
+            for (uint32_t line = newFirst; line <= newLast; ++line)
+            {
+                if ((line < oldFirst) || (line > oldLast))
+                    addLineSprite(line, index);
+            }
+        }
+        else if ((field == 1) && (mConfig.model < gb::Model::GBC))
+        {
+            // Horizontal position only changes the drawing priority on DMG
+            uint32_t firstLine, lastLine;
+            if (!getSpriteLines(mOAM[index * 4 + 0], firstLine, lastLine))
+                return;
+            for (uint32_t line = firstLine; line <= lastLine; ++line)
+            {
+                if (eraseLineSprite(line, index))
+                    insertLineSprite(line, index);
+            }
+        }
+    }
+
+    void Display::invalidateTile(uint32_t tile)
+    {
+        if (!mTileDirty[tile])
+        {
+            mTileDirty[tile] = 1;
+            mTileDirtyList.push_back(static_cast<uint16_t>(tile));
+        }
+    }
+
+    void Display::invalidateTiles()
+    {
+        for (uint32_t tile = 0; tile < mTileDirty.size(); ++tile)
+            invalidateTile(tile);
+    }
+
+    void Display::updateTileCache()
+    {
+        for (auto tile : mTileDirtyList)
+        {
+            mTileDirty[tile] = 0;
+            uint32_t bank = tile / TILE_COUNT;
+            uint32_t addr = bank * VRAM_BANK_SIZE + (tile - bank * TILE_COUNT) * TILE_SIZE;
+            auto dest = mTileCache.data() + tile * TILE_CACHE_TILE_SIZE;
+            for (uint32_t row = 0; row < 8; ++row)
+            {
+                mKernels->expandTileRow(dest, mVRAM[addr + row * 2 + 0], mVRAM[addr + row * 2 + 1]);
+                dest += TILE_CACHE_ROW_SIZE;
+            }
+        }
+        mTileDirtyList.clear();
+    }
+
     void Display::fetchTileRow(uint8_t* dest, const uint8_t* map, uint32_t tileX, uint32_t tileY, uint8_t tileOffset, uint32_t count)
     {
         uint32_t base = (tileY & 0x1f) << 5;
@@ -1187,13 +1491,16 @@ namespace gb
         fetchTileRow(dest, map + VRAM_BANK_SIZE, tileX, tileY, tileOffset, count);
     }
 
-    void Display::drawTiles(uint8_t* dest, const uint8_t* tiles, const uint8_t* attributes, const uint8_t* patterns, uint8_t tileOffsetY, uint16_t count)
+    void Display::drawTiles(uint8_t* dest, const uint8_t* tiles, const uint8_t* attributes, uint32_t tileBase, uint8_t tileOffsetY, uint16_t count)
     {
+        auto tileCache = mTileCache.data();
         for (uint32_t index = 0; index < count; ++index)
         {
             uint8_t attr = attributes[index];
 
             uint8_t palette8 = ((attr & 0x07) << 2) + PALETTE_BASE_BGP;
+            if (attr & 0x80)
+                palette8 |= DisplayKernels::PIXEL_PRIORITY;
             emu::word32_t palette32;
             palette32.w8[0].u = palette8;
             palette32.w8[1].u = palette8;
@@ -1201,49 +1508,28 @@ namespace gb
             palette32.w8[3].u = palette8;
             uint32_t palette = palette32.u;
 
-            uint32_t tile = tiles[index];
-            uint32_t patternBank = (attr & 0x08) << 10; // Attribute bit is 0x08 and bank size is 0x2000
+            uint32_t tileBank = (attr & 0x08) ? TILE_COUNT : 0;
+            uint32_t tile = tileBase + tiles[index] + tileBank;
             uint8_t flipY = int8_t((attr & 0x40) << 1) >> 7; // Expand flip Y bit in the other 7 bits;
-            uint8_t offsetY = (tileOffsetY ^ (flipY & 7)) << 1; // Flip Y position if the lower 3 bits of flipY are set
-            uint32_t patternBase = (tile << 4) + patternBank + offsetY;
-            uint32_t patternBias = (attr & 0x20) >> 2; // Horizontal flip is bit 5 in attrib and is stored 8 bytes later in pattern table
+            uint8_t offsetY = tileOffsetY ^ (flipY & 7); // Flip Y position if the lower 3 bits of flipY are set
+            uint32_t flipX = (attr & 0x20) >> 2; // Horizontal flip is bit 5 in attrib and is stored 8 bytes later in the cached row
 
-            auto pattern0 = reinterpret_cast<const uint32_t*>(&patternMask[patterns[patternBase + 0]][patternBias]);
-            auto pattern1 = reinterpret_cast<const uint32_t*>(&patternMask[patterns[patternBase + 1]][patternBias]);
-
-            auto value0 = (pattern0[0] & 0x01010101) + (pattern1[0] & 0x02020202) + palette;
-            auto value1 = (pattern0[1] & 0x01010101) + (pattern1[1] & 0x02020202) + palette;
-            reinterpret_cast<uint32_t*>(dest)[0] = value0;
-            reinterpret_cast<uint32_t*>(dest)[1] = value1;
+            auto pattern = reinterpret_cast<const uint32_t*>(tileCache + tile * TILE_CACHE_TILE_SIZE + offsetY * TILE_CACHE_ROW_SIZE + flipX);
+            reinterpret_cast<uint32_t*>(dest)[0] = pattern[0] + palette;
+            reinterpret_cast<uint32_t*>(dest)[1] = pattern[1] + palette;
             dest += 8;
         }
     }
 
     void Display::drawSprites(uint8_t* dest, uint8_t line, uint8_t spriteSizeY, uint8_t paletteMask, uint8_t paletteShift, uint8_t bankMask)
     {
-        // Find active sprites visible on this line (up to the line limit)
-        uint8_t sprites[SPRITE_LINE_LIMIT];
-        uint8_t active = 0;
+        // Sprites visible on this line (up to the line limit) by drawing priority
+        const uint8_t* sprites = mLineSprites.data() + line * SPRITE_LINE_LIMIT;
+        uint8_t active = mLineSpriteCount[line];
         line += SPRITE_VISIBLE_Y_BEGIN;
-        auto sizeOAMOrder = mOAMOrder.size();
-        EMU_UNUSED(sizeOAMOrder);
-        auto fastOAMOrder = mOAMOrder.data();
         auto sizeOAM = mOAM.size();
         EMU_UNUSED(sizeOAM);
         auto fastOAM = mOAM.data();
-        for (uint8_t key = 0; key < mActiveSprites; ++key)
-        {
-            EMU_ASSERT(static_cast<size_t>(key) < sizeOAMOrder);
-            uint8_t index = fastOAMOrder[key];
-            auto addrOAM = index * 4 + 0;
-            EMU_ASSERT(static_cast<size_t>(addrOAM) < sizeOAM);
-            uint8_t spriteY = fastOAM[addrOAM];
-            if ((spriteY > line) || (spriteY + spriteSizeY <= line))
-                continue;
-            sprites[active] = index;
-            if (++active >= SPRITE_LINE_LIMIT)
-                break;
-        }
 
         // Render active sprites
         static const uint8_t spriteSizeX = 8;
@@ -1278,56 +1564,30 @@ namespace gb
             tile = (tile & ~tileMask) | ((offsetY >> 3) & tileMask);
 
             // Get the pattern
-            uint8_t flipX = (flags & SPRITE_FLAG_FLIP_X) ? 7 : 0;
-            uint32_t tileBank = (flags & bankMask) << 10;
-            uint32_t tileAddr = (tile << 4) + ((offsetY & 7) << 1) + tileBank;
-            auto sizeVRAM = mVRAM.size();
-            EMU_UNUSED(sizeVRAM);
-            auto fastVRAM = mVRAM.data();
-            auto addrVRAM = tileAddr + 0;
-            EMU_ASSERT(static_cast<size_t>(addrVRAM) < sizeVRAM);
-            uint8_t pattern0 = fastVRAM[addrVRAM];
-            addrVRAM = tileAddr + 1;
-            EMU_ASSERT(static_cast<size_t>(addrVRAM) < sizeVRAM);
-            uint8_t pattern1 = fastVRAM[addrVRAM];
-            const uint8_t* patternMask0 = patternMask[pattern0];
-            const uint8_t* patternMask1 = patternMask[pattern1];
+            uint32_t flipX = (flags & SPRITE_FLAG_FLIP_X) ? TILE_CACHE_FLIP_X : 0;
+            uint32_t tileBank = (flags & bankMask) ? TILE_COUNT : 0;
+            uint32_t tileCacheOffset = (tile + tileBank) * TILE_CACHE_TILE_SIZE + (offsetY & 7) * TILE_CACHE_ROW_SIZE + flipX;
+            EMU_ASSERT(static_cast<size_t>(tileCacheOffset + spriteSizeX) <= mTileCache.size());
+            const uint8_t* pattern = mTileCache.data() + tileCacheOffset;
 
             // Get the palette
             uint8_t palette = (((flags & paletteMask) >> paletteShift) << 2) + PALETTE_BASE_OBP;
 
             // Render pixels
             bool backgroundSprite = (flags & SPRITE_FLAG_BACKGROUND) != 0;
-            for (uint8_t bit = 0; bit < spriteSizeX; ++bit)
-            {
-                uint8_t offsetX = spriteX + (bit ^ flipX);
-                uint8_t src = dest[offsetX];
-
-                uint8_t value = (patternMask0[bit] & 0x01) | (patternMask1[bit] & 0x02);
-                bool transparentBackground = !src;
-                bool visible = value && (!backgroundSprite || transparentBackground) && ((src & PALETTE_BASE_OBP) == 0);
-                value |= palette;
-                value = visible ? value : src;
-                dest[offsetX] = value;
-            }
+            mKernels->mergeSprite(dest + spriteX, pattern, palette, backgroundSprite);
         }
     }
 
-    void Display::blitLine(uint32_t* dest, uint8_t* src, uint32_t count)
+    void Display::blitLine(uint8_t* dest, uint8_t* src, uint32_t count)
     {
-        auto paletteSize = mPalette.size();
-        EMU_UNUSED(paletteSize);
-        auto paletteData = mPalette.data();
-        for (uint32_t index = 0; index < count; ++index)
-        {
-            uint8_t value = src[index];
-            EMU_ASSERT(static_cast<size_t>(value) < paletteSize);
-            uint32_t color = paletteData[value];
-            dest[index] = color;
-        }
+        if (mPixelSize == 4)
+            mKernels->blitLine32(reinterpret_cast<uint32_t*>(dest), src, mPalette.data(), count);
+        else
+            emu::Pixel::blit(mPixelFormat, dest, mPalette.data(), src, count);
     }
 
-    void Display::renderLines(uint32_t firstLine, uint32_t lastLine)
+    void Display::renderLines(uint32_t firstLine, uint32_t lastLine, const RenderRegisters& registers)
     {
         uint8_t rowStorage[RENDER_ROW_STORAGE];
         uint8_t bgTileRowStorage[RENDER_TILE_STORAGE];
@@ -1335,25 +1595,28 @@ namespace gb
         uint8_t windowTileRowStorage[RENDER_TILE_STORAGE];
         uint8_t windowAttrRowStorage[RENDER_TILE_STORAGE];
 
-        bool lcdEnabled = (mRegLCDC & LCDC_LCD_ENABLE) != 0;
-        uint16_t windowTileMapOffset = (mRegLCDC & LCDC_WINDOW_TILE_MAP) ? 0x1c00 : 0x1800;
-        bool windowEnabled = (mRegLCDC & LCDC_WINDOW_ENABLE) != 0;
-        bool bgFirstTilePattern = (mRegLCDC & LCDC_TILE_DATA) != 0;
-        uint16_t bgTileMapOffset = (mRegLCDC & LCDC_BG_TILE_MAP) ? 0x1c00 : 0x1800;
-        bool bgEnabled = (mRegLCDC & LCDC_BG_ENABLE) != 0;
-        uint8_t spriteSizeY = (mRegLCDC & LCDC_SPRITES_SIZE) ? 16 : 8;
-        bool spritesEnabled = (mRegLCDC & LCDC_SPRITES_ENABLE) != 0;
+        bool lcdEnabled = (registers.LCDC & LCDC_LCD_ENABLE) != 0;
+        uint16_t windowTileMapOffset = (registers.LCDC & LCDC_WINDOW_TILE_MAP) ? 0x1c00 : 0x1800;
+        bool windowEnabled = (registers.LCDC & LCDC_WINDOW_ENABLE) != 0;
+        bool bgFirstTilePattern = (registers.LCDC & LCDC_TILE_DATA) != 0;
+        uint16_t bgTileMapOffset = (registers.LCDC & LCDC_BG_TILE_MAP) ? 0x1c00 : 0x1800;
+        bool bgEnabled = (registers.LCDC & LCDC_BG_ENABLE) != 0;
+        uint8_t spriteSizeY = (registers.LCDC & LCDC_SPRITES_SIZE) ? 16 : 8;
+        bool spritesEnabled = (registers.LCDC & LCDC_SPRITES_ENABLE) != 0;
         bool isColor = mConfig.model >= gb::Model::GBC;
 
         if (spritesEnabled && !mSortedSprites)
             sortSprites();
 
-        if (lcdEnabled && !mCachedPalette)
-            updatePalette();
+        if (lcdEnabled && (!mCachedPalette || (!isColor && (getMonoPalette(registers) != mPaletteMono))))
+            updatePalette(registers);
+
+        if (!mTileDirtyList.empty())
+            updateTileCache();
 
         if (!lcdEnabled || !bgEnabled)
             memset(rowStorage, 0, RENDER_ROW_STORAGE);
-        else if (!isColor)
+        if (!isColor)
         {
             memset(bgAttrRowStorage, 0, RENDER_TILE_STORAGE);
             memset(windowAttrRowStorage, 0, RENDER_TILE_STORAGE);
@@ -1363,26 +1626,26 @@ namespace gb
         uint8_t spritePaletteShift = isColor ? SPRITE_FLAG_COLOR_PALETTE_SHIFT : SPRITE_FLAG_MONO_PALETTE_SHIFT;
         uint8_t spriteBankMask = isColor ? SPRITE_FLAG_COLOR_BANK_MASK : 0x00;
         uint8_t spritesTileBias = 0x00;
-        auto spritesTilePatterns = mVRAM.data() + 0x0000;
+        uint32_t spritesTileBase = 0x0000 / TILE_SIZE;
 
         uint8_t windowTileBias = 0x80;
-        auto windowTilePatterns = mVRAM.data() + 0x0800;
+        uint32_t windowTileBase = 0x0800 / TILE_SIZE;
 
         uint8_t bgTileBias = bgFirstTilePattern ? spritesTileBias : windowTileBias;
-        auto bgTilePatterns = bgFirstTilePattern ? spritesTilePatterns : windowTilePatterns;
+        uint32_t bgTileBase = bgFirstTilePattern ? spritesTileBase : windowTileBase;
 
-        windowEnabled = windowEnabled && (mRegWX < DISPLAY_SIZE_X + 7);
-        uint8_t windowTileCountX = windowEnabled ? (DISPLAY_SIZE_X + 7 - mRegWX + 7) >> 3 : 0;
+        windowEnabled = windowEnabled && (registers.WX < DISPLAY_SIZE_X + 7);
+        uint8_t windowTileCountX = windowEnabled ? (DISPLAY_SIZE_X + 7 - registers.WX + 7) >> 3 : 0;
         uint8_t windowPrevTileY = 0xff;
         auto windowTileMap = mVRAM.data() + windowTileMapOffset;
-        auto windowTileOffset = 8 - 7 + mRegWX;
+        auto windowTileOffset = 8 - 7 + registers.WX;
         auto windowTileDest = rowStorage + windowTileOffset;
         EMU_ASSERT(!windowEnabled || (windowTileCountX <= RENDER_TILE_STORAGE));
         EMU_ASSERT(!windowEnabled || (windowTileOffset + (windowTileCountX << 3) <= RENDER_ROW_STORAGE));
 
-        uint8_t bgTileX = (mRegSCX >> 3) & 0xff;
-        uint8_t bgTileOffsetX = mRegSCX & 0x07;
-        uint8_t bgLineY = (mRegSCY + firstLine) & 0xff;
+        uint8_t bgTileX = (registers.SCX >> 3) & 0xff;
+        uint8_t bgTileOffsetX = registers.SCX & 0x07;
+        uint8_t bgLineY = (registers.SCY + firstLine) & 0xff;
         uint8_t bgPrevTileY = 0xff;
         auto bgTileMap = mVRAM.data() + bgTileMapOffset;
         auto bgTileDest = rowStorage + 8 - bgTileOffsetX;
@@ -1396,12 +1659,12 @@ namespace gb
             fclose(file);
         }
 
-        auto dest = mSurface + mPitch * firstLine;
+        auto dest = mSurface ? mSurface + mPitch * firstLine : nullptr;
         for (uint32_t line = firstLine; line <= lastLine; ++line)
         {
             if (lcdEnabled)
             {
-                bool hasWindow = windowEnabled && (line >= mRegWY);
+                bool hasWindow = windowEnabled && (line >= registers.WY);
 
                 if (bgEnabled)
                 {
@@ -1414,13 +1677,13 @@ namespace gb
                         if (isColor)
                             fetchAttrRow(bgAttrRowStorage, bgTileMap, bgTileX, bgTileY, 0, RENDER_TILE_STORAGE);
                     }
-                    drawTiles(bgTileDest, bgTileRowStorage, bgAttrRowStorage, bgTilePatterns, bgTileOffsetY, RENDER_TILE_STORAGE);
+                    drawTiles(bgTileDest, bgTileRowStorage, bgAttrRowStorage, bgTileBase, bgTileOffsetY, RENDER_TILE_STORAGE);
                     ++bgLineY;
                 }
 
                 if (hasWindow)
                 {
-                    uint8_t windowLineY = static_cast<uint8_t>(line - mRegWY);
+                    uint8_t windowLineY = static_cast<uint8_t>(line - registers.WY);
                     uint8_t windowTileY = windowLineY >> 3;
                     uint8_t windowTileOffsetY = windowLineY & 0x07;
                     if (windowPrevTileY != windowTileY)
@@ -1428,16 +1691,80 @@ namespace gb
                         windowPrevTileY = windowTileY;
                         fetchTileRow(windowTileRowStorage, windowTileMap, 0, windowTileY, windowTileBias, windowTileCountX);
                         if (isColor)
-                            fetchAttrRow(windowAttrRowStorage, windowTileMap, 0, windowTileY, windowTileBias, windowTileCountX);
+                            fetchAttrRow(windowAttrRowStorage, windowTileMap, 0, windowTileY, 0, windowTileCountX);
                     }
-                    drawTiles(windowTileDest, windowTileRowStorage, windowAttrRowStorage, windowTilePatterns, windowTileOffsetY, windowTileCountX);
+                    drawTiles(windowTileDest, windowTileRowStorage, windowAttrRowStorage, windowTileBase, windowTileOffsetY, windowTileCountX);
                 }
 
                 if (spritesEnabled)
                     drawSprites(rowStorage, static_cast<uint8_t>(line), spriteSizeY, spritePaletteMask, spritePaletteShift, spriteBankMask);
             }
-            blitLine(reinterpret_cast<uint32_t*>(dest), rowStorage + 8, DISPLAY_SIZE_X);
-            dest += mPitch;
+            if (dest)
+            {
+                blitLine(dest, rowStorage + 8, DISPLAY_SIZE_X);
+                dest += mPitch;
+            }
+            mDirtyLines.addLine(line, 0, rowStorage + 8, DISPLAY_SIZE_X, mPaletteHash);
+            mObservation.addLine(line, 0, rowStorage + 8, DISPLAY_SIZE_X);
+        }
+    }
+
+    uint32_t Display::getMonoPalette(const RenderRegisters& registers)
+    {
+        return registers.BGP | (registers.OBP0 << 8) | (registers.OBP1 << 16);
+    }
+
+    uint32_t Display::getNextRenderLine(int32_t tick)
+    {
+        // Lines whose pixel transfer has started before tick are final
+        updateRasterPos(tick);
+        uint32_t line = mRasterLine;
+        if (tick >= mLineFirstTick + mMode3StartTick)
+            ++line;
+        return std::max<uint32_t>(std::min<uint32_t>(line, DISPLAY_SIZE_Y), mRenderedLine);
+    }
+
+    void Display::resetRegisterLog()
+    {
+        mRenderRegisters.LCDC = mRegLCDC;
+        mRenderRegisters.SCY = mRegSCY;
+        mRenderRegisters.SCX = mRegSCX;
+        mRenderRegisters.WY = mRegWY;
+        mRenderRegisters.WX = mRegWX;
+        mRenderRegisters.BGP = mRegBGP;
+        mRenderRegisters.OBP0 = mRegOBP0;
+        mRenderRegisters.OBP1 = mRegOBP1;
+        mRegisterLog.clear();
+        mRegisterLogPos = 0;
+    }
+
+    void Display::logRegister(int32_t tick, uint8_t RenderRegisters::* reg, uint8_t value)
+    {
+        // Changes during VBlank are picked up from the live registers by the next frame
+        uint32_t line = getNextRenderLine(tick);
+        if (line >= DISPLAY_SIZE_Y)
+            return;
+
+        if ((mRegisterLogPos == mRegisterLog.size()) && (line <= mRenderedLine))
+        {
+            // No pending line uses the previous value
+            mRenderRegisters.*reg = value;
+            return;
+        }
+
+        RegisterLogEntry entry;
+        entry.line = static_cast<uint8_t>(line);
+        entry.reg = reg;
+        entry.value = value;
+        mRegisterLog.push_back(entry);
+    }
+
+    void Display::applyRegisterLog(uint32_t line)
+    {
+        while ((mRegisterLogPos < mRegisterLog.size()) && (mRegisterLog[mRegisterLogPos].line <= line))
+        {
+            const auto& entry = mRegisterLog[mRegisterLogPos++];
+            mRenderRegisters.*entry.reg = entry.value;
         }
     }
 
@@ -1450,22 +1777,23 @@ namespace gb
                 EMU_NOT_IMPLEMENTED();
             }
 
-            // Find first line
-            updateRasterPos(tick);
-            int32_t firstLine = mRenderedLine;
-
-            // Find last line
-            int32_t lastLine = mRasterLine;
-            if (tick < mLineFirstTick + mMode3StartTick)
-                --lastLine;
-            if (lastLine >= DISPLAY_SIZE_Y)
-                lastLine = DISPLAY_SIZE_Y - 1;
-
-            // Render new lines
-            if (mSurface && (firstLine <= lastLine))
-                renderLines(firstLine, lastLine);
+            // Render new lines in bands sharing the same registers, a frame without
+            // logged changes is drawn in a single pass
+            uint32_t endLine = getNextRenderLine(tick);
+            uint32_t line = mRenderedLine;
+            bool enabled = mSurface || mObservation.isEnabled() || mDirtyLines.isEnabled();
+            while (line < endLine)
+            {
+                applyRegisterLog(line);
+                uint32_t bandEndLine = endLine;
+                if (mRegisterLogPos < mRegisterLog.size())
+                    bandEndLine = std::min<uint32_t>(bandEndLine, mRegisterLog[mRegisterLogPos].line);
+                if (enabled)
+                    renderLines(line, bandEndLine - 1, mRenderRegisters);
+                line = bandEndLine;
+            }
 
-            mRenderedLine = static_cast<uint8_t>(lastLine + 1);
+            mRenderedLine = static_cast<uint8_t>(endLine);
             mRenderedTick = tick;
             mRenderedLineFirstTick = static_cast<uint8_t>(mLineFirstTick);
         }
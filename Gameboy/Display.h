@@ -2,12 +2,17 @@
 
 #include <Core/Clock.h>
 #include <Core/Core.h>
+#include <Core/DirtyLines.h>
+#include <Core/Observation.h>
+#include <Core/PixelFormat.h>
 #include <Core/RegisterBank.h>
+#include <Core/TrackedBuffer.h>
 #include "GB.h"
 
 namespace gb
 {
     class Interrupts;
+    struct DisplayKernels;
 
     class Display
     {
@@ -27,9 +32,14 @@ namespace gb
         bool create(Config& config, emu::Clock& clock, uint32_t master_clock_divider, emu::MemoryBus& memory, Interrupts& interrupts, emu::RegisterBank& registers);
         void destroy();
         void reset();
-        void serialize(emu::ISerializer& serializer);
+        void serialize(emu::ISerializer& serializer, uint32_t version);
         void beginFrame();
-        void setRenderSurface(void* surface, size_t pitch);
+        void setRenderSurface(void* surface, size_t pitch, emu::PixelFormat format);
+        bool setObservation(const emu::Observation::Config& config);
+        const emu::Observation& getObservation() const;
+        const emu::DirtyLines& getDirtyLines() const;
+        void enableDirtyLines(bool enable);
+        void setKernels(const DisplayKernels& kernels);
 
     private:
         class ClockListener : public emu::Clock::IListener
@@ -50,6 +60,25 @@ namespace gb
             Display*        mDisplay;
         };
 
+        struct RenderRegisters
+        {
+            uint8_t     LCDC;
+            uint8_t     SCY;
+            uint8_t     SCX;
+            uint8_t     WY;
+            uint8_t     WX;
+            uint8_t     BGP;
+            uint8_t     OBP0;
+            uint8_t     OBP1;
+        };
+
+        struct RegisterLogEntry
+        {
+            uint8_t                     line;
+            uint8_t RenderRegisters::*  reg;
+            uint8_t                     value;
+        };
+
         struct RegisterAccessors
         {
             struct
@@ -138,8 +167,18 @@ namespace gb
         void writeOBPD(int32_t tick, uint16_t addr, uint8_t value);
         uint8_t readHDMA(int32_t tick, uint16_t addr);
         void writeHDMA(int32_t tick, uint16_t addr, uint8_t value);
+        bool isHDMAActive() const;
+        void scheduleHDMA(int32_t tick);
+        void onHDMA(int32_t tick);
+        void transferHDMABlock(int32_t tick);
+        void writeVRAM(int32_t tick, uint16_t addr, uint8_t value);
         void writeOAM(int32_t tick, uint16_t addr, uint8_t value);
 
+        static void onWriteVRAM(void* context, int32_t tick, uint32_t addr, uint8_t value)
+        {
+            static_cast<Display*>(context)->writeVRAM(tick, static_cast<uint16_t>(addr), value);
+        }
+
         static void onWriteOAM(void* context, int32_t tick, uint32_t addr, uint8_t value)
         {
             static_cast<Display*>(context)->writeOAM(tick, static_cast<uint16_t>(addr), value);
@@ -156,16 +195,34 @@ namespace gb
         void onVBlankStart(int32_t tick);
         void updateRasterPos(int32_t tick);
         uint8_t getMode(int32_t tick);
-        void updateInterrupts(int32_t tick);
-        void updateLineInterrupt(int32_t tick);
-        void updatePalette();
+        int32_t getNextLineTick(int32_t tick, int32_t lineTick, uint32_t firstLine, uint32_t lineCount) const;
+        int32_t getNextMode0Tick(int32_t tick) const;
+        int32_t getNextStatTick(int32_t tick) const;
+        void scheduleStatInterrupt(int32_t tick);
+        void onStatInterrupt(int32_t tick);
+        void updatePalette(const RenderRegisters& registers);
+        uint16_t getSpriteKey(uint8_t index) const;
+        bool getSpriteLines(uint8_t spriteY, uint32_t& firstLine, uint32_t& lastLine) const;
         void sortSprites();
+        void insertLineSprite(uint32_t line, uint8_t index);
+        bool eraseLineSprite(uint32_t line, uint8_t index);
+        void addLineSprite(uint32_t line, uint8_t index);
+        void removeLineSprite(uint32_t line, uint8_t index);
+        void updateSprite(uint8_t index, uint32_t field, uint8_t oldValue);
         void fetchTileRow(uint8_t* dest, const uint8_t* map, uint32_t tileX, uint32_t tileY, uint8_t tileOffset, uint32_t count);
         void fetchAttrRow(uint8_t* dest, const uint8_t* map, uint32_t tileX, uint32_t tileY, uint8_t tileOffset, uint32_t count);
-        void drawTiles(uint8_t* dest, const uint8_t* tiles, const uint8_t* attributes, const uint8_t* patterns, uint8_t tileOffsetY, uint16_t count);
+        void invalidateTile(uint32_t tile);
+        void invalidateTiles();
+        void updateTileCache();
+        void drawTiles(uint8_t* dest, const uint8_t* tiles, const uint8_t* attributes, uint32_t tileBase, uint8_t tileOffsetY, uint16_t count);
         void drawSprites(uint8_t* dest, uint8_t line, uint8_t spriteSizeY, uint8_t paletteShift, uint8_t paletteMask, uint8_t bankMask);
-        void blitLine(uint32_t* dest, uint8_t* src, uint32_t count);
-        void renderLines(uint32_t firstLine, uint32_t lastLine);
+        void blitLine(uint8_t* dest, uint8_t* src, uint32_t count);
+        void renderLines(uint32_t firstLine, uint32_t lastLine, const RenderRegisters& registers);
+        static uint32_t getMonoPalette(const RenderRegisters& registers);
+        uint32_t getNextRenderLine(int32_t tick);
+        void resetRegisterLog();
+        void logRegister(int32_t tick, uint8_t RenderRegisters::* reg, uint8_t value);
+        void applyRegisterLog(uint32_t line);
         void render(int32_t tick);
 
         static void onVBlankStart(void* context, int32_t tick)
@@ -173,11 +230,20 @@ namespace gb
             static_cast<Display*>(context)->onVBlankStart(tick);
         }
 
+        static void onHDMA(void* context, int32_t tick)
+        {
+            static_cast<Display*>(context)->onHDMA(tick);
+        }
+
+        static void onStatInterrupt(void* context, int32_t tick)
+        {
+            static_cast<Display*>(context)->onStatInterrupt(tick);
+        }
+
         emu::Clock*                 mClock;
         emu::MemoryBus*             mMemory;
         emu::MemoryBus::Accessor    mMemoryDMAReadAccessor;
         emu::MemoryBus::Accessor    mMemoryHDMAReadAccessor;
-        emu::MemoryBus::Accessor    mMemoryHDMAWriteAccessor;
         Interrupts*                 mInterrupts;
         Config                      mConfig;
         ClockListener               mClockListener;
@@ -185,12 +251,27 @@ namespace gb
         MEM_ACCESS_READ_WRITE       mMemoryVRAM;
         MEM_ACCESS_READ_WRITE       mMemoryOAM;
         MEM_ACCESS_READ_WRITE       mMemoryNotUsable;
-        emu::Buffer                 mVRAM;
+        emu::TrackedBuffer          mVRAM;
         emu::Buffer                 mOAM;
-        std::vector<uint8_t>        mOAMOrder;
+        emu::Buffer                 mTileCache;
+        std::vector<uint8_t>        mTileDirty;
+        std::vector<uint16_t>       mTileDirtyList;
+        std::vector<uint8_t>        mLineSprites;
+        std::vector<uint8_t>        mLineSpriteCount;
+        std::vector<uint8_t>        mLineSpriteTotal;
         std::vector<uint32_t>       mPalette;
         uint8_t*                    mSurface;
         size_t                      mPitch;
+        emu::PixelFormat            mPixelFormat;
+        size_t                      mPixelSize;
+        emu::Observation            mObservation;
+        emu::DirtyLines             mDirtyLines;
+        uint32_t                    mPaletteHash;
+        uint32_t                    mPaletteMono;
+        RenderRegisters             mRenderRegisters;
+        std::vector<RegisterLogEntry> mRegisterLog;
+        size_t                      mRegisterLogPos;
+        const DisplayKernels*       mKernels;
         int32_t                     mSimulatedTick;
         uint8_t                     mRenderedLine;
         uint8_t                     mRenderedLineFirstTick;
@@ -203,7 +284,6 @@ namespace gb
         int32_t                     mUpdateRasterPosFast;
         int32_t                     mLineFirstTick;
         int32_t                     mLineTick;
-        int32_t                     mLineIntTick;
         int32_t                     mRasterTick;
         uint8_t                     mRasterLine;
         uint8_t                     mBankVRAM;
@@ -224,15 +304,9 @@ namespace gb
         uint8_t                     mRegOBPI;
         uint8_t                     mRegOBPD[64];
         uint8_t                     mRegHDMA[5];
-        uint8_t                     mActiveSprites;
-        uint8_t                     mLineIntLastLY;
-        uint8_t                     mLineIntLastLYC;
         bool                        mSortedSprites;
         bool                        mCachedPalette;
-        bool                        mLineIntLastEnabled;
-        uint8_t                     mIntUpdate;
-        uint8_t                     mIntEnabled;
-        uint8_t                     mIntSync;
-        int32_t                     mIntPredictionMode0;
+        int32_t                     mStatIntTick;
+        int32_t                     mHDMATick;
     };
 }
@@ -0,0 +1,236 @@
+#include <Core/Log.h>
+#include <Core/Simd.h>
+#include "DisplayKernels.h"
+#include <string.h>
+
+#if EMU_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    typedef gb::DisplayKernels DisplayKernels;
+
+    static const uint32_t VERIFY_ITERATIONS = 4096;
+    static const uint32_t VERIFY_LINE_SIZE = 176;
+    static const uint32_t VERIFY_PALETTE_SIZE = 128;
+
+    void expandTileRowScalar(uint8_t* dest, uint8_t pattern0, uint8_t pattern1)
+    {
+        for (uint32_t bit = 0; bit < 8; ++bit)
+        {
+            uint8_t value = static_cast<uint8_t>((((pattern0 << bit) & 0x80) >> 7) | (((pattern1 << bit) & 0x80) >> 6));
+            dest[bit] = value;
+            dest[15 - bit] = value;
+        }
+    }
+
+    void mergeSpriteScalar(uint8_t* dest, const uint8_t* pattern, uint8_t palette, bool backgroundSprite)
+    {
+        for (uint32_t bit = 0; bit < 8; ++bit)
+        {
+            uint8_t src = dest[bit];
+            uint8_t value = pattern[bit];
+            bool transparentBackground = (src & DisplayKernels::PIXEL_COLOR_MASK) == 0;
+            bool backgroundPriority = backgroundSprite || ((src & DisplayKernels::PIXEL_PRIORITY) != 0);
+            bool visible = value && (!backgroundPriority || transparentBackground) && ((src & DisplayKernels::PIXEL_SPRITE) == 0);
+            dest[bit] = visible ? (value | palette) : src;
+        }
+    }
+
+    void blitLine32Scalar(uint32_t* dest, const uint8_t* src, const uint32_t* palette, uint32_t count)
+    {
+        for (uint32_t index = 0; index < count; ++index)
+            dest[index] = palette[src[index]];
+    }
+
+#if EMU_SIMD_X86
+    void expandTileRowSSE2(uint8_t* dest, uint8_t pattern0, uint8_t pattern1)
+    {
+        // Left half tests bits from MSB to LSB, right half holds the flipped row
+        const __m128i bits = _mm_setr_epi8(
+            static_cast<char>(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+            0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80));
+        __m128i plane0 = _mm_and_si128(_mm_set1_epi8(static_cast<char>(pattern0)), bits);
+        __m128i plane1 = _mm_and_si128(_mm_set1_epi8(static_cast<char>(pattern1)), bits);
+        __m128i mask0 = _mm_cmpeq_epi8(plane0, bits);
+        __m128i mask1 = _mm_cmpeq_epi8(plane1, bits);
+        __m128i value = _mm_or_si128(_mm_and_si128(mask0, _mm_set1_epi8(1)), _mm_and_si128(mask1, _mm_set1_epi8(2)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), value);
+    }
+
+    void mergeSpriteSSE2(uint8_t* dest, const uint8_t* pattern, uint8_t palette, bool backgroundSprite)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i flagSprite = _mm_set1_epi8(DisplayKernels::PIXEL_SPRITE);
+        const __m128i flagPriority = _mm_set1_epi8(DisplayKernels::PIXEL_PRIORITY);
+        const __m128i colorMask = _mm_set1_epi8(DisplayKernels::PIXEL_COLOR_MASK);
+
+        __m128i src = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dest));
+        __m128i value = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pattern));
+
+        __m128i transparentSprite = _mm_cmpeq_epi8(value, zero);
+        __m128i spriteBelow = _mm_cmpeq_epi8(_mm_and_si128(src, flagSprite), flagSprite);
+        __m128i transparentBackground = _mm_cmpeq_epi8(_mm_and_si128(src, colorMask), zero);
+        __m128i backgroundPriority = backgroundSprite ? _mm_cmpeq_epi8(zero, zero) : _mm_cmpeq_epi8(_mm_and_si128(src, flagPriority), flagPriority);
+        __m128i aboveBackground = _mm_or_si128(transparentBackground, _mm_andnot_si128(backgroundPriority, _mm_cmpeq_epi8(zero, zero)));
+        __m128i visible = _mm_andnot_si128(_mm_or_si128(transparentSprite, spriteBelow), aboveBackground);
+
+        value = _mm_or_si128(value, _mm_set1_epi8(static_cast<char>(palette)));
+        __m128i result = _mm_or_si128(_mm_and_si128(visible, value), _mm_andnot_si128(visible, src));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest), result);
+    }
+
+    EMU_TARGET_AVX2 void blitLine32AVX2(uint32_t* dest, const uint8_t* src, const uint32_t* palette, uint32_t count)
+    {
+        uint32_t index = 0;
+        for (; index + 8 <= count; index += 8)
+        {
+            __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + index)));
+            __m256i colors = _mm256_i32gather_epi32(reinterpret_cast<const int*>(palette), indices, 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + index), colors);
+        }
+        for (; index < count; ++index)
+            dest[index] = palette[src[index]];
+    }
+#endif
+
+    const DisplayKernels kernelsScalar =
+    {
+        "Scalar",
+        expandTileRowScalar,
+        mergeSpriteScalar,
+        blitLine32Scalar,
+    };
+
+#if EMU_SIMD_X86
+    // Tile rows and sprites are vectorized, the blit stays scalar since SSE2 has no gather
+    const DisplayKernels kernelsSSE2 =
+    {
+        "SSE2 tiles and sprites, scalar blit",
+        expandTileRowSSE2,
+        mergeSpriteSSE2,
+        blitLine32Scalar,
+    };
+
+    // Only the blit uses AVX2, tile rows and sprites are the SSE2 kernels since they fit in 16 bytes
+    const DisplayKernels kernelsAVX2 =
+    {
+        "SSE2 tiles and sprites, AVX2 blit",
+        expandTileRowSSE2,
+        mergeSpriteSSE2,
+        blitLine32AVX2,
+    };
+#endif
+
+    uint32_t nextRandom(uint32_t& seed)
+    {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    }
+
+    bool verifyKernels(const DisplayKernels& kernels)
+    {
+        const DisplayKernels& reference = kernelsScalar;
+
+        // Every possible tile row
+        for (uint32_t pattern = 0; pattern < 0x10000; ++pattern)
+        {
+            uint8_t expected[16];
+            uint8_t actual[16];
+            reference.expandTileRow(expected, static_cast<uint8_t>(pattern), static_cast<uint8_t>(pattern >> 8));
+            kernels.expandTileRow(actual, static_cast<uint8_t>(pattern), static_cast<uint8_t>(pattern >> 8));
+            if (memcmp(expected, actual, sizeof(expected)) != 0)
+                return false;
+        }
+
+        // Random sprites over random lines, mixing background, priority and sprite pixels
+        uint32_t seed = 1;
+        for (uint32_t iteration = 0; iteration < VERIFY_ITERATIONS; ++iteration)
+        {
+            uint8_t line[8];
+            uint8_t pattern[8];
+            for (uint32_t index = 0; index < 8; ++index)
+            {
+                line[index] = static_cast<uint8_t>(nextRandom(seed) & 0x7f);
+                pattern[index] = static_cast<uint8_t>(nextRandom(seed) & 0x03);
+            }
+            uint8_t palette = static_cast<uint8_t>(0x20 + ((nextRandom(seed) & 0x07) << 2));
+            bool backgroundSprite = (nextRandom(seed) & 1) != 0;
+
+            uint8_t expected[8];
+            uint8_t actual[8];
+            memcpy(expected, line, sizeof(line));
+            memcpy(actual, line, sizeof(line));
+            reference.mergeSprite(expected, pattern, palette, backgroundSprite);
+            kernels.mergeSprite(actual, pattern, palette, backgroundSprite);
+            if (memcmp(expected, actual, sizeof(expected)) != 0)
+                return false;
+        }
+
+        // Palette conversion, including a tail that is not a multiple of the vector size
+        uint32_t palette[VERIFY_PALETTE_SIZE];
+        for (auto& color : palette)
+            color = nextRandom(seed) ^ (nextRandom(seed) << 16);
+        uint8_t src[VERIFY_LINE_SIZE];
+        for (auto& value : src)
+            value = static_cast<uint8_t>(nextRandom(seed) % VERIFY_PALETTE_SIZE);
+        for (uint32_t count = VERIFY_LINE_SIZE - 9; count <= VERIFY_LINE_SIZE; ++count)
+        {
+            uint32_t expected[VERIFY_LINE_SIZE];
+            uint32_t actual[VERIFY_LINE_SIZE];
+            reference.blitLine32(expected, src, palette, count);
+            kernels.blitLine32(actual, src, palette, count);
+            if (memcmp(expected, actual, count * sizeof(uint32_t)) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    const DisplayKernels& selectKernels()
+    {
+        const DisplayKernels* candidates[3];
+        uint32_t count = 0;
+#if EMU_SIMD_X86
+        auto level = emu::Simd::getLevel();
+        if (level >= emu::Simd::Level::AVX2)
+            candidates[count++] = &kernelsAVX2;
+        if (level >= emu::Simd::Level::SSE2)
+            candidates[count++] = &kernelsSSE2;
+#endif
+        candidates[count++] = &kernelsScalar;
+
+#if defined(EMU_DEBUG)
+        // The self test takes a few milliseconds, release builds rely on the test run by debug builds
+        for (uint32_t index = 0; index < count; ++index)
+        {
+            auto& kernels = *candidates[index];
+            if (verifyKernels(kernels))
+                return kernels;
+            emu::Log::printf(emu::Log::Type::Error, "Display kernels %s do not match the reference implementation\n", kernels.name);
+        }
+        return kernelsScalar;
+#else
+        return *candidates[0];
+#endif
+    }
+}
+
+namespace gb
+{
+    const DisplayKernels& DisplayKernels::getScalar()
+    {
+        return kernelsScalar;
+    }
+
+    bool DisplayKernels::verify(const DisplayKernels& kernels)
+    {
+        return verifyKernels(kernels);
+    }
+
+    const DisplayKernels& DisplayKernels::getDefault()
+    {
+        static const DisplayKernels& kernels = selectKernels();
+        return kernels;
+    }
+}
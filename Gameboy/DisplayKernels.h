@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Core/Core.h>
+
+namespace gb
+{
+    // Line rendering primitives used by Display. The scalar set is the reference implementation.
+    struct DisplayKernels
+    {
+        static const uint8_t PIXEL_SPRITE = 0x20;      // Pixel comes from a sprite palette
+        static const uint8_t PIXEL_PRIORITY = 0x40;    // Background pixel drawn over sprites when its color is not 0
+        static const uint8_t PIXEL_COLOR_MASK = 0x03;
+
+        // Expands a 2bpp tile row into 8 color indices followed by the same row flipped horizontally.
+        typedef void (*ExpandTileRow)(uint8_t* dest, uint8_t pattern0, uint8_t pattern1);
+
+        // Merges 8 sprite pixels over the line, honoring sprite and background priorities.
+        typedef void (*MergeSprite)(uint8_t* dest, const uint8_t* pattern, uint8_t palette, bool backgroundSprite);
+
+        // Converts palette indices to 32 bit colors.
+        typedef void (*BlitLine32)(uint32_t* dest, const uint8_t* src, const uint32_t* palette, uint32_t count);
+
+        const char*     name;
+        ExpandTileRow   expandTileRow;
+        MergeSprite     mergeSprite;
+        BlitLine32      blitLine32;
+
+        static const DisplayKernels& getScalar();
+
+        // Fastest kernels supported by the processor. Debug builds only pick them when they match the scalar results.
+        static const DisplayKernels& getDefault();
+
+        // Compares every tile row and a random set of sprites and lines against the scalar kernels.
+        static bool verify(const DisplayKernels& kernels);
+    };
+}
@@ -8,6 +8,8 @@
 
 namespace gb
 {
+    struct DisplayKernels;
+
     enum class Model : uint8_t
     {
         GB,
@@ -98,6 +100,9 @@ namespace gb
         virtual uint8_t read8(uint16_t addr) = 0;
         virtual void write8(uint16_t addr, uint8_t value) = 0;
 
+        // Replaces the line rendering kernels picked for the processor, to compare them with the scalar ones.
+        virtual void setDisplayKernels(const DisplayKernels& kernels) = 0;
+
         static Context* create(const Rom& rom, Model model);
     };
 
@@ -137,7 +137,7 @@ namespace gb
         mMemoryROM[1].setReadMemory(mBankMapROM[mBankROM[1]]);
         if (!mExternalRAM.empty() && (mEnableExternalRAM || !mRom->getDescription().hasBattery))
         {
-            mMemoryExternalRAM.setReadWriteMemory(mBankMapRAM[mBankExternalRAM]);
+            mMemoryExternalRAM.setReadWriteMemory(mBankMapRAM[mBankExternalRAM], mExternalRAM);
         }
         else
         {
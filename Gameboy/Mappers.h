@@ -2,6 +2,7 @@
 
 #include <Core/Core.h>
 #include <Core/RegisterBank.h>
+#include <Core/TrackedBuffer.h>
 #include "GB.h"
 
 namespace gb
@@ -58,7 +59,7 @@ namespace gb
         MEM_ACCESS              mMemoryROM[2];
         MEM_ACCESS_READ_WRITE   mMemoryExternalRAM;
         MEM_ACCESS_READ_WRITE   mMemoryExternalRAMEmpty;
-        emu::Buffer             mExternalRAM;
+        emu::TrackedBuffer      mExternalRAM;
         uint32_t                mBankROM[2];
         uint32_t                mBankExternalRAM;
         bool                    mEnableExternalRAM;
@@ -0,0 +1,95 @@
+#include <Core/DirtyLines.h>
+#include <Core/InputController.h>
+#include <Core/Log.h>
+#include "DisplayKernels.h"
+#include "GB.h"
+#include "Tests.h"
+#include <vector>
+
+namespace
+{
+    static const uint32_t DISPLAY_TEST_FRAMES = 3600;
+
+    struct DisplayTestContext
+    {
+        gb::Context*            context = nullptr;
+        std::vector<uint32_t>   surface;
+
+        ~DisplayTestContext()
+        {
+            if (context)
+                context->dispose();
+        }
+
+        bool create(const gb::Rom& rom, gb::Model model, const gb::DisplayKernels& kernels)
+        {
+            context = gb::Context::create(rom, model);
+            if (!context)
+                return false;
+            context->setDisplayKernels(kernels);
+            surface.resize(gb::Context::DisplaySizeX * gb::Context::DisplaySizeY);
+            context->setRenderBuffer(surface.data(), gb::Context::DisplaySizeX * sizeof(uint32_t));
+            return context->reset();
+        }
+
+        uint32_t hashFrame() const
+        {
+            return emu::DirtyLines::hash(surface.data(), surface.size() * sizeof(uint32_t), 0);
+        }
+    };
+
+    bool compareKernels(const gb::Rom& rom, gb::Model model, const char* modelName, const char* recordedPath)
+    {
+        auto& scalar = gb::DisplayKernels::getScalar();
+        auto& kernels = gb::DisplayKernels::getDefault();
+
+        DisplayTestContext reference;
+        DisplayTestContext candidate;
+        if (!reference.create(rom, model, scalar) || !candidate.create(rom, model, kernels))
+            return false;
+
+        // Frames past the end of the recording are played without input
+        auto source = emu::GroupController::create();
+        auto playback = emu::InputPlayback::create(*source);
+        bool success = playback && playback->load(recordedPath);
+        if (!success)
+            emu::Log::printf(emu::Log::Type::Error, "Cannot load the recorded inputs %s\n", recordedPath);
+
+        for (uint32_t frame = 0; success && (frame < DISPLAY_TEST_FRAMES); ++frame)
+        {
+            uint8_t buttons = playback->readInput();
+            reference.context->setController(0, buttons);
+            candidate.context->setController(0, buttons);
+            reference.context->execute();
+            candidate.context->execute();
+            if (reference.hashFrame() != candidate.hashFrame())
+            {
+                emu::Log::printf(emu::Log::Type::Error, "%s: frame %d rendered by the %s kernels differs from the scalar kernels\n", modelName, frame, kernels.name);
+                success = false;
+            }
+        }
+
+        if (success)
+            emu::Log::printf(emu::Log::Type::Info, "%s: %d frames rendered by the %s kernels match the scalar kernels\n", modelName, DISPLAY_TEST_FRAMES, kernels.name);
+
+        if (playback)
+            playback->dispose();
+        source->dispose();
+        return success;
+    }
+}
+
+bool runDisplayKernelTest(const char* romPath, const char* recordedPath)
+{
+    if (&gb::DisplayKernels::getDefault() == &gb::DisplayKernels::getScalar())
+        emu::Log::printf(emu::Log::Type::Warning, "The processor only runs the scalar display kernels, nothing to compare\n");
+
+    auto rom = gb::Rom::load(romPath);
+    if (!rom)
+        return false;
+
+    bool success = compareKernels(*rom, gb::Model::GB, "GB", recordedPath);
+    success = compareKernels(*rom, gb::Model::GBC, "GBC", recordedPath) && success;
+    rom->dispose();
+    return success;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// Plays a recorded session with the scalar display kernels and the ones picked for the processor, on GB and GBC.
+bool runDisplayKernelTest(const char* romPath, const char* recordedPath);
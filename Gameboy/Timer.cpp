@@ -2,18 +2,27 @@
 #include <Core/Serializer.h>
 #include "Timer.h"
 #include "Interrupts.h"
+#include <algorithm>
 
 namespace
 {
-    static const int32_t DIV_FREQUENCY_GB = 16384;
-
     static const uint8_t TAC_START = 0x04;
     static const uint8_t TAC_SELECT_MASK = 0x03;
     static const uint8_t TAC_SELECT_SHIFT = 0;
-    static const uint32_t TAC_CLOCK_BASE = 262144;
-    static const uint32_t TAC_CLOCK_SHIFT[4] = { 6, 0, 2, 4 };
 
-    static const int32_t TIMER_OVERFLOW = 0x100;
+    // TIMA counts the falling edges of one bit of the internal counter, DIV is its upper byte
+    static const uint32_t TAC_COUNTER_SHIFT[4] = { 10, 4, 6, 8 };
+    static const uint32_t DIV_SHIFT = 8;
+
+    static const uint32_t TIMER_OVERFLOW = 0x100;
+
+    // Version 1 states counted TIMA from a 262144Hz clock, one tick of it every 16 counter cycles
+    static const uint32_t VERSION1_CLOCK_SHIFT = 4;
+
+    uint32_t getTimerShift(uint8_t tac)
+    {
+        return TAC_COUNTER_SHIFT[(tac & TAC_SELECT_MASK) >> TAC_SELECT_SHIFT];
+    }
 }
 
 namespace gb
@@ -49,11 +58,6 @@ namespace gb
         initialize();
     }
 
-    void Timer::ClockListener::execute()
-    {
-        mTimer->execute();
-    }
-
     void Timer::ClockListener::resetClock()
     {
         mTimer->resetClock();
@@ -64,11 +68,6 @@ namespace gb
         mTimer->advanceClock(tick);
     }
 
-    void Timer::ClockListener::setDesiredTicks(int32_t tick)
-    {
-        mTimer->setDesiredTicks(tick);
-    }
-
     ////////////////////////////////////////////////////////////////////////////
 
     Timer::Timer()
@@ -85,29 +84,22 @@ namespace gb
     {
         mClock          = nullptr;
         mInterrupts     = nullptr;
-        mClockFrequency = 0;
-        mSimulatedTick  = 0;
-        mDesiredTick    = 0;
-        mDivSpeed       = 0;
-        mDivTick        = 0;
-        mRegDIV         = 0x00;
+        mTicksPerCycle  = 1;
+        mCounterTick    = 0;
+        mCounter        = 0x0000;
         mRegTIMA        = 0x00;
         mRegTMA         = 0x00;
         mRegTAC         = 0x00;
-        mTimerMasterClock = 0;
-        mTimerTicksPerClock = 0;
-        resetTimer();
+        mTimerIntTick   = INT32_MAX;
     }
 
     bool Timer::create(emu::Clock& clock, uint32_t clockFrequency, uint32_t fixedClockDivider, uint32_t variableClockDivider, Interrupts& interrupts, emu::RegisterBank& registers)
     {
+        EMU_UNUSED(clockFrequency);
         EMU_UNUSED(fixedClockDivider);
         mClock = &clock;
         mInterrupts = &interrupts;
-        mClockFrequency = clockFrequency;
-        mTimerMasterClock = clockFrequency;
-        mTimerTicksPerClock = clockFrequency / TAC_CLOCK_BASE;
-        setVariableClockDivider(variableClockDivider);
+        mTicksPerCycle = variableClockDivider;
 
         EMU_VERIFY(mClockListener.create(clock, *this));
 
@@ -133,184 +125,147 @@ namespace gb
 
     void Timer::reset()
     {
-        mRegDIV         = 0x00;
+        mCounterTick    = 0;
+        mCounter        = 0x0000;
         mRegTIMA        = 0x00;
         mRegTMA         = 0x00;
         mRegTAC         = 0x00;
-        resetTimer();
+        mTimerIntTick   = INT32_MAX;
     }
 
-    void Timer::setVariableClockDivider(uint32_t variableClockDivider)
+    void Timer::setVariableClockDivider(int32_t tick, uint32_t variableClockDivider)
     {
-        mDivSpeed = mClockFrequency / (DIV_FREQUENCY_GB << variableClockDivider);
-    }
+        if (mTicksPerCycle == static_cast<int32_t>(variableClockDivider))
+            return;
 
-    void Timer::beginFrame()
-    {
-        updateTimerValue(mSimulatedTick);
+        // The internal counter runs on the CPU clock, so double speed makes it count twice as fast
+        updateCounter(tick);
+        mCounterTick = tick;
+        mTicksPerCycle = variableClockDivider;
         updateTimerPrediction();
     }
 
-    void Timer::execute()
+    void Timer::beginFrame()
     {
-        if (mSimulatedTick < mDesiredTick)
-        {
-            mSimulatedTick = mDesiredTick;
-            updateTimerInterrupt(mSimulatedTick);
-        }
+        // Clock events do not survive the end of a frame
+        if (mTimerIntTick != INT32_MAX)
+            mClock->addEvent(onTimerOverflow, this, mTimerIntTick);
     }
 
     void Timer::resetClock()
     {
-        mSimulatedTick = 0;
-        mDesiredTick = 0;
-        mDivTick = 0;
+        mCounterTick = 0;
+        mTimerIntTick = INT32_MAX;
     }
 
     void Timer::advanceClock(int32_t tick)
     {
-        mSimulatedTick -= tick;
-        mDesiredTick -= tick;
-        mDivTick -= tick;
-        mTimerLastClockTick -= tick;
-        mTimerTick -= tick;
-        mTimerIntTick -= tick;
-        mTimerLastIntTick -= tick;
-    }
-
-    void Timer::setDesiredTicks(int32_t tick)
-    {
-        mDesiredTick = tick;
-    }
-
-    void Timer::advanceDIV(int32_t tick)
-    {
-        // TODO: Fast forward if gap is too big
-        while (mDivTick + mDivSpeed <= tick)
-        {
-            mDivTick += mDivSpeed;
-            ++mRegDIV;
-        }
-    }
-
-    void Timer::resetTimer()
-    {
-        mTimerLastClockTick = 0;
-        mTimerTick = 0;
-        mTimerClock = 0;
-        mTimerIntTick = 0;
-        mTimerLastIntTick = 0;
+        // Keep the reference tick close so it never overflows when the registers are not accessed
+        updateCounter(tick);
+        mCounterTick -= tick;
+        if (mTimerIntTick != INT32_MAX)
+            mTimerIntTick -= tick;
     }
 
-    void Timer::updateTimerValue(int32_t tick)
+    void Timer::updateCounter(int32_t tick)
     {
-        if (tick < mTimerTick)
+        if (tick <= mCounterTick)
             return;
-        EMU_ASSERT(mTimerTick <= tick);
-        mTimerTick = tick;
 
-        bool timerEnabled = (mRegTAC & TAC_START) != 0;
+        uint32_t cycles = (tick - mCounterTick) / mTicksPerCycle;
+        if (!cycles)
+            return;
 
-        // Advance clock
-        int32_t deltaClockTick = (tick - mTimerLastClockTick);
-        int32_t deltaClock = 0;
-        if (deltaClockTick >= mTimerTicksPerClock)
+        if (mRegTAC & TAC_START)
         {
-            deltaClock = deltaClockTick / mTimerTicksPerClock;
-            int32_t modClockTicks = deltaClockTick % mTimerTicksPerClock;
-            mTimerLastClockTick = tick - modClockTicks;
+            // Count falling edges of the selected counter bit over the elapsed cycles
+            uint32_t shift = getTimerShift(mRegTAC);
+            uint32_t edges = ((mCounter & ((1 << shift) - 1)) + cycles) >> shift;
+            if (edges)
+                incrementTimer(tick, edges);
         }
+        mCounter = static_cast<uint16_t>(mCounter + cycles);
+        mCounterTick += cycles * mTicksPerCycle;
 
-        // Advance timer
-        if (timerEnabled)
-        {
-            mTimerClock += deltaClock;
-
-            auto shift = TAC_CLOCK_SHIFT[(mRegTAC & TAC_SELECT_MASK) >> TAC_SELECT_SHIFT];
-            auto divClock = mTimerClock >> shift;
-            auto modClock = mTimerClock & ((1 << shift) - 1);
-            mTimerClock = modClock;
-
-            if (divClock)
-            {
-                uint32_t timer = divClock + mRegTIMA;
-                while (timer >= TIMER_OVERFLOW)
-                    timer -= TIMER_OVERFLOW - mRegTMA;
-                mRegTIMA = static_cast<uint8_t>(timer);
-            }
-        }
+        // The predicted overflow was just raised, the pending event must not raise it again
+        if (mTimerIntTick <= tick)
+            updateTimerPrediction();
     }
 
-    void Timer::updateTimerSync()
+    bool Timer::getTimerInput() const
     {
         if ((mRegTAC & TAC_START) == 0)
-            return;
+            return false;
+        return (mCounter & (1 << (getTimerShift(mRegTAC) - 1))) != 0;
+    }
 
-        mClock->addSync(mTimerIntTick);
+    void Timer::incrementTimer(int32_t tick, uint32_t count)
+    {
+        uint32_t timer = mRegTIMA + count;
+        if (timer >= TIMER_OVERFLOW)
+        {
+            // Overflows reload TMA, which is reached after every (256 - TMA) increments
+            uint32_t reload = TIMER_OVERFLOW - mRegTMA;
+            timer = mRegTMA + (timer - TIMER_OVERFLOW) % reload;
+            mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::Timer);
+        }
+        mRegTIMA = static_cast<uint8_t>(timer);
     }
 
     void Timer::updateTimerPrediction()
     {
+        mTimerIntTick = INT32_MAX;
         if ((mRegTAC & TAC_START) == 0)
             return;
 
-        auto shift = TAC_CLOCK_SHIFT[(mRegTAC & TAC_SELECT_MASK) >> TAC_SELECT_SHIFT];
-        auto missingTimer = TIMER_OVERFLOW - mRegTIMA;
-        auto missingClock = (missingTimer << shift) - mTimerClock;
-        auto missingTicks = missingClock * mTimerTicksPerClock;
-        mTimerIntTick = mTimerLastClockTick + missingTicks;
-
-        updateTimerSync();
+        uint32_t shift = getTimerShift(mRegTAC);
+        uint32_t period = 1 << shift;
+        uint32_t cycles = period - (mCounter & (period - 1)) + (TIMER_OVERFLOW - 1 - mRegTIMA) * period;
+        mTimerIntTick = mCounterTick + static_cast<int32_t>(cycles) * mTicksPerCycle;
+        mClock->addEvent(onTimerOverflow, this, mTimerIntTick);
     }
 
-    void Timer::updateTimerInterrupt(int32_t tick)
+    void Timer::onTimerOverflow(int32_t tick)
     {
-        if ((mRegTAC & TAC_START) == 0)
+        // Events are never removed from the clock, ignore the ones of an outdated prediction
+        if (tick != mTimerIntTick)
             return;
 
-        bool triggered = false;
-        while (mTimerIntTick <= tick)
-        {
-            triggered = true;
-            updateTimerValue(mTimerIntTick);
-            updateTimerPrediction();
-        }
-
-        if (triggered)
-        {
-            mInterrupts->setInterrupt(tick, gb::Interrupts::Signal::Timer);
-            auto delta = tick - mTimerLastIntTick;
-            EMU_UNUSED(delta);
-            mTimerLastIntTick = tick;
-        }
+        // Counting up to the overflow raises the interrupt and predicts the next one
+        updateCounter(tick);
     }
 
     uint8_t Timer::readDIV(int32_t tick, uint16_t addr)
     {
         EMU_UNUSED(addr);
-        advanceDIV(tick);
-        return mRegDIV;
+        updateCounter(tick);
+        return static_cast<uint8_t>(mCounter >> DIV_SHIFT);
     }
 
     void Timer::writeDIV(int32_t tick, uint16_t addr, uint8_t value)
     {
         EMU_UNUSED(addr);
         EMU_UNUSED(value);
-        advanceDIV(tick);
-        mRegDIV = 0;
+        updateCounter(tick);
+
+        // Clearing the counter is a falling edge when the selected bit was set
+        if (getTimerInput())
+            incrementTimer(tick, 1);
+        mCounter = 0;
+        updateTimerPrediction();
     }
 
     uint8_t Timer::readTIMA(int32_t tick, uint16_t addr)
     {
         EMU_UNUSED(addr);
-        updateTimerValue(tick);
+        updateCounter(tick);
         return mRegTIMA;
     }
 
     void Timer::writeTIMA(int32_t tick, uint16_t addr, uint8_t value)
     {
         EMU_UNUSED(addr);
-        updateTimerValue(tick);
+        updateCounter(tick);
         mRegTIMA = value;
         updateTimerPrediction();
     }
@@ -327,9 +282,8 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegTMA != value)
         {
-            updateTimerValue(tick);
+            updateCounter(tick);
             mRegTMA = value;
-            updateTimerPrediction();
         }
     }
 
@@ -345,27 +299,85 @@ namespace gb
         EMU_UNUSED(addr);
         if (mRegTAC != value)
         {
-            updateTimerValue(tick);
+            updateCounter(tick);
+
+            // The timer input is the selected bit AND the enable flag, dropping it is a falling edge
+            bool input = getTimerInput();
             mRegTAC = value;
+            if (input && !getTimerInput())
+                incrementTimer(tick, 1);
             updateTimerPrediction();
         }
     }
 
-    void Timer::serialize(emu::ISerializer& serializer)
+    void Timer::serialize(emu::ISerializer& serializer, uint32_t version)
+    {
+        if (version < 2)
+        {
+            serializeVersion1(serializer);
+            return;
+        }
+
+        serializer
+            .value("TicksPerCycle", mTicksPerCycle)
+            .value("CounterTick", mCounterTick)
+            .value("Counter", mCounter)
+            .value("RegTIMA", mRegTIMA)
+            .value("RegTMA", mRegTMA)
+            .value("RegTAC", mRegTAC)
+            .value("TimerIntTick", mTimerIntTick);
+    }
+
+    void Timer::serializeVersion1(emu::ISerializer& serializer)
     {
+        int32_t simulatedTick = 0;
+        int32_t desiredTick = 0;
+        int32_t divSpeed = 0;
+        int32_t divTick = 0;
+        uint8_t regDIV = 0;
+        int32_t timerLastClockTick = 0;
+        int32_t timerTick = 0;
+        int32_t timerClock = 0;
+        int32_t timerIntTick = 0;
+        int32_t timerLastIntTick = 0;
         serializer
-            .value("SimulatedTick", mSimulatedTick)
-            .value("DesiredTick", mDesiredTick)
-            .value("DivSpeed", mDivSpeed)
-            .value("DivTick", mDivTick)
-            .value("RegDIV", mRegDIV)
+            .value("SimulatedTick", simulatedTick)
+            .value("DesiredTick", desiredTick)
+            .value("DivSpeed", divSpeed)
+            .value("DivTick", divTick)
+            .value("RegDIV", regDIV)
             .value("RegTIMA", mRegTIMA)
             .value("RegTMA", mRegTMA)
             .value("RegTAC", mRegTAC)
-            .value("TimerLastClockTick", mTimerLastClockTick)
-            .value("TimerTick", mTimerTick)
-            .value("TimerClock", mTimerClock)
-            .value("TimerIntTick", mTimerIntTick)
-            .value("TimerLastIntTick", mTimerLastIntTick);
+            .value("TimerLastClockTick", timerLastClockTick)
+            .value("TimerTick", timerTick)
+            .value("TimerClock", timerClock)
+            .value("TimerIntTick", timerIntTick)
+            .value("TimerLastIntTick", timerLastIntTick);
+        if (serializer.isWriting())
+            return;
+
+        // DIV counted from the tick of its last increment, the counter resumes from its value at the saved tick
+        int64_t elapsed = std::max<int64_t>(static_cast<int64_t>(simulatedTick) - divTick, 0);
+        uint32_t divValue = regDIV;
+        uint32_t divFraction = 0;
+        if (divSpeed > 0)
+        {
+            divValue += static_cast<uint32_t>(elapsed / divSpeed);
+            divFraction = static_cast<uint32_t>(((elapsed % divSpeed) << DIV_SHIFT) / divSpeed);
+        }
+        mCounter = static_cast<uint16_t>((divValue << DIV_SHIFT) | divFraction);
+        mCounterTick = simulatedTick;
+
+        // TIMA was only brought up to date when accessed, count the increments since its last update from the predicted overflow
+        uint32_t clockShift = getTimerShift(mRegTAC) - VERSION1_CLOCK_SHIFT;
+        int32_t missingClocks = static_cast<int32_t>((TIMER_OVERFLOW - mRegTIMA) << clockShift) - timerClock;
+        if ((mRegTAC & TAC_START) && (missingClocks > 0) && (timerIntTick > simulatedTick) && (simulatedTick > timerLastClockTick))
+        {
+            int32_t ticksPerClock = (timerIntTick - timerLastClockTick) / missingClocks;
+            uint32_t clocks = timerClock + (simulatedTick - timerLastClockTick) / std::max(ticksPerClock, 1);
+            mRegTIMA = static_cast<uint8_t>(mRegTIMA + std::min<uint32_t>(clocks >> clockShift, TIMER_OVERFLOW - 1 - mRegTIMA));
+        }
+        updateTimerPrediction();
     }
 }
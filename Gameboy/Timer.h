@@ -17,9 +17,9 @@ namespace gb
         bool create(emu::Clock& clock, uint32_t clockFrequency, uint32_t fixedClockDivider, uint32_t variableClockDivider, Interrupts& interrupts, emu::RegisterBank& registers);
         void destroy();
         void reset();
-        void setVariableClockDivider(uint32_t variableClockDivider);
+        void setVariableClockDivider(int32_t tick, uint32_t variableClockDivider);
         void beginFrame();
-        void serialize(emu::ISerializer& serializer);
+        void serialize(emu::ISerializer& serializer, uint32_t version);
 
     private:
         class ClockListener : public emu::Clock::IListener
@@ -30,10 +30,8 @@ namespace gb
             void initialize();
             bool create(emu::Clock& clock, Timer& timer);
             void destroy();
-            virtual void execute() override;
             virtual void resetClock() override;
             virtual void advanceClock(int32_t tick) override;
-            virtual void setDesiredTicks(int32_t tick) override;
 
         private:
             emu::Clock*     mClock;
@@ -60,17 +58,19 @@ namespace gb
         };
 
         void initialize();
-        void execute();
         void resetClock();
         void advanceClock(int32_t tick);
-        void setDesiredTicks(int32_t tick);
-        void scheduleNextEvent(int32_t tick);
-        void advanceDIV(int32_t tick);
-        void resetTimer();
-        void updateTimerValue(int32_t tick);
-        void updateTimerSync();
+        void updateCounter(int32_t tick);
+        bool getTimerInput() const;
+        void incrementTimer(int32_t tick, uint32_t count);
         void updateTimerPrediction();
-        void updateTimerInterrupt(int32_t tick);
+        void onTimerOverflow(int32_t tick);
+        void serializeVersion1(emu::ISerializer& serializer);
+
+        static void onTimerOverflow(void* context, int32_t tick)
+        {
+            static_cast<Timer*>(context)->onTimerOverflow(tick);
+        }
 
         uint8_t readDIV(int32_t tick, uint16_t addr);
         void writeDIV(int32_t tick, uint16_t addr, uint8_t value);
@@ -85,21 +85,12 @@ namespace gb
         Interrupts*             mInterrupts;
         ClockListener           mClockListener;
         RegisterAccessors       mRegisterAccessors;
-        uint32_t                mClockFrequency;
-        int32_t                 mSimulatedTick;
-        int32_t                 mDesiredTick;
-        int32_t                 mDivSpeed;
-        int32_t                 mDivTick;
-        uint8_t                 mRegDIV;
+        int32_t                 mTicksPerCycle;
+        int32_t                 mCounterTick;
+        uint16_t                mCounter;
         uint8_t                 mRegTIMA;
         uint8_t                 mRegTMA;
         uint8_t                 mRegTAC;
-        int32_t                 mTimerMasterClock;
-        int32_t                 mTimerTicksPerClock;
-        int32_t                 mTimerLastClockTick;
-        int32_t                 mTimerTick;
-        int32_t                 mTimerClock;
         int32_t                 mTimerIntTick;
-        int32_t                 mTimerLastIntTick;
     };
 }
@@ -0,0 +1,170 @@
+#include "AudioQueue.h"
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    static const double RATE_INTEGRAL_GAIN = 0.005;
+}
+
+AudioQueue::AudioQueue()
+    : mMask(0)
+    , mChannelCount(0)
+    , mTargetSize(0)
+    , mMaxRateDelta(0.0f)
+    , mReadPos(0)
+    , mWritePos(0)
+    , mUnderrunCount(0)
+    , mPhase(0.0)
+    , mRateCorrection(0.0)
+    , mSizeTotal(0)
+    , mSizeCount(0)
+    , mRunning(false)
+{
+    memset(mLastFrame, 0, sizeof(mLastFrame));
+}
+
+AudioQueue::~AudioQueue()
+{
+    destroy();
+}
+
+bool AudioQueue::create(size_t capacity, size_t targetSize, uint32_t channelCount, float maxRateDelta)
+{
+    destroy();
+    EMU_VERIFY(targetSize && (targetSize < capacity));
+    EMU_VERIFY(channelCount && (channelCount <= MAX_CHANNEL_COUNT));
+
+    // Positions are free running, a power of two size turns the wrap around into a mask
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    mBuffer.resize(size * channelCount, 0);
+    mMask = size - 1;
+    mChannelCount = channelCount;
+    mTargetSize = targetSize;
+    mMaxRateDelta = maxRateDelta;
+    return true;
+}
+
+void AudioQueue::destroy()
+{
+    mBuffer.clear();
+    mMask = 0;
+    mChannelCount = 0;
+    mTargetSize = 0;
+    mMaxRateDelta = 0.0f;
+    mReadPos = 0;
+    mWritePos = 0;
+    mUnderrunCount = 0;
+    mResampled.clear();
+    mPhase = 0.0;
+    mRateCorrection = 0.0;
+    memset(mLastFrame, 0, sizeof(mLastFrame));
+    mSizeTotal = 0;
+    mSizeCount = 0;
+    mRunning = false;
+}
+
+size_t AudioQueue::push(const int16_t* data, size_t count)
+{
+    if (mBuffer.empty() || !count)
+        return 0;
+
+    // Produce slightly more samples when the queue drains and slightly less when it fills up
+    size_t size = getSize();
+    mSizeTotal += size;
+    ++mSizeCount;
+    double error = (static_cast<double>(size) - static_cast<double>(mTargetSize)) / mTargetSize;
+    error = std::min(std::max(error, -1.0), 1.0);
+
+    // The accumulated error absorbs a constant difference between the emulated and the audio rates,
+    // the proportional part alone would settle away from the target to compensate for it
+    mRateCorrection = std::min(std::max(mRateCorrection + error * RATE_INTEGRAL_GAIN, -1.0), 1.0);
+    double ratio = 1.0 - mMaxRateDelta * std::min(std::max(error + mRateCorrection, -1.0), 1.0);
+    double step = 1.0 / ratio;
+
+    // Linear interpolation, position -1 is the last frame of the previous push
+    mResampled.clear();
+    double pos = mPhase - 1.0;
+    double last = static_cast<double>(count - 1);
+    while (pos < last)
+    {
+        auto index = static_cast<int32_t>(pos + 1.0) - 1;
+        double frac = pos - index;
+        const int16_t* frame0 = index < 0 ? mLastFrame : data + index * mChannelCount;
+        const int16_t* frame1 = data + (index + 1) * mChannelCount;
+        for (uint32_t channel = 0; channel < mChannelCount; ++channel)
+            mResampled.push_back(static_cast<int16_t>(frame0[channel] + (frame1[channel] - frame0[channel]) * frac));
+        pos += step;
+    }
+    mPhase = pos - last;
+    memcpy(mLastFrame, data + (count - 1) * mChannelCount, mChannelCount * sizeof(int16_t));
+
+    return write(mResampled.data(), mResampled.size() / mChannelCount);
+}
+
+size_t AudioQueue::write(const int16_t* data, size_t count)
+{
+    size_t writePos = mWritePos.load(std::memory_order_relaxed);
+    size_t readPos = mReadPos.load(std::memory_order_acquire);
+    count = std::min(count, mMask + 1 - (writePos - readPos));
+    for (size_t pos = 0; pos < count; )
+    {
+        size_t offset = (writePos + pos) & mMask;
+        size_t size = std::min(count - pos, mMask + 1 - offset);
+        memcpy(&mBuffer[offset * mChannelCount], data + pos * mChannelCount, size * mChannelCount * sizeof(int16_t));
+        pos += size;
+    }
+    mWritePos.store(writePos + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioQueue::pop(int16_t* data, size_t count)
+{
+    size_t readPos = mReadPos.load(std::memory_order_relaxed);
+    size_t writePos = mWritePos.load(std::memory_order_acquire);
+    size_t available = writePos - readPos;
+
+    // Wait for the target size before starting, and again after running dry, it must remain once this request is served
+    if (!mRunning && (available < mTargetSize + count))
+    {
+        memset(data, 0, count * mChannelCount * sizeof(int16_t));
+        return 0;
+    }
+    mRunning = true;
+
+    size_t size = std::min(count, available);
+    for (size_t pos = 0; pos < size; )
+    {
+        size_t offset = (readPos + pos) & mMask;
+        size_t currentSize = std::min(size - pos, mMask + 1 - offset);
+        memcpy(data + pos * mChannelCount, &mBuffer[offset * mChannelCount], currentSize * mChannelCount * sizeof(int16_t));
+        pos += currentSize;
+    }
+    mReadPos.store(readPos + size, std::memory_order_release);
+
+    if (size < count)
+    {
+        memset(data + size * mChannelCount, 0, (count - size) * mChannelCount * sizeof(int16_t));
+        mUnderrunCount.fetch_add(1, std::memory_order_relaxed);
+        mRunning = false;
+    }
+    return size;
+}
+
+size_t AudioQueue::getSize() const
+{
+    size_t readPos = mReadPos.load(std::memory_order_acquire);
+    return mWritePos.load(std::memory_order_acquire) - readPos;
+}
+
+uint32_t AudioQueue::getUnderrunCount() const
+{
+    return mUnderrunCount.load(std::memory_order_relaxed);
+}
+
+float AudioQueue::getAverageSize() const
+{
+    return mSizeCount ? static_cast<float>(mSizeTotal) / mSizeCount : 0.0f;
+}
@@ -0,0 +1,57 @@
+#ifndef __AUDIO_QUEUE_H__
+#define __AUDIO_QUEUE_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <Core/Core.h>
+
+// Wait-free queue between one producer (the emulation) and one consumer (the audio callback).
+// The producer resamples its frames by a fraction of a percent to keep the queue near the target size.
+// Sizes are in frames of interleaved samples, one per channel.
+class AudioQueue
+{
+public:
+    AudioQueue();
+    ~AudioQueue();
+    bool create(size_t capacity, size_t targetSize, uint32_t channelCount, float maxRateDelta);
+    void destroy();
+    size_t push(const int16_t* data, size_t count);
+    size_t pop(int16_t* data, size_t count);
+    size_t getSize() const;
+    uint32_t getUnderrunCount() const;
+    float getAverageSize() const;
+
+    size_t getTargetSize() const
+    {
+        return mTargetSize;
+    }
+
+private:
+    static const uint32_t MAX_CHANNEL_COUNT = 2;
+
+    size_t write(const int16_t* data, size_t count);
+
+    std::vector<int16_t>    mBuffer;
+    size_t                  mMask;
+    uint32_t                mChannelCount;
+    size_t                  mTargetSize;
+    float                   mMaxRateDelta;
+    std::atomic<size_t>     mReadPos;
+    std::atomic<size_t>     mWritePos;
+    std::atomic<uint32_t>   mUnderrunCount;
+
+    // Producer state
+    std::vector<int16_t>    mResampled;
+    double                  mPhase;
+    double                  mRateCorrection;
+    int16_t                 mLastFrame[MAX_CHANNEL_COUNT];
+    uint64_t                mSizeTotal;
+    uint64_t                mSizeCount;
+
+    // Consumer state
+    bool                    mRunning;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <Core/Log.h>
+#include "AudioQueue.h"
+#include "AudioQueueTests.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    static const uint32_t TEST_SAMPLING_RATE = 44100;
+    static const uint32_t TEST_CHANNEL_COUNT = 2;
+    static const uint32_t TEST_PERIOD = 1024;
+    static const uint32_t TEST_FRAME_RATE = 60;
+    static const uint32_t TEST_FRAME_SIZE = TEST_SAMPLING_RATE / TEST_FRAME_RATE;
+    static const float TEST_RATE_CONTROL = 0.005f;
+    static const double TEST_DURATION = 120.0;
+
+    struct AudioQueueTest
+    {
+        float   delay;      // Target delay in seconds, clamped to one period like the sandbox does
+        float   jitter;     // Each frame is produced late by a random time up to this many seconds
+        float   drift;      // Relative error of the emulated frame rate
+    };
+
+    static const AudioQueueTest kAudioQueueTests[] =
+    {
+        { 0.050f, 0.004f,  0.000f },
+        { 0.050f, 0.030f,  0.003f },
+        { 0.050f, 0.030f, -0.003f },
+        { 0.000f, 0.004f,  0.000f },
+        { 0.000f, 0.008f,  0.003f },
+        { 0.000f, 0.008f, -0.003f },
+    };
+}
+
+bool runAudioQueueTest(const AudioQueueTest& test)
+{
+    // The audio callback and the emulation are simulated on one thread, the callback pops one period at a fixed rate
+    size_t targetSize = std::max<size_t>(static_cast<size_t>(TEST_SAMPLING_RATE * test.delay), TEST_PERIOD);
+    AudioQueue queue;
+    if (!queue.create((targetSize + TEST_PERIOD + TEST_FRAME_SIZE) * 2, targetSize, TEST_CHANNEL_COUNT, TEST_RATE_CONTROL))
+        return false;
+
+    std::vector<int16_t> frame(TEST_FRAME_SIZE * TEST_CHANNEL_COUNT);
+    std::vector<int16_t> period(TEST_PERIOD * TEST_CHANNEL_COUNT);
+    for (size_t index = 0; index < frame.size(); ++index)
+        frame[index] = static_cast<int16_t>((index * 97) & 0x3fff);
+
+    uint32_t random = 1;
+    uint64_t frameIndex = 0;
+    uint64_t periodIndex = 0;
+    double frameTime = 0.0;
+    double framePeriod = 1.0 / (TEST_FRAME_RATE * (1.0 + test.drift));
+    double callbackPeriod = static_cast<double>(TEST_PERIOD) / TEST_SAMPLING_RATE;
+    for (;;)
+    {
+        double callbackTime = periodIndex * callbackPeriod;
+        if (std::min(frameTime, callbackTime) >= TEST_DURATION)
+            break;
+
+        if (frameTime <= callbackTime)
+        {
+            queue.push(frame.data(), TEST_FRAME_SIZE);
+
+            // Frames are late by a random amount but keep their average rate, and never run ahead of the previous one
+            random = random * 1664525 + 1013904223;
+            double late = test.jitter * (random >> 8) / static_cast<double>(1 << 24);
+            frameTime = std::max(frameTime, ++frameIndex * framePeriod + late);
+        }
+        else
+        {
+            queue.pop(period.data(), TEST_PERIOD);
+            ++periodIndex;
+        }
+    }
+
+    // Delays are reported like the sandbox does on shutdown
+    uint32_t underrunCount = queue.getUnderrunCount();
+    emu::Log::printf(emu::Log::Type::Warning, "AudioQueue: target %.1f ms, jitter %.1f ms, drift %+.1f%%: %d underruns, average delay %.1f ms\n",
+        queue.getTargetSize() * 1000.0f / TEST_SAMPLING_RATE, test.jitter * 1000.0f, test.drift * 100.0f,
+        underrunCount, queue.getAverageSize() * 1000.0f / TEST_SAMPLING_RATE);
+    return underrunCount == 0;
+}
+
+bool runAudioQueueTests()
+{
+    bool success = true;
+    for (const auto& test : kAudioQueueTests)
+    {
+        if (!runAudioQueueTest(test))
+            success = false;
+    }
+    return success;
+}
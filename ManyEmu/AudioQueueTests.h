@@ -0,0 +1,6 @@
+#ifndef __AUDIO_QUEUE_TESTS_H__
+#define __AUDIO_QUEUE_TESTS_H__
+
+bool runAudioQueueTests();
+
+#endif
@@ -0,0 +1,152 @@
+#include <SDL.h>
+#include <Core/AudioStage.h>
+#include <Core/Context.h>
+#include <Core/Emulator.h>
+#include <Core/Log.h>
+#include <Core/Resampler.h>
+#include <Core/Serializer.h>
+#include <Core/Simd.h>
+#include <Core/Stream.h>
+#include "Backend.h"
+#include "Benchmarks.h"
+#include "Path.h"
+#include <vector>
+
+namespace
+{
+    static const uint32_t RESAMPLER_FRAME_COUNT = 600;
+    static const uint32_t RESAMPLER_CHANNEL_COUNT = 2;
+    static const uint32_t RESAMPLER_OUTPUT_SIZES[] = { 735, 800 };  // 44.1 and 48 kHz at 60 frames per second
+
+    static const uint32_t FORK_WARMUP_FRAMES = 120;
+    static const uint32_t FORK_COUNT = 500;
+
+    static const char* kQualityNames[] = { "Low", "Medium", "High" };
+    static_assert(sizeof(kQualityNames) / sizeof(kQualityNames[0]) == static_cast<size_t>(emu::Resampler::Quality::COUNT), "Missing quality names");
+
+    bool forkThroughStream(emu::IEmulator& emulator, const emu::IRom& rom, emu::IContext& context)
+    {
+        emu::MemoryStream stream;
+        emu::BinaryWriter writer(stream);
+        EMU_VERIFY(context.serializeGameState(writer));
+
+        auto fork = emulator.createContext(rom);
+        EMU_VERIFY(fork);
+        emu::BinaryReader reader(stream);
+        bool success = fork->serializeGameState(reader);
+        emulator.destroyContext(*fork);
+        return success;
+    }
+
+    bool forkThroughClone(emu::IEmulator& emulator, emu::IContext& context)
+    {
+        auto fork = context.clone();
+        EMU_VERIFY(fork);
+        emulator.destroyContext(*fork);
+        return true;
+    }
+
+    void logForks(const std::string& path, const char* method, uint64_t start, uint64_t end)
+    {
+        double seconds = static_cast<double>(end - start) / SDL_GetPerformanceFrequency();
+        emu::Log::printf(emu::Log::Type::Warning, "%s: %s %.0f forks/sec\n", path.c_str(), method, FORK_COUNT / seconds);
+    }
+}
+
+bool runResamplerBenchmark()
+{
+    // Frames of the audio stage internal rate are converted to the host rate, like the APUs do when resampling
+    uint32_t inputSize = emu::AudioStage::INTERNAL_SAMPLE_COUNT;
+    std::vector<int16_t> input(inputSize);
+    uint32_t seed = 1;
+    for (auto& value : input)
+    {
+        seed = seed * 1664525 + 1013904223;
+        value = static_cast<int16_t>(seed >> 16);
+    }
+
+    auto maxLevel = emu::Simd::getLevel();
+    for (uint32_t level = 0; level <= static_cast<uint32_t>(maxLevel); ++level)
+    {
+        for (uint32_t quality = 0; quality < static_cast<uint32_t>(emu::Resampler::Quality::COUNT); ++quality)
+        {
+            for (auto outputSize : RESAMPLER_OUTPUT_SIZES)
+            {
+                emu::Resampler resampler;
+                if (!resampler.create(inputSize, outputSize, RESAMPLER_CHANNEL_COUNT, static_cast<emu::Resampler::Quality>(quality)))
+                    return false;
+                if (!resampler.setKernelLevel(static_cast<emu::Simd::Level>(level)))
+                    return false;
+
+                std::vector<int16_t> output(outputSize * RESAMPLER_CHANNEL_COUNT);
+                size_t produced = 0;
+                uint64_t start = SDL_GetPerformanceCounter();
+                for (uint32_t frame = 0; frame < RESAMPLER_FRAME_COUNT; ++frame)
+                {
+                    for (uint32_t channel = 0; channel < RESAMPLER_CHANNEL_COUNT; ++channel)
+                        resampler.write(channel, input.data(), input.size());
+                    produced += resampler.read(output.data(), outputSize);
+                }
+                uint64_t end = SDL_GetPerformanceCounter();
+
+                // Each channel counts as a sample
+                double seconds = static_cast<double>(end - start) / SDL_GetPerformanceFrequency();
+                emu::Log::printf(emu::Log::Type::Warning, "Resampler %s %s %d Hz: %.2f ns/sample\n",
+                    emu::Simd::getLevelName(static_cast<emu::Simd::Level>(level)), kQualityNames[quality], outputSize * 60,
+                    seconds * 1e9 / (produced * RESAMPLER_CHANNEL_COUNT));
+            }
+        }
+    }
+    return true;
+}
+
+bool runForkBenchmark(BackendRegistry& registry, const std::string& path)
+{
+    // Forks of a running game, through a serialized state like before clone existed, with clone, and with cloneInto a pooled context
+    std::string root;
+    std::string ext;
+    Path::splitExt(path, root, ext);
+    auto backend = registry.getBackend(Path::normalizeCase(ext).c_str());
+    if (!backend)
+        return false;
+
+    auto& emulator = backend->getEmulator();
+    auto rom = emulator.loadRom(path.c_str());
+    if (!rom)
+        return false;
+
+    bool success = false;
+    auto context = emulator.createContext(*rom);
+    auto pooled = emulator.createContext(*rom);
+    if (context && pooled && context->reset())
+    {
+        for (uint32_t frame = 0; frame < FORK_WARMUP_FRAMES; ++frame)
+            context->execute();
+
+        success = true;
+        uint64_t start = SDL_GetPerformanceCounter();
+        for (uint32_t fork = 0; success && (fork < FORK_COUNT); ++fork)
+            success = forkThroughStream(emulator, *rom, *context);
+        uint64_t end = SDL_GetPerformanceCounter();
+        logForks(path, "serialize + create", start, end);
+
+        start = SDL_GetPerformanceCounter();
+        for (uint32_t fork = 0; success && (fork < FORK_COUNT); ++fork)
+            success = forkThroughClone(emulator, *context);
+        end = SDL_GetPerformanceCounter();
+        logForks(path, "clone", start, end);
+
+        start = SDL_GetPerformanceCounter();
+        for (uint32_t fork = 0; success && (fork < FORK_COUNT); ++fork)
+            success = context->cloneInto(*pooled);
+        end = SDL_GetPerformanceCounter();
+        logForks(path, "cloneInto", start, end);
+    }
+
+    if (pooled)
+        emulator.destroyContext(*pooled);
+    if (context)
+        emulator.destroyContext(*context);
+    emulator.unloadRom(*rom);
+    return success;
+}
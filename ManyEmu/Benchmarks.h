@@ -0,0 +1,11 @@
+#ifndef __BENCHMARKS_H__
+#define __BENCHMARKS_H__
+
+#include <string>
+
+class BackendRegistry;
+
+bool runResamplerBenchmark();
+bool runForkBenchmark(BackendRegistry& registry, const std::string& path);
+
+#endif
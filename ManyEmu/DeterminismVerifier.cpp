@@ -0,0 +1,216 @@
+#include "DeterminismVerifier.h"
+#include <Core/StateIndex.h>
+#include <Core/Stream.h>
+#include <string.h>
+
+DeterminismVerifier::DeterminismVerifier()
+    : mEmulator(nullptr)
+    , mShadow(nullptr)
+    , mReadPos(0)
+    , mWritePos(0)
+    , mContinuous(false)
+    , mRunning(false)
+    , mTerminate(false)
+{
+}
+
+DeterminismVerifier::~DeterminismVerifier()
+{
+    destroy();
+}
+
+bool DeterminismVerifier::create(emu::IEmulator& emulator, emu::IContext& context, const Callback& callback)
+{
+    destroy();
+
+    // The clone has no render or sound buffer, replaying a frame costs only the emulation
+    mShadow = context.clone();
+    EMU_VERIFY(mShadow);
+    mEmulator = &emulator;
+    mCallback = callback;
+    mStatistics = Statistics();
+    mReadPos = 0;
+    mWritePos = 0;
+    mContinuous = false;
+    mTerminate = false;
+    mRunning = true;
+    mThread.start(*this, "DeterminismVerifier");
+    return true;
+}
+
+void DeterminismVerifier::destroy()
+{
+    if (mRunning)
+    {
+        flush();
+        {
+            ScopedLock lock(mMutex);
+            mTerminate = true;
+        }
+        mWork.signal();
+        mThread.wait();
+        mRunning = false;
+    }
+
+    if (mShadow)
+    {
+        mEmulator->destroyContext(*mShadow);
+        mShadow = nullptr;
+    }
+    mEmulator = nullptr;
+    mCallback = nullptr;
+    for (auto& frame : mFrames)
+        frame.state.clear();
+    mResult.clear();
+}
+
+void DeterminismVerifier::beginFrame(emu::IContext& context, uint32_t frame, const uint32_t* controllers, uint32_t controllerCount)
+{
+    if (!mRunning)
+        return;
+
+    uint32_t writePos = 0;
+    {
+        ScopedLock lock(mMutex);
+        if (mWritePos - mReadPos >= FRAME_COUNT)
+        {
+            // The worker is late, this frame goes unchecked along with the one before it
+            ++mStatistics.skippedCount;
+            mContinuous = false;
+            return;
+        }
+        writePos = mWritePos;
+    }
+
+    // The slot is out of the worker's reach until the write position moves past it
+    auto& entry = mFrames[writePos % FRAME_COUNT];
+    if (!entry.state.save(context))
+    {
+        ScopedLock lock(mMutex);
+        ++mStatistics.skippedCount;
+        mContinuous = false;
+        return;
+    }
+    entry.index = frame;
+    entry.controllerCount = controllerCount < MAX_CONTROLLERS ? controllerCount : MAX_CONTROLLERS;
+    memcpy(entry.controllers, controllers, entry.controllerCount * sizeof(uint32_t));
+    entry.continuous = mContinuous;
+
+    {
+        ScopedLock lock(mMutex);
+        ++mWritePos;
+        mContinuous = true;
+    }
+    mWork.signal();
+}
+
+void DeterminismVerifier::invalidate()
+{
+    ScopedLock lock(mMutex);
+    mContinuous = false;
+}
+
+void DeterminismVerifier::flush()
+{
+    if (!mRunning)
+        return;
+
+    // The last frame waits for the state that follows it, it is not counted as pending
+    for (;;)
+    {
+        {
+            ScopedLock lock(mMutex);
+            if (mWritePos - mReadPos <= 1)
+                return;
+        }
+        mIdle.wait();
+    }
+}
+
+DeterminismVerifier::Statistics DeterminismVerifier::getStatistics()
+{
+    ScopedLock lock(mMutex);
+    return mStatistics;
+}
+
+void DeterminismVerifier::execute()
+{
+    ScopedLock lock(mMutex);
+    for (;;)
+    {
+        if (mWritePos - mReadPos < 2)
+        {
+            mIdle.signal();
+            if (mTerminate)
+                break;
+
+            ScopedUnlock unlock(mMutex);
+            mWork.wait();
+            continue;
+        }
+
+        // Both slots stay untouched by the main thread until the read position moves on
+        auto& frame = mFrames[mReadPos % FRAME_COUNT];
+        auto& next = mFrames[(mReadPos + 1) % FRAME_COUNT];
+        if (!next.continuous)
+        {
+            ++mStatistics.skippedCount;
+        }
+        else
+        {
+            bool same = true;
+            {
+                ScopedUnlock unlock(mMutex);
+                same = verify(frame, next);
+            }
+            if (same)
+                ++mStatistics.verifiedCount;
+            else
+                ++mStatistics.failedCount;
+        }
+        ++mReadPos;
+    }
+}
+
+bool DeterminismVerifier::verify(const Frame& frame, const Frame& next)
+{
+    if (!frame.state.load(*mShadow))
+        return false;
+    for (uint32_t index = 0; index < frame.controllerCount; ++index)
+        mShadow->setController(index, frame.controllers[index]);
+    mShadow->execute();
+
+    // The next state was captured after its inputs were set, they are part of it
+    for (uint32_t index = 0; index < next.controllerCount; ++index)
+        mShadow->setController(index, next.controllers[index]);
+    mResult.save(*mShadow);
+
+    if ((mResult.getSize() == next.state.getSize()) && !memcmp(mResult.getData(), next.state.getData(), mResult.getSize()))
+        return true;
+
+    if (mCallback)
+        mCallback(frame.index, findDifference(next));
+    return false;
+}
+
+std::string DeterminismVerifier::findDifference(const Frame& next)
+{
+    // Snapshots have no field names, both states are serialized again with them
+    emu::IndexedWriter replayWriter;
+    emu::MemoryStream replayStream;
+    mShadow->serializeGameState(replayWriter);
+    replayWriter.write(replayStream);
+
+    emu::IndexedWriter expectedWriter;
+    emu::MemoryStream expectedStream;
+    next.state.load(*mShadow);
+    mShadow->serializeGameState(expectedWriter);
+    expectedWriter.write(expectedStream);
+
+    emu::StateIndex replay;
+    emu::StateIndex expected;
+    std::vector<emu::StateIndex::Difference> differences;
+    if (replay.open(replayStream.getBuffer(), replayStream.getSize()) && expected.open(expectedStream.getBuffer(), expectedStream.getSize()))
+        emu::StateIndex::diff(expected, replay, differences);
+    return differences.empty() ? std::string("unknown") : differences.front().path;
+}
@@ -0,0 +1,79 @@
+#ifndef __DETERMINISM_VERIFIER_H__
+#define __DETERMINISM_VERIFIER_H__
+
+#include <functional>
+#include <string>
+#include <Core/Context.h>
+#include <Core/Emulator.h>
+#include <Core/Snapshot.h>
+#include "Thread.h"
+
+// Checks that frames give the same result when they are executed again. A shadow context on a worker thread replays each
+// frame from the state captured before it with the same inputs, and compares its result with the state captured before
+// the next frame. The emulation only pays for that one snapshot per frame, frames are skipped when the worker is late.
+class DeterminismVerifier : public IExecutable
+{
+public:
+    static const uint32_t MAX_CONTROLLERS = 4;
+
+    struct Statistics
+    {
+        uint32_t    verifiedCount = 0;
+        uint32_t    skippedCount = 0;
+        uint32_t    failedCount = 0;
+    };
+
+    // Called on the worker thread for each frame giving another state when replayed, with the first field that differs.
+    typedef std::function<void(uint32_t frame, const std::string& field)> Callback;
+
+    DeterminismVerifier();
+    ~DeterminismVerifier();
+    bool create(emu::IEmulator& emulator, emu::IContext& context, const Callback& callback);
+    void destroy();
+
+    // Captures the state of the context right before the frame is executed, along with its inputs.
+    void beginFrame(emu::IContext& context, uint32_t frame, const uint32_t* controllers, uint32_t controllerCount);
+
+    // The state was changed outside of a frame, by a rewind or a load, the last frame captured can't be checked.
+    void invalidate();
+
+    // Waits until every frame captured has been checked.
+    void flush();
+
+    Statistics getStatistics();
+
+    virtual void execute() override;
+
+private:
+    static const uint32_t FRAME_COUNT = 4;
+
+    struct Frame
+    {
+        emu::Snapshot   state;
+        uint32_t        index;
+        uint32_t        controllers[MAX_CONTROLLERS];
+        uint32_t        controllerCount;
+        bool            continuous;
+    };
+
+    bool verify(const Frame& frame, const Frame& next);
+    std::string findDifference(const Frame& next);
+
+    emu::IEmulator*     mEmulator;
+    emu::IContext*      mShadow;
+    Callback            mCallback;
+    Frame               mFrames[FRAME_COUNT];
+    emu::Snapshot       mResult;
+    Statistics          mStatistics;
+    uint32_t            mReadPos;
+    uint32_t            mWritePos;
+    bool                mContinuous;
+    Mutex               mMutex;
+    Event               mWork;
+    Event               mIdle;
+    Thread              mThread;
+    bool                mRunning;
+    bool                mTerminate;
+};
+
+#endif
@@ -22,6 +22,10 @@ GameSession::GameSession()
     , mEmulator(nullptr)
     , mRom(nullptr)
     , mContext(nullptr)
+    , mGameDataFile(0)
+    , mGameStateFile(0)
+    , mControllerCount(0)
+    , mFrameIndex(0)
     , mValid(false)
 {
 }
@@ -49,6 +53,16 @@ bool GameSession::loadRom(IBackend& backend, const std::string& path, const std:
     mSavePath = Path::join(saveDirectory, romName);
     mGameDataPath = mSavePath + FileExtensionData;
     mGameStatePath = mSavePath + FileExtensionState;
+    // The worker thread only runs while a game is loaded
+    mSaveWriter.create([this](const std::string& path, bool success)
+    {
+        if (!success)
+            emu::Log::printf(emu::Log::Type::Error, "Cannot write file %s\n", path.c_str());
+        if (mSaveCallback)
+            mSaveCallback(path, success);
+    });
+    mGameDataFile = mSaveWriter.addFile(mGameDataPath);
+    mGameStateFile = mSaveWriter.addFile(mGameStatePath, true);
 
     mRom = mEmulator->loadRom(path.c_str());
     if (!mRom)
@@ -61,6 +75,8 @@ bool GameSession::loadRom(IBackend& backend, const std::string& path, const std:
     EMU_VERIFY(mContext->getSystemInfo(mSystemInfo));
     EMU_VERIFY(mContext->getDisplayInfo(mDisplayInfo));
 
+    mControllerCount = 0;
+    mFrameIndex = 0;
     mValid = true;
     return true;
 }
@@ -68,6 +84,8 @@ bool GameSession::loadRom(IBackend& backend, const std::string& path, const std:
 void GameSession::unloadRom()
 {
     mValid = false;
+    mSaveWriter.destroy();
+    mVerifier.destroy();
 
     if (mContext)
     {
@@ -92,6 +110,8 @@ bool GameSession::loadGameData()
     if (!mValid)
         return false;
 
+    // A save still queued would be read back stale
+    mSaveWriter.flush();
     emu::FileStream stream(mGameDataPath.c_str(), "rb");
     if (!stream.valid())
         return false;
@@ -105,15 +125,10 @@ bool GameSession::saveGameData()
     if (!mValid)
         return false;
 
-    emu::MemoryStream streamTemp;
-    emu::BinaryWriter writer(streamTemp);
-    if (!mContext->serializeGameData(writer))
-        return false;
-    if (streamTemp.getSize() <= 0)
-        return false;
-
-    emu::FileStream streamFinal(mGameDataPath.c_str(), "wb");
-    bool success = streamFinal.write(streamTemp.getBuffer(), streamTemp.getSize());
+    auto& stream = mSaveWriter.beginWrite(mGameDataFile);
+    emu::BinaryWriter writer(stream);
+    bool success = mContext->serializeGameData(writer) && (stream.getSize() > 0);
+    mSaveWriter.endWrite(mGameDataFile, success);
     return success;
 }
 
@@ -122,11 +137,13 @@ bool GameSession::loadGameState()
     if (!mValid)
         return false;
 
+    mSaveWriter.flush();
     emu::FileStream stream(mGameStatePath.c_str(), "rb");
     if (!stream.valid())
         return false;
 
-    emu::BinaryReader reader(stream);
+    emu::CompressedStream streamUnpacked(stream);
+    emu::BinaryReader reader(streamUnpacked);
     return serializeGameState(reader);
 }
 
@@ -135,15 +152,10 @@ bool GameSession::saveGameState()
     if (!mValid)
         return false;
 
-    emu::MemoryStream streamTemp;
-    emu::BinaryWriter writer(streamTemp);
-    if (!serializeGameState(writer))
-        return false;
-    if (streamTemp.getSize() <= 0)
-        return false;
-
-    emu::FileStream streamFinal(mGameStatePath.c_str(), "wb");
-    bool success = streamFinal.write(streamTemp.getBuffer(), streamTemp.getSize());
+    auto& stream = mSaveWriter.beginWrite(mGameStateFile);
+    emu::BinaryWriter writer(stream);
+    bool success = serializeGameState(writer) && (stream.getSize() > 0);
+    mSaveWriter.endWrite(mGameStateFile, success);
     return success;
 }
 
@@ -162,12 +174,48 @@ bool GameSession::serializeGameState(emu::ISerializer& serializer)
     return mContext->serializeGameState(serializer);
 }
 
-bool GameSession::setRenderBuffer(void* buffer, size_t pitch)
+bool GameSession::saveSnapshot(emu::Snapshot& snapshot)
+{
+    if (!mValid)
+        return false;
+
+    return snapshot.save(*mContext);
+}
+
+bool GameSession::loadSnapshot(const emu::Snapshot& snapshot)
 {
     if (!mValid)
         return false;
 
-    return mContext->setRenderBuffer(buffer, pitch);
+    if (!reset())
+        return false;
+    return snapshot.load(*mContext);
+}
+
+emu::SnapshotChain::Id GameSession::captureSnapshot(emu::SnapshotChain& chain)
+{
+    if (!mValid)
+        return emu::SnapshotChain::INVALID_ID;
+
+    return chain.capture(*mContext);
+}
+
+bool GameSession::restoreSnapshot(emu::SnapshotChain& chain, emu::SnapshotChain::Id id)
+{
+    if (!mValid)
+        return false;
+
+    if (!reset())
+        return false;
+    return chain.restore(*mContext, id);
+}
+
+bool GameSession::setRenderBuffer(void* buffer, size_t pitch, emu::PixelFormat format)
+{
+    if (!mValid)
+        return false;
+
+    return mContext->setRenderBuffer(buffer, pitch, format);
 }
 
 bool GameSession::setSoundBuffer(void* buffer, size_t size)
@@ -178,19 +226,75 @@ bool GameSession::setSoundBuffer(void* buffer, size_t size)
     return mContext->setSoundBuffer(static_cast<int16_t*>(buffer), size);
 }
 
+bool GameSession::setSoundFormat(const emu::AudioStage::Format& format)
+{
+    if (!mValid)
+        return false;
+
+    return mContext->setSoundFormat(format);
+}
+
+bool GameSession::getDirtyLines(uint32_t& dirtyCount, uint8_t* flags, size_t count)
+{
+    if (!mValid)
+        return false;
+
+    return mContext->getDirtyLines(dirtyCount, flags, count);
+}
+
+bool GameSession::getStateHash(uint64_t& hash)
+{
+    if (!mValid)
+        return false;
+
+    return mContext->getStateHash(hash);
+}
+
 bool GameSession::setController(uint32_t index, uint32_t value)
 {
     if (!mValid)
         return false;
 
+    if (index < DeterminismVerifier::MAX_CONTROLLERS)
+    {
+        for (; mControllerCount <= index; ++mControllerCount)
+            mControllers[mControllerCount] = 0;
+        mControllers[index] = value;
+    }
     return mContext->setController(index, value);
 }
 
+void GameSession::setSaveCallback(const SaveWriter::Callback& callback)
+{
+    mSaveWriter.flush();
+    mSaveCallback = callback;
+}
+
+bool GameSession::enableVerifier(const DeterminismVerifier::Callback& callback)
+{
+    if (!mValid)
+        return false;
+
+    return mVerifier.create(*mEmulator, *mContext, callback);
+}
+
+void GameSession::disableVerifier()
+{
+    mVerifier.destroy();
+}
+
+DeterminismVerifier::Statistics GameSession::getVerifierStatistics()
+{
+    return mVerifier.getStatistics();
+}
+
 bool GameSession::reset()
 {
     if (!mValid)
         return false;
 
+    // Every load goes through here, the state no longer follows from the previous frame
+    mVerifier.invalidate();
     return mContext->reset();
 }
 
@@ -199,6 +303,8 @@ bool GameSession::execute()
     if (!mValid)
         return false;
 
+    mVerifier.beginFrame(*mContext, mFrameIndex++, mControllers, mControllerCount);
+
     bool success = true;
     __try
     {
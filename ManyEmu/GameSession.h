@@ -3,8 +3,12 @@
 
 #include <stdint.h>
 #include <string>
+#include <Core/AudioStage.h>
 #include <Core/Core.h>
+#include <Core/Snapshot.h>
 #include "Backend.h"
+#include "DeterminismVerifier.h"
+#include "SaveWriter.h"
 
 class GameSession
 {
@@ -22,9 +26,23 @@ public:
     bool loadGameState();
     bool saveGameState();
     bool serializeGameState(emu::ISerializer& serializer);
-    bool setRenderBuffer(void* buffer, size_t pitch);
+    bool saveSnapshot(emu::Snapshot& snapshot);
+    bool loadSnapshot(const emu::Snapshot& snapshot);
+    emu::SnapshotChain::Id captureSnapshot(emu::SnapshotChain& chain);
+    bool restoreSnapshot(emu::SnapshotChain& chain, emu::SnapshotChain::Id id);
+    bool setRenderBuffer(void* buffer, size_t pitch, emu::PixelFormat format = emu::PixelFormat::RGBA8888);
     bool setSoundBuffer(void* buffer, size_t size);
+    bool setSoundFormat(const emu::AudioStage::Format& format);
+    bool getDirtyLines(uint32_t& dirtyCount, uint8_t* flags = nullptr, size_t count = 0);
+    bool getStateHash(uint64_t& hash);
     bool setController(uint32_t index, uint32_t value);
+    void setSaveCallback(const SaveWriter::Callback& callback);
+
+    // Replays every frame on a worker thread and reports those giving another state the second time.
+    bool enableVerifier(const DeterminismVerifier::Callback& callback);
+    void disableVerifier();
+    DeterminismVerifier::Statistics getVerifierStatistics();
+
     bool reset();
     bool execute();
 
@@ -54,6 +72,14 @@ private:
     emu::IContext*      mContext;
     SystemInfo          mSystemInfo;
     DisplayInfo         mDisplayInfo;
+    SaveWriter          mSaveWriter;
+    SaveWriter::Callback mSaveCallback;
+    uint32_t            mGameDataFile;
+    uint32_t            mGameStateFile;
+    DeterminismVerifier mVerifier;
+    uint32_t            mControllers[DeterminismVerifier::MAX_CONTROLLERS];
+    uint32_t            mControllerCount;
+    uint32_t            mFrameIndex;
     bool                mValid;
 };
 
@@ -0,0 +1,402 @@
+#include "Netplay.h"
+#include "GameSession.h"
+#include <SDL.h>
+#include <algorithm>
+
+namespace
+{
+    static const uint32_t NO_ROLLBACK = UINT32_MAX;
+
+    // Input packet, little endian: frame, advantage, ack, first input frame, input count, then the inputs
+    static const size_t PACKET_HEADER_SIZE = 5 * sizeof(uint32_t);
+
+    void write32(std::vector<uint8_t>& buffer, uint32_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value));
+        buffer.push_back(static_cast<uint8_t>(value >> 8));
+        buffer.push_back(static_cast<uint8_t>(value >> 16));
+        buffer.push_back(static_cast<uint8_t>(value >> 24));
+    }
+
+    uint32_t read32(const uint8_t* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+}
+
+LoopbackNetwork::LoopbackNetwork()
+    : mTicksPerSecond(0)
+    , mRandom(1)
+{
+}
+
+LoopbackNetwork::~LoopbackNetwork()
+{
+    destroy();
+}
+
+bool LoopbackNetwork::create(uint32_t playerCount, const Config& config)
+{
+    destroy();
+
+    ScopedLock lock(mMutex);
+    mConfig = config;
+    mEndpoints.resize(playerCount);
+    for (uint32_t index = 0; index < playerCount; ++index)
+    {
+        mEndpoints[index].network = this;
+        mEndpoints[index].index = index;
+    }
+    mTicksPerSecond = SDL_GetPerformanceFrequency();
+    mRandom = config.seed ? config.seed : 1;
+    return true;
+}
+
+void LoopbackNetwork::destroy()
+{
+    ScopedLock lock(mMutex);
+    mEndpoints.clear();
+    mPackets.clear();
+}
+
+INetTransport& LoopbackNetwork::getTransport(uint32_t player)
+{
+    EMU_ASSERT(player < mEndpoints.size());
+    return mEndpoints[player];
+}
+
+bool LoopbackNetwork::Endpoint::send(uint32_t player, const void* data, size_t size)
+{
+    return network->send(index, player, data, size);
+}
+
+bool LoopbackNetwork::Endpoint::receive(uint32_t& player, std::vector<uint8_t>& data)
+{
+    return network->receive(index, player, data);
+}
+
+bool LoopbackNetwork::send(uint32_t source, uint32_t target, const void* data, size_t size)
+{
+    ScopedLock lock(mMutex);
+    if ((target >= mEndpoints.size()) || (target == source))
+        return false;
+
+    // A lost packet looks sent, like it would on a real network
+    if (random() < mConfig.loss)
+        return true;
+
+    float delay = mConfig.latency + random() * mConfig.jitter;
+    Packet packet;
+    packet.deliveryTime = SDL_GetPerformanceCounter() + static_cast<uint64_t>(delay * mTicksPerSecond);
+    packet.source = source;
+    packet.target = target;
+    packet.data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+    mPackets.push_back(std::move(packet));
+    return true;
+}
+
+bool LoopbackNetwork::receive(uint32_t target, uint32_t& source, std::vector<uint8_t>& data)
+{
+    ScopedLock lock(mMutex);
+    uint64_t time = SDL_GetPerformanceCounter();
+    size_t found = mPackets.size();
+    for (size_t index = 0; index < mPackets.size(); ++index)
+    {
+        auto& packet = mPackets[index];
+        if ((packet.target == target) && (packet.deliveryTime <= time))
+        {
+            if ((found == mPackets.size()) || (packet.deliveryTime < mPackets[found].deliveryTime))
+                found = index;
+        }
+    }
+    if (found == mPackets.size())
+        return false;
+
+    // Jitter already reorders the packets, the order of the list doesn't matter
+    source = mPackets[found].source;
+    data.swap(mPackets[found].data);
+    std::swap(mPackets[found], mPackets.back());
+    mPackets.pop_back();
+    return true;
+}
+
+float LoopbackNetwork::random()
+{
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return (mRandom >> 8) * (1.0f / 16777216.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+RollbackSession::RollbackSession()
+    : mGameSession(nullptr)
+    , mTransport(nullptr)
+    , mFrame(0)
+    , mRollbackFrame(NO_ROLLBACK)
+    , mLastSyncFrame(0)
+    , mSyncWait(0)
+    , mStartTime(0)
+    , mFrameStart(0)
+    , mTicksPerSecond(0)
+    , mRollbackDepthTotal(0)
+    , mResimulatedCount(0)
+    , mFrameTimeTotal(0.0)
+    , mValid(false)
+{
+}
+
+RollbackSession::~RollbackSession()
+{
+    destroy();
+}
+
+bool RollbackSession::create(GameSession& gameSession, INetTransport& transport, const Config& config)
+{
+    destroy();
+
+    EMU_VERIFY((config.playerCount >= 2) && (config.playerCount <= MAX_PLAYERS));
+    EMU_VERIFY(config.localPlayer < config.playerCount);
+    EMU_VERIFY((config.maxPrediction >= 1) && (config.maxPrediction <= MAX_PREDICTION));
+    EMU_VERIFY(config.inputDelay <= MAX_INPUT_DELAY);
+
+    mGameSession = &gameSession;
+    mTransport = &transport;
+    mConfig = config;
+
+    // Every player starts with the same empty inputs for the frames covered by the delay
+    for (auto& player : mPlayers)
+    {
+        for (auto& input : player.inputs)
+            input = 0;
+        player.confirmedCount = config.inputDelay;
+        player.ackCount = config.inputDelay;
+        player.remoteFrame = 0;
+        player.remoteAdvantage = 0;
+    }
+
+    mFrame = 0;
+    mRollbackFrame = NO_ROLLBACK;
+    mLastSyncFrame = 0;
+    mSyncWait = 0;
+    mStatistics = Statistics();
+    mRollbackDepthTotal = 0;
+    mResimulatedCount = 0;
+    mFrameTimeTotal = 0.0;
+    mTicksPerSecond = SDL_GetPerformanceFrequency();
+    mStartTime = SDL_GetPerformanceCounter();
+    mFrameStart = mStartTime;
+    mValid = true;
+    return true;
+}
+
+void RollbackSession::destroy()
+{
+    mValid = false;
+    mGameSession = nullptr;
+    mTransport = nullptr;
+    for (auto& snapshot : mSnapshots)
+        snapshot.clear();
+}
+
+bool RollbackSession::synchronize(uint32_t localInput)
+{
+    if (!mValid)
+        return false;
+
+    mFrameStart = SDL_GetPerformanceCounter();
+    receive();
+
+    // A frame waiting for the other players keeps the input it was given first
+    auto& local = mPlayers[mConfig.localPlayer];
+    if (local.confirmedCount == mFrame + mConfig.inputDelay)
+    {
+        local.inputs[local.confirmedCount % INPUT_COUNT] = localInput;
+        ++local.confirmedCount;
+    }
+    sendInputs();
+
+    mGameSession->setRenderBuffer(nullptr, 0);
+    mGameSession->setSoundBuffer(nullptr, 0);
+
+    if (mRollbackFrame < mFrame)
+    {
+        uint32_t depth = mFrame - mRollbackFrame;
+        ++mStatistics.rollbackCount;
+        mStatistics.maxRollbackDepth = std::max(mStatistics.maxRollbackDepth, depth);
+        mRollbackDepthTotal += depth;
+        mResimulatedCount += depth;
+
+        mGameSession->loadSnapshot(mSnapshots[mRollbackFrame % SNAPSHOT_COUNT]);
+        for (uint32_t frame = mRollbackFrame; frame < mFrame; ++frame)
+            executeFrame(frame);
+    }
+    mRollbackFrame = NO_ROLLBACK;
+
+    // Past the prediction window, a rollback could need a state that is no longer kept
+    bool stall = false;
+    for (uint32_t index = 0; index < mConfig.playerCount; ++index)
+    {
+        if ((index != mConfig.localPlayer) && (mFrame >= mPlayers[index].confirmedCount + mConfig.maxPrediction))
+            stall = true;
+    }
+
+    // A player ahead of the others waits a few frames, or the others would keep rolling back
+    if (!stall && !mSyncWait && (mFrame >= mLastSyncFrame + SYNC_INTERVAL))
+    {
+        int32_t sync = getTimeSync();
+        if (sync > 0)
+        {
+            mSyncWait = std::min<uint32_t>(sync, mConfig.maxPrediction);
+            mLastSyncFrame = mFrame;
+        }
+    }
+    if (!stall && mSyncWait)
+    {
+        --mSyncWait;
+        stall = true;
+    }
+
+    if (stall)
+        ++mStatistics.stallCount;
+    return !stall;
+}
+
+bool RollbackSession::execute()
+{
+    if (!mValid)
+        return false;
+
+    bool success = executeFrame(mFrame++);
+
+    float frameTime = static_cast<float>(SDL_GetPerformanceCounter() - mFrameStart) / mTicksPerSecond;
+    ++mStatistics.frameCount;
+    mFrameTimeTotal += frameTime;
+    mStatistics.maxFrameTime = std::max(mStatistics.maxFrameTime, frameTime);
+    if (frameTime > mConfig.frameBudget)
+        ++mStatistics.overBudgetCount;
+    return success;
+}
+
+RollbackSession::Statistics RollbackSession::getStatistics() const
+{
+    Statistics statistics = mStatistics;
+    if (statistics.rollbackCount)
+        statistics.averageRollbackDepth = static_cast<float>(mRollbackDepthTotal) / statistics.rollbackCount;
+    if (statistics.frameCount)
+        statistics.averageFrameTime = static_cast<float>(mFrameTimeTotal / statistics.frameCount);
+    if (mValid)
+    {
+        double elapsed = static_cast<double>(SDL_GetPerformanceCounter() - mStartTime) / mTicksPerSecond;
+        if (elapsed > 0.0)
+            statistics.resimulatedPerSecond = static_cast<float>(mResimulatedCount / elapsed);
+    }
+    return statistics;
+}
+
+void RollbackSession::receive()
+{
+    uint32_t source = 0;
+    while (mTransport->receive(source, mPacket))
+        readPacket(source, mPacket);
+}
+
+void RollbackSession::sendInputs()
+{
+    // The local inputs not acknowledged yet go in every packet, a lost packet is covered by the next one
+    auto& local = mPlayers[mConfig.localPlayer];
+    for (uint32_t index = 0; index < mConfig.playerCount; ++index)
+    {
+        if (index == mConfig.localPlayer)
+            continue;
+
+        // Everything the player hasn't acknowledged is resent, a gap would stop it from confirming the inputs after it.
+        // The range stays within the buffer since each side only runs a bounded number of frames past the other's inputs.
+        auto& player = mPlayers[index];
+        uint32_t first = std::max(player.ackCount, local.confirmedCount - std::min(local.confirmedCount, INPUT_COUNT));
+        uint32_t count = local.confirmedCount - first;
+
+        mPacket.clear();
+        write32(mPacket, mFrame);
+        write32(mPacket, static_cast<uint32_t>(static_cast<int32_t>(mFrame - player.remoteFrame)));
+        write32(mPacket, player.confirmedCount);
+        write32(mPacket, first);
+        write32(mPacket, count);
+        for (uint32_t frame = first; frame < local.confirmedCount; ++frame)
+            write32(mPacket, local.inputs[frame % INPUT_COUNT]);
+        mTransport->send(index, mPacket.data(), mPacket.size());
+    }
+}
+
+void RollbackSession::readPacket(uint32_t source, const std::vector<uint8_t>& packet)
+{
+    if ((source >= mConfig.playerCount) || (source == mConfig.localPlayer) || (packet.size() < PACKET_HEADER_SIZE))
+        return;
+
+    auto data = packet.data();
+    uint32_t remoteFrame = read32(data);
+    int32_t advantage = static_cast<int32_t>(read32(data + 4));
+    uint32_t ack = read32(data + 8);
+    uint32_t first = read32(data + 12);
+    uint32_t count = read32(data + 16);
+    if (packet.size() != PACKET_HEADER_SIZE + count * sizeof(uint32_t))
+        return;
+
+    // Packets can arrive out of order, only the newest frame is kept
+    auto& player = mPlayers[source];
+    if (remoteFrame >= player.remoteFrame)
+    {
+        player.remoteFrame = remoteFrame;
+        player.remoteAdvantage = advantage;
+    }
+    player.ackCount = std::max(player.ackCount, ack);
+
+    // The predictions still needed and the inputs received ahead of the present share the buffer
+    uint32_t last = std::min(first + count, mFrame + INPUT_COUNT - MAX_PREDICTION - 1);
+    for (uint32_t frame = std::max(first, player.confirmedCount); frame < last; ++frame)
+    {
+        if (frame != player.confirmedCount)
+            break;
+
+        uint32_t input = read32(data + PACKET_HEADER_SIZE + (frame - first) * sizeof(uint32_t));
+        auto& slot = player.inputs[frame % INPUT_COUNT];
+        if ((frame < mFrame) && (slot != input))
+            mRollbackFrame = std::min(mRollbackFrame, frame);
+        slot = input;
+        ++player.confirmedCount;
+    }
+}
+
+uint32_t RollbackSession::getInput(uint32_t player, uint32_t frame)
+{
+    // Frames past the last input received repeat it, and keep the prediction to compare with the input once it arrives
+    auto& entry = mPlayers[player];
+    if (frame >= entry.confirmedCount)
+        entry.inputs[frame % INPUT_COUNT] = entry.confirmedCount ? entry.inputs[(entry.confirmedCount - 1) % INPUT_COUNT] : 0;
+    return entry.inputs[frame % INPUT_COUNT];
+}
+
+bool RollbackSession::executeFrame(uint32_t frame)
+{
+    mGameSession->saveSnapshot(mSnapshots[frame % SNAPSHOT_COUNT]);
+    for (uint32_t index = 0; index < mConfig.playerCount; ++index)
+        mGameSession->setController(index, getInput(index, frame));
+    return mGameSession->execute();
+}
+
+int32_t RollbackSession::getTimeSync() const
+{
+    // Both sides see the other one late by the latency, half the difference of their views is how far ahead this one is
+    int32_t sync = 0;
+    for (uint32_t index = 0; index < mConfig.playerCount; ++index)
+    {
+        if (index == mConfig.localPlayer)
+            continue;
+
+        auto& player = mPlayers[index];
+        int32_t advantage = static_cast<int32_t>(mFrame - player.remoteFrame);
+        sync = std::max(sync, (advantage - player.remoteAdvantage) / 2);
+    }
+    return sync;
+}
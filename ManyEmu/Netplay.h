@@ -0,0 +1,167 @@
+#ifndef __NETPLAY_H__
+#define __NETPLAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <Core/Core.h>
+#include <Core/Snapshot.h>
+#include "Thread.h"
+
+class GameSession;
+
+// Unreliable datagrams between the players of a session, packets may be lost, delayed or reordered.
+class INetTransport
+{
+public:
+    virtual ~INetTransport() {}
+    virtual bool send(uint32_t player, const void* data, size_t size) = 0;
+
+    // Returns false when no packet is waiting.
+    virtual bool receive(uint32_t& player, std::vector<uint8_t>& data) = 0;
+};
+
+// Players of a session running in the same process, connected through a network simulating latency, jitter and loss.
+class LoopbackNetwork
+{
+public:
+    struct Config
+    {
+        float       latency = 0.050f;   // One way delay in seconds
+        float       jitter = 0.010f;    // Random delay added to each packet, up to this many seconds
+        float       loss = 0.0f;        // Fraction of the packets dropped
+        uint32_t    seed = 1;
+    };
+
+    LoopbackNetwork();
+    ~LoopbackNetwork();
+    bool create(uint32_t playerCount, const Config& config);
+    void destroy();
+    INetTransport& getTransport(uint32_t player);
+
+private:
+    class Endpoint : public INetTransport
+    {
+    public:
+        virtual bool send(uint32_t player, const void* data, size_t size) override;
+        virtual bool receive(uint32_t& player, std::vector<uint8_t>& data) override;
+
+        LoopbackNetwork*    network;
+        uint32_t            index;
+    };
+
+    struct Packet
+    {
+        uint64_t                deliveryTime;
+        uint32_t                source;
+        uint32_t                target;
+        std::vector<uint8_t>    data;
+    };
+
+    bool send(uint32_t source, uint32_t target, const void* data, size_t size);
+    bool receive(uint32_t target, uint32_t& source, std::vector<uint8_t>& data);
+    float random();
+
+    Config                  mConfig;
+    std::vector<Endpoint>   mEndpoints;
+    std::vector<Packet>     mPackets;
+    uint64_t                mTicksPerSecond;
+    uint32_t                mRandom;
+    Mutex                   mMutex;
+};
+
+// Rollback session between two to four players. Remote inputs are predicted to be the same as the last ones received,
+// the state is saved before each frame, and when an input arrives that doesn't match its prediction the session goes
+// back to that frame and executes the frames up to the present again, without rendering or audio.
+// Each player only runs a few frames ahead of the inputs received, which bounds the frames executed again.
+class RollbackSession
+{
+public:
+    static const uint32_t MAX_PLAYERS = 4;
+    static const uint32_t MAX_PREDICTION = 16;
+    static const uint32_t MAX_INPUT_DELAY = 8;
+
+    struct Config
+    {
+        uint32_t    playerCount = 2;
+        uint32_t    localPlayer = 0;
+        uint32_t    inputDelay = 2;     // Frames between reading the local input and applying it
+        uint32_t    maxPrediction = 8;  // Frames executed ahead of the last inputs received
+        float       frameBudget = 1.0f / 60.0f;
+    };
+
+    struct Statistics
+    {
+        uint32_t    frameCount = 0;
+        uint32_t    stallCount = 0;         // Frames not executed to wait for the other players
+        uint32_t    rollbackCount = 0;
+        uint32_t    maxRollbackDepth = 0;
+        float       averageRollbackDepth = 0.0f;
+        float       resimulatedPerSecond = 0.0f;
+        float       averageFrameTime = 0.0f;    // Seconds spent per frame, rollbacks included
+        float       maxFrameTime = 0.0f;
+        uint32_t    overBudgetCount = 0;    // Frames taking longer than the frame budget
+    };
+
+    RollbackSession();
+    ~RollbackSession();
+    bool create(GameSession& gameSession, INetTransport& transport, const Config& config);
+    void destroy();
+
+    // Receives the remote inputs, sends the local one and rolls back when a prediction was wrong.
+    // Returns false when the frame must wait for the other players, execute() is not to be called then.
+    // Render and sound buffers are cleared, they are to be set again before execute().
+    bool synchronize(uint32_t localInput);
+
+    // Executes the current frame with the inputs known or predicted.
+    bool execute();
+
+    Statistics getStatistics() const;
+
+    uint32_t getFrame() const
+    {
+        return mFrame;
+    }
+
+private:
+    static const uint32_t INPUT_COUNT = 64;
+    static const uint32_t SNAPSHOT_COUNT = MAX_PREDICTION + 2;
+    static const uint32_t SYNC_INTERVAL = 10;
+
+    struct Player
+    {
+        uint32_t    inputs[INPUT_COUNT];    // Inputs received, or predicted past the confirmed count
+        uint32_t    confirmedCount;         // Frames with a known input, they all come before the others
+        uint32_t    ackCount;               // Local inputs the player acknowledged
+        uint32_t    remoteFrame;            // Last frame reported by the player
+        int32_t     remoteAdvantage;        // Frames the player reports being ahead of this one
+    };
+
+    void receive();
+    void sendInputs();
+    void readPacket(uint32_t source, const std::vector<uint8_t>& packet);
+    uint32_t getInput(uint32_t player, uint32_t frame);
+    bool executeFrame(uint32_t frame);
+    int32_t getTimeSync() const;
+
+    GameSession*            mGameSession;
+    INetTransport*          mTransport;
+    Config                  mConfig;
+    Player                  mPlayers[MAX_PLAYERS];
+    emu::Snapshot           mSnapshots[SNAPSHOT_COUNT];
+    std::vector<uint8_t>    mPacket;
+    uint32_t                mFrame;
+    uint32_t                mRollbackFrame;
+    uint32_t                mLastSyncFrame;
+    uint32_t                mSyncWait;
+    uint64_t                mStartTime;
+    uint64_t                mFrameStart;
+    uint64_t                mTicksPerSecond;
+    Statistics              mStatistics;
+    uint64_t                mRollbackDepthTotal;
+    uint64_t                mResimulatedCount;
+    double                  mFrameTimeTotal;
+    bool                    mValid;
+};
+
+#endif
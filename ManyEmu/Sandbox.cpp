@@ -1,15 +1,21 @@
 #include <SDL.h>
+#include <algorithm>
 #include <string>
 #include <vector>
-#include <deque>
 #include <Core/InputController.h>
 #include <Core/Log.h>
 #include <Core/Serializer.h>
+#include <Core/StateHash.h>
 #include <Core/Stream.h>
+#include <Gameboy/Tests.h>
+#include "AudioQueue.h"
+#include "AudioQueueTests.h"
 #include "Backend.h"
+#include "Benchmarks.h"
 #include "GameSession.h"
 #include "GameView.h"
 #include "InputManager.h"
+#include "Netplay.h"
 #include "Path.h"
 
 #define DUMP_ROM_LIST 0
@@ -23,16 +29,6 @@
 
 namespace
 {
-    bool verifyMemory(const void* src1, const void* src2, size_t size, size_t& pos)
-    {
-        for (pos = 0; pos < size; ++pos)
-        {
-            if (static_cast<const uint8_t*>(src1)[pos] != static_cast<const uint8_t*>(src2)[pos])
-                return false;
-        }
-        return true;
-    }
-
     class SandboxImpl : public Sandbox
     {
     public:
@@ -48,12 +44,24 @@ namespace
             uint32_t        replayBufferSize;   // Size of buffer used to rewind game in time
             uint32_t        replayFrameSeek;    // Number of frames between two rewind snapshots
             uint32_t        samplingRate;       // Sound buffer sampling rate
-            float           soundDelay;         // Sound delay in seconds
+            uint32_t        soundPeriod;        // Number of samples requested by each audio callback
+            uint32_t        soundChannels;      // Number of sound channels, 1 for mono or 2 for stereo
+            uint32_t        netplayPlayers;     // Players of a rollback session over a simulated network, 0 to play alone
+            uint32_t        netplayInputDelay;  // Frames between reading the local input and applying it
+            float           netplayLatency;     // Simulated one way network delay in seconds
+            float           netplayJitter;      // Random delay added to each packet, up to this many seconds
+            float           netplayLoss;        // Fraction of the packets lost
+            emu::Resampler::Quality soundQuality;   // Filter quality used when resampling
+            float           soundDelay;         // Sound delay in seconds, can be as low as one sound period
+            float           soundRateControl;   // Maximum sampling rate adjustment used to keep the sound delay stable
             bool            rewindEnabled;      // Enable rewind feature
             bool            playback;           // Replay recorded controller input
+            bool            stateHashes;        // Save the state hash of each recorded frame, or compare them during playback
+            bool            verifyDeterminism;  // Replay each frame on a worker thread and report those giving another state
             bool            enableAudio;        // Enable audio
             bool            stubAudio;          // Redirect audio to a fake output
             bool            saveAudio;          // Save audio to file (not very efficient, for debugging only)
+            bool            soundResample;      // Synthesize sound at a higher rate and filter it down to the sampling rate
             bool            autoSave;           // Automatically save game state before exiting game
             bool            autoLoad;           // Automatically load savegame at startup
             bool            profile;            // Saves some timings in a file called profiling.prof (for debugging only)
@@ -66,12 +74,24 @@ namespace
                 , replayBufferSize(10 * 1024 * 1024)
                 , replayFrameSeek(5)
                 , samplingRate(44100)
+                , soundPeriod(1024)
+                , soundChannels(1)
+                , netplayPlayers(0)
+                , netplayInputDelay(2)
+                , netplayLatency(0.050f)
+                , netplayJitter(0.010f)
+                , netplayLoss(0.0f)
+                , soundQuality(emu::Resampler::Quality::Medium)
                 , soundDelay(0.0500f)
+                , soundRateControl(0.005f)
                 , rewindEnabled(true)
                 , playback(false)
+                , stateHashes(true)
+                , verifyDeterminism(false)
                 , enableAudio(true)
                 , stubAudio(false)
                 , saveAudio(false)
+                , soundResample(false)
                 , autoSave(false)
                 , autoLoad(false)
                 , profile(false)
@@ -112,13 +132,26 @@ namespace
             GameSession*    mSession;
         };
 
+        // Other player of a netplay session, running headless in the same process with made up inputs
+        struct NetPeer
+        {
+            GameSession*        session;
+            RollbackSession     rollback;
+            uint32_t            input;
+            uint32_t            inputFrames;
+        };
+
         void terminate();
         void overrideConfig();
         bool createSound();
         void destroySound();
         GameSession* createGameSession(Application& application, const std::string& path, const std::string& saveDirectory);
         void destroyGameSession(GameSession& gameSession);
+        bool createNetplay(Application& application, const std::string& path);
+        void destroyNetplay();
+        void updateNetPeers();
         void singleFrame(bool frameSkip);
+        void checkStateHash();
         void audioCallback(int16_t* data, uint32_t size);
         static void audioCallback(void* userData, Uint8* stream, int len);
 
@@ -137,14 +170,7 @@ namespace
         uint32_t                    mBufferCount;
         SDL_AudioDeviceID           mSoundDevice;
         std::vector<int16_t>        mSoundBuffer;
-        std::vector<int16_t>        mSoundQueue;
-        size_t                      mSoundReadPos;
-        size_t                      mSoundWritePos;
-        size_t                      mSoundBufferedSize;
-        uint32_t                    mSoundStartSize;
-        uint32_t                    mSoundMinSize;
-        uint32_t                    mSoundMaxSize;
-        bool                        mSoundRunning;
+        AudioQueue                  mSoundQueue;
         emu::FileStream*            mSoundFile;
         emu::FileStream*            mTimingFile;
         InputManager                mInputManager;
@@ -154,27 +180,26 @@ namespace
         emu::InputRecorder*         mInputRecorder;
         emu::InputPlayback*         mInputPlayback;
         emu::InputController*       mPlayer1;
-        emu::MemoryStream           mTestStream0;
-        emu::MemoryStream           mTestStream1;
-        emu::MemoryStream           mTestStream2;
+        emu::StateHashLog           mStateHashes;
+        std::string                 mStateHashPath;
+        bool                        mRecordStateHashes;
+        bool                        mVerifyStateHashes;
         GameSession*                mGameSession;
         GameView*                   mGameView;
+        LoopbackNetwork*            mNetwork;
+        RollbackSession*            mRollback;
+        std::vector<NetPeer*>       mNetPeers;
+        uint32_t                    mNetRandom;
 
         struct Playback
         {
-            Playback(size_t size)
+            Playback()
                 : elapsedFrames(0)
-                , seekCapacity(0)
-                , stream(size)
             {
             }
 
-            typedef std::deque<size_t> SeekQueue;
-
             uint32_t                    elapsedFrames;
-            size_t                      seekCapacity;
-            emu::CircularMemoryStream   stream;
-            SeekQueue                   seekQueue;
+            emu::SnapshotChain          chain;
         };
         Playback*                   mPlayback;
     };
@@ -185,13 +210,6 @@ namespace
         , mFrameIndex(0)
         , mBufferCount(0)
         , mSoundDevice(0)
-        , mSoundReadPos(0)
-        , mSoundWritePos(0)
-        , mSoundBufferedSize(0)
-        , mSoundStartSize(0)
-        , mSoundMinSize(0)
-        , mSoundMaxSize(0)
-        , mSoundRunning(false)
         , mSoundFile(nullptr)
         , mTimingFile(nullptr)
         , mKeyboard(nullptr)
@@ -200,8 +218,13 @@ namespace
         , mInputRecorder(nullptr)
         , mInputPlayback(nullptr)
         , mPlayer1(nullptr)
+        , mRecordStateHashes(false)
+        , mVerifyStateHashes(false)
         , mPlayback(nullptr)
         , mGameView(nullptr)
+        , mNetwork(nullptr)
+        , mRollback(nullptr)
+        , mNetRandom(1)
     {
     }
 
@@ -225,6 +248,17 @@ namespace
 #if 0
         if (!runTestRoms())
             return false;
+        if (!runAudioQueueTests())
+            return false;
+        if (!runResamplerBenchmark())
+            return false;
+        for (const auto& rom : mConfig.roms)
+        {
+            if (!runForkBenchmark(application.getBackendRegistry(), Path::join(mConfig.romFolder, rom)))
+                return false;
+        }
+        if (!runDisplayKernelTest(Path::join(mConfig.romFolder, mConfig.roms.front()).c_str(), mConfig.recorded.c_str()))
+            return false;
 #endif
 
         mInputManager.create(Input_Count);
@@ -269,7 +303,12 @@ namespace
         mPlayer1Controller = new StandardController(mInputManager);
         mPlayer1 = mPlayer1Controller;
 
-        if (!mConfig.recorded.empty())
+        // Netplay mixes delayed local inputs with the remote ones, a recording of the local pad could not be replayed
+        if (!mConfig.recorded.empty() && mConfig.netplayPlayers)
+        {
+            emu::Log::printf(emu::Log::Type::Warning, "Input recording and state hashes are disabled during netplay\n");
+        }
+        else if (!mConfig.recorded.empty())
         {
             if (mConfig.playback)
             {
@@ -287,6 +326,14 @@ namespace
                     return false;
                 mPlayer1 = mInputRecorder;
             }
+
+            if (mConfig.stateHashes)
+            {
+                // Recordings made without hashes are still replayed, only unchecked
+                mStateHashPath = mConfig.recorded + ".hash";
+                mRecordStateHashes = !mConfig.playback;
+                mVerifyStateHashes = mConfig.playback && mStateHashes.load(mStateHashPath.c_str());
+            }
         }
 
         if (mConfig.profile)
@@ -297,16 +344,18 @@ namespace
                 return false;
         }
 
-        mPlayback = new Playback(mConfig.replayBufferSize);
+        mPlayback = new Playback();
 
         if (!createSound())
             return false;
 
         mFirst = true;
 
+        std::string romPath;
         for (auto rom : mConfig.roms)
         {
-            auto gameSession = createGameSession(application, Path::join(mConfig.romFolder, rom), mConfig.saveFolder);
+            romPath = Path::join(mConfig.romFolder, rom);
+            auto gameSession = createGameSession(application, romPath, mConfig.saveFolder);
             if (gameSession)
             {
                 mGameSession = gameSession;
@@ -318,6 +367,18 @@ namespace
         {
             mGameSession->getBackend()->configureController(*mPlayer1Controller, 0);
 
+            if (mConfig.verifyDeterminism)
+            {
+                // Reported from the worker thread, the emulation keeps going
+                mGameSession->enableVerifier([](uint32_t frame, const std::string& field)
+                {
+                    emu::Log::printf(emu::Log::Type::Error, "Frame %d: replay differs at %s\n", frame, field.c_str());
+                });
+            }
+
+            if (mConfig.netplayPlayers && !createNetplay(application, romPath))
+                return false;
+
             auto& displayInfo = mGameSession->getDisplayInfo();
             mTicksPerFrame = static_cast<uint64_t>(SDL_GetPerformanceFrequency() / static_cast<double>(displayInfo.fps));
             mTicksAccumulated = 0;
@@ -343,8 +404,19 @@ namespace
 
         mGameView = nullptr;
 
+        destroyNetplay();
+
         if (mGameSession)
+        {
+            if (mConfig.verifyDeterminism)
+            {
+                mGameSession->disableVerifier();
+                auto statistics = mGameSession->getVerifierStatistics();
+                emu::Log::printf(emu::Log::Type::Info, "Determinism: %d frames verified, %d failed, %d skipped\n",
+                    statistics.verifiedCount, statistics.failedCount, statistics.skippedCount);
+            }
             destroyGameSession(*mGameSession);
+        }
         mGameSession = nullptr;
 
         destroySound();
@@ -371,6 +443,15 @@ namespace
             mInputRecorder = nullptr;
         }
 
+        if (mRecordStateHashes)
+        {
+            if (!mStateHashes.save(mStateHashPath.c_str()))
+                emu::Log::printf(emu::Log::Type::Error, "Cannot write file %s\n", mStateHashPath.c_str());
+            mRecordStateHashes = false;
+        }
+        mVerifyStateHashes = false;
+        mStateHashes.clear();
+
         if (mPlayer1Controller)
         {
             delete mPlayer1Controller;
@@ -403,8 +484,8 @@ namespace
         SDL_zero(audioObtained);
         audioDesired.freq = mConfig.samplingRate;
         audioDesired.format = AUDIO_S16;
-        audioDesired.channels = 1;
-        audioDesired.samples = 1024;
+        audioDesired.channels = static_cast<Uint8>(mConfig.soundChannels);
+        audioDesired.samples = static_cast<Uint16>(mConfig.soundPeriod);
         audioDesired.callback = audioCallback;
         audioDesired.userdata = this;
         mSoundDevice = SDL_OpenAudioDevice(NULL, 0, &audioDesired, &audioObtained, 0);
@@ -412,7 +493,7 @@ namespace
             return false;
 
         mSoundBuffer.clear();
-        mSoundBuffer.resize(mConfig.samplingRate / 60, 0);
+        mSoundBuffer.resize(mConfig.samplingRate / 60 * mConfig.soundChannels, 0);
         if (mConfig.saveAudio)
         {
             std::string path = "..\\audio.snd";
@@ -421,15 +502,12 @@ namespace
                 return false;
         }
 
-        mSoundReadPos = 0;
-        mSoundWritePos = 0;
-        mSoundBufferedSize = 0;
-        mSoundStartSize = static_cast<uint32_t>(mConfig.samplingRate * mConfig.soundDelay);
-        mSoundMinSize = mSoundStartSize >> 1;
-        mSoundMaxSize = mSoundStartSize + mSoundMinSize;
-        mSoundRunning = false;
-        mSoundQueue.clear();
-        mSoundQueue.resize(((mSoundStartSize + mSoundBuffer.size() + 1023) * 2) & ~1023);
+        // The callback needs a full period of samples, a shorter delay would always underrun
+        size_t targetSize = static_cast<size_t>(mConfig.samplingRate * mConfig.soundDelay);
+        targetSize = std::max<size_t>(targetSize, audioObtained.samples);
+        size_t frameSize = mSoundBuffer.size() / mConfig.soundChannels;
+        if (!mSoundQueue.create((targetSize + audioObtained.samples + frameSize) * 2, targetSize, mConfig.soundChannels, mConfig.soundRateControl))
+            return false;
         SDL_PauseAudioDevice(mSoundDevice, 0);
 
         return true;
@@ -437,6 +515,13 @@ namespace
 
     void SandboxImpl::destroySound()
     {
+        if (mSoundDevice)
+        {
+            SDL_PauseAudioDevice(mSoundDevice, 1);
+            emu::Log::printf(emu::Log::Type::Info, "Audio: %d underruns, average delay %.1f ms\n",
+                mSoundQueue.getUnderrunCount(), mSoundQueue.getAverageSize() * 1000.0f / mConfig.samplingRate);
+        }
+
         if (mSoundFile)
         {
             delete mSoundFile;
@@ -484,6 +569,93 @@ namespace
         delete &gameSession;
     }
 
+    bool SandboxImpl::createNetplay(Application& application, const std::string& path)
+    {
+        // Every player loads the same ROM and save, the sessions have to start from the same state
+        LoopbackNetwork::Config networkConfig;
+        networkConfig.latency = mConfig.netplayLatency;
+        networkConfig.jitter = mConfig.netplayJitter;
+        networkConfig.loss = mConfig.netplayLoss;
+        mNetwork = new LoopbackNetwork();
+        if (!mNetwork->create(mConfig.netplayPlayers, networkConfig))
+            return false;
+
+        RollbackSession::Config sessionConfig;
+        sessionConfig.playerCount = mConfig.netplayPlayers;
+        sessionConfig.inputDelay = mConfig.netplayInputDelay;
+        sessionConfig.frameBudget = 1.0f / mGameSession->getDisplayInfo().fps;
+        mRollback = new RollbackSession();
+        if (!mRollback->create(*mGameSession, mNetwork->getTransport(0), sessionConfig))
+            return false;
+
+        for (uint32_t player = 1; player < mConfig.netplayPlayers; ++player)
+        {
+            auto peer = new NetPeer();
+            peer->session = createGameSession(application, path, mConfig.saveFolder);
+            peer->input = 0;
+            peer->inputFrames = 0;
+            mNetPeers.push_back(peer);
+            if (!peer->session)
+                return false;
+
+            sessionConfig.localPlayer = player;
+            if (!peer->rollback.create(*peer->session, mNetwork->getTransport(player), sessionConfig))
+                return false;
+        }
+        return true;
+    }
+
+    void SandboxImpl::destroyNetplay()
+    {
+        if (mRollback)
+        {
+            auto statistics = mRollback->getStatistics();
+            emu::Log::printf(emu::Log::Type::Info, "Netplay: %d frames, %d stalls, %d rollbacks of %.1f frames (%d at most), %.0f frames executed again per second\n",
+                statistics.frameCount, statistics.stallCount, statistics.rollbackCount, statistics.averageRollbackDepth, statistics.maxRollbackDepth, statistics.resimulatedPerSecond);
+            emu::Log::printf(emu::Log::Type::Info, "Netplay: %.2f ms per frame (%.2f ms at most), %d frames over budget\n",
+                statistics.averageFrameTime * 1000.0f, statistics.maxFrameTime * 1000.0f, statistics.overBudgetCount);
+            delete mRollback;
+            mRollback = nullptr;
+        }
+
+        // The peers share the save files of the local player, they leave them as they are
+        for (auto peer : mNetPeers)
+        {
+            peer->rollback.destroy();
+            if (peer->session)
+            {
+                peer->session->unloadRom();
+                delete peer->session;
+            }
+            delete peer;
+        }
+        mNetPeers.clear();
+
+        if (mNetwork)
+        {
+            delete mNetwork;
+            mNetwork = nullptr;
+        }
+    }
+
+    void SandboxImpl::updateNetPeers()
+    {
+        for (auto peer : mNetPeers)
+        {
+            // Buttons held for a random number of frames, enough to get the predictions wrong now and then
+            if (!peer->inputFrames)
+            {
+                mNetRandom = mNetRandom * 1103515245 + 12345;
+                peer->input = (mNetRandom >> 16) & 0xff;
+                peer->inputFrames = 5 + ((mNetRandom >> 8) & 0x1f);
+            }
+            --peer->inputFrames;
+
+            if (peer->rollback.synchronize(peer->input))
+                peer->rollback.execute();
+        }
+    }
+
     void SandboxImpl::update()
     {
         if (!mValid || !mGameSession || !mGameSession->isValid())
@@ -529,9 +701,21 @@ namespace
         if (mInputManager.isPressed(Input_Exit))
             terminate();
 
+        // With netplay the local input goes to the other players, the frame may have to wait for theirs
+        auto& gameSession = *mGameSession;
+        bool stalled = false;
+        if (mRollback)
+        {
+            updateNetPeers();
+            stalled = !mRollback->synchronize(mPlayer1 ? mPlayer1->readInput() : 0);
+        }
+        else if (mPlayer1)
+        {
+            gameSession.setController(0, mPlayer1->readInput());
+        }
+
         void* pixels = nullptr;
         int pitch = 0;
-        auto& gameSession = *mGameSession;
         gameSession.setRenderBuffer(nullptr, 0);
         if (mConfig.display && !frameSkip)
         {
@@ -546,70 +730,46 @@ namespace
         if (mFrameIndex == frameTrigger)
             frameTrigger = frameTrigger;
 
-        if (mPlayer1)
-            gameSession.setController(0, mPlayer1->readInput());
-        if (mSoundBuffer.size() && mConfig.enableAudio)
+        // Without a consumer for the samples, let the emulator skip the synthesis
+        bool needAudio = mConfig.enableAudio && (!mConfig.stubAudio || mSoundFile);
+        if (mSoundBuffer.size() && needAudio)
         {
             size_t size = mSoundBuffer.size();
             mSoundBuffer.clear();
             mSoundBuffer.resize(size, 0);
-            gameSession.setSoundBuffer(&mSoundBuffer[0], mSoundBuffer.size());
+
+            emu::AudioStage::Format soundFormat;
+            soundFormat.channelCount = mConfig.soundChannels;
+            soundFormat.resample = mConfig.soundResample;
+            soundFormat.quality = mConfig.soundQuality;
+            gameSession.setSoundFormat(soundFormat);
+            gameSession.setSoundBuffer(&mSoundBuffer[0], mSoundBuffer.size() / mConfig.soundChannels);
         }
         else
         {
             gameSession.setSoundBuffer(nullptr, 0);
         }
 
-        static bool testGameState = false;
-        if (testGameState)
-        {
-            // Capture state before running the frame
-            mTestStream0.clear();
-            emu::BinaryWriter writer(mTestStream0);
-            gameSession.serializeGameState(writer);
-        }
-
         uint64_t frameStart = SDL_GetPerformanceCounter();
-        gameSession.execute();
-        uint64_t frameEnd = SDL_GetPerformanceCounter();
-
-        if (testGameState)
-        {
-            // Capture state after running the frame
-            mTestStream1.clear();
-            emu::BinaryWriter writer1(mTestStream1);
-            gameSession.serializeGameState(writer1);
-
-            // Rewind to the beginning of the frame
-            emu::BinaryReader reader1(mTestStream0);
-            gameSession.serializeGameState(reader1);
-
-            // Execute the frame again
+        if (!mRollback)
             gameSession.execute();
+        else if (!stalled)
+            mRollback->execute();
+        uint64_t frameEnd = SDL_GetPerformanceCounter();
 
-            // Capture the state after running the frame again
-            mTestStream2.clear();
-            emu::BinaryWriter writer2(mTestStream2);
-            gameSession.serializeGameState(writer2);
+        // A stalled netplay frame executed nothing, it has no state nor samples of its own
+        if (!stalled)
+            checkStateHash();
 
-            // Compare to make sure the result is the same
-            size_t diffPos = 0;
-            bool same = mTestStream1.getSize() == mTestStream2.getSize();
-            same = same && verifyMemory(mTestStream1.getBuffer(), mTestStream2.getBuffer(), mTestStream1.getSize(), diffPos);
-            if (!same)
-            {
-                emu::Log::printf(emu::Log::Type::Error, "Frame %d: serialization failed at offset %d\n!", mFrameIndex, static_cast<uint32_t>(diffPos));
-                EMU_ASSERT(false);
-                terminate();
-            }
-        }
-
-        if (pixels)
+        if (pixels && !stalled)
         {
-            mGraphics->updateTexture(*mTexture, pixels, mFakeTexture.size());
+            // Skip the upload when the emulator reports that no line changed
+            uint32_t dirtyCount = 0;
+            if (!gameSession.getDirtyLines(dirtyCount) || dirtyCount)
+                mGraphics->updateTexture(*mTexture, pixels, mFakeTexture.size());
         }
 
-        if (mSoundFile)
+        if (mSoundFile && !stalled)
         {
             for (uint32_t pos = 0; pos < mSoundBuffer.size(); ++pos)
             {
@@ -619,31 +779,8 @@ namespace
             mSoundFile->write(&mSoundBuffer[0], mSoundBuffer.size() * 2);
         }
 
-        if (mConfig.enableAudio && !mConfig.stubAudio)
-        {
-            SDL_LockAudioDevice(mSoundDevice);
-            if (mSoundBufferedSize < mSoundMaxSize)
-            {
-                auto soundQueueSize = mSoundQueue.size();
-                auto size = mSoundBuffer.size();
-                const int16_t* data = &mSoundBuffer[0];
-                while (size)
-                {
-                    auto currentSize = size;
-                    auto maxSize = soundQueueSize - mSoundWritePos;
-                    if (currentSize > maxSize)
-                        currentSize = maxSize;
-                    memcpy(&mSoundQueue[mSoundWritePos], data, currentSize * sizeof(int16_t));
-                    mSoundBufferedSize += currentSize;
-                    mSoundWritePos += currentSize;
-                    data += currentSize;
-                    size -= currentSize;
-                    if (mSoundWritePos >= soundQueueSize)
-                        mSoundWritePos -= soundQueueSize;
-                }
-            }
-            SDL_UnlockAudioDevice(mSoundDevice);
-        }
+        if (mConfig.enableAudio && !mConfig.stubAudio && !stalled)
+            mSoundQueue.push(&mSoundBuffer[0], mSoundBuffer.size() / mConfig.soundChannels);
 
         float frameTime = static_cast<float>(frameEnd - frameStart) / SDL_GetPerformanceFrequency();
         if (mTimingFile)
@@ -654,40 +791,24 @@ namespace
         }
 
         float timeDir = mInputManager.getInput(Input_TimeDir);
-        if (timeDir < -0.0001f)
+        if ((timeDir < -0.0001f) && !mRollback)
         {
-            if (!mPlayback->seekQueue.empty())
+            auto& chain = mPlayback->chain;
+            if (chain.getCount())
             {
-                size_t size = mPlayback->seekQueue.back();
-                mPlayback->seekQueue.pop_back();
-                mPlayback->seekCapacity -= size;
-                EMU_ASSERT(mPlayback->seekCapacity >= 0);
-                bool valid = mPlayback->stream.setReadOffset(size);
-                if (valid)
-                {
-                    emu::BinaryReader reader(mPlayback->stream);
-                    gameSession.serializeGameState(reader);
-                    mPlayback->stream.rewind(size);
-                }
+                gameSession.restoreSnapshot(chain, chain.getLast());
+                chain.removeLast();
             }
         }
 
-        if (mConfig.rewindEnabled && (++mPlayback->elapsedFrames >= mConfig.replayFrameSeek))
+        // The other players can't go back in time, rewind is left out of netplay
+        if (mConfig.rewindEnabled && !mRollback && (++mPlayback->elapsedFrames >= mConfig.replayFrameSeek))
         {
-            emu::BinaryWriter writer(mPlayback->stream);
-            mPlayback->stream.setReadOffset(0);
-            gameSession.serializeGameState(writer);
-            size_t size = mPlayback->stream.getReadOffset();
-            mPlayback->seekQueue.push_back(size);
-            mPlayback->seekCapacity += size;
-            while (mPlayback->seekCapacity > mConfig.replayBufferSize)
-            {
-                EMU_ASSERT(!mPlayback->seekQueue.empty());
-                size_t localSize = mPlayback->seekQueue.front();
-                mPlayback->seekQueue.pop_front();
-                mPlayback->seekCapacity -= localSize;
-                EMU_ASSERT(mPlayback->seekCapacity >= 0);
-            }
+            // Snapshots only store the pages written since the previous one, a whole group goes when the buffer is full
+            auto& chain = mPlayback->chain;
+            gameSession.captureSnapshot(chain);
+            while (chain.getMemorySize() > mConfig.replayBufferSize)
+                chain.removeOldest();
             mPlayback->elapsedFrames = 0;
         }
 
@@ -698,37 +819,39 @@ namespace
         }
     }
 
-    void SandboxImpl::audioCallback(int16_t* data, uint32_t size)
+    void SandboxImpl::checkStateHash()
     {
-        // Fill with empty sound if we are not ready to run
-        if ((!mSoundRunning && (mSoundBufferedSize < mSoundStartSize)) || (mSoundRunning && (mSoundBufferedSize < mSoundMinSize)))
+        if (!mRecordStateHashes && !mVerifyStateHashes)
+            return;
+
+        uint64_t hash = 0;
+        if (!mGameSession->getStateHash(hash))
+            return;
+
+        if (mRecordStateHashes)
         {
-            mSoundRunning = false;
-            memset(data, 0, 2 * size);
+            mStateHashes.record(hash);
             return;
         }
 
-        mSoundRunning = true;
-        size_t soundQueueSize = mSoundQueue.size();
-        while (size)
+        // Only the first divergence is reported, the frames after it differ as well
+        uint32_t frame = mStateHashes.getFrame();
+        if (!mStateHashes.verify(hash) && (mStateHashes.getFirstMismatch() == frame))
         {
-            size_t currentSize = size;
-            size_t maxSize = soundQueueSize - mSoundReadPos;
-            if (currentSize > maxSize)
-                currentSize = maxSize;
-            memcpy(data, &mSoundQueue[mSoundReadPos], currentSize * sizeof(int16_t));
-            mSoundBufferedSize -= currentSize;
-            mSoundReadPos += currentSize;
-            data += currentSize;
-            size -= static_cast<uint32_t>(currentSize);
-            if (mSoundReadPos >= soundQueueSize)
-                mSoundReadPos -= soundQueueSize;
+            emu::Log::printf(emu::Log::Type::Error, "Frame %d: replay diverged from the recording, state hash %016llx instead of %016llx\n",
+                frame, static_cast<unsigned long long>(hash), static_cast<unsigned long long>(mStateHashes.getRecordedHash(frame)));
         }
     }
 
+    void SandboxImpl::audioCallback(int16_t* data, uint32_t size)
+    {
+        mSoundQueue.pop(data, size);
+    }
+
     void SandboxImpl::audioCallback(void* userData, Uint8* stream, int len)
     {
-        static_cast<SandboxImpl*>(userData)->audioCallback(reinterpret_cast<int16_t*>(stream), len >> 1);
+        auto sandbox = static_cast<SandboxImpl*>(userData);
+        sandbox->audioCallback(reinterpret_cast<int16_t*>(stream), len / (2 * sandbox->mConfig.soundChannels));
     }
 
     void SandboxImpl::overrideConfig()
@@ -0,0 +1,215 @@
+#include "SaveWriter.h"
+#include <Windows.h>
+
+namespace
+{
+    static const char* FileExtensionTemp = ".tmp";
+}
+
+SaveWriter::SaveWriter()
+    : mRunning(false)
+    , mTerminate(false)
+{
+}
+
+SaveWriter::~SaveWriter()
+{
+    destroy();
+}
+
+bool SaveWriter::create(const Callback& callback)
+{
+    destroy();
+    mCallback = callback;
+    mTerminate = false;
+    mRunning = true;
+    mThread.start(*this, "SaveWriter");
+    return true;
+}
+
+void SaveWriter::destroy()
+{
+    if (mRunning)
+    {
+        flush();
+        {
+            ScopedLock lock(mMutex);
+            mTerminate = true;
+        }
+        mWork.signal();
+        mThread.wait();
+        mRunning = false;
+    }
+    clearFiles();
+    mCallback = nullptr;
+}
+
+uint32_t SaveWriter::addFile(const std::string& path, bool compress)
+{
+    auto file = new File;
+    file->path = path;
+    file->compress = compress;
+    file->states[0] = BufferState::Free;
+    file->states[1] = BufferState::Free;
+
+    ScopedLock lock(mMutex);
+    mFiles.push_back(file);
+    return static_cast<uint32_t>(mFiles.size() - 1);
+}
+
+void SaveWriter::clearFiles()
+{
+    flush();
+
+    ScopedLock lock(mMutex);
+    for (auto file : mFiles)
+        delete file;
+    mFiles.clear();
+}
+
+emu::MemoryStream& SaveWriter::beginWrite(uint32_t file)
+{
+    ScopedLock lock(mMutex);
+    EMU_ASSERT(file < mFiles.size());
+    auto& entry = *mFiles[file];
+
+    // Reuse a buffer still waiting for the worker so only the latest save gets written
+    uint32_t index = ((entry.states[0] == BufferState::Writing) || (entry.states[1] == BufferState::Pending)) ? 1 : 0;
+    EMU_ASSERT(entry.states[index] != BufferState::Filling);
+    entry.states[index] = BufferState::Filling;
+    entry.buffers[index].clear();
+    return entry.buffers[index];
+}
+
+void SaveWriter::endWrite(uint32_t file, bool commit)
+{
+    File* entry = nullptr;
+    uint32_t index = 0;
+    {
+        ScopedLock lock(mMutex);
+        EMU_ASSERT(file < mFiles.size());
+        entry = mFiles[file];
+        index = (entry->states[0] == BufferState::Filling) ? 0 : 1;
+        EMU_ASSERT(entry->states[index] == BufferState::Filling);
+        if (!commit)
+        {
+            entry->states[index] = BufferState::Free;
+            return;
+        }
+        if (mRunning)
+        {
+            entry->states[index] = BufferState::Pending;
+            mWork.signal();
+            return;
+        }
+    }
+
+    // Without a worker the file is written right away
+    bool success = writeFile(*entry, entry->buffers[index]);
+    if (mCallback)
+        mCallback(entry->path, success);
+
+    ScopedLock lock(mMutex);
+    entry->states[index] = BufferState::Free;
+}
+
+void SaveWriter::flush()
+{
+    if (!mRunning)
+        return;
+
+    for (;;)
+    {
+        {
+            ScopedLock lock(mMutex);
+            bool busy = false;
+            for (auto file : mFiles)
+            {
+                for (auto state : file->states)
+                    busy |= (state == BufferState::Pending) || (state == BufferState::Writing);
+            }
+            if (!busy)
+                return;
+        }
+        mIdle.wait();
+    }
+}
+
+void SaveWriter::execute()
+{
+    ScopedLock lock(mMutex);
+    for (;;)
+    {
+        File* file = nullptr;
+        uint32_t index = 0;
+        for (auto entry : mFiles)
+        {
+            for (uint32_t pos = 0; pos < EMU_ARRAY_SIZE(entry->states); ++pos)
+            {
+                if (entry->states[pos] == BufferState::Pending)
+                {
+                    file = entry;
+                    index = pos;
+                    break;
+                }
+            }
+            if (file)
+                break;
+        }
+
+        if (!file)
+        {
+            mIdle.signal();
+            if (mTerminate)
+                break;
+
+            ScopedUnlock unlock(mMutex);
+            mWork.wait();
+            continue;
+        }
+
+        // The emulation keeps filling the other buffer while this one is on its way to the disk
+        file->states[index] = BufferState::Writing;
+        {
+            ScopedUnlock unlock(mMutex);
+            bool success = writeFile(*file, file->buffers[index]);
+            if (mCallback)
+                mCallback(file->path, success);
+        }
+        file->states[index] = BufferState::Free;
+    }
+}
+
+bool SaveWriter::writeFile(const File& file, emu::MemoryStream& buffer)
+{
+    const std::string& path = file.path;
+    std::string tempPath = path + FileExtensionTemp;
+    {
+        emu::FileStream stream(tempPath.c_str(), "wb");
+        bool success = stream.valid();
+        if (success && file.compress)
+        {
+            // Packing happens here so the emulation thread only serializes the raw data
+            emu::CompressedStream streamPacked(stream);
+            success = streamPacked.write(buffer.getBuffer(), buffer.getSize()) && streamPacked.flush();
+        }
+        else if (success)
+        {
+            success = stream.write(buffer.getBuffer(), buffer.getSize());
+        }
+        if (!success)
+        {
+            stream.close();
+            DeleteFileA(tempPath.c_str());
+            return false;
+        }
+    }
+
+    // The previous file stays intact until the new one is complete
+    if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        DeleteFileA(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef __SAVE_WRITER_H__
+#define __SAVE_WRITER_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <Core/Stream.h>
+#include "Thread.h"
+
+// Writes save files on a background thread so the emulation never waits for the disk.
+// Each file has two buffers: the worker writes one while the other receives the next save. A save requested before the
+// worker picks up the previous one replaces it. Files are written under a temporary name, then renamed over the old one.
+// Files added as compressed are packed by the worker too, the buffers hold the raw data.
+class SaveWriter : public IExecutable
+{
+public:
+    // Called on the worker thread once a file has been written.
+    typedef std::function<void(const std::string& path, bool success)> Callback;
+
+    SaveWriter();
+    ~SaveWriter();
+    bool create(const Callback& callback);
+    void destroy();
+    uint32_t addFile(const std::string& path, bool compress = false);
+    void clearFiles();
+
+    // The stream stays valid until endWrite(), the data is only queued when it is committed.
+    emu::MemoryStream& beginWrite(uint32_t file);
+    void endWrite(uint32_t file, bool commit);
+
+    // Waits until every queued file has been written.
+    void flush();
+
+    virtual void execute() override;
+
+private:
+    enum class BufferState
+    {
+        Free,
+        Filling,
+        Pending,
+        Writing,
+    };
+
+    struct File
+    {
+        std::string         path;
+        bool                compress;
+        emu::MemoryStream   buffers[2];
+        BufferState         states[2];
+    };
+
+    bool writeFile(const File& file, emu::MemoryStream& buffer);
+
+    std::vector<File*>  mFiles;
+    Callback            mCallback;
+    Mutex               mMutex;
+    Event               mWork;
+    Event               mIdle;
+    Thread              mThread;
+    bool                mRunning;
+    bool                mTerminate;
+};
+
+#endif
@@ -3,7 +3,7 @@
 #include <Core/Serializer.h>
 #include "APU.h"
 #include "nes.h"
-#include <vector>
+#include <algorithm>
 
 namespace
 {
@@ -13,17 +13,62 @@ namespace
         EMU_ASSERT(false);
     }
 
-    void dummyTimerCallback(void* context, int32_t ticks)
-    {
-        EMU_UNUSED(context);
-        EMU_UNUSED(ticks);
-    }
-
     static const uint32_t kLength[] =
     {
         0x0a, 0xfe, 0x14, 0x02, 0x28, 0x04, 0x50, 0x06, 0xa0, 0x08, 0x3c, 0x0a, 0x0e, 0x0c, 0x1a, 0x0e,
         0x0c, 0x10, 0x18, 0x12, 0x30, 0x14, 0x60, 0x16, 0xc0, 0x18, 0x48, 0x1a, 0x10, 0x1c, 0x20, 0x1e,
     };
+
+    static const uint8_t kDuty[4][8] =
+    {
+        { 0, 1, 0, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 1, 1, 0, 0, 0 },
+        { 1, 0, 0, 1, 1, 1, 1, 1 },
+    };
+
+    // Number of timer steps until the duty output changes
+    static const uint32_t kDutyRun[4][8] =
+    {
+        { 1, 1, 7, 6, 5, 4, 3, 2 },
+        { 1, 2, 1, 6, 5, 4, 3, 2 },
+        { 1, 4, 3, 2, 1, 4, 3, 2 },
+        { 1, 2, 1, 6, 5, 4, 3, 2 },
+    };
+
+    static const int8_t kVolume[16][2] =
+    {
+        {  -0,  +0 }, {  -1,  +1 }, {  -2,  +2 }, {  -3,  +3 },
+        {  -4,  +4 }, {  -5,  +5 }, {  -6,  +6 }, {  -7,  +7 },
+        {  -8,  +8 }, {  -9,  +9 }, { -10, +10 }, { -11, +11 },
+        { -12, +12 }, { -13, +13 }, { -14, +14 }, { -15, +15 },
+    };
+
+    static const int8_t kTriangle[] =
+    {
+        -15, -13, -11, -9, -7, -5, -3, -1, +1, +3, +5, +8, +9, +11, +13, +15,
+        +15, +13, +11, +9, +7, +5, +3, +1, -1, -3, -5, -8, -9, -11, -13, -15,
+    };
+
+    // Linear mixer weights scaled to the 16-bit output range
+    static const int32_t PULSE_WEIGHT = 246;
+    static const int32_t TRIANGLE_WEIGHT = 279;
+    static const int32_t NOISE_WEIGHT = 162;
+    static const int32_t DMC_WEIGHT = 116;
+
+    uint32_t advanceTimer(uint32_t& timerCount, uint32_t period, uint32_t ticks)
+    {
+        // Same as reloading the timer one period at a time, returns the number of times it expired
+        if (ticks <= timerCount)
+        {
+            timerCount -= ticks;
+            return 0;
+        }
+        uint32_t remaining = ticks - timerCount;
+        uint32_t steps = 1 + (remaining - 1) / period;
+        timerCount = steps * period - remaining;
+        return steps;
+    }
 }
 
 namespace nes
@@ -44,33 +89,38 @@ namespace nes
         mMemory = nullptr;
         mMasterClockDivider = 0;
         mMasterClockFrequency = 0;
+        mMasterClockPerFrame = 0;
         mFrameCountTicks = 0;
         memset(mRegister, 0, sizeof(mRegister));
         memset(mController, 0, sizeof(mController));
         memset(mShifter, 0, sizeof(mShifter));
         mSoundBuffer = nullptr;
         mSoundBufferSize = 0;
-        mSoundBufferOffset = 0;
-        mSampleSpeed = 0;
+        mSoundFormat = emu::AudioStage::Format();
+        mAudio.destroy();
         mBufferTick = 0;
-        mSampleTick = 0;
         mSequenceTick = 0;
         mSequenceCount = 0;
         mPulse[0].reset(mMasterClockDivider * 2, 0);
         mPulse[1].reset(mMasterClockDivider * 2, 1);
         mTriangle.reset(mMasterClockDivider);
         mNoise.reset(mMasterClockDivider);
+        resetOutputs();
         mMode5Step = false;
+        mIRQInhibit = false;
         mIRQ = false;
+        mIRQLine = false;
+        mIrqTick = INT32_MAX;
     }
 
-    bool APU::create(emu::Clock& clock, emu::MemoryBus& memory, uint32_t masterClockDivider, uint32_t masterClockFrequency)
+    bool APU::create(emu::Clock& clock, emu::MemoryBus& memory, uint32_t masterClockDivider, uint32_t masterClockFrequency, uint32_t masterClockPerFrame)
     {
         mClock = &clock;
         mClock->addListener(*this);
         mMemory = &memory;
         mMasterClockDivider = masterClockDivider;
         mMasterClockFrequency = masterClockFrequency;
+        mMasterClockPerFrame = masterClockPerFrame;
         mFrameCountTicks = masterClockFrequency / 240;
         return true;
     }
@@ -85,7 +135,7 @@ namespace nes
     void APU::reset()
     {
         memset(mRegister, 0, sizeof(mRegister));
-        mSoundBufferOffset = 0;
+        mAudio.clear();
         mBufferTick = 0;
         mSequenceTick = 0;
         mSequenceCount = 0;
@@ -94,12 +144,42 @@ namespace nes
         mTriangle.reset(mMasterClockDivider);
         mNoise.reset(mMasterClockDivider);
         mDMC.reset(*mClock, *mMemory, mMasterClockDivider);
+        resetOutputs();
+        mMode5Step = false;
+        mIRQInhibit = false;
+        mIRQ = false;
+        mIRQLine = false;
+        mIrqTick = INT32_MAX;
+    }
+
+    void APU::addListener(IListener& listener)
+    {
+        mListeners.push_back(&listener);
+    }
+
+    void APU::removeListener(IListener& listener)
+    {
+        auto item = std::find(mListeners.begin(), mListeners.end(), &listener);
+        mListeners.erase(item);
+    }
+
+    void APU::resetOutputs()
+    {
+        auto& blip = mAudio.getSource(0);
+        mPulse[0].output.reset(blip, PULSE_WEIGHT);
+        mPulse[1].output.reset(blip, PULSE_WEIGHT);
+        mTriangle.output.reset(blip, TRIANGLE_WEIGHT);
+        mNoise.output.reset(blip, NOISE_WEIGHT);
+        mDMC.output.reset(blip, DMC_WEIGHT);
     }
 
     void APU::beginFrame()
     {
-        mClock->addEvent(onSequenceEvent, this, mSequenceTick);
-        mDMC.beginFrame();
+        // Without an output the sequencer is only updated when the CPU can observe it
+        if (mAudio.isEnabled())
+            mClock->addEvent(onSequenceEvent, this, mSequenceTick);
+        mIrqTick = INT32_MAX;
+        scheduleIrqEvent();
     }
 
     void APU::execute()
@@ -109,29 +189,17 @@ namespace nes
     void APU::resetClock()
     {
         mBufferTick = 0;
-        mSampleTick = 0;
         mSequenceTick = 0;
     }
 
     void APU::advanceClock(int32_t ticks)
     {
         advanceBuffer(ticks);
+        mAudio.endFrame(ticks, mSoundBuffer);
         mSequenceTick -= ticks;
-        mBufferTick = 0;
-        mSampleTick = 0;
-        if (mSoundBuffer)
-        {
-            EMU_ASSERT(mSoundBufferOffset == mSoundBufferSize - 1);
-            while (mSoundBufferOffset < mSoundBufferSize)
-            {
-                mSoundBuffer[mSoundBufferOffset] = mSoundBuffer[mSoundBufferOffset - 1];
-                ++mSoundBufferOffset;
-            }
-            mSoundBufferOffset -= mSoundBufferSize;
-        }
+        mBufferTick -= ticks;
         EMU_ASSERT(mBufferTick >= 0);
         EMU_ASSERT(mSequenceTick >= 0);
-        EMU_ASSERT(mSampleTick >= 0);
         mDMC.advanceClock(ticks);
     }
 
@@ -142,7 +210,6 @@ namespace nes
 
     uint8_t APU::regRead(int32_t ticks, uint32_t addr)
     {
-        EMU_UNUSED(ticks);
         addr = (addr & (APU_REGISTER_COUNT - 1));
         switch (addr)
         {
@@ -165,7 +232,32 @@ namespace nes
         //case APU_REG_DMC_START: break;
         //case APU_REG_DMC_LEN: break;
         //case APU_REG_OAM_DMA: break;
-        //case APU_REG_SND_CHN: break;
+        case APU_REG_SND_CHN:
+        {
+            advanceBuffer(ticks);
+            uint8_t status = 0;
+            if (mPulse[0].length)
+                status |= 0x01;
+            if (mPulse[1].length)
+                status |= 0x02;
+            if (mTriangle.length)
+                status |= 0x04;
+            if (mNoise.length)
+                status |= 0x08;
+            if (mDMC.sampleCount)
+                status |= 0x10;
+            if (mIRQ)
+                status |= 0x40;
+            if (mDMC.irq)
+                status |= 0x80;
+            mRegister[APU_REG_SND_CHN] = status;
+
+            // Reading the status acknowledges the frame interrupt
+            mIRQ = false;
+            updateIrq();
+            scheduleIrqEvent();
+            break;
+        }
         case APU_REG_JOY1:
         {
             mRegister[APU_REG_JOY1] = 0x40 | (mShifter[0] & 1) | ((mShifter[2] & 1) << 1);
@@ -299,19 +391,23 @@ namespace nes
 
             case APU_REG_JOY2:
                 advanceBuffer(ticks);
-                if ((value & 0x40) != 0)
-                    mMode5Step = true;
-                if ((value & 0x80) == 0)
-                    mIRQ = true;
-                if ((value & 0x80) != 0)
-                {
-                    mSequenceCount = 0;
+                mMode5Step = (value & 0x80) != 0;
+                mIRQInhibit = (value & 0x40) != 0;
+                if (mIRQInhibit)
+                    mIRQ = false;
+                mSequenceCount = 0;
+                mSequenceTick = ticks;
+                if (mAudio.isEnabled())
                     mClock->addEvent(onSequenceEvent, this, ticks);
-                }
                 break;
         default:
             NOT_IMPLEMENTED("Register write");
         }
+
+        if ((addr < APU_REG_OAM_DMA) || (addr == APU_REG_SND_CHN))
+            updateLevels(ticks);
+        updateIrq();
+        scheduleIrqEvent();
     }
 
     void APU::setController(uint32_t index, uint8_t buttons)
@@ -332,10 +428,36 @@ namespace nes
 
     void APU::setSoundBuffer(int16_t* buffer, size_t size)
     {
-        mSoundBuffer = buffer;
-        mSoundBufferSize = static_cast<uint32_t>(size);
-        mSoundBufferOffset = 0;
-        mSampleSpeed = mMasterClockFrequency / (60 * static_cast<uint32_t>(size));
+        uint32_t sampleCount = buffer ? static_cast<uint32_t>(size) : 0;
+        mSoundBuffer = sampleCount ? buffer : nullptr;
+        if (sampleCount == mSoundBufferSize)
+            return;
+
+        // The buffer receives a whole frame of samples, so its size defines the sampling rate
+        mSoundBufferSize = sampleCount;
+        createAudio();
+    }
+
+    bool APU::setSoundFormat(const emu::AudioStage::Format& format)
+    {
+        if (format == mSoundFormat)
+            return true;
+
+        // The single output of the NES is duplicated when more channels are requested
+        mSoundFormat = format;
+        return createAudio();
+    }
+
+    bool APU::createAudio()
+    {
+        mAudio.destroy();
+        if (mSoundBufferSize)
+        {
+            EMU_VERIFY(mAudio.create(mMasterClockPerFrame, mSoundBufferSize, 1, mSoundFormat));
+            resetOutputs();
+            updateLevels(mBufferTick);
+        }
+        return true;
     }
 
     void APU::updateEnvelopesAndLinearCounter()
@@ -356,32 +478,26 @@ namespace nes
         mNoise.updateLengthCounter();
     }
 
-    void APU::advanceSamples(int32_t tick)
+    void APU::updateLevels(int32_t tick)
+    {
+        mPulse[0].updateLevel(tick);
+        mPulse[1].updateLevel(tick);
+        mTriangle.updateLevel(tick);
+        mNoise.updateLevel(tick);
+        mDMC.updateLevel(tick);
+    }
+
+    void APU::updateChannels(int32_t tick)
     {
         if (tick <= mBufferTick)
             return;
 
-        while (mSampleTick <= tick)
-        {
-            int32_t updateTicks = mSampleTick - mBufferTick;
-            mPulse[0].update(updateTicks);
-            mPulse[1].update(updateTicks);
-            mTriangle.update(updateTicks);
-            mNoise.update(updateTicks);
-            mDMC.update(updateTicks);
-            if (mSoundBuffer && (mSoundBufferOffset < mSoundBufferSize))
-            {
-                float pulseOut = 0.00752f * (mPulse[0].level + mPulse[1].level);
-                float tndOut = 0.00851f * mTriangle.level + 0.00494f * mNoise.level + 0.00355f * mDMC.level;
-                float soundOut = pulseOut + tndOut;
-                uint16_t value = static_cast<int16_t>(soundOut * 32767.0f);
-
-                mSoundBuffer[mSoundBufferOffset++] = value;
-            }
-            mBufferTick = mSampleTick;
-            mSampleTick += mSampleSpeed;
-        }
-
+        uint32_t ticks = tick - mBufferTick;
+        mPulse[0].update(mBufferTick, ticks);
+        mPulse[1].update(mBufferTick, ticks);
+        mTriangle.update(mBufferTick, ticks);
+        mNoise.update(mBufferTick, ticks);
+        mDMC.update(ticks);
         mBufferTick = tick;
     }
 
@@ -390,9 +506,12 @@ namespace nes
         if (tick <= mBufferTick)
             return;
 
+        // Without an output nothing needs the steps on time, they are caught up on the next access
+        bool silent = !mAudio.isEnabled();
         while (mSequenceTick <= tick)
         {
-            advanceSamples(mSequenceTick);
+            int32_t sequenceTick = mSequenceTick;
+            updateChannels(sequenceTick);
             mSequenceTick += mFrameCountTicks;
             if (mMode5Step)
             {
@@ -445,16 +564,48 @@ namespace nes
                     updateEnvelopesAndLinearCounter();
                     updateLengthCountersAndSweepUnits();
                     mSequenceCount = 0;
-                    // TODO: Generate IRQ if bit 6 of $4017 is clear
+                    if (!mIRQInhibit)
+                        mIRQ = true;
                     break;
 
                 default:
                     EMU_ASSERT(false);
                 }
             }
-            mClock->addEvent(onSequenceEvent, this, mSequenceTick);
+            updateLevels(sequenceTick);
+            if (!silent)
+                mClock->addEvent(onSequenceEvent, this, mSequenceTick);
         }
-        advanceSamples(tick);
+        updateChannels(tick);
+        updateIrq();
+    }
+
+    void APU::updateIrq()
+    {
+        bool active = mIRQ || mDMC.irq;
+        if (active == mIRQLine)
+            return;
+
+        mIRQLine = active;
+        for (auto listener : mListeners)
+            listener->onIrqUpdate(active);
+    }
+
+    void APU::scheduleIrqEvent()
+    {
+        // The interrupts must be raised on time even when the channels are updated lazily
+        int32_t irqTick = mDMC.getIrqTick();
+        if (!mMode5Step && !mIRQInhibit && !mIRQ)
+        {
+            int32_t steps = (3 - mSequenceCount) & 3;
+            irqTick = std::min(irqTick, mSequenceTick + steps * static_cast<int32_t>(mFrameCountTicks));
+        }
+        if (irqTick == mIrqTick)
+            return;
+
+        mIrqTick = irqTick;
+        if (irqTick != INT32_MAX)
+            mClock->addEvent(onIrqEvent, this, irqTick);
     }
 
     void APU::onSequenceEvent(int32_t tick)
@@ -468,16 +619,30 @@ namespace nes
         static_cast<APU*>(context)->onSequenceEvent(tick);
     }
 
+    void APU::onIrqEvent(int32_t tick)
+    {
+        if (tick != mIrqTick)
+            return;
+
+        mIrqTick = INT32_MAX;
+        advanceBuffer(tick);
+        scheduleIrqEvent();
+    }
+
+    void APU::onIrqEvent(void* context, int32_t tick)
+    {
+        static_cast<APU*>(context)->onIrqEvent(tick);
+    }
+
     void APU::serialize(emu::ISerializer& serializer)
     {
-        uint32_t version = 2;
+        uint32_t version = 3;
         serializer
             .value("Version", version)
             .value("Register", mRegister)
             .value("Controller", mController)
             .value("Shifter", mShifter)
             .value("BufferTick", mBufferTick)
-            .value("SampleTick", mSampleTick)
             .value("SequenceTick", mSequenceTick)
             .value("SequenceCount", mSequenceCount)
             .value("Pulse0", mPulse[0])
@@ -489,6 +654,38 @@ namespace nes
         serializer
             .value("Mode5Step", mMode5Step)
             .value("IRQ", mIRQ);
+        if (version >= 3)
+            serializer.value("IRQInhibit", mIRQInhibit);
+        else
+        {
+            // Was not tracking the frame interrupt, it stays inhibited so it never fires as before
+            mIRQ = false;
+            mIRQInhibit = true;
+        }
+        if (serializer.isReading())
+        {
+            mIRQLine = mIRQ || mDMC.irq;
+            mIrqTick = INT32_MAX;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    void APU::Output::reset(emu::BlipBuffer& _blip, int32_t _weight)
+    {
+        blip = &_blip;
+        weight = _weight;
+        amplitude = 0;
+    }
+
+    void APU::Output::update(int32_t tick, int32_t level)
+    {
+        int32_t value = level * weight;
+        if (value != amplitude)
+        {
+            blip->addDelta(tick, value - amplitude);
+            amplitude = value;
+        }
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -541,38 +738,39 @@ namespace nes
         envelopeDivider = envelope;
     }
 
-    void APU::Pulse::update(uint32_t ticks)
+    void APU::Pulse::update(int32_t tick, uint32_t ticks)
     {
         if (!period)
             return;
 
-        // Update timer
-        while (ticks > timerCount)
+        // The output only changes on the timer steps flipping the duty bit, jump from one to the next
+        bool audible = output.isEnabled() && length && (timer >= 8) && envelopeVolume;
+        if (audible)
         {
-            ticks -= timerCount;
-            timerCount = period;
-            if (length)
-                cycle = (cycle + 1) & 7;
+            while (true)
+            {
+                uint32_t run = kDutyRun[duty][cycle];
+                uint32_t runTicks = timerCount + (run - 1) * period;
+                if (ticks <= runTicks)
+                    break;
+                ticks -= runTicks;
+                tick += runTicks;
+                timerCount = period;
+                cycle = (cycle + run) & 7;
+                updateLevel(tick);
+            }
         }
-        timerCount -= ticks;
 
-        // Update level
-        static const uint8_t kLevel[4][8] =
-        {
-            { 0, 1, 0, 0, 0, 0, 0, 0 },
-            { 0, 1, 1, 0, 0, 0, 0, 0 },
-            { 0, 1, 1, 1, 1, 0, 0, 0 },
-            { 1, 0, 0, 1, 1, 1, 1, 1 },
-        };
-        static const int8_t kVolume[16][2] =
-        {
-            {  -0,  +0 }, {  -1,  +1 }, {  -2,  +2 }, {  -3,  +3 },
-            {  -4,  +4 }, {  -5,  +5 }, {  -6,  +6 }, {  -7,  +7 },
-            {  -8,  +8 }, {  -9,  +9 }, { -10, +10 }, { -11, +11 },
-            { -12, +12 }, { -13, +13 }, { -14, +14 }, { -15, +15 },
-        };
-        uint32_t value =  kLevel[duty][cycle];
+        uint32_t steps = advanceTimer(timerCount, period, ticks);
+        if (length)
+            cycle = (cycle + steps) & 7;
+    }
+
+    void APU::Pulse::updateLevel(int32_t tick)
+    {
+        uint32_t value = kDuty[duty][cycle];
         level = (!length || (timer < 8)) ? 0 : kVolume[envelopeVolume][value];
+        output.update(tick, level);
     }
 
     void APU::Pulse::updatePeriod()
@@ -677,7 +875,8 @@ namespace nes
 
     void APU::Pulse::serialize(emu::ISerializer& serializer)
     {
-        uint32_t version = 1;
+        // The level is the last output value, it depends on audio being enabled and is no longer part of the state
+        uint32_t version = 2;
         serializer
             .value("Version", version)
             .value("Dutey", duty)
@@ -693,8 +892,10 @@ namespace nes
             .value("Enabled", enabled)
             .value("Period", period)
             .value("TimerCount", timerCount)
-            .value("Cycle", cycle)
-            .value("Level", level)
+            .value("Cycle", cycle);
+        if (version < 2)
+            serializer.value("Level", level);
+        serializer
             .value("EnvelopeDivider", envelopeDivider)
             .value("EnvelopeCounter", envelopeCounter)
             .value("EnvelopeVolume", envelopeVolume)
@@ -732,29 +933,34 @@ namespace nes
         }
     }
 
-    void APU::Triangle::update(uint32_t ticks)
+    void APU::Triangle::update(int32_t tick, uint32_t ticks)
     {
         if (!period)
             return;
 
-        // Update timer
-        while (ticks > timerCount)
+        bool running = linearCount && length;
+        if (running && (timer >= 4) && output.isEnabled())
         {
-            ticks -= timerCount;
-            timerCount = period;
-            if (linearCount && length)
+            while (ticks > timerCount)
+            {
+                ticks -= timerCount;
+                tick += timerCount;
+                timerCount = period;
                 sequence = (sequence + 1) & 31;
+                updateLevel(tick);
+            }
         }
-        timerCount -= ticks;
 
-        // Update level
-        static const int32_t kLevel[] =
-        {
-            -15, -13, -11, -9, -7, -5, -3, -1, +1, +3, +5, +8, +9, +11, +13, +15,
-            +15, +13, +11, +9, +7, +5, +3, +1, -1, -3, -5, -8, -9, -11, -13, -15,
-        };
-        uint32_t value = kLevel[sequence];
-        level = static_cast<uint8_t>((!linearCount || !length || (timer < 4)) ? 0 : value);
+        // Silent or ultrasonic, the sequence still moves but the output stays at zero
+        uint32_t steps = advanceTimer(timerCount, period, ticks);
+        if (running)
+            sequence = (sequence + steps) & 31;
+    }
+
+    void APU::Triangle::updateLevel(int32_t tick)
+    {
+        level = (!linearCount || !length || (timer < 4)) ? 0 : kTriangle[sequence];
+        output.update(tick, level);
     }
 
     void APU::Triangle::updateLengthCounter()
@@ -806,7 +1012,7 @@ namespace nes
 
     void APU::Triangle::serialize(emu::ISerializer& serializer)
     {
-        uint32_t version = 1;
+        uint32_t version = 2;
         serializer
             .value("Version", version)
             .value("Control", control)
@@ -818,8 +1024,9 @@ namespace nes
             .value("Period", period)
             .value("TimerCount", timerCount)
             .value("LinearCount", linearCount)
-            .value("Sequence", sequence)
-            .value("Level", level);
+            .value("Sequence", sequence);
+        if (version < 2)
+            serializer.value("Level", level);
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -863,31 +1070,44 @@ namespace nes
         envelopeDivider = envelope;
     }
 
-    void APU::Noise::update(uint32_t ticks)
+    void APU::Noise::update(int32_t tick, uint32_t ticks)
     {
         if (!period)
             return;
 
+        // Without an output only the shift register moves, the state stays the same as with audio enabled
+        if (!output.isEnabled())
+        {
+            for (uint32_t steps = advanceTimer(timerCount, period, ticks); steps; --steps)
+                clockGenerator();
+            return;
+        }
+
         // Update timer
+        bool audible = length && envelopeVolume;
         while (ticks > timerCount)
         {
             ticks -= timerCount;
+            tick += timerCount;
             timerCount = period;
-            uint32_t feedback = ((generator >> shiftMode) ^ generator) & 1;
-            generator = (generator >> 1) | (feedback << 14);
+            clockGenerator();
+            if (audible)
+                updateLevel(tick);
         }
         timerCount -= ticks;
+    }
 
-        // Update level
-        static const int8_t kVolume[16][2] =
-        {
-            {  -0,  +0 }, {  -1,  +1 }, {  -2,  +2 }, {  -3,  +3 },
-            {  -4,  +4 }, {  -5,  +5 }, {  -6,  +6 }, {  -7,  +7 },
-            {  -8,  +8 }, {  -9,  +9 }, { -10, +10 }, { -11, +11 },
-            { -12, +12 }, { -13, +13 }, { -14, +14 }, { -15, +15 },
-        };
+    void APU::Noise::clockGenerator()
+    {
+        uint32_t feedback = ((generator >> shiftMode) ^ generator) & 1;
+        generator = (generator >> 1) | (feedback << 14);
+    }
+
+    void APU::Noise::updateLevel(int32_t tick)
+    {
         uint32_t value = (generator & 1) ^ 1;
         level = !length ? 0 : kVolume[envelopeVolume][value];
+        output.update(tick, level);
     }
 
     void APU::Noise::updatePeriod()
@@ -955,7 +1175,7 @@ namespace nes
 
     void APU::Noise::serialize(emu::ISerializer& serializer)
     {
-        uint32_t version = 1;
+        uint32_t version = 2;
         serializer
             .value("Version", version)
             .value("Loop", loop)
@@ -967,8 +1187,10 @@ namespace nes
             .value("Enabled", enabled)
             .value("Period", period)
             .value("TimerCount", timerCount)
-            .value("Generator", generator)
-            .value("Level", level)
+            .value("Generator", generator);
+        if (version < 2)
+            serializer.value("Level", level);
+        serializer
             .value("EnvelopeDivider", envelopeDivider)
             .value("EnvelopeCounter", envelopeCounter)
             .value("EnvelopeVolume", envelopeVolume);
@@ -982,6 +1204,7 @@ namespace nes
         memory = &_memory;
         masterClockDivider = _masterClockDivider;
 
+        irqEnable = false;
         loop = false;
         period = 0x1ac * masterClockDivider;    // Initialize at the lowest frequency
         sampleAddress = 0xc000;
@@ -1019,11 +1242,6 @@ namespace nes
         irq = false;
     }
 
-    void APU::DMC::beginFrame()
-    {
-        prepareNextReaderTick();
-    }
-
     void APU::DMC::advanceClock(int32_t ticks)
     {
         timerTick -= ticks;
@@ -1033,8 +1251,21 @@ namespace nes
     void APU::DMC::update(uint32_t ticks)
     {
         int32_t lastTick = updateTick + ticks;
+        if (silenced && !available && (lastTick > timerTick))
+        {
+            // Idle, only the bit counter moves and the level drops at the end of the current byte
+            uint32_t steps = 1 + (lastTick - timerTick - 1) / period;
+            if (steps >= bit)
+            {
+                level = 0;
+                updateLevel(timerTick + (bit - 1) * period);
+            }
+            timerTick += steps * period;
+            bit = 8 - (8 - bit + steps) % 8;
+        }
         while (lastTick > timerTick)
         {
+            int32_t stepTick = timerTick;
             timerTick += period;
             if (!silenced)
             {
@@ -1066,10 +1297,16 @@ namespace nes
                     level = 0;
                 }
             }
+            updateLevel(stepTick);
         }
         updateTick = lastTick;
     }
 
+    void APU::DMC::updateLevel(int32_t tick)
+    {
+        output.update(tick, level);
+    }
+
     void APU::DMC::updateReader(uint32_t tick)
     {
         if (!sampleCount)
@@ -1084,25 +1321,21 @@ namespace nes
                 samplePos = sampleAddress;
                 sampleCount = sampleLength;
             }
-            else
+            else if (irqEnable)
             {
-                // TODO: Signal interrupt
                 irq = true;
             }
         }
-
-        prepareNextReaderTick();
     }
 
-    void APU::DMC::prepareNextReaderTick()
+    int32_t APU::DMC::getIrqTick() const
     {
-        // Next reader tick is when the shift buffer will be ready to fetch the next sample
-        if (sampleCount)
-        {
-            uint32_t readerTick = timerTick + period * (bit - 1);
-            EMU_UNUSED(readerTick);
-            //clock->addEvent(dummyTimerCallback, nullptr, readerTick);
-        }
+        // The interrupt is raised by the last fetch, a new byte is fetched each time the shift register empties
+        if (!irqEnable || loop || !sampleCount || !available || irq)
+            return INT32_MAX;
+        int64_t steps = bit + 8 * (sampleCount - 1);
+        int64_t fetchTick = timerTick + (steps - 1) * period;
+        return static_cast<int32_t>(std::min<int64_t>(fetchTick + 1, INT32_MAX));
     }
 
     void APU::DMC::write(uint32_t index, uint32_t value)
@@ -1118,10 +1351,11 @@ namespace nes
         switch (index)
         {
         case 0:
-            irq = (value & 0x40) != 0;
-            loop = (value & 0x20) != 0;
+            irqEnable = (value & 0x80) != 0;
+            if (!irqEnable)
+                irq = false;
+            loop = (value & 0x40) != 0;
             period = kTimer[value & 0x0f] * masterClockDivider;
-            prepareNextReaderTick();
             break;
 
         case 1:
@@ -1143,7 +1377,7 @@ namespace nes
 
     void APU::DMC::serialize(emu::ISerializer& serializer)
     {
-        uint32_t version = 1;
+        uint32_t version = 2;
         serializer
             .value("Version", version)
             .value("Loop", loop)
@@ -1161,5 +1395,7 @@ namespace nes
             .value("Available", available)
             .value("Silenced", silenced)
             .value("IRQ", irq);
+        if (version >= 2)
+            serializer.value("IRQEnable", irqEnable);
     }
 }
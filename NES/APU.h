@@ -1,8 +1,10 @@
 #ifndef __APU_H__
 #define __APU_H__
 
+#include <Core/AudioStage.h>
 #include <Core/Clock.h>
 #include <stdint.h>
+#include <vector>
 
 namespace emu
 {
@@ -16,11 +18,19 @@ namespace nes
     class APU : public emu::Clock::IListener
     {
     public:
+        class IListener
+        {
+        public:
+            virtual void onIrqUpdate(bool active) { EMU_UNUSED(active); }
+        };
+
         APU();
         ~APU();
-        bool create(emu::Clock& clock, emu::MemoryBus& memoryBus, uint32_t masterClockDivider, uint32_t masterClockFrequency);
+        bool create(emu::Clock& clock, emu::MemoryBus& memoryBus, uint32_t masterClockDivider, uint32_t masterClockFrequency, uint32_t masterClockPerFrame);
         void destroy();
         void reset();
+        void addListener(IListener& listener);
+        void removeListener(IListener& listener);
         void beginFrame();
         virtual void execute() override;
         virtual void resetClock() override;
@@ -30,6 +40,7 @@ namespace nes
         void regWrite(int32_t ticks, uint32_t addr, uint8_t value);
         void setController(uint32_t index, uint8_t buttons);
         void setSoundBuffer(int16_t* buffer, size_t size);
+        bool setSoundFormat(const emu::AudioStage::Format& format);
         void serialize(emu::ISerializer& serializer);
 
         static const uint32_t APU_REGISTER_COUNT = 0x20;
@@ -58,11 +69,27 @@ namespace nes
         static const uint32_t APU_REG_JOY2 = 0x17;
 
     private:
+        struct Output
+        {
+            emu::BlipBuffer*    blip;
+            int32_t             weight;
+            int32_t             amplitude;
+
+            void reset(emu::BlipBuffer& _blip, int32_t _weight);
+            void update(int32_t tick, int32_t level);
+
+            bool isEnabled() const
+            {
+                return blip->isEnabled();
+            }
+        };
+
         struct Pulse
         {
             // Configuration
             uint32_t    masterClockDivider;
             uint32_t    sweepCarry;
+            Output      output;
 
             // Register fields
             uint32_t    duty;
@@ -95,7 +122,8 @@ namespace nes
             void reset(uint32_t _masterClockDivider, uint32_t _sweepCarry);
             void enable(bool _enabled);
             void reload();
-            void update(uint32_t ticks);
+            void update(int32_t tick, uint32_t ticks);
+            void updateLevel(int32_t tick);
             void updatePeriod();
             void updateEnvelope();
             void updateLengthCounter();
@@ -108,6 +136,7 @@ namespace nes
         {
             // Configuration
             uint32_t    masterClockDivider;
+            Output      output;
 
             // Register fields
             bool        control;
@@ -126,7 +155,8 @@ namespace nes
 
             void reset(uint32_t _masterClockDivider);
             void enable(bool _enabled);
-            void update(uint32_t ticks);
+            void update(int32_t tick, uint32_t ticks);
+            void updateLevel(int32_t tick);
             void updateLengthCounter();
             void updateLinearCounter();
             void write(uint32_t index, uint32_t value);
@@ -137,6 +167,7 @@ namespace nes
         {
             // Configuration
             uint32_t    masterClockDivider;
+            Output      output;
 
             // Register fields
             bool        loop;
@@ -161,7 +192,9 @@ namespace nes
             void reset(uint32_t _masterClockDivider);
             void enable(bool _enabled);
             void reload();
-            void update(uint32_t ticks);
+            void update(int32_t tick, uint32_t ticks);
+            void updateLevel(int32_t tick);
+            void clockGenerator();
             void updatePeriod();
             void updateEnvelope();
             void updateLengthCounter();
@@ -175,8 +208,10 @@ namespace nes
             emu::Clock*         clock;
             emu::MemoryBus*     memory;
             uint32_t            masterClockDivider;
+            Output              output;
 
             // Register fields
+            bool                irqEnable;
             bool                loop;
             uint32_t            period;
             uint32_t            sampleAddress;
@@ -197,37 +232,47 @@ namespace nes
 
             void reset(emu::Clock& _clock, emu::MemoryBus& _memory, uint32_t _masterClockDivider);
             void enable(uint32_t tick, bool _enabled);
-            void beginFrame();
             void advanceClock(int32_t ticks);
             void update(uint32_t ticks);
+            void updateLevel(int32_t tick);
             void updateReader(uint32_t tick);
-            void prepareNextReaderTick();
+            int32_t getIrqTick() const;
             void write(uint32_t index, uint32_t value);
             void serialize(emu::ISerializer& serializer);
         };
 
+        typedef std::vector<IListener*> ListenerQueue;
+
         void initialize();
+        void resetOutputs();
+        bool createAudio();
         void updateEnvelopesAndLinearCounter();
         void updateLengthCountersAndSweepUnits();
-        void advanceSamples(int32_t tick);
+        void updateLevels(int32_t tick);
+        void updateChannels(int32_t tick);
         void advanceBuffer(int32_t tick);
+        void updateIrq();
+        void scheduleIrqEvent();
         void onSequenceEvent(int32_t tick);
         static void onSequenceEvent(void* context, int32_t tick);
+        void onIrqEvent(int32_t tick);
+        static void onIrqEvent(void* context, int32_t tick);
 
         emu::Clock*             mClock;
         emu::MemoryBus*         mMemory;
+        ListenerQueue           mListeners;
         uint32_t                mMasterClockDivider;
         uint32_t                mMasterClockFrequency;
+        uint32_t                mMasterClockPerFrame;
         uint32_t                mFrameCountTicks;
         uint8_t                 mRegister[APU_REGISTER_COUNT];
         uint8_t                 mController[4];
         uint8_t                 mShifter[4];
         int16_t*                mSoundBuffer;
         uint32_t                mSoundBufferSize;
-        uint32_t                mSoundBufferOffset;
-        uint32_t                mSampleSpeed;
+        emu::AudioStage::Format mSoundFormat;
+        emu::AudioStage         mAudio;
         int32_t                 mBufferTick;
-        int32_t                 mSampleTick;
         int32_t                 mSequenceTick;
         uint32_t                mSequenceCount;
         Pulse                   mPulse[2];
@@ -235,7 +280,10 @@ namespace nes
         Noise                   mNoise;
         DMC                     mDMC;
         bool                    mMode5Step;
+        bool                    mIRQInhibit;
         bool                    mIRQ;
+        bool                    mIRQLine;
+        int32_t                 mIrqTick;
     };
 }
 
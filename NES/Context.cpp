@@ -2,6 +2,9 @@
 #include <Core/Log.h>
 #include <Core/MemoryBus.h>
 #include <Core/Serializer.h>
+#include <Core/Snapshot.h>
+#include <Core/StateHash.h>
+#include <Core/TrackedBuffer.h>
 #include "nes.h"
 #include "APU.h"
 #include "Cpu6502.h"
@@ -100,8 +103,11 @@ namespace
             irqMapper = false;
 
             // APU
-            if (!apu.create(clock, cpuMemory, MASTER_CLOCK_APU_DIVIDER_NTSC, MASTER_CLOCK_FREQUENCY_NTSC))
+            if (!apu.create(clock, cpuMemory, MASTER_CLOCK_APU_DIVIDER_NTSC, MASTER_CLOCK_FREQUENCY_NTSC, MASTER_CLOCK_PER_FRAME_NTSC))
                 return false;
+            if (!apuListener.create(*this))
+                return false;
+            apu.addListener(apuListener);
 
             // ROM
             const uint8_t* romPage1 = romContent.prgRom;
@@ -138,7 +144,7 @@ namespace
             // CPU RAM
             cpuRam.resize(0x800, 0);
             accessCpuRamRead.setReadMemory(&cpuRam[0]);
-            accessCpuRamWrite.setWriteMemory(&cpuRam[0]);
+            accessCpuRamWrite.setWriteMemory(&cpuRam[0], cpuRam);
             for (uint16_t mirror = 0; mirror < 4; ++mirror)
             {
                 uint16_t addr_start = mirror * 0x0800;
@@ -153,7 +159,7 @@ namespace
             static const uint16_t SAVE_RAM_END_ADDR = SAVE_RAM_START_ADDR + SAVE_RAM_SIZE - 1;
             saveRam.resize(SAVE_RAM_SIZE, 0);
             accessSaveRamRead.setReadMemory(&saveRam[0]);
-            accessSaveRamWrite.setWriteMemory(&saveRam[0]);
+            accessSaveRamWrite.setWriteMemory(&saveRam[0], saveRam);
             cpuMemory.addMemoryRange(MEMORY_BUS::PAGE_TABLE_READ, SAVE_RAM_START_ADDR, SAVE_RAM_END_ADDR, accessSaveRamRead);
             cpuMemory.addMemoryRange(MEMORY_BUS::PAGE_TABLE_WRITE, SAVE_RAM_START_ADDR, SAVE_RAM_END_ADDR, accessSaveRamWrite);
 
@@ -188,6 +194,7 @@ namespace
             mapperListener.destroy();
 
             apu.destroy();
+            apuListener.destroy();
             ppuListener.destroy();
             ppu.destroy();
             cpu.destroy();
@@ -236,6 +243,37 @@ namespace
             return true;
         }
 
+        virtual emu::IContext* clone() override
+        {
+            auto context = nes::Context::create(*rom);
+            if (context && !cloneInto(*context))
+            {
+                context->dispose();
+                context = nullptr;
+            }
+            return context;
+        }
+
+        virtual bool cloneInto(emu::IContext& context) override
+        {
+            // Each context points its memory maps at its own buffers, only the state needs to be copied
+            auto& target = static_cast<ContextImpl&>(context);
+            if (&target == this)
+                return true;
+            if (target.rom != rom)
+                return false;
+            if (!cloneSnapshot.save(*this))
+                return false;
+            if (!target.reset())
+                return false;
+            return cloneSnapshot.load(target);
+        }
+
+        virtual bool getStateHash(uint64_t& hash) override
+        {
+            return stateHasher.compute(*this, hash);
+        }
+
         virtual bool setController(uint32_t index, uint32_t buttons) override
         {
             apu.setController(index, static_cast<uint8_t>(buttons));
@@ -248,9 +286,35 @@ namespace
             return true;
         }
 
-        virtual bool setRenderBuffer(void* surface, size_t pitch) override
+        virtual bool setSoundFormat(const emu::AudioStage::Format& format) override
+        {
+            return apu.setSoundFormat(format);
+        }
+
+        virtual bool setRenderBuffer(void* surface, size_t pitch, emu::PixelFormat format = emu::PixelFormat::RGBA8888) override
+        {
+            ppu.setRenderSurface(surface, pitch, format);
+            return true;
+        }
+
+        virtual bool setObservation(const emu::Observation::Config& config) override
+        {
+            return ppu.setObservation(config);
+        }
+
+        virtual bool getObservation(void* buffer, size_t size) override
+        {
+            return ppu.getObservation().read(buffer, size);
+        }
+
+        virtual bool getDirtyLines(uint32_t& dirtyCount, uint8_t* flags, size_t count) override
+        {
+            return ppu.getDirtyLines().read(dirtyCount, flags, count);
+        }
+
+        virtual bool enableDirtyLines(bool enable) override
         {
-            ppu.setRenderSurface(surface, pitch);
+            ppu.enableDirtyLines(enable);
             return true;
         }
 
@@ -378,6 +442,38 @@ namespace
             ContextImpl*    mContext;
         };
 
+        class APUListener : public nes::APU::IListener
+        {
+        public:
+            APUListener()
+                : mContext(nullptr)
+            {
+            }
+
+            ~APUListener()
+            {
+                destroy();
+            }
+
+            bool create(ContextImpl& context)
+            {
+                mContext = &context;
+                return true;
+            }
+
+            void destroy()
+            {
+            }
+
+            virtual void onIrqUpdate(bool active)
+            {
+                mContext->updateApuIrq(active);
+            }
+
+        private:
+            ContextImpl*    mContext;
+        };
+
         class MapperListener : public nes::IMapper::IListener
         {
         public:
@@ -428,11 +524,14 @@ namespace
         nes::Cpu6502            cpu;
         nes::PPU                ppu;
         PPUListener             ppuListener;
+        APUListener             apuListener;
         nes::APU                apu;
-        emu::Buffer             cpuRam;
-        emu::Buffer             saveRam;
+        emu::TrackedBuffer      cpuRam;
+        emu::TrackedBuffer      saveRam;
         MapperListener          mapperListener;
         nes::IMapper*           mapper;
+        emu::Snapshot           cloneSnapshot;
+        emu::StateHasher        stateHasher;
     };
 }
 
@@ -170,12 +170,12 @@ namespace nes
                 bank2,
                 bank3,
             };
-            uint8_t* nameTables = mPpu->getNameTableMemory();
+            auto& nameTables = mPpu->getNameTableMemory();
             for (uint32_t index = 0; index < 4; ++index)
             {
                 uint8_t* nameTable = &nameTables[banks[index] * 0x0400];
                 mPpu->getNameTableRead(index)->setReadMemory(nameTable);
-                mPpu->getNameTableWrite(index)->setWriteMemory(nameTable);
+                mPpu->getNameTableWrite(index)->setWriteMemory(nameTable, nameTables);
             }
         }
 
@@ -240,8 +240,8 @@ namespace nes
                 EMU_ASSERT(chrBank1 < 2);
                 mMemChrRomRead[0].setReadMemory(&mChrRam[4 * 1024 * chrBank0]);
                 mMemChrRomRead[1].setReadMemory(&mChrRam[4 * 1024 * chrBank1]);
-                mMemChrRomWrite[0].setWriteMemory(&mChrRam[4 * 1024 * chrBank0]);
-                mMemChrRomWrite[1].setWriteMemory(&mChrRam[4 * 1024 * chrBank1]);
+                mMemChrRomWrite[0].setWriteMemory(&mChrRam[4 * 1024 * chrBank0], mChrRam);
+                mMemChrRomWrite[1].setWriteMemory(&mChrRam[4 * 1024 * chrBank1], mChrRam);
             }
             else
             {
@@ -253,7 +253,7 @@ namespace nes
                 mMemChrRomWrite[1].setWriteMethod(unsupportedWrite, nullptr);
             }
 
-            uint8_t* nameTables = mPpu->getNameTableMemory();
+            auto& nameTables = mPpu->getNameTableMemory();
             EMU_UNUSED(nameTables);            uint32_t nameTableBanks[4] = { 0, 0, 0, 0 };
             switch (mirroring)
             {
@@ -332,7 +332,7 @@ namespace nes
         void enablePrgRam()
         {
             mMemPrgRamRead.setReadMemory(&mPrgRam[0]);
-            mMemPrgRamWrite.setWriteMemory(&mPrgRam[0]);
+            mMemPrgRamWrite.setWriteMemory(&mPrgRam[0], mPrgRam);
         }
 
         uint8_t onEnablePrgRamRead(uint32_t addr)
@@ -345,6 +345,7 @@ namespace nes
         {
             enablePrgRam();
             mPrgRam[addr] = value;
+            mPrgRam.markDirty(&mPrgRam[addr]);
         }
 
         static uint8_t enablePrgRamRead(void* context, int32_t ticks, uint32_t addr)
@@ -384,8 +385,8 @@ namespace nes
         MEM_ACCESS              mMemPrgRamWrite;
         MEM_ACCESS              mMemChrRomRead[2];
         MEM_ACCESS              mMemChrRomWrite[2];
-        emu::Buffer             mChrRam;
-        emu::Buffer             mPrgRam;
+        emu::TrackedBuffer      mChrRam;
+        emu::TrackedBuffer      mPrgRam;
         uint32_t                mShift;
         uint32_t                mCycle;
         uint32_t                mPrgRomPage[2];
@@ -38,7 +38,7 @@ namespace nes
             auto& ppuMemory = mPpu->getMemory();
             mChrRam.resize(8 * 1024);
             mMemChrRamRead.setReadMemory(&mChrRam[0]);
-            mMemChrRamWrite.setWriteMemory(&mChrRam[0]);
+            mMemChrRamWrite.setWriteMemory(&mChrRam[0], mChrRam);
 
             // Load banks
             reset();
@@ -109,7 +109,7 @@ namespace nes
         MEM_ACCESS              mMemPrgRomWrite;
         MEM_ACCESS              mMemChrRamRead;
         MEM_ACCESS              mMemChrRamWrite;
-        emu::Buffer             mChrRam;
+        emu::TrackedBuffer      mChrRam;
         uint8_t                 mRegister;
     };
 }
@@ -184,14 +184,16 @@ namespace nes
 
             // Name tables
             uint8_t* nameTable[4];
-            uint8_t* nameTableVRAM = mPpu->getNameTableMemory();
+            auto& nameTableVRAM = mPpu->getNameTableMemory();
+            emu::TrackedBuffer* nameTableBuffer[4] = { &nameTableVRAM, &nameTableVRAM, &nameTableVRAM, &nameTableVRAM };
             if (romDescription.mirroring == nes::Rom::Mirroring_FourScreen)
             {
-                uint8_t* nameTableLocal = mNameTableLocal.empty() ? nameTableVRAM : &mNameTableLocal[0];
+                auto& nameTableLocal = mNameTableLocal.empty() ? nameTableVRAM : mNameTableLocal;
                 nameTable[0] = &nameTableVRAM[0x0000];
                 nameTable[1] = &nameTableVRAM[0x0400];
                 nameTable[2] = &nameTableLocal[0x0000];
                 nameTable[3] = &nameTableLocal[0x0400];
+                nameTableBuffer[2] = nameTableBuffer[3] = &nameTableLocal;
             }
             else
             {
@@ -211,7 +213,7 @@ namespace nes
             for (uint32_t bank = 0; bank < 4; ++bank)
             {
                 mPpu->getNameTableRead(bank)->setReadMemory(nameTable[bank]);
-                mPpu->getNameTableWrite(bank)->setWriteMemory(nameTable[bank]);
+                mPpu->getNameTableWrite(bank)->setWriteMemory(nameTable[bank], *nameTableBuffer[bank]);
             }
         }
 
@@ -334,7 +336,7 @@ namespace nes
         nes::PPU*                   mPpu;
         PPUListener                 mPpuListener;
         nes::IMapper::IListener*    mMapperListener;
-        emu::Buffer                 mNameTableLocal;
+        emu::TrackedBuffer          mNameTableLocal;
         MEM_ACCESS                  mMemPrgRomRead[4];
         MEM_ACCESS                  mMemPrgRomWrite;
         MEM_ACCESS                  mMemChrRomRead[8];
@@ -169,7 +169,10 @@ namespace nes
         , mVisibleLines(0)
         , mSurface(nullptr)
         , mPitch(0)
+        , mPixelFormat(emu::PixelFormat::RGBA8888)
+        , mPixelSize(4)
     {
+        emu::Pixel::convertPalette(mPixelFormat, mSurfacePalette, reinterpret_cast<const uint32_t*>(colorPalette), EMU_ARRAY_SIZE(mSurfacePalette));
         initialize();
     }
 
@@ -234,10 +237,10 @@ namespace nes
             mNameTableRead[1].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
             mNameTableRead[2].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
             mNameTableRead[3].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
+            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
         }
         else if (vramFlags == CREATE_VRAM_VERTICAL_MIRROR)
         {
@@ -246,10 +249,10 @@ namespace nes
             mNameTableRead[1].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
             mNameTableRead[2].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
             mNameTableRead[3].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
-            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
-            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
+            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1], mNameTableRAM);
+            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1], mNameTableRAM);
         }
         else if (vramFlags == CREATE_VRAM_HORIZONTAL_MIRROR)
         {
@@ -258,10 +261,10 @@ namespace nes
             mNameTableRead[1].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
             mNameTableRead[2].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
             mNameTableRead[3].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
-            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
-            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
+            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1], mNameTableRAM);
+            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1], mNameTableRAM);
         }
         else
         {
@@ -270,10 +273,10 @@ namespace nes
             mNameTableRead[1].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
             mNameTableRead[2].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET2]);
             mNameTableRead[3].setReadMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET3]);
-            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0]);
-            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1]);
-            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET2]);
-            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET3]);
+            mNameTableWrite[0].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET0], mNameTableRAM);
+            mNameTableWrite[1].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET1], mNameTableRAM);
+            mNameTableWrite[2].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET2], mNameTableRAM);
+            mNameTableWrite[3].setWriteMemory(&mNameTableRAM[VRAM_NAMETABLE_OFFSET3], mNameTableRAM);
         }
         for (uint16_t mirror = 0; mirror < 2; ++mirror)
         {
@@ -313,6 +316,10 @@ namespace nes
 
         mScanlineEvents[SCANLINE_TYPE_VBLANK].push_back(ScanlineEvent::make(341 * masterClockDivider, SCANLINE_ACTION_NEXT_LINE));
 
+        // Track changes to the render surface
+        if (!mDirtyLines.create(visibleLines))
+            return false;
+
         return true;
     }
 
@@ -321,6 +328,7 @@ namespace nes
         mScanlineEvents[SCANLINE_TYPE_PRESCAN].clear();
         mScanlineEvents[SCANLINE_TYPE_VISIBLE].clear();
         mScanlineEvents[SCANLINE_TYPE_VBLANK].clear();
+        mDirtyLines.destroy();
         mMemory.destroy();
         if (mClock)
             mClock->removeListener(*this);
@@ -349,9 +357,9 @@ namespace nes
         return mMemory;
     }
 
-    uint8_t* PPU::getNameTableMemory()
+    emu::TrackedBuffer& PPU::getNameTableMemory()
     {
-        return &mNameTableRAM[0];
+        return mNameTableRAM;
     }
 
     MEM_ACCESS* PPU::getPatternTableRead(uint32_t index)
@@ -604,6 +612,8 @@ namespace nes
     void PPU::onVBlankStart(int32_t ticks)
     {
         advanceFrame(ticks);
+        mObservation.endFrame();
+        mDirtyLines.endFrame();
         mVisibleArea = false;
         mCheckHitTest = false;
         startVBlank();
@@ -643,10 +653,36 @@ namespace nes
         mListeners.erase(item);
     }
 
-    void PPU::setRenderSurface(void* surface, size_t pitch)
+    void PPU::setRenderSurface(void* surface, size_t pitch, emu::PixelFormat format)
     {
         mSurface = static_cast<uint8_t*>(surface);
         mPitch = pitch;
+        mPixelFormat = format;
+        mPixelSize = emu::Pixel::getSize(format);
+        mDirtyLines.setSurface(surface, pitch, format);
+        emu::Pixel::convertPalette(format, mSurfacePalette, reinterpret_cast<const uint32_t*>(colorPalette), EMU_ARRAY_SIZE(mSurfacePalette));
+    }
+
+    bool PPU::setObservation(const emu::Observation::Config& config)
+    {
+        EMU_VERIFY(mObservation.create(config, PPU_VISIBLE_COLUMNS, mVisibleLines));
+        mObservation.setPalette(reinterpret_cast<const uint32_t*>(colorPalette), EMU_ARRAY_SIZE(colorPalette));
+        return true;
+    }
+
+    const emu::Observation& PPU::getObservation() const
+    {
+        return mObservation;
+    }
+
+    const emu::DirtyLines& PPU::getDirtyLines() const
+    {
+        return mDirtyLines;
+    }
+
+    void PPU::enableDirtyLines(bool enable)
+    {
+        mDirtyLines.setEnabled(enable);
     }
 
     void PPU::getRasterPosition(int32_t tick, int32_t& x, int32_t& y)
@@ -885,22 +921,21 @@ namespace nes
             dest[index] = palette[dest[index] & 0x1f];
     }
 
-    void PPU::blitSurface(uint32_t* dest, const uint8_t* src, uint32_t count)
+    void PPU::blitSurface(uint8_t* dest, const uint8_t* src, uint32_t count)
     {
-        for (uint32_t pos = 0; pos < count; ++pos)
-            dest[pos] = reinterpret_cast<uint32_t*>(colorPalette)[src[pos]];
+        emu::Pixel::blit(mPixelFormat, dest, mSurfacePalette, src, count);
     }
 
     void PPU::render(int32_t lastTick)
     {
-        if (!mSurface)
-            return;
-
         if (lastTick <= mLastTickRendered)
             return;
 
+        // The position moves on without a surface too, the state must not depend on what is being displayed
         int32_t firstTick = mLastTickRendered;
         mLastTickRendered = lastTick;
+        if (!mSurface && !mObservation.isEnabled() && !mDirtyLines.isEnabled())
+            return;
 
         int32_t x0, y0;
         int32_t x1, y1;
@@ -991,7 +1026,7 @@ namespace nes
         uint8_t attributes2[36];
         uint8_t names[36];
         uint8_t work[SCANLINE_PIXEL_CAPACITY + 8];
-        uint8_t* surface = mSurface + y0 * mPitch;
+        uint8_t* surface = mSurface ? mSurface + y0 * mPitch : nullptr;
         uint8_t* attributes = attributes1;
 
         uint16_t patternTableBase = (mRegister[PPU_REG_PPUCTRL] & PPU_CONTROL_BACKGROUND_PATTERN_TABLE) ? 0x1000 : 0x0000;
@@ -1044,8 +1079,13 @@ namespace nes
             }
             if (mRegister[PPU_REG_PPUMASK] & (PPU_MASK_SHOW_BACKGROUND | PPU_MASK_SHOW_SPRITES))
                 applyPalette(work + fineX + x0, palette, 256);
-            blitSurface(reinterpret_cast<uint32_t*>(surface + x0 * 4), work + fineX + x0, copySize + 1);
-            surface += mPitch;
+            if (surface)
+            {
+                blitSurface(surface + x0 * mPixelSize, work + fineX + x0, copySize + 1);
+                surface += mPitch;
+            }
+            mDirtyLines.addLine(y0, x0, work + fineX + x0, copySize + 1, 0);
+            mObservation.addLine(y0, x0, work + fineX + x0, copySize + 1);
 
             /*++patternTable;
             ++y;
@@ -2,7 +2,11 @@
 #define __PPU_H__
 
 #include <Core/Clock.h>
+#include <Core/DirtyLines.h>
 #include <Core/MemoryBus.h>
+#include <Core/Observation.h>
+#include <Core/PixelFormat.h>
+#include <Core/TrackedBuffer.h>
 #include <stdint.h>
 
 namespace emu
@@ -30,7 +34,7 @@ namespace nes
         void beginFrame();
         virtual void execute() override;
         emu::MemoryBus& getMemory();
-        uint8_t* getNameTableMemory();
+        emu::TrackedBuffer& getNameTableMemory();
         MEM_ACCESS* getPatternTableRead(uint32_t index);
         MEM_ACCESS* getPatternTableWrite(uint32_t index);
         MEM_ACCESS* getNameTableRead(uint32_t index);
@@ -44,7 +48,11 @@ namespace nes
         void endVBlank();
         void addListener(IListener& listener);
         void removeListener(IListener& listener);
-        void setRenderSurface(void* surface, size_t pitch);
+        void setRenderSurface(void* surface, size_t pitch, emu::PixelFormat format);
+        bool setObservation(const emu::Observation::Config& config);
+        const emu::Observation& getObservation() const;
+        const emu::DirtyLines& getDirtyLines() const;
+        void enableDirtyLines(bool enable);
         void startFrame();
         int32_t getTickCount(uint32_t lines, uint32_t dots);
         void serialize(emu::ISerializer& serializer);
@@ -92,7 +100,7 @@ namespace nes
         void drawSprites8(uint8_t* dest, uint32_t y);
         void drawSprites16(uint8_t* dest, uint32_t y);
         void applyPalette(uint8_t* dest, const uint8_t* palette, uint32_t count);
-        void blitSurface(uint32_t* dest, const uint8_t* src, uint32_t count);
+        void blitSurface(uint8_t* dest, const uint8_t* src, uint32_t count);
         void render(int32_t lastTick);
         void updateSpriteHitTestConditions();
         void checkHitTest(int32_t tick);
@@ -147,11 +155,16 @@ namespace nes
         ScanlineEventTable      mScanlineEvents[SCANLINE_TYPE_COUNT];
         ScanlineEventTable      mScanlineEventsVisible;
         ScanlineEventTable      mScanlineEventsVBlank;
-        emu::Buffer             mNameTableRAM;
+        emu::TrackedBuffer      mNameTableRAM;
         emu::Buffer             mPaletteRAM;
         emu::Buffer             mOAM;
         uint8_t*                mSurface;
         size_t                  mPitch;
+        emu::PixelFormat        mPixelFormat;
+        size_t                  mPixelSize;
+        uint32_t                mSurfacePalette[256];
+        emu::Observation        mObservation;
+        emu::DirtyLines         mDirtyLines;
         int32_t                 mLastTickRendered;
         int32_t                 mLastTickUpdated;
         int32_t                 mScanlineNumber;
@@ -1,7 +1,16 @@
 #include <Core/Log.h>
+#include <Core/Snapshot.h>
 #include "Tests.h"
 #include "nes.h"
+#include <string.h>
 #include <string>
+#include <vector>
+
+namespace
+{
+    static const uint32_t SILENT_TEST_FRAMES = 600;
+    static const uint32_t SILENT_TEST_SOUND_BUFFER_SIZE = 735;
+}
 
 bool runTestRom(const char* path)
 {
@@ -39,6 +48,57 @@ bool runTestRom(const char* path)
     return success;
 }
 
+bool runSilentAudioTest(const char* path)
+{
+    // Silent mode only skips what the CPU can't observe, a session played with and without audio must give the same states
+    auto rom = nes::Rom::load(path);
+    if (!rom)
+        return false;
+
+    auto normal = nes::Context::create(*rom);
+    auto silent = nes::Context::create(*rom);
+    bool success = normal && silent;
+    if (success)
+    {
+        std::vector<int16_t> soundBuffer(SILENT_TEST_SOUND_BUFFER_SIZE);
+        normal->setSoundBuffer(soundBuffer.data(), soundBuffer.size());
+        silent->setSoundBuffer(nullptr, 0);
+        normal->reset();
+        silent->reset();
+
+        emu::Snapshot normalState;
+        emu::Snapshot silentState;
+        uint32_t input = 1;
+        for (uint32_t frame = 0; frame < SILENT_TEST_FRAMES; ++frame)
+        {
+            // The recorded session is a fixed sequence of pads, held for a few frames each
+            if ((frame & 7) == 0)
+                input = input * 1664525 + 1013904223;
+            uint8_t buttons = static_cast<uint8_t>(input >> 24);
+            normal->setController(0, buttons);
+            silent->setController(0, buttons);
+            normal->execute();
+            silent->execute();
+
+            normalState.save(*normal);
+            silentState.save(*silent);
+            if ((normalState.getSize() != silentState.getSize()) || memcmp(normalState.getData(), silentState.getData(), normalState.getSize()))
+            {
+                emu::Log::printf(emu::Log::Type::Warning, "%s: silent mode state differs at frame %d\n", path, frame);
+                success = false;
+                break;
+            }
+        }
+    }
+
+    if (silent)
+        silent->dispose();
+    if (normal)
+        normal->dispose();
+    rom->dispose();
+    return success;
+}
+
 bool runTestRoms()
 {
     static const char* testFiles[] =
@@ -74,5 +134,16 @@ bool runTestRoms()
 
     emu::Log::printf(emu::Log::Type::Warning, "Executed: %d\nPassed: %d\n", executed, passed);
 
+    static const char* silentTestFiles[] =
+    {
+        "ROMs\\all_instrs.nes",
+        "ROMs\\official_only.nes",
+    };
+    for (auto file : silentTestFiles)
+    {
+        if (!runSilentAudioTest(file))
+            return false;
+    }
+
     return true;
 }
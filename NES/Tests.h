@@ -1,6 +1,7 @@
 #ifndef __TESTS_H__
 #define __TESTS_H__
 
+bool runSilentAudioTest(const char* path);
 bool runTestRoms();
 
 #endif
\ No newline at end of file